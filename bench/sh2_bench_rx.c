@@ -0,0 +1,268 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Receive path micro-benchmark: sensor reports parsed per second.
+ *
+ * Provides the sh2_hal_ functions itself.  The reset advertises the
+ * sensorhub channels and report lengths, then a corpus of input cargos,
+ * each a base timestamp reference followed by as many sensor reports as
+ * fit in one transfer, is fed to the driver's receive callback as fast as
+ * possible.  The figure covers SHTP, report length lookup, timestamping
+ * and event delivery to an empty sensor callback.
+ *
+ * Build from the repository root, with sh2_hal_impl.h on the include path:
+ *   cc -O2 -I. -I<impl dir> bench/sh2_bench_rx.c \
+ *      sh2.c shtp.c sh2_util.c sh2_SensorValue.c -lm
+ *
+ * Usage: sh2_bench_rx [passes]
+ */
+
+// For clock_gettime()
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sh2_hal.h"
+#include "shtp.h"
+
+// Input cargos in the corpus
+#define CORPUS_CARGOS (1000)
+
+#define SHTP_HDR_LEN (4)
+
+// Channels advertised for the benchmark
+#define CHAN_COMMAND (0)
+#define CHAN_EXECUTABLE (1)
+#define CHAN_CONTROL (2)
+#define CHAN_INPUT_NORMAL (3)
+#define CHAN_INPUT_WAKE (4)
+#define CHAN_INPUT_GYRO_RV (5)
+
+#define GUID_EXECUTABLE (1)
+#define GUID_SENSORHUB (2)
+
+#define TAG_SH2_VERSION (0x80)
+#define TAG_SH2_REPORT_LENGTHS (0x81)
+
+#define RESP_ADVERTISE (0)
+#define BASE_TIMESTAMP_REF (0xFB)
+#define BASE_TIMESTAMP_REF_LEN (5)
+
+// Sensors in the corpus, and the report lengths advertised for them
+static const uint8_t reportLen[][2] = {
+    {SH2_ROTATION_VECTOR, 14},
+    {SH2_GAME_ROTATION_VECTOR, 12},
+    {SH2_ACCELEROMETER, 10},
+    {SH2_GYROSCOPE_CALIBRATED, 10},
+    {SH2_LINEAR_ACCELERATION, 10},
+    {SH2_GRAVITY, 10},
+    {BASE_TIMESTAMP_REF, BASE_TIMESTAMP_REF_LEN},
+};
+#define CORPUS_SENSORS (sizeof(reportLen)/sizeof(reportLen[0]) - 1)
+
+static sh2_rxCallback_t *onRx;
+static void *onRxCookie;
+static uint8_t chanSeq[8];
+
+static uint8_t corpus[CORPUS_CARGOS][SH2_HAL_MAX_TRANSFER];
+static uint16_t corpusLen[CORPUS_CARGOS];
+static uint32_t corpusReports;
+static uint32_t reports;
+
+// --- HAL ------------------------------------------------------------------
+
+static uint16_t tlv(uint8_t *p, uint8_t tag, const void *pValue, uint8_t len)
+{
+    p[0] = tag;
+    p[1] = len;
+    memcpy(p+2, pValue, len);
+
+    return 2 + len;
+}
+
+static uint16_t tlvU8(uint8_t *p, uint8_t tag, uint8_t value)
+{
+    return tlv(p, tag, &value, 1);
+}
+
+static uint16_t tlvU32(uint8_t *p, uint8_t tag, uint32_t value)
+{
+    uint8_t le[4] = { value, value >> 8, value >> 16, value >> 24 };
+
+    return tlv(p, tag, le, 4);
+}
+
+static uint16_t tlvStr(uint8_t *p, uint8_t tag, const char *s)
+{
+    return tlv(p, tag, s, strlen(s) + 1);
+}
+
+// Deliver one cargo, in a single transfer
+static void send(uint8_t chan, const uint8_t *pCargo, uint16_t len)
+{
+    uint8_t transfer[SH2_HAL_MAX_TRANSFER];
+    uint16_t transferLen = len + SHTP_HDR_LEN;
+
+    transfer[0] = transferLen & 0xFF;
+    transfer[1] = transferLen >> 8;
+    transfer[2] = chan;
+    transfer[3] = chanSeq[chan]++;
+    memcpy(transfer + SHTP_HDR_LEN, pCargo, len);
+
+    onRx(onRxCookie, transfer, transferLen, 0);
+}
+
+static void sendAdvert(void)
+{
+    uint8_t advert[256];
+    uint16_t n = 0;
+
+    advert[n++] = RESP_ADVERTISE;
+
+    n += tlvU32(advert+n, TAG_GUID, GUID_EXECUTABLE);
+    n += tlvU8(advert+n, TAG_NORMAL_CHANNEL, CHAN_EXECUTABLE);
+    n += tlvStr(advert+n, TAG_APP_NAME, "executable");
+    n += tlvStr(advert+n, TAG_CHANNEL_NAME, "device");
+
+    n += tlvU32(advert+n, TAG_GUID, GUID_SENSORHUB);
+    n += tlvStr(advert+n, TAG_APP_NAME, "sensorhub");
+    n += tlvU8(advert+n, TAG_NORMAL_CHANNEL, CHAN_CONTROL);
+    n += tlvStr(advert+n, TAG_CHANNEL_NAME, "control");
+    n += tlvU8(advert+n, TAG_NORMAL_CHANNEL, CHAN_INPUT_NORMAL);
+    n += tlvStr(advert+n, TAG_CHANNEL_NAME, "inputNormal");
+    n += tlvU8(advert+n, TAG_WAKE_CHANNEL, CHAN_INPUT_WAKE);
+    n += tlvStr(advert+n, TAG_CHANNEL_NAME, "inputWake");
+    n += tlvU8(advert+n, TAG_NORMAL_CHANNEL, CHAN_INPUT_GYRO_RV);
+    n += tlvStr(advert+n, TAG_CHANNEL_NAME, "inputGyroRv");
+    n += tlvStr(advert+n, TAG_SH2_VERSION, "1.0.0");
+    n += tlv(advert+n, TAG_SH2_REPORT_LENGTHS, reportLen, sizeof(reportLen));
+
+    send(CHAN_COMMAND, advert, n);
+}
+
+int sh2_hal_reset(bool dfuMode, sh2_rxCallback_t *callback, void *cookie)
+{
+    onRx = callback;
+    onRxCookie = cookie;
+    memset(chanSeq, 0, sizeof(chanSeq));
+
+    sendAdvert();
+
+    return SH2_OK;
+}
+
+int sh2_hal_tx(uint8_t *pData, uint32_t len)
+{
+    return SH2_OK;
+}
+
+int sh2_hal_rx(uint8_t *pData, uint32_t len)
+{
+    return SH2_OK;
+}
+
+int sh2_hal_block(void)
+{
+    return SH2_OK;
+}
+
+int sh2_hal_unblock(void)
+{
+    return SH2_OK;
+}
+
+// --- Benchmark ------------------------------------------------------------
+
+static void eventHdlr(void *cookie, sh2_AsyncEvent_t *pEvent)
+{
+}
+
+static void sensorHdlr(void *cookie, sh2_SensorEvent_t *pEvent)
+{
+    reports++;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Fill each cargo with reports of the corpus sensors in turn
+static void buildCorpus(void)
+{
+    unsigned sensor = 0;
+    uint8_t seq = 0;
+
+    for (int c = 0; c < CORPUS_CARGOS; c++) {
+        uint8_t *p = corpus[c];
+        uint16_t n = 0;
+
+        memset(p, 0, sizeof(corpus[c]));
+        p[n] = BASE_TIMESTAMP_REF;
+        n += BASE_TIMESTAMP_REF_LEN;
+
+        while (n + reportLen[sensor][1] <= SH2_HAL_MAX_TRANSFER - SHTP_HDR_LEN) {
+            p[n] = reportLen[sensor][0];
+            p[n+1] = seq++;
+            n += reportLen[sensor][1];
+            corpusReports++;
+            sensor = (sensor + 1) % CORPUS_SENSORS;
+        }
+        corpusLen[c] = n;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int passes = (argc > 1) ? atoi(argv[1]) : 50;
+
+    sh2_initialize(eventHdlr, 0);
+    sh2_setSensorCallback(sensorHdlr, 0);
+
+    buildCorpus();
+    printf("Corpus: %d cargos, %u reports\n", CORPUS_CARGOS, corpusReports);
+
+    double best = 0;
+    for (int pass = 0; pass < passes; pass++) {
+        reports = 0;
+
+        double start = now_s();
+        for (int c = 0; c < CORPUS_CARGOS; c++) {
+            send(CHAN_INPUT_NORMAL, corpus[c], corpusLen[c]);
+        }
+        double rate = reports / (now_s() - start);
+
+        if (rate > best) best = rate;
+    }
+    printf("Parsed %u reports per pass, best %.2f Mreports/s\n", reports, best / 1e6);
+
+    if (reports != corpusReports) {
+        fprintf(stderr, "Not every report was delivered\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -35,8 +35,118 @@
 // Max length of sensorhub version string.
 #define MAX_VER_LEN (16)
 
-// Max number of report ids supported
-#define SH2_MAX_REPORT_IDS (64)
+// State shared between the receive path and application threads (the
+// event ring and the latest extended timestamp) uses C11 atomics where the
+// compiler has them.  Otherwise, or if SH2_NO_ATOMICS is defined (it may
+// be, in sh2_hal_impl.h), it is merely volatile: then the driver must run
+// on a single core, HAL receive callbacks must not interrupt one another,
+// and sh2_pollEvents() must not interrupt the receive path.
+#if !defined(SH2_NO_ATOMICS) && defined(__STDC_VERSION__) && \
+    (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+typedef atomic_uint_fast32_t sh2_Atomic_t;
+#define ATOMIC_LOAD(p, order) atomic_load_explicit((p), memory_order_##order)
+#define ATOMIC_STORE(p, v, order) atomic_store_explicit((p), (v), memory_order_##order)
+#define ATOMIC_ADD(p, v) atomic_fetch_add_explicit((p), (v), memory_order_relaxed)
+#define ATOMIC_CAS(p, pExpected, desired) \
+    atomic_compare_exchange_weak_explicit((p), (pExpected), (desired), \
+                                          memory_order_relaxed, memory_order_relaxed)
+#if ATOMIC_LLONG_LOCK_FREE == 2
+typedef atomic_ullong sh2_Atomic64_t;
+#define ATOMIC64_LOAD(p) ATOMIC_LOAD(p, relaxed)
+#define ATOMIC64_STORE(p, v) ATOMIC_STORE(p, v, relaxed)
+#define ATOMIC64_CAS(p, pExpected, desired) ATOMIC_CAS(p, pExpected, desired)
+#else
+// No lock-free 64-bit atomics (as on most 32-bit MCUs): the latest
+// timestamp is merely volatile, and the single core rules above apply to it.
+#define VOLATILE_ATOMIC64
+#endif
+#else
+#define VOLATILE_ATOMIC64
+typedef volatile uint_fast32_t sh2_Atomic_t;
+#define ATOMIC_LOAD(p, order) (*(p))
+#define ATOMIC_STORE(p, v, order) (*(p) = (v))
+#define ATOMIC_ADD(p, v) (*(p) += (v))
+#define ATOMIC_CAS(p, pExpected, desired) \
+    ((*(p) == *(pExpected)) ? ((*(p) = (desired)), true) : ((*(pExpected) = *(p)), false))
+#endif
+
+#ifdef VOLATILE_ATOMIC64
+typedef volatile unsigned long long sh2_Atomic64_t;
+#define ATOMIC64_LOAD(p) (*(p))
+#define ATOMIC64_STORE(p, v) (*(p) = (v))
+#define ATOMIC64_CAS(p, pExpected, desired) \
+    ((*(p) == *(pExpected)) ? ((*(p) = (desired)), true) : ((*(pExpected) = *(p)), false))
+#endif
+
+// Storage class of the per-thread current instance pointer.
+// May be overridden in sh2_hal_impl.h.  (Define it empty on systems
+// without threads.)
+#ifndef SH2_THREAD_LOCAL
+#if defined(_MSC_VER)
+#define SH2_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define SH2_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define SH2_THREAD_LOCAL __thread
+#else
+#define SH2_THREAD_LOCAL
+#endif
+#endif
+
+// Max number of operations queued or in progress.
+// May be overridden in sh2_hal_impl.h.
+#ifndef SH2_OP_QUEUE_LEN
+#define SH2_OP_QUEUE_LEN (8)
+#endif
+
+// Number of times an FRS read resumes after missing data (or, for a
+// metadata prefetch, after a busy response) before failing.
+// May be overridden in sh2_hal_impl.h.
+#ifndef SH2_FRS_READ_RETRIES
+#define SH2_FRS_READ_RETRIES (3)
+#endif
+
+// Time an operation may be in progress before sh2_checkTimeouts() fails it, uS.
+// May be overridden in sh2_hal_impl.h.
+#ifndef SH2_OP_TIMEOUT_US
+#define SH2_OP_TIMEOUT_US (1000000)
+#endif
+
+// Max number of FRS write data requests outstanding at once.
+// May be overridden in sh2_hal_impl.h.  (1 waits for each to be received.)
+#ifndef SH2_FRS_WRITE_WINDOW
+#define SH2_FRS_WRITE_WINDOW (4)
+#endif
+
+// Number of times an FRS write is retried after the hub reports busy.
+// May be overridden in sh2_hal_impl.h.
+#ifndef SH2_FRS_WRITE_RETRIES
+#define SH2_FRS_WRITE_RETRIES (8)
+#endif
+
+// Reference sensor samples fitted by clock sync, see sh2_setClockSync().
+// May be overridden in sh2_hal_impl.h.
+#ifndef SH2_CLOCK_SYNC_WINDOW
+#define SH2_CLOCK_SYNC_WINDOW (64)
+#endif
+
+// latestTimestamp before the first timestamp is seen.
+#define TIMESTAMP_UNSET (0xFFFFFFFFFFFFFFFFULL)
+
+// How far a timestamp may trail the latest one and be taken as late rather
+// than as a rollover: one quarter of the 32-bit range, about 17.9 minutes.
+#define TIMESTAMP_LATE_MAX (0x40000000UL)
+
+// Samples needed before the clock sync fit is used.
+#define CLOCK_SYNC_MIN_SAMPLES (4)
+
+// A reference sample this many periods from the fit restarts it.
+#define CLOCK_SYNC_MAX_ERROR (4)
+
+// The clock sync fit is kept in fixed point with this many fraction bits.
+#define CLOCK_SYNC_FRAC_BITS (16)
+#define CLOCK_SYNC_ONE ((int64_t)1 << CLOCK_SYNC_FRAC_BITS)
 
 // Tags for sensorhub app advertisements.
 #define TAG_SH2_VERSION (0x80)
@@ -52,14 +162,18 @@
 
 // --- Private Data Types -------------------------------------------------
 
-typedef int (sh2_OpStart_t)(void);
-typedef void (sh2_OpTxDone_t)(void);
-typedef void (sh2_OpRx_t)(const uint8_t *payload, uint16_t len);
+typedef struct sh2_OpReq_s sh2_OpReq_t;
+
+typedef int (sh2_OpStart_t)(sh2_OpReq_t *pReq);
+typedef void (sh2_OpTxDone_t)(sh2_OpReq_t *pReq);
+typedef void (sh2_OpRx_t)(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 
 typedef struct sh2_Op_s {
     sh2_OpStart_t *start;
     sh2_OpTxDone_t *txDone;
     sh2_OpRx_t *rx;
+    bool pipelined;  // Responses matched by commandSeq, may overlap other pipelined ops
+    uint32_t timeout_us;  // 0 for SH2_OP_TIMEOUT_US
 } sh2_Op_t;
 
 // Report definitions
@@ -292,39 +406,23 @@ typedef PACKED_STRUCT {
 #pragma pack(pop)
 #endif
 
-typedef struct sh2_s {
-    uint8_t controlChan;
-
-    char version[MAX_VER_LEN+1];
-    struct {
-        uint8_t id;
-        uint8_t len;
-    } report[SH2_MAX_REPORT_IDS];
-
-    uint32_t emptyPayloads;
-    uint32_t unknownReportIds;
-    uint32_t execBadPayload;
-
-	bool advertDone;
-	bool gotInitResp;
-	bool calledResetCallback;
-  
-    sh2_EventCallback_t *eventCallback;
-    void * eventCallbackCookie;
-
-    sh2_SensorCallback_t *sensorCallback;
-    void * sensorCallbackCookie;
-
-    uint8_t nextCmdSeq;
+// Operation request states
+#define OP_FREE     (0)
+#define OP_RESERVED (1)  // Being set up by an API call
+#define OP_QUEUED   (2)  // Waiting to start
+#define OP_ACTIVE   (3)  // Started, waiting for completion
 
+// One queued or in-progress SH-2 operation
+struct sh2_OpReq_s {
     const sh2_Op_t *pOp;
-
-    int opStatus;
-
-	uint32_t frsData[MAX_FRS_WORDS];
-	uint16_t frsDataLen;
-
-	// Parameters and state information for the operation in progress
+    uint8_t state;
+    uint32_t ticket;  // Submission order
+    bool deadlineSet;
+    uint32_t deadline;  // Set by the first sh2_checkTimeouts() after starting
+    sh2_OpCallback_t *callback;
+    void *cookie;
+
+	// Parameters and state information for this operation
 	union {
 		struct {
 			CommandReq_t req;
@@ -342,18 +440,46 @@ typedef struct sh2_s {
 			const sh2_SensorConfig_t *pConfig;
 			sh2_SensorId_t sensorId;
 		} setSensorConfig;
+		struct {
+			sh2_SensorConfigEntry_t *pEntries;
+			uint16_t numEntries;
+		} setSensorConfigs;
 		struct {
 			uint16_t frsType;
 			uint32_t *pData;
 			uint16_t *pWords;
+			uint16_t readOffset;  // First word to read
+			uint16_t blockSize;   // Words to read, 0 for the rest of the record
 			uint16_t nextOffset;
+			uint8_t retries;
+			bool resuming;        // Waiting for data from a resumed read
 			sh2_SensorMetadata_t *pMetadata;
 		} getFrs;
+        struct {
+            sh2_MetadataCacheEntry_t *pTable;
+            uint16_t numEntries;
+            sh2_MetadataPrefetchStats_t *pStats;
+            uint16_t nextRecord;  // Index into sensorToRecordMap
+            uint16_t nextOffset;
+            uint8_t retries;      // Per record
+            bool resuming;        // Waiting for data from a resumed read
+            uint16_t records;
+            uint32_t bytes;
+            bool started;         // startTime is valid
+            uint32_t startTime;
+            uint32_t lastRespTime;
+        } prefetchMetadata;
 		struct {
 			uint16_t frsType;
 			uint32_t *pData;
 			uint16_t words;
-			uint16_t offset;
+			uint16_t offset;       // Next word to send
+			uint16_t acked;        // Words below this were received by the hub
+			uint8_t window;        // Max requests outstanding, cut to 1 when the hub is busy
+			uint8_t retries;
+			bool ready;            // Hub accepted the write request
+			uint16_t busy;         // Busy responses seen
+			uint32_t readyTime;
 		} setFrs;
 		struct {
 			uint8_t seq;
@@ -393,18 +519,118 @@ typedef struct sh2_s {
             uint8_t seq;
         } startCal;
         struct {
-            sh2_CalStatus_t status;
+            sh2_CalStatus_t *pStatus;
             uint8_t seq;
         } finishCal;
     } opData;
+};
+
+typedef struct sh2_s {
+    sh2_Hal_t *pHal;
+    shtp_t *pShtp;
+
+    uint8_t controlChan;
+
+    char version[MAX_VER_LEN+1];
+
+    // Report lengths indexed by report id (0 for unknown ids)
+    uint8_t reportLen[256];
 
+    uint32_t emptyPayloads;
+    uint32_t unknownReportIds;
+    uint32_t execBadPayload;
+
+	bool advertDone;
+	bool gotInitResp;
+	bool calledResetCallback;
+  
+    sh2_EventCallback_t *eventCallback;
+    void * eventCallbackCookie;
+
+    sh2_SensorCallback_t *sensorCallback;
+    void * sensorCallbackCookie;
+    bool sensorCallbackCopy;
+
+    sh2_SensorBatchCallback_t *batchCallback;
+    void * batchCallbackCookie;
+    sh2_SensorEvent_t *batch;  // Caller's storage, see sh2_setSensorBatchCallback()
+    uint16_t batchCapacity;
+    uint16_t batchLen;
+    uint32_t batchTimestamp;
+    uint32_t batchReferenceDelta;
+
+    // Per-sensor callbacks, take precedence over sensorCallback
+    struct {
+        sh2_SensorCallback_t *callback;
+        void * cookie;
+    } sensorCallbackFor[SH2_MAX_SENSOR_ID+1];
+
+    // Optional SPSC ring of sensor events.  head is written only by the
+    // receive path, tail only by sh2_pollEvents().
+    sh2_SensorEvent_t *eventRing;
+    uint32_t eventRingMask;
+    sh2_Atomic_t eventRingHead;
+    sh2_Atomic_t eventRingTail;
+    sh2_Atomic_t eventRingHighWater;
+    sh2_Atomic_t eventRingOverflows;
+
+    uint8_t nextCmdSeq;
+
+    sh2_OpReq_t opReq[SH2_OP_QUEUE_LEN];
+    uint32_t nextOpTicket;
+    bool opStarting;
+    bool opBlocking;
+
+    int opStatus;
+
+    // HAL timestamp of the control channel transfer being processed
+    uint32_t controlTimestamp;
+
+    // Latest HAL timestamp, extended to 64 bits.  (See extendTimestamp().)
+    sh2_Atomic64_t latestTimestamp;
+
+    // Clock sync, see sh2_setClockSync().  The fitted time of reference
+    // sample index x is clockY0 + (clockA + clockB*(x - clockX0)) / CLOCK_SYNC_ONE.
+    uint8_t clockSensor;     // Reference sensor, 0 if disabled
+    uint32_t clockInterval;  // Its nominal interval [uS], 0 if unknown
+    uint8_t clockSeq;        // Sequence number of its last report
+    uint32_t clockIndex[SH2_CLOCK_SYNC_WINDOW];  // Unwrapped sequence numbers
+    uint64_t clockTime[SH2_CLOCK_SYNC_WINDOW];   // Uncorrected timestamps
+    uint16_t clockNext;
+    uint16_t clockSamples;
+    uint32_t clockX0;
+    uint64_t clockY0;
+    int64_t clockA;           // [uS, fixed point]
+    int64_t clockB;           // Sample period [uS, fixed point]
+    uint64_t clockVariance;   // Of samples about the fit [uS^2, fixed point]
+    int64_t clockCorrection;
+    uint32_t clockResyncs;
+    uint64_t clockLastTime[SH2_MAX_SENSOR_ID+1];
+
+    sh2_FrsWriteStats_t frsWriteStats;
+
+	uint32_t frsData[MAX_FRS_WORDS];
+	uint16_t frsDataLen;
+
+    // Optional cache of sensor configs and metadata, see sh2_setCache()
+    bool cacheEnabled;
+    bool configCached[SH2_MAX_SENSOR_ID+1];
+    sh2_SensorConfig_t configCache[SH2_MAX_SENSOR_ID+1];
+    sh2_MetadataCacheEntry_t *metadataCache;
+    uint16_t metadataCacheLen;
+    uint16_t nextMetadataEntry;
+
+    // Outbound cargo packed from several reports
+    uint8_t cargo[SH2_HAL_MAX_TRANSFER];
 } sh2_t;
 
 // --- Forward Declarations -----------------------------------------------
 static int16_t toQ14(double x);
-static void setupCmdParams(uint8_t cmd, uint8_t p[9]);
-static void setupCmd0(uint8_t cmd);
-static void setupCmd1(uint8_t cmd, uint8_t p0);
+static int64_t divRound(int64_t num, int64_t den);
+static uint32_t isqrt64(uint64_t x);
+static void setupCmdParams(sh2_OpReq_t *pReq, uint8_t cmd, uint8_t p[9]);
+static void setupCmd0(sh2_OpReq_t *pReq, uint8_t cmd);
+static void setupCmd1(sh2_OpReq_t *pReq, uint8_t cmd, uint8_t p0);
     
 static void executableAdvertHdlr(void *cookie, uint8_t tag, uint8_t len, uint8_t *val);
 static void executableDeviceHdlr(void *cookie, uint8_t *payload, uint16_t len, uint32_t timestamp);
@@ -415,144 +641,194 @@ static void sensorhubInputNormalHdlr(void *cookie, uint8_t *payload, uint16_t le
 static void sensorhubInputWakeHdlr(void *cookie, uint8_t *payload, uint16_t len, uint32_t timestamp);
 static void sensorhubInputGyroRvHdlr(void *cookie, uint8_t *payload, uint16_t len, uint32_t timestamp);
 
-static uint8_t getReportLen(uint8_t reportId);
+static inline uint8_t getReportLen(uint8_t reportId);
+static void startSensorBatch(uint32_t timestamp, uint32_t referenceDelta);
+static void flushSensorBatch(void);
+static void deliverSensorEvent(sh2_SensorEvent_t *pEvent, uint8_t sensorId, const uint8_t *pReport);
     
 // SH-2 transaction phases
-static int opStart(const sh2_Op_t *pOp);
-static void opTxDone(void);
+static sh2_OpReq_t *opAlloc(sh2_OpCallback_t *callback);
+static int opSubmit(sh2_OpReq_t *pReq, const sh2_Op_t *pOp,
+                    sh2_OpCallback_t *callback, void *cookie);
+static void opStartPending(void);
+static int opWait(int rc);
+static void opUnblock(void *cookie, int status);
+static void opTxDone(sh2_OpReq_t *pReq);
 static void opRx(const uint8_t *payload, uint16_t len);
-static int opCompleted(int status);
+static int opCompleted(sh2_OpReq_t *pReq, int status);
+static void opCancel(sh2_OpReq_t *pReq, int status);
 
+static uint64_t extendTimestamp(uint32_t hostInt);
 static uint64_t touSTimestamp(uint32_t hostInt, int32_t referenceDelta, uint16_t delay);
 
+static sh2_t *enterInstance(void *cookie);
+
+static void clockSyncRestart(void);
+static void clockSyncCargo(uint8_t *payload, uint16_t len, uint32_t timestamp);
+static uint64_t clockSyncTime(uint8_t sensorId, uint64_t timestamp);
+
+static void cacheClear(void);
+static void cacheDropConfig(sh2_SensorId_t sensorId);
+static void cacheDropMetadata(uint16_t recordId);
+static void cacheStoreConfig(sh2_SensorId_t sensorId, const sh2_SensorConfig_t *pConfig);
+static void cacheStoreMetadata(uint16_t recordId, const sh2_SensorMetadata_t *pMetadata);
+static bool cacheGetConfig(sh2_SensorId_t sensorId, sh2_SensorConfig_t *pConfig);
+static bool cacheGetMetadata(uint16_t recordId, sh2_SensorMetadata_t *pMetadata);
+
 // --- Private Data -------------------------------------------------------
-static sh2_t sh2;
+
+// One per hub
+static sh2_t instances[SH2_MAX_INSTANCES];
+
+// Instance used by API calls from this thread, 0 until one is selected.
+// (See sh2_select().)  Rx callbacks switch to the instance they belong to.
+static SH2_THREAD_LOCAL sh2_t *sh2 = 0;
 
 // SH-2 Transaction handlers
 
 // Operation to Send a Command, No response
-static int sendCmdStart(void);
-static void sendCmdTxDone(void);
+static int sendCmdStart(sh2_OpReq_t *pReq);
+static void sendCmdTxDone(sh2_OpReq_t *pReq);
 const sh2_Op_t sendCmdOp = {
     .start = sendCmdStart,
     .txDone = sendCmdTxDone,
 };
 
 // Operation to get product id
-static int getProdIdStart(void);
-static void getProdIdRx(const uint8_t *payload, uint16_t len);
+static int getProdIdStart(sh2_OpReq_t *pReq);
+static void getProdIdRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t getProdIdOp = {
     .start = getProdIdStart,
     .rx = getProdIdRx,
 };
 
 // getSensorConfig Operation
-static int getSensorConfigStart(void);
-static void getSensorConfigRx(const uint8_t *payload, uint16_t len);
+static int getSensorConfigStart(sh2_OpReq_t *pReq);
+static void getSensorConfigRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t getSensorConfigOp = {
     .start = getSensorConfigStart,
     .rx = getSensorConfigRx,
 };
 
 // setSensorConfig Operation
-static int setSensorConfigStart(void);
-static void setSensorConfigTxDone(void);
+static int setSensorConfigStart(sh2_OpReq_t *pReq);
+static void setSensorConfigTxDone(sh2_OpReq_t *pReq);
 const sh2_Op_t setSensorConfigOp = {
     .start = setSensorConfigStart,
     .txDone = setSensorConfigTxDone,
 };
 
+// setSensorConfigs Operation
+static int setSensorConfigsStart(sh2_OpReq_t *pReq);
+const sh2_Op_t setSensorConfigsOp = {
+    .start = setSensorConfigsStart,
+};
+
 // get FRS Operation
-static int getFrsStart(void);
-static void getFrsRx(const uint8_t *payload, uint16_t len);
+static int getFrsStart(sh2_OpReq_t *pReq);
+static void getFrsRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t getFrsOp = {
     .start = getFrsStart,
     .rx = getFrsRx,
 };
 
+// prefetch metadata Operation
+static int prefetchMetadataStart(sh2_OpReq_t *pReq);
+static void prefetchMetadataRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
+const sh2_Op_t prefetchMetadataOp = {
+    .start = prefetchMetadataStart,
+    .rx = prefetchMetadataRx,
+};
+
 // set FRS Operation
-static int setFrsStart(void);
-static void setFrsRx(const uint8_t *payload, uint16_t len);
+static int setFrsStart(sh2_OpReq_t *pReq);
+static void setFrsRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t setFrsOp = {
     .start = setFrsStart,
     .rx = setFrsRx,
+    .timeout_us = 5 * SH2_OP_TIMEOUT_US,  // Flash writes
 };
 
 // get errors operation
-static int getErrorsStart(void);
-static void getErrorsRx(const uint8_t *payload, uint16_t len);
+static int getErrorsStart(sh2_OpReq_t *pReq);
+static void getErrorsRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t getErrorsOp = {
     .start = getErrorsStart,
     .rx = getErrorsRx,
+    .pipelined = true,
 };
 
 // get counts operation
-static int getCountsStart(void);
-static void getCountsRx(const uint8_t *payload, uint16_t len);
+static int getCountsStart(sh2_OpReq_t *pReq);
+static void getCountsRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t getCountsOp = {
     .start = getCountsStart,
     .rx = getCountsRx,
+    .pipelined = true,
 };
 
 // reinitialize operation
-static int reinitStart(void);
-static void reinitRx(const uint8_t *payload, uint16_t len);
+static int reinitStart(sh2_OpReq_t *pReq);
+static void reinitRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t reinitOp = {
     .start = reinitStart,
     .rx = reinitRx,
 };
 
 // save dcd now operation
-static int saveDcdNowStart(void);
-static void saveDcdNowRx(const uint8_t *payload, uint16_t len);
+static int saveDcdNowStart(sh2_OpReq_t *pReq);
+static void saveDcdNowRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t saveDcdNowOp = {
     .start = saveDcdNowStart,
     .rx = saveDcdNowRx,
+    .timeout_us = 5 * SH2_OP_TIMEOUT_US,  // Flash writes
 };
 
 // cal config operation
-static int calConfigStart(void);
-static void calConfigRx(const uint8_t *payload, uint16_t len);
+static int calConfigStart(sh2_OpReq_t *pReq);
+static void calConfigRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t calConfigOp = {
     .start = calConfigStart,
     .rx = calConfigRx,
 };
 
 // get cal config operation
-static int getCalConfigStart(void);
-static void getCalConfigRx(const uint8_t *payload, uint16_t len);
+static int getCalConfigStart(sh2_OpReq_t *pReq);
+static void getCalConfigRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t getCalConfigOp = {
     .start = getCalConfigStart,
     .rx = getCalConfigRx,
+    .pipelined = true,
 };
 
 // force flush operation
-static int forceFlushStart(void);
-static void forceFlushRx(const uint8_t *payload, uint16_t len);
+static int forceFlushStart(sh2_OpReq_t *pReq);
+static void forceFlushRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t forceFlushOp = {
     .start = forceFlushStart,
     .rx = forceFlushRx,
 };
 
 // getOscType Operation
-static int getOscTypeStart(void);
-static void getOscTypeRx(const uint8_t *payload, uint16_t len);
+static int getOscTypeStart(sh2_OpReq_t *pReq);
+static void getOscTypeRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t getOscTypeOp = {
     .start = getOscTypeStart,
     .rx = getOscTypeRx,
+    .pipelined = true,
 };
 
 // startCalibration Operation
-static int startCalStart(void);
-static void startCalRx(const uint8_t *payload, uint16_t len);
+static int startCalStart(sh2_OpReq_t *pReq);
+static void startCalRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t startCalOp = {
     .start = startCalStart,
     .rx = startCalRx,
 };
 
 // finishCalibration Operation
-static int finishCalStart(void);
-static void finishCalRx(const uint8_t *payload, uint16_t len);
+static int finishCalStart(sh2_OpReq_t *pReq);
+static void finishCalRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len);
 const sh2_Op_t finishCalOp = {
     .start = finishCalStart,
     .rx = finishCalRx,
@@ -560,247 +836,824 @@ const sh2_Op_t finishCalOp = {
 
 // --- Public API ---------------------------------------------------------
 
+#ifndef SH2_NO_GLOBAL_HAL
+static int globalHalReset(sh2_Hal_t *self, bool dfuMode, sh2_rxCallback_t *onRx, void *cookie)
+{
+    return sh2_hal_reset(dfuMode, onRx, cookie);
+}
+
+static int globalHalTx(sh2_Hal_t *self, uint8_t *pData, uint32_t len)
+{
+    return sh2_hal_tx(pData, len);
+}
+
+static int globalHalRx(sh2_Hal_t *self, uint8_t *pData, uint32_t len)
+{
+    return sh2_hal_rx(pData, len);
+}
+
+static int globalHalBlock(sh2_Hal_t *self)
+{
+    return sh2_hal_block();
+}
+
+static int globalHalUnblock(sh2_Hal_t *self)
+{
+    return sh2_hal_unblock();
+}
+
+sh2_Hal_t sh2_globalHal = {
+    .reset = globalHalReset,
+    .tx = globalHalTx,
+    .rx = globalHalRx,
+    .block = globalHalBlock,
+    .unblock = globalHalUnblock,
+};
+
 // sh2_init
 int sh2_initialize(sh2_EventCallback_t *eventCallback, void *resetCookie)
 {
-    sh2.controlChan = 0xFF;  // An invalid value since we don't know yet.
+    uint8_t instance = (sh2 != 0) ? (uint8_t)(sh2 - instances) : 0;
 
-    sh2.emptyPayloads = 0;
-    sh2.unknownReportIds = 0;
+    return sh2_open(instance, &sh2_globalHal, eventCallback, resetCookie);
+}
+#endif
 
-    sh2.advertDone = false;
-    sh2.gotInitResp = false;
-    sh2.calledResetCallback = false;
-  
-    sh2.eventCallback = eventCallback;
-    sh2.eventCallbackCookie = resetCookie;
-    sh2.sensorCallback = 0;
-    sh2.sensorCallbackCookie = 0;
+int sh2_select(uint8_t instance)
+{
+    if (instance >= SH2_MAX_INSTANCES) {
+        return SH2_ERR_BAD_PARAM;
+    }
 
-    sh2.pOp = 0;
-    
-    for (int n = 0; n < SH2_MAX_REPORT_IDS; n++) {
-        sh2.report[n].id = 0;
-        sh2.report[n].len = 0;
+    sh2 = &instances[instance];
+
+    return SH2_OK;
+}
+
+int sh2_open(uint8_t instance, sh2_Hal_t *pHal,
+             sh2_EventCallback_t *eventCallback, void *resetCookie)
+{
+    if ((instance >= SH2_MAX_INSTANCES) || (pHal == 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+    sh2 = &instances[instance];
+
+    sh2->pHal = pHal;
+    sh2->controlChan = 0xFF;  // An invalid value since we don't know yet.
+
+    sh2->emptyPayloads = 0;
+    sh2->unknownReportIds = 0;
+
+    sh2->advertDone = false;
+    sh2->gotInitResp = false;
+    sh2->calledResetCallback = false;
+  
+    sh2->eventCallback = eventCallback;
+    sh2->eventCallbackCookie = resetCookie;
+    sh2->sensorCallback = 0;
+    sh2->sensorCallbackCookie = 0;
+    sh2->sensorCallbackCopy = true;
+    sh2->cacheEnabled = false;
+    sh2->metadataCache = 0;
+    sh2->metadataCacheLen = 0;
+    cacheClear();
+    sh2->batchCallback = 0;
+    sh2->batchCallbackCookie = 0;
+    sh2->batch = 0;
+    sh2->batchCapacity = 0;
+    sh2->batchLen = 0;
+    for (int n = 0; n <= SH2_MAX_SENSOR_ID; n++) {
+        sh2->sensorCallbackFor[n].callback = 0;
+        sh2->sensorCallbackFor[n].cookie = 0;
+    }
+    sh2->eventRing = 0;
+    sh2->eventRingMask = 0;
+    ATOMIC_STORE(&sh2->eventRingHead, 0, relaxed);
+    ATOMIC_STORE(&sh2->eventRingTail, 0, relaxed);
+    ATOMIC_STORE(&sh2->eventRingHighWater, 0, relaxed);
+    ATOMIC_STORE(&sh2->eventRingOverflows, 0, relaxed);
+
+    for (int n = 0; n < SH2_OP_QUEUE_LEN; n++) {
+        sh2->opReq[n].state = OP_FREE;
     }
+    sh2->nextOpTicket = 0;
+    sh2->opStarting = false;
+    sh2->opBlocking = false;
+    
+    memset(sh2->reportLen, 0, sizeof(sh2->reportLen));
   
-    sh2.nextCmdSeq = 0;
+    sh2->nextCmdSeq = 0;
+    ATOMIC64_STORE(&sh2->latestTimestamp, TIMESTAMP_UNSET);
+    sh2->clockSensor = 0;
+    clockSyncRestart();
 
     // init SHTP layer
-    shtp_init();
+    sh2->pShtp = shtp_init(instance, pHal);
 
     // Register SH2 handlers
-    shtp_listenAdvert("sensorhub", sensorhubAdvertHdlr, NULL);
-    shtp_listenChan("sensorhub", "control", sensorhubControlHdlr, NULL);
-    shtp_listenChan("sensorhub", "inputNormal", sensorhubInputNormalHdlr, NULL);
-    shtp_listenChan("sensorhub", "inputWake", sensorhubInputWakeHdlr, NULL);
-    shtp_listenChan("sensorhub", "inputGyroRv", sensorhubInputGyroRvHdlr, NULL);
+    shtp_listenAdvert(sh2->pShtp, "sensorhub", sensorhubAdvertHdlr, sh2);
+    shtp_listenChan(sh2->pShtp, "sensorhub", "control", sensorhubControlHdlr, sh2);
+    shtp_listenChan(sh2->pShtp, "sensorhub", "inputNormal", sensorhubInputNormalHdlr, sh2);
+    shtp_listenChan(sh2->pShtp, "sensorhub", "inputWake", sensorhubInputWakeHdlr, sh2);
+    shtp_listenChan(sh2->pShtp, "sensorhub", "inputGyroRv", sensorhubInputGyroRvHdlr, sh2);
 
-    sh2.execBadPayload = 0;
+    sh2->execBadPayload = 0;
 
     // Register EXECUTABLE handlers
-    shtp_listenAdvert("executable", executableAdvertHdlr, NULL);
-    shtp_listenChan("executable", "device", executableDeviceHdlr, NULL);
+    shtp_listenAdvert(sh2->pShtp, "executable", executableAdvertHdlr, sh2);
+    shtp_listenChan(sh2->pShtp, "executable", "device", executableDeviceHdlr, sh2);
 
     // Start SHTP operations (resets sensor hub in non-dfu mode)
-    shtp_start(false);
+    shtp_start(sh2->pShtp, false);
 
     return SH2_OK;
 }
 
 int sh2_setSensorCallback(sh2_SensorCallback_t *callback, void *cookie)
 {
-    sh2.sensorCallback = callback;
-    sh2.sensorCallbackCookie = cookie;
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2->sensorCallback = callback;
+    sh2->sensorCallbackCookie = cookie;
+    sh2->sensorCallbackCopy = true;
 
     return SH2_OK;
 }
 
-int sh2_getProdIds(sh2_ProductIds_t *pProdIds)
+int sh2_setSensorCallbackNoCopy(sh2_SensorCallback_t *callback, void *cookie)
 {
-	sh2.opData.getProdIds.pProdIds = pProdIds;
-	sh2.opData.getProdIds.nextEntry = 0;
-    sh2.opData.getProdIds.expectedEntries = 4;  // Most products supply 4 product ids.
-                                                // When the first arrives, we'll know if
-                                                // we need to adjust this.
-	return opStart(&getProdIdOp);
-}
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
 
-int sh2_getSensorConfig(sh2_SensorId_t sensorId, sh2_SensorConfig_t *config)
-{
-    sh2.opData.getSensorConfig.sensorId = sensorId;
-    sh2.opData.getSensorConfig.pConfig = config;
-    return opStart(&getSensorConfigOp);
+    sh2->sensorCallback = callback;
+    sh2->sensorCallbackCookie = cookie;
+    sh2->sensorCallbackCopy = false;
+
+    return SH2_OK;
 }
 
-int sh2_setSensorConfig(sh2_SensorId_t sensorId, const sh2_SensorConfig_t *pConfig)
+int sh2_getShtpStats(shtp_Stats_t *pStats)
 {
-    // Set up operation
-    sh2.opData.setSensorConfig.sensorId = sensorId;
-    sh2.opData.setSensorConfig.pConfig = pConfig;
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
 
-    return opStart(&setSensorConfigOp);
-}
-
-const static struct {
-    sh2_SensorId_t sensorId;
-    uint16_t recordId;
-} sensorToRecordMap[] = {
-    { SH2_RAW_ACCELEROMETER,            FRS_ID_META_RAW_ACCELEROMETER },
-    { SH2_ACCELEROMETER,                FRS_ID_META_ACCELEROMETER },
-    { SH2_LINEAR_ACCELERATION,          FRS_ID_META_LINEAR_ACCELERATION },
-    { SH2_GRAVITY,                      FRS_ID_META_GRAVITY },
-    { SH2_RAW_GYROSCOPE,                FRS_ID_META_RAW_GYROSCOPE },
-    { SH2_GYROSCOPE_CALIBRATED,         FRS_ID_META_GYROSCOPE_CALIBRATED },
-    { SH2_GYROSCOPE_UNCALIBRATED,       FRS_ID_META_GYROSCOPE_UNCALIBRATED },
-    { SH2_RAW_MAGNETOMETER,             FRS_ID_META_RAW_MAGNETOMETER },
-    { SH2_MAGNETIC_FIELD_CALIBRATED,    FRS_ID_META_MAGNETIC_FIELD_CALIBRATED },
-    { SH2_MAGNETIC_FIELD_UNCALIBRATED,  FRS_ID_META_MAGNETIC_FIELD_UNCALIBRATED },
-    { SH2_ROTATION_VECTOR,              FRS_ID_META_ROTATION_VECTOR },
-    { SH2_GAME_ROTATION_VECTOR,         FRS_ID_META_GAME_ROTATION_VECTOR },
-    { SH2_GEOMAGNETIC_ROTATION_VECTOR,  FRS_ID_META_GEOMAGNETIC_ROTATION_VECTOR },
-    { SH2_PRESSURE,                     FRS_ID_META_PRESSURE },
-    { SH2_AMBIENT_LIGHT,                FRS_ID_META_AMBIENT_LIGHT },
-    { SH2_HUMIDITY,                     FRS_ID_META_HUMIDITY },
-    { SH2_PROXIMITY,                    FRS_ID_META_PROXIMITY },
-    { SH2_TEMPERATURE,                  FRS_ID_META_TEMPERATURE },
-    { SH2_TAP_DETECTOR,                 FRS_ID_META_TAP_DETECTOR },
-    { SH2_STEP_DETECTOR,                FRS_ID_META_STEP_DETECTOR },
-    { SH2_STEP_COUNTER,                 FRS_ID_META_STEP_COUNTER },
-    { SH2_SIGNIFICANT_MOTION,           FRS_ID_META_SIGNIFICANT_MOTION },
-    { SH2_STABILITY_CLASSIFIER,         FRS_ID_META_STABILITY_CLASSIFIER },
-    { SH2_SHAKE_DETECTOR,               FRS_ID_META_SHAKE_DETECTOR },
-    { SH2_FLIP_DETECTOR,                FRS_ID_META_FLIP_DETECTOR },
-    { SH2_PICKUP_DETECTOR,              FRS_ID_META_PICKUP_DETECTOR },
-    { SH2_STABILITY_DETECTOR,           FRS_ID_META_STABILITY_DETECTOR },
-    { SH2_PERSONAL_ACTIVITY_CLASSIFIER, FRS_ID_META_PERSONAL_ACTIVITY_CLASSIFIER },
-    { SH2_SLEEP_DETECTOR,               FRS_ID_META_SLEEP_DETECTOR },
-    { SH2_TILT_DETECTOR,                FRS_ID_META_TILT_DETECTOR },
-    { SH2_POCKET_DETECTOR,              FRS_ID_META_POCKET_DETECTOR },
-    { SH2_CIRCLE_DETECTOR,              FRS_ID_META_CIRCLE_DETECTOR },
-};
+    if ((pStats == 0) || (sh2->pShtp == 0)) return SH2_ERR_BAD_PARAM;
 
-int sh2_getMetadata(sh2_SensorId_t sensorId, sh2_SensorMetadata_t *pData)
-{
-    // pData must be non-null
-    if (pData == 0) return SH2_ERR_BAD_PARAM;
-  
-	// Convert sensorId to metadata recordId
-	int i;
-	for (i = 0; i < ARRAY_LEN(sensorToRecordMap); i++) {
-		if (sensorToRecordMap[i].sensorId == sensorId) {
-			break;
-		}
-	}
-	if (i >= ARRAY_LEN(sensorToRecordMap)) {
-		// no match was found
-		return SH2_ERR_BAD_PARAM;
-	}
-	uint16_t recordId = sensorToRecordMap[i].recordId;
-	
-	// Set up an FRS read operation
-	sh2.opData.getFrs.frsType = recordId;
-	sh2.opData.getFrs.pData = sh2.frsData;
-	sh2.frsDataLen = ARRAY_LEN(sh2.frsData);
-	sh2.opData.getFrs.pWords = &sh2.frsDataLen;
-	sh2.opData.getFrs.nextOffset = 0;
-	sh2.opData.getFrs.pMetadata = pData;
+    shtp_getStats(sh2->pShtp, pStats);
 
-	return opStart(&getFrsOp);
+    return SH2_OK;
 }
 
-int sh2_getFrs(uint16_t recordId, uint32_t *pData, uint16_t *words)
+int sh2_setSensorBatchCallback(sh2_SensorBatchCallback_t *callback, void *cookie,
+                               sh2_SensorEvent_t *pBuffer, uint16_t capacity)
 {
-    if ((pData == 0) || (words == 0)) {
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if ((callback != 0) && ((pBuffer == 0) || (capacity == 0))) {
         return SH2_ERR_BAD_PARAM;
     }
-    
-	// Store params for this op
-	sh2.opData.getFrs.frsType = recordId;
-	sh2.opData.getFrs.pData = pData;
-	sh2.opData.getFrs.pWords = words;
-	sh2.opData.getFrs.nextOffset = 0;
-	sh2.opData.getFrs.pMetadata = 0;
 
-    return opStart(&getFrsOp);
+    sh2->batchCallback = callback;
+    sh2->batchCallbackCookie = cookie;
+    sh2->batch = (callback != 0) ? pBuffer : 0;
+    sh2->batchCapacity = (callback != 0) ? capacity : 0;
+    sh2->batchLen = 0;
+
+    return SH2_OK;
 }
 
-int sh2_setFrs(uint16_t recordId, uint32_t *pData, uint16_t words)
+int sh2_setSensorCallbackFor(sh2_SensorId_t sensorId,
+                             sh2_SensorCallback_t *callback, void *cookie)
 {
-    if ((pData == 0) && (words != 0)) {
-        return SH2_ERR_BAD_PARAM;
-    }
-    
-    sh2.opData.setFrs.frsType = recordId;
-    sh2.opData.setFrs.pData = pData;
-    sh2.opData.setFrs.words = words;
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
 
-    return opStart(&setFrsOp);
-}
+    if (sensorId > SH2_MAX_SENSOR_ID) return SH2_ERR_BAD_PARAM;
 
-int sh2_getErrors(uint8_t severity, sh2_ErrorRecord_t *pErrors, uint16_t *numErrors)
-{
-    sh2.opData.getErrors.severity = severity;
-    sh2.opData.getErrors.pErrors = pErrors;
-    sh2.opData.getErrors.pNumErrors = numErrors;
-    
-    return opStart(&getErrorsOp);
-}
+    sh2->sensorCallbackFor[sensorId].callback = callback;
+    sh2->sensorCallbackFor[sensorId].cookie = cookie;
 
-int sh2_getCounts(sh2_SensorId_t sensorId, sh2_Counts_t *pCounts)
-{
-    sh2.opData.getCounts.sensorId = sensorId;
-    sh2.opData.getCounts.pCounts = pCounts;
-    
-    return opStart(&getCountsOp);
+    return SH2_OK;
 }
 
-int sh2_clearCounts(sh2_SensorId_t sensorId)
+int sh2_setEventRing(sh2_SensorEvent_t *pBuffer, uint32_t capacity)
 {
-    uint8_t p[9];
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
 
-    memset(p, 0, sizeof(p));
-    p[0] = SH2_COUNTS_CLEAR_COUNTS;
-    p[1] = sensorId;
-    setupCmdParams(SH2_CMD_COUNTS, p);
+    if ((pBuffer != 0) &&
+        ((capacity == 0) || ((capacity & (capacity-1)) != 0))) {
+        // Capacity must be a power of two
+        return SH2_ERR_BAD_PARAM;
+    }
 
-    return opStart(&sendCmdOp);
+    sh2->eventRing = 0;
+    ATOMIC_STORE(&sh2->eventRingHead, 0, seq_cst);
+    ATOMIC_STORE(&sh2->eventRingTail, 0, seq_cst);
+    ATOMIC_STORE(&sh2->eventRingHighWater, 0, seq_cst);
+    ATOMIC_STORE(&sh2->eventRingOverflows, 0, seq_cst);
+    sh2->eventRingMask = (pBuffer != 0) ? capacity-1 : 0;
+    sh2->eventRing = pBuffer;
+
+    return SH2_OK;
 }
 
-int sh2_setTareNow(uint8_t axes,    // SH2_TARE_X | SH2_TARE_Y | SH2_TARE_Z
-                   sh2_TareBasis_t basis)
+int sh2_pollEvents(sh2_SensorEvent_t *batch, int max)
 {
-    uint8_t p[9];
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
 
-    memset(p, 0, sizeof(p));
-    p[0] = SH2_TARE_TARE_NOW;
-    p[1] = axes;
-    p[2] = basis;
-    setupCmdParams(SH2_CMD_TARE, p);
+    if (sh2->eventRing == 0) return SH2_ERR;
+    if ((batch == 0) || (max < 0)) return SH2_ERR_BAD_PARAM;
+
+    uint32_t tail = ATOMIC_LOAD(&sh2->eventRingTail, relaxed);
+    uint32_t head = ATOMIC_LOAD(&sh2->eventRingHead, acquire);
+    uint32_t avail = head - tail;
+    int n = (avail < (uint32_t)max) ? (int)avail : max;
 
-    return opStart(&sendCmdOp);
+    for (int i = 0; i < n; i++) {
+        batch[i] = sh2->eventRing[(tail + i) & sh2->eventRingMask];
+    }
+    ATOMIC_STORE(&sh2->eventRingTail, tail + n, release);
+
+    return n;
 }
 
-int sh2_clearTare(void)
+int sh2_getEventRingStats(sh2_EventRingStats_t *pStats)
 {
-    uint8_t p[9];
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
 
-    memset(p, 0, sizeof(p));
-    p[0] = SH2_TARE_SET_REORIENTATION;
+    if (pStats == 0) return SH2_ERR_BAD_PARAM;
+
+    uint32_t tail = ATOMIC_LOAD(&sh2->eventRingTail, seq_cst);
+    uint32_t head = ATOMIC_LOAD(&sh2->eventRingHead, seq_cst);
+
+    pStats->capacity = (sh2->eventRing != 0) ? sh2->eventRingMask+1 : 0;
+    pStats->count = head - tail;
+    pStats->highWater = ATOMIC_LOAD(&sh2->eventRingHighWater, seq_cst);
+    pStats->overflows = ATOMIC_LOAD(&sh2->eventRingOverflows, seq_cst);
 
-    setupCmdParams(SH2_CMD_TARE, p);
-    return opStart(&sendCmdOp);
+    return SH2_OK;
 }
 
-int sh2_persistTare(void)
+int sh2_setClockSync(sh2_SensorId_t sensorId, uint32_t interval_us)
 {
-    setupCmd1(SH2_CMD_TARE, SH2_TARE_PERSIST_TARE);
-    return opStart(&sendCmdOp);
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if (sensorId > SH2_MAX_SENSOR_ID) return SH2_ERR_BAD_PARAM;
+
+    sh2->clockSensor = sensorId;
+    sh2->clockInterval = interval_us;
+    sh2->clockResyncs = 0;
+    memset(sh2->clockLastTime, 0, sizeof(sh2->clockLastTime));
+    clockSyncRestart();
+
+    return SH2_OK;
 }
 
-int sh2_setReorientation(sh2_Quaternion_t *orientation)
+int sh2_getClockSyncStats(sh2_ClockSyncStats_t *pStats)
 {
-    uint8_t p[9];
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if (pStats == 0) return SH2_ERR_BAD_PARAM;
+
+    bool fitted = (sh2->clockSamples >= CLOCK_SYNC_MIN_SAMPLES);
+
+    pStats->samples = sh2->clockSamples;
+    pStats->resyncs = sh2->clockResyncs;
+    pStats->period_ns = 0;
+    pStats->skew_ppm = 0;
+    pStats->jitter_ns = 0;
+    if (fitted && (sh2->clockB > 0)) {
+        pStats->period_ns = (uint32_t)divRound(sh2->clockB * 1000, CLOCK_SYNC_ONE);
+        if (sh2->clockInterval != 0) {
+            int64_t diff = sh2->clockInterval * CLOCK_SYNC_ONE - sh2->clockB;
+            pStats->skew_ppm = (int32_t)((diff / sh2->clockB) * 1000000 +
+                                         divRound((diff % sh2->clockB) * 1000000, sh2->clockB));
+        }
+        // Square root of the variance has half its fraction bits
+        pStats->jitter_ns = (uint32_t)divRound((int64_t)isqrt64(sh2->clockVariance) * 1000,
+                                               (int64_t)1 << (CLOCK_SYNC_FRAC_BITS/2));
+    }
+    pStats->correction_us = (int32_t)sh2->clockCorrection;
+
+    return SH2_OK;
+}
+
+int sh2_checkTimeouts(uint32_t now_us)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    int timedOut = 0;
+
+    for (int n = 0; n < SH2_OP_QUEUE_LEN; n++) {
+        sh2_OpReq_t *pReq = &sh2->opReq[n];
+        if (pReq->state != OP_ACTIVE) continue;
+
+        if (!pReq->deadlineSet) {
+            uint32_t timeout_us = pReq->pOp->timeout_us;
+            if (timeout_us == 0) timeout_us = SH2_OP_TIMEOUT_US;
+            pReq->deadline = now_us + timeout_us;
+            pReq->deadlineSet = true;
+        }
+        else if ((int32_t)(now_us - pReq->deadline) >= 0) {
+            opCancel(pReq, SH2_ERR_TIMEOUT);
+            timedOut++;
+        }
+    }
+
+    return timedOut;
+}
+
+int sh2_cancelOperations(void)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    int cancelled = 0;
+
+    // Cancel in submission order, without starting queued operations that
+    // are about to be cancelled too.  Callbacks may queue new operations;
+    // those are started afterwards.
+    bool starting = sh2->opStarting;
+    sh2->opStarting = true;
+    uint32_t lastTicket = sh2->nextOpTicket;
+    while (true) {
+        sh2_OpReq_t *pReq = 0;
+        for (int n = 0; n < SH2_OP_QUEUE_LEN; n++) {
+            if (((sh2->opReq[n].state == OP_QUEUED) || (sh2->opReq[n].state == OP_ACTIVE)) &&
+                ((int32_t)(sh2->opReq[n].ticket - lastTicket) < 0) &&
+                ((pReq == 0) || ((int32_t)(sh2->opReq[n].ticket - pReq->ticket) < 0))) {
+                pReq = &sh2->opReq[n];
+            }
+        }
+        if (pReq == 0) break;
+
+        opCancel(pReq, SH2_ERR_CANCELLED);
+        cancelled++;
+    }
+    sh2->opStarting = starting;
+
+    opStartPending();
+
+    return cancelled;
+}
+
+int sh2_getProdIds(sh2_ProductIds_t *pProdIds)
+{
+    return opWait(sh2_getProdIdsAsync(pProdIds, opUnblock, 0));
+}
+
+int sh2_getProdIdsAsync(sh2_ProductIds_t *pProdIds,
+                        sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+	pReq->opData.getProdIds.pProdIds = pProdIds;
+	pReq->opData.getProdIds.nextEntry = 0;
+    pReq->opData.getProdIds.expectedEntries = 4;  // Most products supply 4 product ids.
+                                                // When the first arrives, we'll know if
+                                                // we need to adjust this.
+	return opSubmit(pReq, &getProdIdOp, callback, cookie);
+}
+
+int sh2_getSensorConfig(sh2_SensorId_t sensorId, sh2_SensorConfig_t *config)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if (cacheGetConfig(sensorId, config)) return SH2_OK;
+
+    return opWait(sh2_getSensorConfigAsync(sensorId, config, opUnblock, 0));
+}
+
+int sh2_getSensorConfigAsync(sh2_SensorId_t sensorId, sh2_SensorConfig_t *config,
+                             sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if (cacheGetConfig(sensorId, config)) {
+        if (callback != 0) {
+            callback(cookie, SH2_OK);
+        }
+        return SH2_OK;
+    }
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    pReq->opData.getSensorConfig.sensorId = sensorId;
+    pReq->opData.getSensorConfig.pConfig = config;
+    return opSubmit(pReq, &getSensorConfigOp, callback, cookie);
+}
+
+int sh2_setSensorConfig(sh2_SensorId_t sensorId, const sh2_SensorConfig_t *pConfig)
+{
+    return opWait(sh2_setSensorConfigAsync(sensorId, pConfig, opUnblock, 0));
+}
+
+int sh2_setSensorConfigAsync(sh2_SensorId_t sensorId, const sh2_SensorConfig_t *pConfig,
+                             sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    // Set up operation
+    pReq->opData.setSensorConfig.sensorId = sensorId;
+    pReq->opData.setSensorConfig.pConfig = pConfig;
+    cacheDropConfig(sensorId);
+
+    return opSubmit(pReq, &setSensorConfigOp, callback, cookie);
+}
+
+int sh2_setSensorConfigs(sh2_SensorConfigEntry_t *pEntries, uint16_t numEntries)
+{
+    return opWait(sh2_setSensorConfigsAsync(pEntries, numEntries, opUnblock, 0));
+}
+
+int sh2_setSensorConfigsAsync(sh2_SensorConfigEntry_t *pEntries, uint16_t numEntries,
+                              sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if ((pEntries == 0) && (numEntries != 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    pReq->opData.setSensorConfigs.pEntries = pEntries;
+    pReq->opData.setSensorConfigs.numEntries = numEntries;
+    for (int n = 0; n < numEntries; n++) {
+        cacheDropConfig(pEntries[n].sensorId);
+    }
+
+    return opSubmit(pReq, &setSensorConfigsOp, callback, cookie);
+}
+
+int sh2_setCache(bool enable, sh2_MetadataCacheEntry_t *pMetadata, uint16_t numMetadata)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if ((pMetadata == 0) && (numMetadata != 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    sh2->cacheEnabled = false;
+    sh2->metadataCache = enable ? pMetadata : 0;
+    sh2->metadataCacheLen = enable ? numMetadata : 0;
+    cacheClear();
+    sh2->cacheEnabled = enable;
+
+    return SH2_OK;
+}
+
+const static struct {
+    sh2_SensorId_t sensorId;
+    uint16_t recordId;
+} sensorToRecordMap[] = {
+    { SH2_RAW_ACCELEROMETER,            FRS_ID_META_RAW_ACCELEROMETER },
+    { SH2_ACCELEROMETER,                FRS_ID_META_ACCELEROMETER },
+    { SH2_LINEAR_ACCELERATION,          FRS_ID_META_LINEAR_ACCELERATION },
+    { SH2_GRAVITY,                      FRS_ID_META_GRAVITY },
+    { SH2_RAW_GYROSCOPE,                FRS_ID_META_RAW_GYROSCOPE },
+    { SH2_GYROSCOPE_CALIBRATED,         FRS_ID_META_GYROSCOPE_CALIBRATED },
+    { SH2_GYROSCOPE_UNCALIBRATED,       FRS_ID_META_GYROSCOPE_UNCALIBRATED },
+    { SH2_RAW_MAGNETOMETER,             FRS_ID_META_RAW_MAGNETOMETER },
+    { SH2_MAGNETIC_FIELD_CALIBRATED,    FRS_ID_META_MAGNETIC_FIELD_CALIBRATED },
+    { SH2_MAGNETIC_FIELD_UNCALIBRATED,  FRS_ID_META_MAGNETIC_FIELD_UNCALIBRATED },
+    { SH2_ROTATION_VECTOR,              FRS_ID_META_ROTATION_VECTOR },
+    { SH2_GAME_ROTATION_VECTOR,         FRS_ID_META_GAME_ROTATION_VECTOR },
+    { SH2_GEOMAGNETIC_ROTATION_VECTOR,  FRS_ID_META_GEOMAGNETIC_ROTATION_VECTOR },
+    { SH2_PRESSURE,                     FRS_ID_META_PRESSURE },
+    { SH2_AMBIENT_LIGHT,                FRS_ID_META_AMBIENT_LIGHT },
+    { SH2_HUMIDITY,                     FRS_ID_META_HUMIDITY },
+    { SH2_PROXIMITY,                    FRS_ID_META_PROXIMITY },
+    { SH2_TEMPERATURE,                  FRS_ID_META_TEMPERATURE },
+    { SH2_TAP_DETECTOR,                 FRS_ID_META_TAP_DETECTOR },
+    { SH2_STEP_DETECTOR,                FRS_ID_META_STEP_DETECTOR },
+    { SH2_STEP_COUNTER,                 FRS_ID_META_STEP_COUNTER },
+    { SH2_SIGNIFICANT_MOTION,           FRS_ID_META_SIGNIFICANT_MOTION },
+    { SH2_STABILITY_CLASSIFIER,         FRS_ID_META_STABILITY_CLASSIFIER },
+    { SH2_SHAKE_DETECTOR,               FRS_ID_META_SHAKE_DETECTOR },
+    { SH2_FLIP_DETECTOR,                FRS_ID_META_FLIP_DETECTOR },
+    { SH2_PICKUP_DETECTOR,              FRS_ID_META_PICKUP_DETECTOR },
+    { SH2_STABILITY_DETECTOR,           FRS_ID_META_STABILITY_DETECTOR },
+    { SH2_PERSONAL_ACTIVITY_CLASSIFIER, FRS_ID_META_PERSONAL_ACTIVITY_CLASSIFIER },
+    { SH2_SLEEP_DETECTOR,               FRS_ID_META_SLEEP_DETECTOR },
+    { SH2_TILT_DETECTOR,                FRS_ID_META_TILT_DETECTOR },
+    { SH2_POCKET_DETECTOR,              FRS_ID_META_POCKET_DETECTOR },
+    { SH2_CIRCLE_DETECTOR,              FRS_ID_META_CIRCLE_DETECTOR },
+};
+
+// Metadata FRS record of a sensor, 0 if it has none.
+static uint16_t metadataRecordId(sh2_SensorId_t sensorId)
+{
+	for (int i = 0; i < ARRAY_LEN(sensorToRecordMap); i++) {
+		if (sensorToRecordMap[i].sensorId == sensorId) {
+			return sensorToRecordMap[i].recordId;
+		}
+	}
+
+    return 0;
+}
+
+int sh2_getMetadata(sh2_SensorId_t sensorId, sh2_SensorMetadata_t *pData)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if ((pData != 0) && cacheGetMetadata(metadataRecordId(sensorId), pData)) {
+        return SH2_OK;
+    }
+
+    return opWait(sh2_getMetadataAsync(sensorId, pData, opUnblock, 0));
+}
+
+int sh2_getMetadataAsync(sh2_SensorId_t sensorId, sh2_SensorMetadata_t *pData,
+                         sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    // pData must be non-null
+    if (pData == 0) return SH2_ERR_BAD_PARAM;
+  
+	// Convert sensorId to metadata recordId
+	uint16_t recordId = metadataRecordId(sensorId);
+	if (recordId == 0) {
+		// no match was found
+		return SH2_ERR_BAD_PARAM;
+	}
+
+    if (cacheGetMetadata(recordId, pData)) {
+        if (callback != 0) {
+            callback(cookie, SH2_OK);
+        }
+        return SH2_OK;
+    }
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+	
+	// Set up an FRS read operation
+	pReq->opData.getFrs.frsType = recordId;
+	pReq->opData.getFrs.pData = sh2->frsData;
+	pReq->opData.getFrs.pWords = &sh2->frsDataLen;
+	pReq->opData.getFrs.readOffset = 0;
+	pReq->opData.getFrs.blockSize = 0;
+	pReq->opData.getFrs.pMetadata = pData;
+
+	return opSubmit(pReq, &getFrsOp, callback, cookie);
+}
+
+int sh2_prefetchAllMetadata(sh2_MetadataCacheEntry_t *pTable, uint16_t numEntries,
+                            sh2_MetadataPrefetchStats_t *pStats)
+{
+    return opWait(sh2_prefetchAllMetadataAsync(pTable, numEntries, pStats, opUnblock, 0));
+}
+
+int sh2_prefetchAllMetadataAsync(sh2_MetadataCacheEntry_t *pTable, uint16_t numEntries,
+                                 sh2_MetadataPrefetchStats_t *pStats,
+                                 sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if ((pTable == 0) || (numEntries == 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    pReq->opData.prefetchMetadata.pTable = pTable;
+    pReq->opData.prefetchMetadata.numEntries = numEntries;
+    pReq->opData.prefetchMetadata.pStats = pStats;
+
+    return opSubmit(pReq, &prefetchMetadataOp, callback, cookie);
+}
+
+int sh2_getFrs(uint16_t recordId, uint32_t *pData, uint16_t *words)
+{
+    return opWait(sh2_getFrsAsync(recordId, pData, words, opUnblock, 0));
+}
+
+int sh2_getFrsAsync(uint16_t recordId, uint32_t *pData, uint16_t *words,
+                    sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if ((pData == 0) || (words == 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+    
+	// Store params for this op
+	pReq->opData.getFrs.frsType = recordId;
+	pReq->opData.getFrs.pData = pData;
+	pReq->opData.getFrs.pWords = words;
+	pReq->opData.getFrs.readOffset = 0;
+	pReq->opData.getFrs.blockSize = 0;
+	pReq->opData.getFrs.pMetadata = 0;
+
+    return opSubmit(pReq, &getFrsOp, callback, cookie);
+}
+
+int sh2_getFrsRange(uint16_t recordId, uint16_t offset, uint32_t *pData, uint16_t *words)
+{
+    return opWait(sh2_getFrsRangeAsync(recordId, offset, pData, words, opUnblock, 0));
+}
+
+int sh2_getFrsRangeAsync(uint16_t recordId, uint16_t offset, uint32_t *pData, uint16_t *words,
+                         sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if ((pData == 0) || (words == 0) || (*words == 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    pReq->opData.getFrs.frsType = recordId;
+    pReq->opData.getFrs.pData = pData;
+    pReq->opData.getFrs.pWords = words;
+    pReq->opData.getFrs.readOffset = offset;
+    pReq->opData.getFrs.blockSize = *words;
+    pReq->opData.getFrs.pMetadata = 0;
+
+    return opSubmit(pReq, &getFrsOp, callback, cookie);
+}
+
+int sh2_getFrsWriteStats(sh2_FrsWriteStats_t *pStats)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if (pStats == 0) return SH2_ERR_BAD_PARAM;
+
+    *pStats = sh2->frsWriteStats;
+
+    return SH2_OK;
+}
+
+int sh2_setFrs(uint16_t recordId, uint32_t *pData, uint16_t words)
+{
+    return opWait(sh2_setFrsAsync(recordId, pData, words, opUnblock, 0));
+}
+
+int sh2_setFrsAsync(uint16_t recordId, uint32_t *pData, uint16_t words,
+                    sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if ((pData == 0) && (words != 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+    
+    pReq->opData.setFrs.frsType = recordId;
+    pReq->opData.setFrs.pData = pData;
+    pReq->opData.setFrs.words = words;
+    cacheDropMetadata(recordId);
+
+    return opSubmit(pReq, &setFrsOp, callback, cookie);
+}
+
+int sh2_getErrors(uint8_t severity, sh2_ErrorRecord_t *pErrors, uint16_t *numErrors)
+{
+    return opWait(sh2_getErrorsAsync(severity, pErrors, numErrors, opUnblock, 0));
+}
+
+int sh2_getErrorsAsync(uint8_t severity, sh2_ErrorRecord_t *pErrors, uint16_t *numErrors,
+                       sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    pReq->opData.getErrors.severity = severity;
+    pReq->opData.getErrors.pErrors = pErrors;
+    pReq->opData.getErrors.pNumErrors = numErrors;
+    
+    return opSubmit(pReq, &getErrorsOp, callback, cookie);
+}
+
+int sh2_getCounts(sh2_SensorId_t sensorId, sh2_Counts_t *pCounts)
+{
+    return opWait(sh2_getCountsAsync(sensorId, pCounts, opUnblock, 0));
+}
+
+int sh2_getCountsAsync(sh2_SensorId_t sensorId, sh2_Counts_t *pCounts,
+                       sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    pReq->opData.getCounts.sensorId = sensorId;
+    pReq->opData.getCounts.pCounts = pCounts;
+    
+    return opSubmit(pReq, &getCountsOp, callback, cookie);
+}
+
+int sh2_clearCounts(sh2_SensorId_t sensorId)
+{
+    return opWait(sh2_clearCountsAsync(sensorId, opUnblock, 0));
+}
+
+int sh2_clearCountsAsync(sh2_SensorId_t sensorId,
+                         sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    uint8_t p[9];
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    memset(p, 0, sizeof(p));
+    p[0] = SH2_COUNTS_CLEAR_COUNTS;
+    p[1] = sensorId;
+    setupCmdParams(pReq, SH2_CMD_COUNTS, p);
+
+    return opSubmit(pReq, &sendCmdOp, callback, cookie);
+}
+
+int sh2_setTareNow(uint8_t axes,    // SH2_TARE_X | SH2_TARE_Y | SH2_TARE_Z
+                   sh2_TareBasis_t basis)
+{
+    return opWait(sh2_setTareNowAsync(axes, basis, opUnblock, 0));
+}
+
+int sh2_setTareNowAsync(uint8_t axes, sh2_TareBasis_t basis,
+                        sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    uint8_t p[9];
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    memset(p, 0, sizeof(p));
+    p[0] = SH2_TARE_TARE_NOW;
+    p[1] = axes;
+    p[2] = basis;
+    setupCmdParams(pReq, SH2_CMD_TARE, p);
+
+    return opSubmit(pReq, &sendCmdOp, callback, cookie);
+}
+
+int sh2_clearTare(void)
+{
+    return opWait(sh2_clearTareAsync(opUnblock, 0));
+}
+
+int sh2_clearTareAsync(sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    uint8_t p[9];
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    memset(p, 0, sizeof(p));
+    p[0] = SH2_TARE_SET_REORIENTATION;
+
+    setupCmdParams(pReq, SH2_CMD_TARE, p);
+    return opSubmit(pReq, &sendCmdOp, callback, cookie);
+}
+
+int sh2_persistTare(void)
+{
+    return opWait(sh2_persistTareAsync(opUnblock, 0));
+}
+
+int sh2_persistTareAsync(sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    setupCmd1(pReq, SH2_CMD_TARE, SH2_TARE_PERSIST_TARE);
+    return opSubmit(pReq, &sendCmdOp, callback, cookie);
+}
+
+int sh2_setReorientation(sh2_Quaternion_t *orientation)
+{
+    return opWait(sh2_setReorientationAsync(orientation, opUnblock, 0));
+}
+
+int sh2_setReorientationAsync(sh2_Quaternion_t *orientation,
+                              sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    uint8_t p[9];
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
 
     p[0] = SH2_TARE_SET_REORIENTATION;
     writeu16(&p[1], toQ14(orientation->x));
@@ -808,76 +1661,184 @@ int sh2_setReorientation(sh2_Quaternion_t *orientation)
     writeu16(&p[5], toQ14(orientation->z));
     writeu16(&p[7], toQ14(orientation->w));
 
-    setupCmdParams(SH2_CMD_TARE, p);
-    return opStart(&sendCmdOp);
+    setupCmdParams(pReq, SH2_CMD_TARE, p);
+    return opSubmit(pReq, &sendCmdOp, callback, cookie);
 }
 
 int sh2_reinitialize(void)
 {
-    return opStart(&reinitOp);
+    return opWait(sh2_reinitializeAsync(opUnblock, 0));
+}
+
+int sh2_reinitializeAsync(sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    return opSubmit(pReq, &reinitOp, callback, cookie);
 }
 
 int sh2_saveDcdNow(void)
 {
-    return opStart(&saveDcdNowOp);
+    return opWait(sh2_saveDcdNowAsync(opUnblock, 0));
+}
+
+int sh2_saveDcdNowAsync(sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    return opSubmit(pReq, &saveDcdNowOp, callback, cookie);
 }
 
 int sh2_getOscType(sh2_OscType_t *pOscType)
 {
-    sh2.opData.getOscType.pOscType = pOscType;
-    return opStart(&getOscTypeOp);
+    return opWait(sh2_getOscTypeAsync(pOscType, opUnblock, 0));
+}
+
+int sh2_getOscTypeAsync(sh2_OscType_t *pOscType,
+                        sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    pReq->opData.getOscType.pOscType = pOscType;
+    return opSubmit(pReq, &getOscTypeOp, callback, cookie);
 }
 
 
 int sh2_setCalConfig(uint8_t sensors)
 {
-    sh2.opData.calConfig.sensors = sensors;
+    return opWait(sh2_setCalConfigAsync(sensors, opUnblock, 0));
+}
+
+int sh2_setCalConfigAsync(uint8_t sensors,
+                          sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
 
-    return opStart(&calConfigOp);
+    pReq->opData.calConfig.sensors = sensors;
+
+    return opSubmit(pReq, &calConfigOp, callback, cookie);
 }
 
 int sh2_getCalConfig(uint8_t *pSensors)
 {
+    return opWait(sh2_getCalConfigAsync(pSensors, opUnblock, 0));
+}
+
+int sh2_getCalConfigAsync(uint8_t *pSensors,
+                          sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
     if (pSensors == 0) {
         return SH2_ERR_BAD_PARAM;
     }
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
     
-    sh2.opData.getCalConfig.pSensors = pSensors;
+    pReq->opData.getCalConfig.pSensors = pSensors;
 
-    return opStart(&getCalConfigOp);
+    return opSubmit(pReq, &getCalConfigOp, callback, cookie);
 }
 
 int sh2_setDcdAutoSave(bool enabled)
 {
-    setupCmd1(SH2_CMD_DCD_SAVE, enabled ? 0 : 1);
-    return opStart(&sendCmdOp);
+    return opWait(sh2_setDcdAutoSaveAsync(enabled, opUnblock, 0));
+}
+
+int sh2_setDcdAutoSaveAsync(bool enabled,
+                            sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    setupCmd1(pReq, SH2_CMD_DCD_SAVE, enabled ? 0 : 1);
+    return opSubmit(pReq, &sendCmdOp, callback, cookie);
 }
 
 int sh2_flush(sh2_SensorId_t sensorId)
 {
+    return opWait(sh2_flushAsync(sensorId, opUnblock, 0));
+}
+
+int sh2_flushAsync(sh2_SensorId_t sensorId,
+                   sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
     // Set up flush operation
-    sh2.opData.forceFlush.sensorId = sensorId;
+    pReq->opData.forceFlush.sensorId = sensorId;
 
-    return opStart(&forceFlushOp);
+    return opSubmit(pReq, &forceFlushOp, callback, cookie);
 }
 
 int sh2_clearDcdAndReset(void)
 {
-    setupCmd0(SH2_CMD_CLEAR_DCD_AND_RESET);
-    return opStart(&sendCmdOp);
+    return opWait(sh2_clearDcdAndResetAsync(opUnblock, 0));
+}
+
+int sh2_clearDcdAndResetAsync(sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    setupCmd0(pReq, SH2_CMD_CLEAR_DCD_AND_RESET);
+    return opSubmit(pReq, &sendCmdOp, callback, cookie);
 }
 
 int sh2_startCal(uint32_t interval_us)
 {
-    sh2.opData.startCal.interval_us = interval_us;
-    return opStart(&startCalOp);
+    return opWait(sh2_startCalAsync(interval_us, opUnblock, 0));
+}
+
+int sh2_startCalAsync(uint32_t interval_us,
+                      sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    pReq->opData.startCal.interval_us = interval_us;
+    return opSubmit(pReq, &startCalOp, callback, cookie);
 }
 
 int sh2_finishCal(sh2_CalStatus_t *status)
 {
-    int retval = opStart(&finishCalOp);
-    *status = sh2.opData.finishCal.status;
-    return retval;
+    return opWait(sh2_finishCalAsync(status, opUnblock, 0));
+}
+
+int sh2_finishCalAsync(sh2_CalStatus_t *status,
+                       sh2_OpCallback_t *callback, void *cookie)
+{
+    if (sh2 == 0) return SH2_ERR_BAD_PARAM;
+
+    if (status == 0) {
+        return SH2_ERR_BAD_PARAM;
+    }
+    sh2_OpReq_t *pReq = opAlloc(callback);
+    if (pReq == 0) return SH2_ERR_OP_IN_PROGRESS;
+
+    pReq->opData.finishCal.pStatus = status;
+    return opSubmit(pReq, &finishCalOp, callback, cookie);
 }
 
 // --- Private utility functions --------------------------------------------------------------
@@ -889,55 +1850,81 @@ static int16_t toQ14(double x)
     return retval;
 }
 
+// Divide, rounding to nearest.  den must be positive.
+static int64_t divRound(int64_t num, int64_t den)
+{
+    return (num >= 0) ? (num + den/2) / den : -((-num + den/2) / den);
+}
+
+// Integer square root, rounded down
+static uint32_t isqrt64(uint64_t x)
+{
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    while (bit > x) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)root;
+}
+
 // Send a command with parameters from p
-static void setupCmdParams(uint8_t cmd, uint8_t p[9])
+static void setupCmdParams(sh2_OpReq_t *pReq, uint8_t cmd, uint8_t p[9])
 {
     // Set up request
-    sh2.opData.sendCmd.req.reportId = SENSORHUB_COMMAND_REQ;
-    sh2.opData.sendCmd.req.seq = sh2.nextCmdSeq++;
-    sh2.opData.sendCmd.req.command = cmd;
-    memcpy(&sh2.opData.sendCmd.req.p, p,
-           sizeof(sh2.opData.sendCmd.req.p));
+    pReq->opData.sendCmd.req.reportId = SENSORHUB_COMMAND_REQ;
+    pReq->opData.sendCmd.req.seq = sh2->nextCmdSeq++;
+    pReq->opData.sendCmd.req.command = cmd;
+    memcpy(&pReq->opData.sendCmd.req.p, p,
+           sizeof(pReq->opData.sendCmd.req.p));
 }
 
 // Set up command with no params
-static void setupCmd0(uint8_t cmd)
+static void setupCmd0(sh2_OpReq_t *pReq, uint8_t cmd)
 {
     uint8_t p[9];
 
     memset(p, 0, sizeof(p));
-    setupCmdParams(cmd, p);
+    setupCmdParams(pReq, cmd, p);
 }
 
 // Set up command with 1 param
-static void setupCmd1(uint8_t cmd, uint8_t p0)
+static void setupCmd1(sh2_OpReq_t *pReq, uint8_t cmd, uint8_t p0)
 {
     uint8_t p[9];
 
     memset(p, 0, sizeof(p));
     p[0] = p0;
-    setupCmdParams(cmd, p);
+    setupCmdParams(pReq, cmd, p);
 }
 
 static void sensorhubAdvertHdlr(void *cookie, uint8_t tag, uint8_t len, uint8_t *val)
 {
+    sh2_t *caller = enterInstance(cookie);
 
     switch (tag) {
         case TAG_SH2_VERSION:
-            strcpy(sh2.version, (const char *)val);
+            strcpy(sh2->version, (const char *)val);
             break;
 
         case TAG_SH2_REPORT_LENGTHS:
         {
             uint8_t reports = len/2;
-            if (reports > SH2_MAX_REPORT_IDS) {
-                // Hub gave us more report lengths than we can store!
-                reports = SH2_MAX_REPORT_IDS;
-            }
-        
+
+            memset(sh2->reportLen, 0, sizeof(sh2->reportLen));
             for (int n = 0; n < reports; n++) {
-                sh2.report[n].id = val[n*2];
-                sh2.report[n].len = val[n*2 + 1];
+                sh2->reportLen[val[n*2]] = val[n*2 + 1];
             }
             break;
         }
@@ -946,15 +1933,17 @@ static void sensorhubAdvertHdlr(void *cookie, uint8_t tag, uint8_t len, uint8_t
         {
             // 0 tag indicates end of advertisements for this app
             // At this time, the SHTP layer can give us our channel number.
-            sh2.controlChan = shtp_chanNo("sensorhub", "control");
+            sh2->controlChan = shtp_chanNo(sh2->pShtp, "sensorhub", "control");
 
-            sh2.advertDone = true;
+            sh2->advertDone = true;
             break;
         }
         
         default:
             break;
     }
+
+    sh2 = caller;
 }
 
 static void sensorhubControlHdlr(void *cookie, uint8_t *payload, uint16_t len, uint32_t timestamp)
@@ -963,29 +1952,25 @@ static void sensorhubControlHdlr(void *cookie, uint8_t *payload, uint16_t len, u
     uint32_t count = 0;
     CommandResp_t * pResp = 0;
     sh2_AsyncEvent_t event;
+    sh2_t *caller = enterInstance(cookie);
     
     if (len == 0) {
-        sh2.emptyPayloads++;
-        return;
+        sh2->emptyPayloads++;
     }
 
+    sh2->controlTimestamp = timestamp;
+
     while (cursor < len) {
         // Get next report id
         count++;
         uint8_t reportId = payload[cursor];
 
         // Determine report length
-        uint8_t reportLen = 0;
-        for (int n = 0; n < SH2_MAX_REPORT_IDS; n++) {
-            if (sh2.report[n].id == reportId) {
-                reportLen = sh2.report[n].len;
-                break;
-            }
-        }
+        uint8_t reportLen = getReportLen(reportId);
         if (reportLen == 0) {
             // An unrecognized report id
-            sh2.unknownReportIds++;
-            return;
+            sh2->unknownReportIds++;
+            break;
         }
         else {
             // Check for unsolicited initialize response or FRS change response
@@ -995,15 +1980,16 @@ static void sensorhubControlHdlr(void *cookie, uint8_t *payload, uint16_t len, u
                     (pResp->r[1] == SH2_INIT_SYSTEM)) {
                     // This is an unsolicited INIT message.
                     // Is it time to call reset callback?
-                    sh2.gotInitResp = true;
+                    sh2->gotInitResp = true;
                 }
                 if (pResp->command == (SH2_CMD_FRS | SH2_INIT_UNSOLICITED))
                 {
                     // This is an unsolicited FRS change message
                     event.eventId = SH2_FRS_CHANGE;
                     event.frsType = pResp->r[1] + (pResp->r[2] << 8);
-                    if (sh2.eventCallback) {
-                        sh2.eventCallback(sh2.eventCallbackCookie, &event);
+                    cacheDropMetadata(event.frsType);
+                    if (sh2->eventCallback) {
+                        sh2->eventCallback(sh2->eventCallbackCookie, &event);
                     }
 				}
 			}
@@ -1013,6 +1999,8 @@ static void sensorhubControlHdlr(void *cookie, uint8_t *payload, uint16_t len, u
             cursor += reportLen;
         }
     }
+
+    sh2 = caller;
 }
 
 static void sensorhubInputHdlr(uint8_t *payload, uint16_t len, uint32_t timestamp)
@@ -1023,6 +2011,11 @@ static void sensorhubInputHdlr(uint8_t *payload, uint16_t len, uint32_t timestam
     uint32_t referenceDelta;
 
     referenceDelta = 0;
+    startSensorBatch(timestamp, referenceDelta);
+
+    if (sh2->clockSensor != 0) {
+        clockSyncCargo(payload, len, timestamp);
+    }
 
     while (cursor < len) {
         // Get next report id
@@ -1032,7 +2025,8 @@ static void sensorhubInputHdlr(uint8_t *payload, uint16_t len, uint32_t timestam
         uint8_t reportLen = getReportLen(reportId);
         if (reportLen == 0) {
             // An unrecognized report id
-            sh2.unknownReportIds++;
+            sh2->unknownReportIds++;
+            flushSensorBatch();
             return;
         }
         else {
@@ -1041,11 +2035,15 @@ static void sensorhubInputHdlr(uint8_t *payload, uint16_t len, uint32_t timestam
                 
                 // store base timestamp reference
                 referenceDelta = -rpt->timebase;
+                flushSensorBatch();
+                startSensorBatch(timestamp, referenceDelta);
             }
             else if (reportId == SENSORHUB_TIMESTAMP_REBASE) {
                 const TimestampRebase_t *rpt = (const TimestampRebase_t *)(payload+cursor);
 
                 referenceDelta += rpt->timebase;
+                flushSensorBatch();
+                startSensorBatch(timestamp, referenceDelta);
             }
             else if (reportId == SENSORHUB_FLUSH_COMPLETED) {
                 // Route this as if it arrived on command channel.
@@ -1054,165 +2052,428 @@ static void sensorhubInputHdlr(uint8_t *payload, uint16_t len, uint32_t timestam
             else {
                 uint8_t *pReport = payload+cursor;
                 uint16_t delay = ((pReport[2] & 0xFC) << 6) + pReport[3];
-                event.timestamp_uS = touSTimestamp(timestamp, referenceDelta, delay);
+                event.timestamp_uS = clockSyncTime(reportId,
+                                                   touSTimestamp(timestamp, referenceDelta, delay));
                 event.reportId = reportId;
-                memcpy(event.report, pReport, reportLen);
-                /// event.pReport = pReport;
                 event.len = reportLen;
-                if (sh2.sensorCallback != 0) {
-                    sh2.sensorCallback(sh2.sensorCallbackCookie, &event);
-                }
+                deliverSensorEvent(&event, reportId, pReport);
             }
             cursor += reportLen;
         }
     }
+
+    flushSensorBatch();
+}
+
+// Pass an event to a sensor callback, with its report copied into it
+// unless no-copy delivery was selected.
+static void callSensorCallback(sh2_SensorCallback_t *callback, void *cookie,
+                               sh2_SensorEvent_t *pEvent, const uint8_t *pReport)
+{
+    if (sh2->sensorCallbackCopy) {
+        memcpy(pEvent->report, pReport, pEvent->len);
+        pEvent->pReport = 0;
+    }
+    else {
+        pEvent->pReport = pReport;
+    }
+
+    callback(cookie, pEvent);
 }
 
 static void sensorhubInputNormalHdlr(void *cookie, uint8_t *payload, uint16_t len, uint32_t timestamp)
 {
+    sh2_t *caller = enterInstance(cookie);
     
     sensorhubInputHdlr(payload, len, timestamp);
+
+    sh2 = caller;
 }
 
 static void sensorhubInputWakeHdlr(void *cookie, uint8_t *payload, uint16_t len, uint32_t timestamp)
 {
+    sh2_t *caller = enterInstance(cookie);
     
     sensorhubInputHdlr(payload, len, timestamp);
+
+    sh2 = caller;
 }
 
 static void sensorhubInputGyroRvHdlr(void *cookie, uint8_t *payload, uint16_t len, uint32_t timestamp)
 {
+    sh2_t *caller = enterInstance(cookie);
 
     sh2_SensorEvent_t event;
+    uint8_t report[SH2_MAX_SENSOR_EVENT_LEN];
     uint16_t cursor = 0;
 
     uint8_t reportId = SH2_GYRO_INTEGRATED_RV;
     uint8_t reportLen = getReportLen(reportId);
 
-    while (cursor < len) {
-        event.timestamp_uS = timestamp;
-        event.reportId = reportId;
-        memcpy(event.report, payload+cursor, reportLen);
-        /// event.pReport = payload+cursor;
-        event.len = reportLen;
+    if ((reportLen == 0) || (reportLen >= sizeof(report))) {
+        sh2->unknownReportIds++;
+        sh2 = caller;
+        return;
+    }
 
-        if (sh2.sensorCallback != 0) {
-            sh2.sensorCallback(sh2.sensorCallbackCookie, &event);
-        }
+    startSensorBatch(timestamp, 0);
+
+    uint64_t timestamp_uS = extendTimestamp(timestamp);
+
+    while (cursor + reportLen <= len) {
+        // These reports arrive without a header: prefix the report id so
+        // the event looks like any other sensor's.
+        report[0] = reportId;
+        memcpy(report+1, payload+cursor, reportLen);
+
+        event.timestamp_uS = timestamp_uS;
+        event.reportId = reportId;
+        event.len = reportLen+1;
+        deliverSensorEvent(&event, reportId, report);
 
         cursor += reportLen;
     }
+
+    flushSensorBatch();
+
+    sh2 = caller;
+}
+
+static void pushSensorEvent(const sh2_SensorEvent_t *pEvent, const uint8_t *pReport)
+{
+    uint32_t head = ATOMIC_LOAD(&sh2->eventRingHead, relaxed);
+    uint32_t tail = ATOMIC_LOAD(&sh2->eventRingTail, acquire);
+    uint32_t count = head - tail;
+
+    if (count > sh2->eventRingMask) {
+        // Ring full, drop the new event
+        ATOMIC_ADD(&sh2->eventRingOverflows, 1);
+        return;
+    }
+
+    // Events in the ring always carry their own copy of the report
+    sh2_SensorEvent_t *pSlot = &sh2->eventRing[head & sh2->eventRingMask];
+    pSlot->timestamp_uS = pEvent->timestamp_uS;
+    pSlot->len = pEvent->len;
+    memcpy(pSlot->report, pReport, pEvent->len);
+    pSlot->pReport = 0;
+
+    ATOMIC_STORE(&sh2->eventRingHead, head + 1, release);
+
+    count++;
+    if (count > ATOMIC_LOAD(&sh2->eventRingHighWater, relaxed)) {
+        ATOMIC_STORE(&sh2->eventRingHighWater, count, relaxed);
+    }
+}
+
+static void startSensorBatch(uint32_t timestamp, uint32_t referenceDelta)
+{
+    sh2->batchLen = 0;
+    sh2->batchTimestamp = timestamp;
+    sh2->batchReferenceDelta = referenceDelta;
+}
+
+static void flushSensorBatch(void)
+{
+    if ((sh2->batchLen > 0) && (sh2->batchCallback != 0)) {
+        sh2->batchCallback(sh2->batchCallbackCookie, sh2->batch, sh2->batchLen,
+                          sh2->batchTimestamp, sh2->batchReferenceDelta);
+    }
+    sh2->batchLen = 0;
 }
 
-static uint8_t getReportLen(uint8_t reportId)
+// Route a sensor event whose report, pReport, is in the received payload.
+// Events kept past this call (ring and batch) always hold a copy.
+// (pEvent->reportId shares storage with report[], so it is not used here.)
+static void deliverSensorEvent(sh2_SensorEvent_t *pEvent, uint8_t sensorId, const uint8_t *pReport)
 {
-    for (int n = 0; n < SH2_MAX_REPORT_IDS; n++) {
-        if (sh2.report[n].id == reportId) {
-            return sh2.report[n].len;
+    if ((sensorId <= SH2_MAX_SENSOR_ID) &&
+        (sh2->sensorCallbackFor[sensorId].callback != 0)) {
+        callSensorCallback(sh2->sensorCallbackFor[sensorId].callback,
+                           sh2->sensorCallbackFor[sensorId].cookie, pEvent, pReport);
+    }
+    else if (sh2->eventRing != 0) {
+        pushSensorEvent(pEvent, pReport);
+    }
+    else if (sh2->batchCallback != 0) {
+        sh2_SensorEvent_t *pSlot = &sh2->batch[sh2->batchLen++];
+        pSlot->timestamp_uS = pEvent->timestamp_uS;
+        pSlot->len = pEvent->len;
+        memcpy(pSlot->report, pReport, pEvent->len);
+        pSlot->pReport = 0;
+        if (sh2->batchLen == sh2->batchCapacity) {
+            flushSensorBatch();
         }
     }
+    else if (sh2->sensorCallback != 0) {
+        callSensorCallback(sh2->sensorCallback, sh2->sensorCallbackCookie, pEvent, pReport);
+    }
+}
 
-    return 0;
+static inline uint8_t getReportLen(uint8_t reportId)
+{
+    return sh2->reportLen[reportId];
 }
 
 // SH-2 transaction phases
-static int opStart(const sh2_Op_t *pOp)
+
+// Reserve a request slot for a new operation.
+// Returns 0 if the queue is full.
+static sh2_OpReq_t *opAlloc(sh2_OpCallback_t *callback)
+{
+    if (callback == opUnblock) {
+        // Only one thread can be blocked in the HAL at a time.
+        if (sh2->opBlocking) return 0;
+    }
+
+    for (int n = 0; n < SH2_OP_QUEUE_LEN; n++) {
+        if (sh2->opReq[n].state == OP_FREE) {
+            sh2->opReq[n].state = OP_RESERVED;
+            if (callback == opUnblock) {
+                sh2->opBlocking = true;
+            }
+            return &sh2->opReq[n];
+        }
+    }
+
+    return 0;
+}
+
+// Queue an operation whose parameters have been set up in pReq.
+static int opSubmit(sh2_OpReq_t *pReq, const sh2_Op_t *pOp,
+                    sh2_OpCallback_t *callback, void *cookie)
+{
+    pReq->pOp = pOp;
+    pReq->callback = callback;
+    pReq->cookie = cookie;
+    pReq->ticket = sh2->nextOpTicket++;
+    pReq->state = OP_QUEUED;
+
+    // Start it now, if possible
+    opStartPending();
+
+    return SH2_OK;
+}
+
+// Can this queued operation go on the wire alongside those already active?
+static bool opCanStart(const sh2_OpReq_t *pReq)
+{
+    for (int n = 0; n < SH2_OP_QUEUE_LEN; n++) {
+        if (sh2->opReq[n].state == OP_ACTIVE) {
+            if (!pReq->pOp->pipelined || !sh2->opReq[n].pOp->pipelined) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Start queued operations, in order of submission, for as long as they can
+// be in progress together.
+static void opStartPending(void)
 {
-    // return error if another operation already in progress
-    if (sh2.pOp) return SH2_ERR_OP_IN_PROGRESS;
+    // Completions during a start method will land back here; the loop below picks up after them.
+    if (sh2->opStarting) return;
+    sh2->opStarting = true;
+
+    while (true) {
+        // Find the oldest queued operation
+        sh2_OpReq_t *pReq = 0;
+        for (int n = 0; n < SH2_OP_QUEUE_LEN; n++) {
+            if ((sh2->opReq[n].state == OP_QUEUED) &&
+                ((pReq == 0) || ((int32_t)(sh2->opReq[n].ticket - pReq->ticket) < 0))) {
+                pReq = &sh2->opReq[n];
+            }
+        }
+        if ((pReq == 0) || !opCanStart(pReq)) {
+            break;
+        }
+
+        pReq->state = OP_ACTIVE;
+        pReq->deadlineSet = false;
+        int rc = pReq->pOp->start(pReq);  // Call start method
+        if (rc != SH2_OK) {
+            // Operation failed to start
+            opCompleted(pReq, rc);
+        }
+    }
+
+    sh2->opStarting = false;
+}
 
-    // Establish this operation as the new operation in progress
-    sh2.pOp = pOp;
-    int rc = pOp->start();  // Call start method
+// Block the calling thread until the operation started by a blocking API call completes.
+static int opWait(int rc)
+{
     if (rc != SH2_OK) {
-        // Operation failed to start
-        
-        // Unregister this operation
-        sh2.pOp = 0;
+        // Operation wasn't queued, there is nothing to wait for.
         return rc;
     }
 
-    // Block the calling thread until the operation completes.
-    sh2_hal_block();
-
-    // Clear operation in progress
-    sh2.pOp = 0;
+    if (sh2->pHal->block(sh2->pHal) != SH2_OK) {
+        // HAL gave up waiting.  Fail the operation without unblocking the
+        // HAL again.
+        for (int n = 0; n < SH2_OP_QUEUE_LEN; n++) {
+            sh2_OpReq_t *pReq = &sh2->opReq[n];
+            if (((pReq->state == OP_QUEUED) || (pReq->state == OP_ACTIVE)) &&
+                (pReq->callback == opUnblock)) {
+                pReq->callback = 0;
+                opCancel(pReq, SH2_ERR_TIMEOUT);
+                sh2->opStatus = SH2_ERR_TIMEOUT;
+                sh2->opBlocking = false;
+            }
+        }
+    }
 
     // Get return status from opStatus
-    rc = sh2.opStatus;
-    
-    return rc;
+    return sh2->opStatus;
+}
+
+// Completion callback for operations started by blocking API calls.
+static void opUnblock(void *cookie, int status)
+{
+    // Record status
+    sh2->opStatus = status;
+    sh2->opBlocking = false;
+
+    // Release the thread waiting in opWait
+    sh2->pHal->unblock(sh2->pHal);
 }
 
-static void opTxDone(void)
+static void opTxDone(sh2_OpReq_t *pReq)
 {
-    if ((sh2.pOp != 0) && (sh2.pOp->txDone != 0)) {
-        sh2.pOp->txDone();  // Call txDone method
+    if (pReq->pOp->txDone != 0) {
+        pReq->pOp->txDone(pReq);  // Call txDone method
     }
 }
 
+// Offer a received report to each operation in progress.
 static void opRx(const uint8_t *payload, uint16_t len)
 { 
-	if ((sh2.pOp != 0) &&                      // An operation is in progress
-        (sh2.pOp->rx != 0)) {                  // and it has an rx method
-		sh2.pOp->rx(payload, len);  // Call receive method
-	}
+    uint32_t tickets[SH2_OP_QUEUE_LEN];
+    bool active[SH2_OP_QUEUE_LEN];
+
+    // Only operations already in progress when the report arrived see it,
+    // not ones started by completions during this loop.
+    for (int n = 0; n < SH2_OP_QUEUE_LEN; n++) {
+        active[n] = (sh2->opReq[n].state == OP_ACTIVE);
+        tickets[n] = sh2->opReq[n].ticket;
+    }
+
+    for (int n = 0; n < SH2_OP_QUEUE_LEN; n++) {
+        sh2_OpReq_t *pReq = &sh2->opReq[n];
+        if (active[n] &&
+            (pReq->state == OP_ACTIVE) &&          // Still in progress
+            (pReq->ticket == tickets[n]) &&
+            (pReq->pOp->rx != 0)) {                // and it has an rx method
+            pReq->pOp->rx(pReq, payload, len);     // Call receive method
+        }
+    }
 }
 
-static int opCompleted(int status)
+// Fail a queued or active operation.  Responses that arrive for it later
+// are ignored, its slot and ticket having moved on.
+static void opCancel(sh2_OpReq_t *pReq, int status)
 {
-    // Record status
-    sh2.opStatus = status;
+    if ((pReq->state == OP_QUEUED) || (pReq->state == OP_ACTIVE)) {
+        pReq->state = OP_ACTIVE;
+        opCompleted(pReq, status);
+    }
+}
+
+static int opCompleted(sh2_OpReq_t *pReq, int status)
+{
+    if (pReq->state != OP_ACTIVE) {
+        // Already completed
+        return SH2_OK;
+    }
+
+    sh2_OpCallback_t *callback = pReq->callback;
+    void *cookie = pReq->cookie;
+
+    // Release the request slot so the callback can start another operation.
+    pReq->state = OP_FREE;
+
+    if (callback != 0) {
+        callback(cookie, status);
+    }
 
-    // Block the calling thread until the operation completes.
-    sh2_hal_unblock();
+    // Start whatever was waiting on this operation
+    opStartPending();
 
     return SH2_OK;
 }
 
+// Extend a 32-bit HAL timestamp to 64 bits relative to the latest one.
+// A timestamp trailing the latest by up to TIMESTAMP_LATE_MAX is late, as
+// when input channels are delivered from different threads; any other is
+// progress, past a rollover if need be, and becomes the latest.  So gaps
+// between timestamps must stay under 2^32 - TIMESTAMP_LATE_MAX us (about
+// 53.7 minutes).  The latest is updated with a single compare and swap.
+static uint64_t extendTimestamp(uint32_t hostInt)
+{
+    unsigned long long latest = ATOMIC64_LOAD(&sh2->latestTimestamp);
+
+    while (true) {
+        if (latest == TIMESTAMP_UNSET) {
+            // First timestamp, count rollovers from here
+            if (ATOMIC64_CAS(&sh2->latestTimestamp, &latest, hostInt)) {
+                return hostInt;
+            }
+            continue;
+        }
+
+        uint32_t behind = (uint32_t)latest - hostInt;
+        if ((behind != 0) && (behind <= TIMESTAMP_LATE_MAX)) {
+            // Late.  (One from before the first timestamp can't go below 0.)
+            return (behind <= latest) ? (latest - behind) : hostInt;
+        }
+
+        uint64_t next = latest + (uint32_t)(hostInt - (uint32_t)latest);
+        if ((next == latest) ||
+            ATOMIC64_CAS(&sh2->latestTimestamp, &latest, next)) {
+            return next;
+        }
+    }
+}
+
 // Produce 64-bit microsecond timestamp for a sensor event
 static uint64_t touSTimestamp(uint32_t hostInt, int32_t referenceDelta, uint16_t delay)
 {
-    static uint32_t lastHostInt = 0;
-    static uint32_t rollovers = 0;
     uint64_t timestamp;
 
-    // Count times hostInt timestamps rolled over to produce upper bits
-    if (hostInt < lastHostInt) {
-        rollovers++;
-    }
-    lastHostInt = hostInt;
-    
-    timestamp = ((uint64_t)rollovers << 32);
-    timestamp += hostInt + (referenceDelta + delay) * 100;
+    timestamp = extendTimestamp(hostInt);
+    timestamp += (referenceDelta + delay) * 100;
 
     return timestamp;
 }
 
 // --- Operation: Send Command (no response expected.) ----------------------
 
-static int sendCmdStart(void)
+static int sendCmdStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
 
     // Send request
-    rc = shtp_send(sh2.controlChan,
-                   (uint8_t *)&sh2.opData.sendCmd.req,
-                   sizeof(sh2.opData.sendCmd.req));
-    opTxDone();
+    rc = shtp_send(sh2->pShtp, sh2->controlChan,
+                   (uint8_t *)&pReq->opData.sendCmd.req,
+                   sizeof(pReq->opData.sendCmd.req));
+    if (rc == SH2_OK) {
+        opTxDone(pReq);
+    }
 
     return rc;
 }
 
-static void sendCmdTxDone(void)
+static void sendCmdTxDone(sh2_OpReq_t *pReq)
 {
-    opCompleted(SH2_OK);
+    opCompleted(pReq, SH2_OK);
 }
     
 // --- Operation: Get Product Id ----------------------
 
 // Get Product ID Op handler
-static int getProdIdStart(void)
+static int getProdIdStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
     ProdIdReq_t req;
@@ -1220,13 +2481,13 @@ static int getProdIdStart(void)
     // Set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_PROD_ID_REQ;
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    opTxDone(pReq);
 
     return rc;
 }
 
-static void getProdIdRx(const uint8_t *payload, uint16_t len)
+static void getProdIdRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
 	ProdIdResp_t *resp = (ProdIdResp_t *)payload;
 	
@@ -1234,12 +2495,12 @@ static void getProdIdRx(const uint8_t *payload, uint16_t len)
 	if (resp->reportId != SENSORHUB_PROD_ID_RESP) return;
 
 	// Store this product id, if we can
-	sh2_ProductIds_t *pProdIds = sh2.opData.getProdIds.pProdIds;
+	sh2_ProductIds_t *pProdIds = pReq->opData.getProdIds.pProdIds;
 	
 	if (pProdIds) {
 		// Store the product id response
-		if (sh2.opData.getProdIds.nextEntry < sh2.opData.getProdIds.expectedEntries) {
-			sh2_ProductId_t *pProdId = &pProdIds->entry[sh2.opData.getProdIds.nextEntry];
+		if (pReq->opData.getProdIds.nextEntry < pReq->opData.getProdIds.expectedEntries) {
+			sh2_ProductId_t *pProdId = &pProdIds->entry[pReq->opData.getProdIds.nextEntry];
 			
 			pProdId->resetCause = resp->resetCause;
 			pProdId->swVersionMajor = resp->swVerMajor;
@@ -1252,19 +2513,19 @@ static void getProdIdRx(const uint8_t *payload, uint16_t len)
 
             if (pProdId->swPartNumber == 10004095) {
                 // FSP200 has 5 product id entries
-                sh2.opData.getProdIds.expectedEntries = 5;
+                pReq->opData.getProdIds.expectedEntries = 5;
             }
 
 
-			sh2.opData.getProdIds.nextEntry++;
+			pReq->opData.getProdIds.nextEntry++;
 		}
 	}
 
 	// Complete this operation if there is no storage for more product ids
-	if ((sh2.opData.getProdIds.pProdIds == 0) ||
-	    (sh2.opData.getProdIds.nextEntry >= sh2.opData.getProdIds.expectedEntries)) {
-        sh2.opData.getProdIds.pProdIds->numEntries = sh2.opData.getProdIds.nextEntry;
-		opCompleted(SH2_OK);
+	if ((pReq->opData.getProdIds.pProdIds == 0) ||
+	    (pReq->opData.getProdIds.nextEntry >= pReq->opData.getProdIds.expectedEntries)) {
+        pReq->opData.getProdIds.pProdIds->numEntries = pReq->opData.getProdIds.nextEntry;
+		opCompleted(pReq, SH2_OK);
 	}
 
 	return;
@@ -1272,7 +2533,7 @@ static void getProdIdRx(const uint8_t *payload, uint16_t len)
 
 // --- Operation: Get Sensor Config ----------------------
 
-static int getSensorConfigStart(void)
+static int getSensorConfigStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
     GetFeatureReq_t req;
@@ -1280,24 +2541,24 @@ static int getSensorConfigStart(void)
     // set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_GET_FEATURE_REQ;
-    req.featureReportId = sh2.opData.getSensorConfig.sensorId;
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    req.featureReportId = pReq->opData.getSensorConfig.sensorId;
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    opTxDone(pReq);
 
     return rc;
 }
 
-static void getSensorConfigRx(const uint8_t *payload, uint16_t len)
+static void getSensorConfigRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
     GetFeatureResp_t *resp = (GetFeatureResp_t *)payload;
     sh2_SensorConfig_t *pConfig;
     
     // skip this if it isn't the response we're waiting for.
     if (resp->reportId != SENSORHUB_GET_FEATURE_RESP) return;
-    if (resp->featureReportId != sh2.opData.getSensorConfig.sensorId) return;
+    if (resp->featureReportId != pReq->opData.getSensorConfig.sensorId) return;
 
     // Copy out data
-    pConfig = sh2.opData.getSensorConfig.pConfig;
+    pConfig = pReq->opData.getSensorConfig.pConfig;
     
     pConfig->changeSensitivityEnabled = ((resp->flags & FEAT_CHANGE_SENSITIVITY_ENABLED) != 0);
     pConfig->changeSensitivityRelative = ((resp->flags & FEAT_CHANGE_SENSITIVITY_RELATIVE) != 0);
@@ -1307,63 +2568,147 @@ static void getSensorConfigRx(const uint8_t *payload, uint16_t len)
     pConfig->reportInterval_us = resp->reportInterval_uS;
     pConfig->batchInterval_us = resp->batchInterval_uS;
     pConfig->sensorSpecific = resp->sensorSpecific;
+    cacheStoreConfig(resp->featureReportId, pConfig);
 
     // Complete this operation
-    opCompleted(SH2_OK);
+    opCompleted(pReq, SH2_OK);
 
     return;
 }
 
-static int setSensorConfigStart(void)
+// Build a set feature command for one sensor
+static void setupSetFeature(SetFeatureReport_t *req,
+                            sh2_SensorId_t sensorId, const sh2_SensorConfig_t *pConfig)
 {
-    SetFeatureReport_t req;
     uint8_t flags = 0;
-    int rc;
-    sh2_SensorConfig_t *pConfig = sh2.opData.getSensorConfig.pConfig;
     
     if (pConfig->changeSensitivityEnabled)  flags |= FEAT_CHANGE_SENSITIVITY_ENABLED;
     if (pConfig->changeSensitivityRelative) flags |= FEAT_CHANGE_SENSITIVITY_RELATIVE;
     if (pConfig->wakeupEnabled)             flags |= FEAT_WAKE_ENABLED;
     if (pConfig->alwaysOnEnabled)           flags |= FEAT_ALWAYS_ON_ENABLED;
 
-    memset(&req, 0, sizeof(req));
-    req.reportId = SENSORHUB_SET_FEATURE_CMD;
-    req.featureReportId = sh2.opData.setSensorConfig.sensorId;
-    req.flags = flags;
-    req.changeSensitivity = pConfig->changeSensitivity;
-    req.reportInterval_uS = pConfig->reportInterval_us;
-    req.batchInterval_uS = pConfig->batchInterval_us;
-    req.sensorSpecific = pConfig->sensorSpecific;
+    memset(req, 0, sizeof(*req));
+    req->reportId = SENSORHUB_SET_FEATURE_CMD;
+    req->featureReportId = sensorId;
+    req->flags = flags;
+    req->changeSensitivity = pConfig->changeSensitivity;
+    req->reportInterval_uS = pConfig->reportInterval_us;
+    req->batchInterval_uS = pConfig->batchInterval_us;
+    req->sensorSpecific = pConfig->sensorSpecific;
+}
+
+static int setSensorConfigStart(sh2_OpReq_t *pReq)
+{
+    SetFeatureReport_t req;
+    int rc;
+
+    // Drop anything cached by reads that completed while this was queued
+    cacheDropConfig(pReq->opData.setSensorConfig.sensorId);
+
+    setupSetFeature(&req,
+                    pReq->opData.setSensorConfig.sensorId,
+                    pReq->opData.setSensorConfig.pConfig);
 
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    if (rc == SH2_OK) {
+        opTxDone(pReq);
+    }
 
     return rc;
 }
 
-static void setSensorConfigTxDone(void)
+static void setSensorConfigTxDone(sh2_OpReq_t *pReq)
 {
     // complete immediately
-    opCompleted(SH2_OK);
+    opCompleted(pReq, SH2_OK);
+}
+
+// --- set sensor configs operation ------------------------------------
+
+static int setSensorConfigsStart(sh2_OpReq_t *pReq)
+{
+    sh2_SensorConfigEntry_t *pEntries = pReq->opData.setSensorConfigs.pEntries;
+    uint16_t numEntries = pReq->opData.setSensorConfigs.numEntries;
+    uint16_t maxLen = shtp_maxPayloadOut(sh2->pShtp);
+    uint16_t len = 0;
+    uint16_t first = 0;
+    int status = SH2_OK;
+    int rc;
+
+    if (maxLen > sizeof(sh2->cargo)) {
+        maxLen = sizeof(sh2->cargo);
+    }
+
+    // Pack as many set feature commands into each cargo as will fit
+    for (uint16_t n = 0; n < numEntries; n++) {
+        // Drop anything cached by reads that completed while this was queued
+        cacheDropConfig(pEntries[n].sensorId);
+
+        setupSetFeature((SetFeatureReport_t *)(sh2->cargo + len),
+                        pEntries[n].sensorId, &pEntries[n].config);
+        len += sizeof(SetFeatureReport_t);
+
+        if ((n+1 == numEntries) ||
+            (len + sizeof(SetFeatureReport_t) > maxLen)) {
+            // Cargo is full (or these are the last entries), send it.
+            rc = shtp_send(sh2->pShtp, sh2->controlChan, sh2->cargo, len);
+            if ((rc != SH2_OK) && (status == SH2_OK)) {
+                status = rc;
+            }
+
+            // Each entry gets the status of the cargo that carried it
+            for (; first <= n; first++) {
+                pEntries[first].status = rc;
+            }
+            len = 0;
+        }
+    }
+
+    // There is no response to set feature, so complete immediately.
+    opCompleted(pReq, status);
+
+    return SH2_OK;
 }
 
 // --- get frs operation ------------------------------------
 
-static int getFrsStart(void)
+// Request the words from nextOffset to the end of the block (or record)
+static int getFrsRequest(sh2_OpReq_t *pReq)
 {
-    int rc = SH2_OK;
     FrsReadReq_t req;
+    uint16_t blockSize = 0;  // read all avail data
+
+    if (pReq->opData.getFrs.blockSize != 0) {
+        blockSize = pReq->opData.getFrs.readOffset + pReq->opData.getFrs.blockSize -
+                    pReq->opData.getFrs.nextOffset;
+    }
 
-	// set up request to issue
 	memset(&req, 0, sizeof(req));
 	req.reportId = SENSORHUB_FRS_READ_REQ;
 	req.reserved = 0;
-	req.readOffset = 0; // read from start
-	req.frsType = sh2.opData.getFrs.frsType;
-	req.blockSize = 0;  // read all avail data
+	req.readOffset = pReq->opData.getFrs.nextOffset;
+	req.frsType = pReq->opData.getFrs.frsType;
+	req.blockSize = blockSize;
+
+    return shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+}
+
+static int getFrsStart(sh2_OpReq_t *pReq)
+{
+    int rc = SH2_OK;
+
+    // Metadata reads share frsData; a read that completed while this one
+    // was queued may have left frsDataLen at its own length.
+    if (pReq->opData.getFrs.pMetadata != 0) {
+        sh2->frsDataLen = ARRAY_LEN(sh2->frsData);
+    }
+
+    pReq->opData.getFrs.nextOffset = pReq->opData.getFrs.readOffset;
+    pReq->opData.getFrs.retries = SH2_FRS_READ_RETRIES;
+    pReq->opData.getFrs.resuming = false;
 
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    rc = getFrsRequest(pReq);
+    opTxDone(pReq);
 
     return rc;
 }
@@ -1434,13 +2779,18 @@ static void stuffMetadata(sh2_SensorMetadata_t *pData, uint32_t *frsData)
            pData->vendorIdLen);
 }
 
-static void getFrsRx(const uint8_t *payload, uint16_t len)
+static void getFrsRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
 	FrsReadResp_t *resp = (FrsReadResp_t *)payload;
 	uint8_t status;
 
 	// skip this if it isn't the response we're looking for
 	if (resp->reportId != SENSORHUB_FRS_READ_RESP) return;
+	if ((resp->frsType != pReq->opData.getFrs.frsType) &&
+	    (FRS_READ_STATUS(resp->len_status) != FRS_READ_STATUS_UNRECOGNIZED_FRS_TYPE)) {
+		// Left over from a cancelled read of another record
+		return;
+	}
 
 	// Check for errors: Unrecognized FRS type, Busy, Out of range, Device error
 	status = FRS_READ_STATUS(resp->len_status);
@@ -1450,86 +2800,375 @@ static void getFrsRx(const uint8_t *payload, uint16_t len)
 	    (status == FRS_READ_STATUS_DEVICE_ERROR)
 		) {
 		// Operation failed
-		opCompleted(SH2_ERR_HUB);
+		opCompleted(pReq, SH2_ERR_HUB);
 		return;
 	}
 
 	if (status == FRS_READ_STATUS_RECORD_EMPTY) {
 		// Empty record, return zero length.
-		*(sh2.opData.getFrs.pWords) = 0;
-		opCompleted(SH2_OK);
+		*(pReq->opData.getFrs.pWords) = 0;
+		opCompleted(pReq, SH2_OK);
+		return;
 	}
 
 	// Store the contents from this response
 	uint16_t offset = resp->wordOffset;
-
-    // check for missed offsets, resulting in error.
-    if (offset != sh2.opData.getFrs.nextOffset) {
-        // Some data was dropped.
-        *(sh2.opData.getFrs.pWords) = 0;
-        opCompleted(SH2_ERR_IO);
+    bool readDone = ((status == FRS_READ_STATUS_READ_RECORD_COMPLETED) ||
+                     (status == FRS_READ_STATUS_READ_BLOCK_COMPLETED) ||
+                     (status == FRS_READ_STATUS_READ_BLOCK_AND_RECORD_COMPLETED));
+
+    // Some data was dropped: resume from the last good offset.
+    if (offset != pReq->opData.getFrs.nextOffset) {
+        if (pReq->opData.getFrs.resuming) {
+            // Remainder of the interrupted read, discard it.
+            if (readDone) {
+                pReq->opData.getFrs.resuming = false;
+            }
+            return;
+        }
+        if (pReq->opData.getFrs.retries == 0) {
+            *(pReq->opData.getFrs.pWords) = 0;
+            opCompleted(pReq, SH2_ERR_IO);
+            return;
+        }
+        pReq->opData.getFrs.retries--;
+        pReq->opData.getFrs.resuming = !readDone;
+        int rc = getFrsRequest(pReq);
+        if (rc != SH2_OK) {
+            *(pReq->opData.getFrs.pWords) = 0;
+            opCompleted(pReq, rc);
+        }
+        return;
+    }
+    pReq->opData.getFrs.resuming = false;
+
+    // Make sure there is room for this data.  (A size of 0 means no limit.)
+    uint16_t index = offset - pReq->opData.getFrs.readOffset;
+    uint8_t words = FRS_READ_DATALEN(resp->len_status);
+    if ((*(pReq->opData.getFrs.pWords) != 0) &&
+        (index + words > *(pReq->opData.getFrs.pWords))) {
+        *(pReq->opData.getFrs.pWords) = 0;
+        opCompleted(pReq, SH2_ERR_IO);
+        return;
     }
-	
-	// store first word, if we have room
-	if ((*(sh2.opData.getFrs.pWords) == 0) ||
-        (offset <= *(sh2.opData.getFrs.pWords))) {
-		sh2.opData.getFrs.pData[offset] = resp->data0;
-		sh2.opData.getFrs.nextOffset = offset+1;
-	}
 
-    // store second word if there is one and we have room
-    if ((FRS_READ_DATALEN(resp->len_status) == 2)  &&
-        ((*(sh2.opData.getFrs.pWords) == 0) ||
-         (offset <= *(sh2.opData.getFrs.pWords)))) {
-		sh2.opData.getFrs.pData[offset+1] = resp->data1;
-		sh2.opData.getFrs.nextOffset = offset+2;
+	if (words >= 1) {
+		pReq->opData.getFrs.pData[index] = resp->data0;
+	}
+    if (words >= 2) {
+		pReq->opData.getFrs.pData[index+1] = resp->data1;
 	}
+    pReq->opData.getFrs.nextOffset = offset + words;
 
 	// If read is done, complete the operation
-	if ((status == FRS_READ_STATUS_READ_RECORD_COMPLETED) ||
-	    (status == FRS_READ_STATUS_READ_BLOCK_COMPLETED) ||
-	    (status == FRS_READ_STATUS_READ_BLOCK_AND_RECORD_COMPLETED)) {
-		*(sh2.opData.getFrs.pWords) = sh2.opData.getFrs.nextOffset;
+	if (readDone) {
+		*(pReq->opData.getFrs.pWords) = pReq->opData.getFrs.nextOffset - pReq->opData.getFrs.readOffset;
 
         // If this was performed from getMetadata, copy the results into pMetadata.
-        if (sh2.opData.getFrs.pMetadata != 0) {
-            stuffMetadata(sh2.opData.getFrs.pMetadata, sh2.opData.getFrs.pData);
+        if (pReq->opData.getFrs.pMetadata != 0) {
+            stuffMetadata(pReq->opData.getFrs.pMetadata, pReq->opData.getFrs.pData);
+            cacheStoreMetadata(pReq->opData.getFrs.frsType, pReq->opData.getFrs.pMetadata);
         }
 
-        opCompleted(SH2_OK);
+        opCompleted(pReq, SH2_OK);
     }
 
     return;
 }
 
+// --- prefetch metadata operation --------------------------
+
+static void prefetchMetadataDone(sh2_OpReq_t *pReq, int status)
+{
+    sh2_MetadataPrefetchStats_t *pStats = pReq->opData.prefetchMetadata.pStats;
+
+    if (pStats != 0) {
+        pStats->records = pReq->opData.prefetchMetadata.records;
+        pStats->bytes = pReq->opData.prefetchMetadata.bytes;
+        pStats->elapsed_us = pReq->opData.prefetchMetadata.lastRespTime -
+                             pReq->opData.prefetchMetadata.startTime;
+    }
+
+    opCompleted(pReq, status);
+}
+
+// Request the current record from nextOffset to its end
+static int prefetchMetadataRequest(sh2_OpReq_t *pReq)
+{
+    FrsReadReq_t req;
+
+    memset(&req, 0, sizeof(req));
+    req.reportId = SENSORHUB_FRS_READ_REQ;
+    req.readOffset = pReq->opData.prefetchMetadata.nextOffset;
+    req.frsType = sensorToRecordMap[pReq->opData.prefetchMetadata.nextRecord].recordId;
+    req.blockSize = 0;
+
+    return shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+}
+
+static int prefetchMetadataReadNext(sh2_OpReq_t *pReq)
+{
+    pReq->opData.prefetchMetadata.nextOffset = 0;
+    pReq->opData.prefetchMetadata.retries = SH2_FRS_READ_RETRIES;
+    pReq->opData.prefetchMetadata.resuming = false;
+
+    return prefetchMetadataRequest(pReq);
+}
+
+// Re-request the current record from the last word received
+static void prefetchMetadataRetry(sh2_OpReq_t *pReq, int failStatus, bool resuming)
+{
+    if (pReq->opData.prefetchMetadata.retries == 0) {
+        prefetchMetadataDone(pReq, failStatus);
+        return;
+    }
+    pReq->opData.prefetchMetadata.retries--;
+    pReq->opData.prefetchMetadata.resuming = resuming;
+
+    int rc = prefetchMetadataRequest(pReq);
+    if (rc != SH2_OK) {
+        prefetchMetadataDone(pReq, rc);
+    }
+}
+
+static int prefetchMetadataStart(sh2_OpReq_t *pReq)
+{
+    pReq->opData.prefetchMetadata.nextRecord = 0;
+    pReq->opData.prefetchMetadata.records = 0;
+    pReq->opData.prefetchMetadata.bytes = 0;
+    pReq->opData.prefetchMetadata.started = false;
+    pReq->opData.prefetchMetadata.startTime = 0;
+    pReq->opData.prefetchMetadata.lastRespTime = 0;
+
+    // Time from the first request, if the HAL has a clock
+    if (sh2->pHal->getTimeUs != 0) {
+        pReq->opData.prefetchMetadata.startTime = sh2->pHal->getTimeUs(sh2->pHal);
+        pReq->opData.prefetchMetadata.lastRespTime = pReq->opData.prefetchMetadata.startTime;
+        pReq->opData.prefetchMetadata.started = true;
+    }
+
+    int rc = prefetchMetadataReadNext(pReq);
+    opTxDone(pReq);
+
+    return rc;
+}
+
+static void prefetchMetadataRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
+{
+    FrsReadResp_t *resp = (FrsReadResp_t *)payload;
+    uint16_t recordId = sensorToRecordMap[pReq->opData.prefetchMetadata.nextRecord].recordId;
+
+    if (resp->reportId != SENSORHUB_FRS_READ_RESP) return;
+
+    uint8_t status = FRS_READ_STATUS(resp->len_status);
+    if ((resp->frsType != recordId) &&
+        (status != FRS_READ_STATUS_UNRECOGNIZED_FRS_TYPE)) {
+        // Left over from an earlier record
+        return;
+    }
+
+    if (!pReq->opData.prefetchMetadata.started) {
+        pReq->opData.prefetchMetadata.startTime = sh2->controlTimestamp;
+        pReq->opData.prefetchMetadata.started = true;
+    }
+    pReq->opData.prefetchMetadata.lastRespTime = sh2->controlTimestamp;
+
+    bool recordDone = false;
+    if (status == FRS_READ_STATUS_BUSY) {
+        // Request refused, ask again from where we got to
+        prefetchMetadataRetry(pReq, SH2_ERR_HUB, false);
+        return;
+    }
+    else if ((status == FRS_READ_STATUS_OFFSET_OUT_OF_RANGE) ||
+             (status == FRS_READ_STATUS_DEVICE_ERROR)) {
+        prefetchMetadataDone(pReq, SH2_ERR_HUB);
+        return;
+    }
+    else if ((status == FRS_READ_STATUS_UNRECOGNIZED_FRS_TYPE) ||
+             (status == FRS_READ_STATUS_RECORD_EMPTY)) {
+        // This hub doesn't have the record, skip it.
+        recordDone = true;
+    }
+    else {
+        uint16_t offset = resp->wordOffset;
+        uint8_t words = FRS_READ_DATALEN(resp->len_status);
+        bool readDone = ((status == FRS_READ_STATUS_READ_RECORD_COMPLETED) ||
+                         (status == FRS_READ_STATUS_READ_BLOCK_COMPLETED) ||
+                         (status == FRS_READ_STATUS_READ_BLOCK_AND_RECORD_COMPLETED));
+
+        // Some data was dropped: resume from the last good offset.
+        if (offset != pReq->opData.prefetchMetadata.nextOffset) {
+            if (pReq->opData.prefetchMetadata.resuming) {
+                // Remainder of the interrupted read, discard it.
+                if (readDone) {
+                    pReq->opData.prefetchMetadata.resuming = false;
+                }
+                return;
+            }
+            prefetchMetadataRetry(pReq, SH2_ERR_IO, !readDone);
+            return;
+        }
+        pReq->opData.prefetchMetadata.resuming = false;
+
+        if (offset + words > ARRAY_LEN(sh2->frsData)) {
+            // Record doesn't fit
+            prefetchMetadataDone(pReq, SH2_ERR_IO);
+            return;
+        }
+
+        if (words >= 1) sh2->frsData[offset] = resp->data0;
+        if (words >= 2) sh2->frsData[offset+1] = resp->data1;
+        pReq->opData.prefetchMetadata.nextOffset = offset + words;
+        pReq->opData.prefetchMetadata.bytes += words * sizeof(uint32_t);
+
+        if (readDone) {
+            // Store this record in the next table entry
+            sh2_MetadataCacheEntry_t *pEntry =
+                &pReq->opData.prefetchMetadata.pTable[pReq->opData.prefetchMetadata.records];
+            stuffMetadata(&pEntry->metadata, sh2->frsData);
+            pEntry->recordId = recordId;
+            cacheStoreMetadata(recordId, &pEntry->metadata);
+            pReq->opData.prefetchMetadata.records++;
+            recordDone = true;
+        }
+    }
+
+    if (recordDone) {
+        pReq->opData.prefetchMetadata.nextRecord++;
+        if ((pReq->opData.prefetchMetadata.nextRecord >= ARRAY_LEN(sensorToRecordMap)) ||
+            (pReq->opData.prefetchMetadata.records >= pReq->opData.prefetchMetadata.numEntries)) {
+            prefetchMetadataDone(pReq, SH2_OK);
+            return;
+        }
+
+        // Request the next record straight away
+        int rc = prefetchMetadataReadNext(pReq);
+        if (rc != SH2_OK) {
+            prefetchMetadataDone(pReq, rc);
+        }
+    }
+}
+
 // --- set frs operation ------------------------------------
 
-static int setFrsStart(void)
+// Send the FRS write request that opens the record for writing
+static int setFrsRequest(sh2_OpReq_t *pReq)
 {
-    int rc = SH2_OK;
     FrsWriteReq_t req;
 
-    sh2.opData.setFrs.offset = 0;
-    
-    // set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_FRS_WRITE_REQ;
     req.reserved = 0;
-    req.length = sh2.opData.setFrs.words;
-    req.frsType = sh2.opData.getFrs.frsType;
+    req.length = pReq->opData.setFrs.words;
+    req.frsType = pReq->opData.setFrs.frsType;
+
+    return shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+}
+
+// Send write data requests until the window is full, packed into one cargo.
+// The request holding the last words completes the record, so it is only
+// sent once the hub has received all the others.
+static int setFrsSendData(sh2_OpReq_t *pReq)
+{
+    FrsWriteDataReq_t req[SH2_FRS_WRITE_WINDOW];
+    uint16_t maxReqs = shtp_maxPayloadOut(sh2->pShtp) / sizeof(FrsWriteDataReq_t);
+    uint16_t words = pReq->opData.setFrs.words;
+    uint16_t acked = pReq->opData.setFrs.acked;
+    uint16_t offset = pReq->opData.setFrs.offset;
+    uint16_t n = 0;
+    int rc = SH2_OK;
+
+    while (((offset - acked + 1) / 2 < pReq->opData.setFrs.window) &&
+           (offset < words) &&
+           ((offset + 2 < words) || (offset == acked)) &&
+           (n < maxReqs)) {
+        memset(&req[n], 0, sizeof(req[n]));
+        req[n].reportId = SENSORHUB_FRS_WRITE_DATA_REQ;
+        req[n].reserved = 0;
+        req[n].offset = offset;
+        req[n].data0 = pReq->opData.setFrs.pData[offset++];
+        if (offset < pReq->opData.setFrs.words) {
+            req[n].data1 = pReq->opData.setFrs.pData[offset++];
+        } else {
+            req[n].data1 = 0;
+        }
+        n++;
+    }
+    pReq->opData.setFrs.offset = offset;
+
+    if (n > 0) {
+        rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)req, n * sizeof(req[0]));
+        opTxDone(pReq);
+    }
+
+    return rc;
+}
+
+static int setFrsStart(sh2_OpReq_t *pReq)
+{
+    int rc = SH2_OK;
 
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    pReq->opData.setFrs.offset = 0;
+    pReq->opData.setFrs.acked = 0;
+    pReq->opData.setFrs.window = SH2_FRS_WRITE_WINDOW;
+    pReq->opData.setFrs.retries = SH2_FRS_WRITE_RETRIES;
+    pReq->opData.setFrs.ready = false;
+    pReq->opData.setFrs.busy = 0;
+
+    // Drop anything cached by reads that completed while this was queued
+    cacheDropMetadata(pReq->opData.setFrs.frsType);
+    
+    rc = setFrsRequest(pReq);
+    opTxDone(pReq);
 
     return rc;
 }
 
-static void setFrsRx(const uint8_t *payload, uint16_t len)
+// Hub was busy: retry the write request, or resend data from the rejected
+// offset with the window cut to one request.  (It grows back as requests
+// are received.)
+static int setFrsBusy(sh2_OpReq_t *pReq, uint16_t wordOffset)
+{
+    if (!pReq->opData.setFrs.ready) {
+        if (pReq->opData.setFrs.retries == 0) return SH2_ERR_HUB;
+        pReq->opData.setFrs.retries--;
+        pReq->opData.setFrs.busy++;
+        return setFrsRequest(pReq);
+    }
+
+    // Only the oldest unanswered request rewinds.  Answers to requests
+    // sent before the rewind are ignored; they will be sent again.
+    if (wordOffset != pReq->opData.setFrs.acked) {
+        return SH2_OK;
+    }
+
+    if (pReq->opData.setFrs.retries == 0) return SH2_ERR_HUB;
+    pReq->opData.setFrs.retries--;
+    pReq->opData.setFrs.busy++;
+    pReq->opData.setFrs.offset = wordOffset;
+    pReq->opData.setFrs.window = 1;
+
+    return setFrsSendData(pReq);
+}
+
+static void setFrsCompleted(sh2_OpReq_t *pReq)
+{
+    uint32_t elapsed = sh2->controlTimestamp - pReq->opData.setFrs.readyTime;
+
+    sh2->frsWriteStats.words = pReq->opData.setFrs.words;
+    sh2->frsWriteStats.busy = pReq->opData.setFrs.busy;
+    sh2->frsWriteStats.elapsed_us = elapsed;
+    sh2->frsWriteStats.wordsPerSecond = 0;
+    if (elapsed != 0) {
+        sh2->frsWriteStats.wordsPerSecond =
+            (uint32_t)(((uint64_t)pReq->opData.setFrs.words * 1000000) / elapsed);
+    }
+}
+
+static void setFrsRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
     FrsWriteResp_t *resp = (FrsWriteResp_t *)payload;
-    FrsWriteDataReq_t req;
     uint8_t status;
-    bool sendMoreData = false;
     bool completed = false;
     int rc = SH2_OK;
 
@@ -1539,12 +3178,27 @@ static void setFrsRx(const uint8_t *payload, uint16_t len)
     // Check for errors: Unrecognized FRS type, Busy, Out of range, Device error
     status = resp->status;
     switch(status) {
-        case FRS_WRITE_STATUS_RECEIVED:
         case FRS_WRITE_STATUS_READY:
-            sendMoreData = true;
+            pReq->opData.setFrs.ready = true;
+            pReq->opData.setFrs.readyTime = sh2->controlTimestamp;
+            rc = setFrsSendData(pReq);
+            break;
+        case FRS_WRITE_STATUS_RECEIVED:
+            // Requests are answered in order: anything but the oldest one
+            // outstanding was sent before a rewind.
+            if (resp->wordOffset != pReq->opData.setFrs.acked) {
+                break;
+            }
+            pReq->opData.setFrs.acked += 2;
+            if (pReq->opData.setFrs.window < SH2_FRS_WRITE_WINDOW) {
+                pReq->opData.setFrs.window++;
+            }
+            rc = setFrsSendData(pReq);
             break;
-        case FRS_WRITE_STATUS_UNRECOGNIZED_FRS_TYPE:
         case FRS_WRITE_STATUS_BUSY:
+            rc = setFrsBusy(pReq, resp->wordOffset);
+            break;
+        case FRS_WRITE_STATUS_UNRECOGNIZED_FRS_TYPE:
         case FRS_WRITE_STATUS_FAILED:
         case FRS_WRITE_STATUS_NOT_READY:
         case FRS_WRITE_STATUS_INVALID_LENGTH:
@@ -1555,8 +3209,15 @@ static void setFrsRx(const uint8_t *payload, uint16_t len)
             completed = true;
             break;
         case FRS_WRITE_STATUS_WRITE_COMPLETED:
-            // Successful completion
-            rc = SH2_OK;
+            // Successful completion, unless some data was never received
+            if ((pReq->opData.setFrs.words != 0) &&
+                (pReq->opData.setFrs.acked + 2 < pReq->opData.setFrs.words)) {
+                rc = SH2_ERR_HUB;
+            }
+            else {
+                setFrsCompleted(pReq);
+                rc = SH2_OK;
+            }
             completed = true;
             break;
         case FRS_WRITE_STATUS_RECORD_VALID:
@@ -1564,31 +3225,9 @@ static void setFrsRx(const uint8_t *payload, uint16_t len)
             break;
     }
 
-    // if we should send more data, do it.
-    if (sendMoreData &&
-        (sh2.opData.setFrs.offset < sh2.opData.setFrs.words)) {
-        uint16_t offset = sh2.opData.setFrs.offset;
-        
-        memset(&req, 0, sizeof(req));
-        req.reportId = SENSORHUB_FRS_WRITE_DATA_REQ;
-        req.reserved = 0;
-        req.offset = offset;
-        req.data0 = sh2.opData.setFrs.pData[offset++];
-        if (offset < sh2.opData.setFrs.words) {
-            req.data1 = sh2.opData.setFrs.pData[offset++];
-        } else {
-            req.data1 = 0;
-        }
-        sh2.opData.setFrs.offset = offset;
-        
-        rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-        opTxDone();
-
-    }
-
     // if the operation is done or has to be aborted, complete it
-    if (completed) {
-        opCompleted(rc);
+    if (completed || (rc != SH2_OK)) {
+        opCompleted(pReq, rc);
     }
 
     return;
@@ -1596,55 +3235,55 @@ static void setFrsRx(const uint8_t *payload, uint16_t len)
 
 // --- Operation: get errors --------------
 
-static int getErrorsStart(void)
+static int getErrorsStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
     CommandReq_t req;
     
     // Create a command sequence number for this command
-    sh2.opData.getErrors.seq = sh2.nextCmdSeq++;
-    sh2.opData.getErrors.errsRead = 0;
+    pReq->opData.getErrors.seq = sh2->nextCmdSeq++;
+    pReq->opData.getErrors.errsRead = 0;
     
     // set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_COMMAND_REQ;
-    req.seq = sh2.opData.getErrors.seq;
+    req.seq = pReq->opData.getErrors.seq;
     req.command = SH2_CMD_ERRORS;
-    req.p[0] = sh2.opData.getErrors.severity;
+    req.p[0] = pReq->opData.getErrors.severity;
     
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    opTxDone(pReq);
     
     return rc;
 }
 
-static void getErrorsRx(const uint8_t *payload, uint16_t len)
+static void getErrorsRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
     CommandResp_t *resp = (CommandResp_t *)payload;
     
     // skip this if it isn't the right response
     if (resp->reportId != SENSORHUB_COMMAND_RESP) return;
     if (resp->command != SH2_CMD_ERRORS) return;
-    if (resp->commandSeq != sh2.opData.getErrors.seq) return;
+    if (resp->commandSeq != pReq->opData.getErrors.seq) return;
 
 
     if (resp->r[2] == 255) {
         // No error to report, operation is complete
-        *(sh2.opData.getErrors.pNumErrors) = sh2.opData.getErrors.errsRead;
-        opCompleted(SH2_OK);
+        *(pReq->opData.getErrors.pNumErrors) = pReq->opData.getErrors.errsRead;
+        opCompleted(pReq, SH2_OK);
     } else {
         // Copy data for invoker.
-        unsigned int index = sh2.opData.getErrors.errsRead;
-        if (index < *(sh2.opData.getErrors.pNumErrors)) {
+        unsigned int index = pReq->opData.getErrors.errsRead;
+        if (index < *(pReq->opData.getErrors.pNumErrors)) {
             // We have room for this one.
-            sh2.opData.getErrors.pErrors[index].severity = resp->r[0];
-            sh2.opData.getErrors.pErrors[index].sequence = resp->r[1];
-            sh2.opData.getErrors.pErrors[index].source = resp->r[2];
-            sh2.opData.getErrors.pErrors[index].error = resp->r[3];
-            sh2.opData.getErrors.pErrors[index].module = resp->r[4];
-            sh2.opData.getErrors.pErrors[index].code = resp->r[5];
-
-            sh2.opData.getErrors.errsRead++;
+            pReq->opData.getErrors.pErrors[index].severity = resp->r[0];
+            pReq->opData.getErrors.pErrors[index].sequence = resp->r[1];
+            pReq->opData.getErrors.pErrors[index].source = resp->r[2];
+            pReq->opData.getErrors.pErrors[index].error = resp->r[3];
+            pReq->opData.getErrors.pErrors[index].module = resp->r[4];
+            pReq->opData.getErrors.pErrors[index].code = resp->r[5];
+
+            pReq->opData.getErrors.errsRead++;
         }
     }
 
@@ -1653,50 +3292,50 @@ static void getErrorsRx(const uint8_t *payload, uint16_t len)
 
 // --- Operation: get counts --------------
 
-static int getCountsStart(void)
+static int getCountsStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
     CommandReq_t req;
     
     // Create a command sequence number for this command
-    sh2.opData.getCounts.seq = sh2.nextCmdSeq++;
+    pReq->opData.getCounts.seq = sh2->nextCmdSeq++;
     
     // set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_COMMAND_REQ;
-    req.seq = sh2.opData.getCounts.seq;
+    req.seq = pReq->opData.getCounts.seq;
     req.command = SH2_CMD_COUNTS;
     req.p[0] = SH2_COUNTS_GET_COUNTS;
-    req.p[1] = sh2.opData.getCounts.sensorId;
+    req.p[1] = pReq->opData.getCounts.sensorId;
     
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    opTxDone(pReq);
 
     return rc;
 }
 
-static void getCountsRx(const uint8_t *payload, uint16_t len)
+static void getCountsRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
     CommandResp_t *resp = (CommandResp_t *)payload;
     
     // skip this if it isn't the right response
     if (resp->reportId != SENSORHUB_COMMAND_RESP) return;
     if (resp->command != SH2_CMD_COUNTS) return;
-    if (resp->commandSeq != sh2.opData.getCounts.seq) return;
+    if (resp->commandSeq != pReq->opData.getCounts.seq) return;
 
     // Store results
     if (resp->respSeq == 0) {
-        sh2.opData.getCounts.pCounts->offered = readu32(&resp->r[3]);
-        sh2.opData.getCounts.pCounts->accepted = readu32(&resp->r[7]);
+        pReq->opData.getCounts.pCounts->offered = readu32(&resp->r[3]);
+        pReq->opData.getCounts.pCounts->accepted = readu32(&resp->r[7]);
     }
     else {
-        sh2.opData.getCounts.pCounts->on = readu32(&resp->r[3]);
-        sh2.opData.getCounts.pCounts->attempted = readu32(&resp->r[7]);
+        pReq->opData.getCounts.pCounts->on = readu32(&resp->r[3]);
+        pReq->opData.getCounts.pCounts->attempted = readu32(&resp->r[7]);
     }
     
     // Complete this operation if we've received last response
     if (resp->respSeq == 1) {
-        opCompleted(SH2_OK);
+        opCompleted(pReq, SH2_OK);
     }
 
     return;
@@ -1704,35 +3343,35 @@ static void getCountsRx(const uint8_t *payload, uint16_t len)
 
 // --- Operation: reinitialize --------------
 
-static int reinitStart(void)
+static int reinitStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
     CommandReq_t req;
     
     // Create a command sequence number for this command
-    sh2.opData.reinit.seq = sh2.nextCmdSeq++;
+    pReq->opData.reinit.seq = sh2->nextCmdSeq++;
     
     // set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_COMMAND_REQ;
-    req.seq = sh2.opData.reinit.seq;
+    req.seq = pReq->opData.reinit.seq;
     req.command = SH2_CMD_INITIALIZE;
     req.p[0] = SH2_INIT_SYSTEM;
     
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    opTxDone(pReq);
 
     return rc;
 }
 
-static void reinitRx(const uint8_t *payload, uint16_t len)
+static void reinitRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
     CommandResp_t *resp = (CommandResp_t *)payload;
     
     // skip this if it isn't the right response
     if (resp->reportId != SENSORHUB_COMMAND_RESP) return;
     if (resp->command != SH2_CMD_INITIALIZE) return;
-    if (resp->commandSeq != sh2.opData.reinit.seq) return;
+    if (resp->commandSeq != pReq->opData.reinit.seq) return;
 
     // If return status is error, return error to invoker
     int rc = SH2_OK;
@@ -1741,41 +3380,41 @@ static void reinitRx(const uint8_t *payload, uint16_t len)
     }
     
     // Complete this operation
-    opCompleted(rc);
+    opCompleted(pReq, rc);
 
     return;
 }
 
 // --- Operation: save dcd now --------------
 
-static int saveDcdNowStart(void)
+static int saveDcdNowStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
     CommandReq_t req;
     
     // Create a command sequence number for this command
-    sh2.opData.saveDcdNow.seq = sh2.nextCmdSeq++;
+    pReq->opData.saveDcdNow.seq = sh2->nextCmdSeq++;
     
     // set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_COMMAND_REQ;
-    req.seq = sh2.opData.saveDcdNow.seq;
+    req.seq = pReq->opData.saveDcdNow.seq;
     req.command = SH2_CMD_DCD;
     
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    opTxDone(pReq);
 
     return rc;
 }
 
-static void saveDcdNowRx(const uint8_t *payload, uint16_t len)
+static void saveDcdNowRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
     CommandResp_t *resp = (CommandResp_t *)payload;
     
     // skip this if it isn't the right response
     if (resp->reportId != SENSORHUB_COMMAND_RESP) return;
     if (resp->command != SH2_CMD_DCD) return;
-    if (resp->commandSeq != sh2.opData.saveDcdNow.seq) return;
+    if (resp->commandSeq != pReq->opData.saveDcdNow.seq) return;
 
     // If return status is error, return error to invoker
     int rc = SH2_OK;
@@ -1784,38 +3423,38 @@ static void saveDcdNowRx(const uint8_t *payload, uint16_t len)
     }
     
     // Complete this operation
-    opCompleted(rc);
+    opCompleted(pReq, rc);
 
     return;
 }
 
 // --- Operation: cal config --------------
 
-static int calConfigStart(void)
+static int calConfigStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
     CommandReq_t req;
     
     // Create a command sequence number for this command
-    sh2.opData.calConfig.seq = sh2.nextCmdSeq++;
+    pReq->opData.calConfig.seq = sh2->nextCmdSeq++;
     
     // set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_COMMAND_REQ;
-    req.seq = sh2.opData.calConfig.seq;
+    req.seq = pReq->opData.calConfig.seq;
     req.command = SH2_CMD_ME_CAL;
-    req.p[0] = (sh2.opData.calConfig.sensors & SH2_CAL_ACCEL) ? 1 : 0; // accel cal
-    req.p[1] = (sh2.opData.calConfig.sensors & SH2_CAL_GYRO)  ? 1 : 0; // gyro cal
-    req.p[2] = (sh2.opData.calConfig.sensors & SH2_CAL_MAG)   ? 1 : 0; // mag cal
-    req.p[4] = (sh2.opData.calConfig.sensors & SH2_CAL_PLANAR) ? 1 : 0; // planar cal
+    req.p[0] = (pReq->opData.calConfig.sensors & SH2_CAL_ACCEL) ? 1 : 0; // accel cal
+    req.p[1] = (pReq->opData.calConfig.sensors & SH2_CAL_GYRO)  ? 1 : 0; // gyro cal
+    req.p[2] = (pReq->opData.calConfig.sensors & SH2_CAL_MAG)   ? 1 : 0; // mag cal
+    req.p[4] = (pReq->opData.calConfig.sensors & SH2_CAL_PLANAR) ? 1 : 0; // planar cal
     
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    opTxDone(pReq);
 
     return rc;
 }
 
-static void calConfigRx(const uint8_t *payload, uint16_t len)
+static void calConfigRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
     int rc = SH2_OK;
     CommandResp_t *resp = (CommandResp_t *)payload;
@@ -1823,7 +3462,7 @@ static void calConfigRx(const uint8_t *payload, uint16_t len)
     // skip this if it isn't the right response
     if (resp->reportId != SENSORHUB_COMMAND_RESP) return;
     if (resp->command != SH2_CMD_ME_CAL) return;
-    if (resp->commandSeq != sh2.opData.calConfig.seq) return;
+    if (resp->commandSeq != pReq->opData.calConfig.seq) return;
 
     // If return status is error, return error to invoker
     if (resp->r[0] != 0) {
@@ -1831,35 +3470,35 @@ static void calConfigRx(const uint8_t *payload, uint16_t len)
     }
     
     // Complete this operation
-    opCompleted(rc);
+    opCompleted(pReq, rc);
 
     return;
 }
 
 // --- Operation: cal config --------------
 
-static int getCalConfigStart(void)
+static int getCalConfigStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
     CommandReq_t req;
     
     // Create a command sequence number for this command
-    sh2.opData.getCalConfig.seq = sh2.nextCmdSeq++;
+    pReq->opData.getCalConfig.seq = sh2->nextCmdSeq++;
     
     // set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_COMMAND_REQ;
-    req.seq = sh2.opData.getCalConfig.seq;
+    req.seq = pReq->opData.getCalConfig.seq;
     req.command = SH2_CMD_ME_CAL;
     req.p[3] = 0x01;  // Get ME Cal settings
     
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    opTxDone(pReq);
 
     return rc;
 }
 
-static void getCalConfigRx(const uint8_t *payload, uint16_t len)
+static void getCalConfigRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
     int rc = SH2_OK;
     CommandResp_t *resp = (CommandResp_t *)payload;
@@ -1867,7 +3506,7 @@ static void getCalConfigRx(const uint8_t *payload, uint16_t len)
     // skip this if it isn't the right response
     if (resp->reportId != SENSORHUB_COMMAND_RESP) return;
     if (resp->command != SH2_CMD_ME_CAL) return;
-    if (resp->commandSeq != sh2.opData.getCalConfig.seq) return;
+    if (resp->commandSeq != pReq->opData.getCalConfig.seq) return;
 
     // If return status is error, return error to invoker
     if (resp->r[0] != 0) {
@@ -1880,17 +3519,17 @@ static void getCalConfigRx(const uint8_t *payload, uint16_t len)
     if (resp->r[2]) sensors |= SH2_CAL_GYRO;
     if (resp->r[3]) sensors |= SH2_CAL_MAG;
     if (resp->r[4]) sensors |= SH2_CAL_PLANAR;
-    *(sh2.opData.getCalConfig.pSensors) = sensors;
+    *(pReq->opData.getCalConfig.pSensors) = sensors;
     
     // Complete this operation
-    opCompleted(rc);
+    opCompleted(pReq, rc);
 
     return;
 }
 
 // --- Operation: force flush --------------
 
-static int forceFlushStart(void)
+static int forceFlushStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
     ForceFlushReq_t req;
@@ -1898,50 +3537,50 @@ static int forceFlushStart(void)
     // set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_FORCE_SENSOR_FLUSH;
-    req.sensorId = sh2.opData.forceFlush.sensorId;
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    req.sensorId = pReq->opData.forceFlush.sensorId;
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    opTxDone(pReq);
 
     return rc;
 }
 
-static void forceFlushRx(const uint8_t *payload, uint16_t len)
+static void forceFlushRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
     ForceFlushResp_t *resp = (ForceFlushResp_t *)payload;
     
     // skip this if it isn't the flush completed response for this sensor
     if (resp->reportId != SENSORHUB_FLUSH_COMPLETED) return;
-    if (resp->sensorId != sh2.opData.forceFlush.sensorId) return;
+    if (resp->sensorId != pReq->opData.forceFlush.sensorId) return;
 
     // Complete this operation
-    opCompleted(SH2_OK);
+    opCompleted(pReq, SH2_OK);
 
     return;
 }
 
 // --- Operation: get oscillator type --------------
 
-static int getOscTypeStart(void)
+static int getOscTypeStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
     CommandReq_t req;
     
     // Create a command sequence number for this command
-    sh2.opData.getOscType.seq = sh2.nextCmdSeq++;
+    pReq->opData.getOscType.seq = sh2->nextCmdSeq++;
     
     // set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_COMMAND_REQ;
-    req.seq = sh2.opData.getOscType.seq;
+    req.seq = pReq->opData.getOscType.seq;
     req.command = SH2_CMD_GET_OSC_TYPE;
     
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    opTxDone(pReq);
 
     return rc;
 }
 
-static void getOscTypeRx(const uint8_t *payload, uint16_t len)
+static void getOscTypeRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
     CommandResp_t *resp = (CommandResp_t *)payload;
     sh2_OscType_t *pOscType;
@@ -1949,100 +3588,100 @@ static void getOscTypeRx(const uint8_t *payload, uint16_t len)
     // skip this if it isn't the response we're waiting for.
     if (resp->reportId != SENSORHUB_COMMAND_RESP) return;
     if (resp->command != SH2_CMD_GET_OSC_TYPE) return;
-    if (resp->commandSeq != sh2.opData.getOscType.seq) return;
+    if (resp->commandSeq != pReq->opData.getOscType.seq) return;
 
     // Read out data
-    pOscType = sh2.opData.getOscType.pOscType;
+    pOscType = pReq->opData.getOscType.pOscType;
     *pOscType = (sh2_OscType_t)resp->r[0];
 
     // Complete this operation
-    opCompleted(SH2_OK);
+    opCompleted(pReq, SH2_OK);
 
     return;
 }
 
 // --- Operation: start calibration --------------
 
-static int startCalStart(void)
+static int startCalStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
     CommandReq_t req;
     
     // Create a command sequence number for this command
-    sh2.opData.getOscType.seq = sh2.nextCmdSeq++;
+    pReq->opData.startCal.seq = sh2->nextCmdSeq++;
     
     // set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_COMMAND_REQ;
-    req.seq = sh2.opData.startCal.seq;
+    req.seq = pReq->opData.startCal.seq;
     req.command = SH2_CMD_CAL;
     req.p[0] = SH2_CAL_START;
-    req.p[1] = sh2.opData.startCal.interval_us & 0xFF;          // LSB
-    req.p[2] = (sh2.opData.startCal.interval_us >> 8) & 0xFF;
-    req.p[3] = (sh2.opData.startCal.interval_us >> 16) & 0xFF;
-    req.p[4] = (sh2.opData.startCal.interval_us >> 24) & 0xFF;  // MSB
+    req.p[1] = pReq->opData.startCal.interval_us & 0xFF;          // LSB
+    req.p[2] = (pReq->opData.startCal.interval_us >> 8) & 0xFF;
+    req.p[3] = (pReq->opData.startCal.interval_us >> 16) & 0xFF;
+    req.p[4] = (pReq->opData.startCal.interval_us >> 24) & 0xFF;  // MSB
     
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    opTxDone(pReq);
 
     return rc;
 }
 
-static void startCalRx(const uint8_t *payload, uint16_t len)
+static void startCalRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
     CommandResp_t *resp = (CommandResp_t *)payload;
     
     // skip this if it isn't the response we're waiting for.
     if (resp->reportId != SENSORHUB_COMMAND_RESP) return;
     if (resp->command != SH2_CMD_CAL) return;
-    if (resp->commandSeq != sh2.opData.startCal.seq) return;
+    if (resp->commandSeq != pReq->opData.startCal.seq) return;
 
     // Complete this operation
-    opCompleted(SH2_OK);
+    opCompleted(pReq, SH2_OK);
 
     return;
 }
 
 // --- Operation: stop calibration --------------
 
-static int finishCalStart(void)
+static int finishCalStart(sh2_OpReq_t *pReq)
 {
     int rc = SH2_OK;
     CommandReq_t req;
     
     // Create a command sequence number for this command
-    sh2.opData.getOscType.seq = sh2.nextCmdSeq++;
+    pReq->opData.finishCal.seq = sh2->nextCmdSeq++;
     
     // set up request to issue
     memset(&req, 0, sizeof(req));
     req.reportId = SENSORHUB_COMMAND_REQ;
-    req.seq = sh2.opData.finishCal.seq;
+    req.seq = pReq->opData.finishCal.seq;
     req.command = SH2_CMD_CAL;
     req.p[0] = SH2_CAL_FINISH;
     
-    rc = shtp_send(sh2.controlChan, (uint8_t *)&req, sizeof(req));
-    opTxDone();
+    rc = shtp_send(sh2->pShtp, sh2->controlChan, (uint8_t *)&req, sizeof(req));
+    opTxDone(pReq);
 
     return rc;
 }
 
-static void finishCalRx(const uint8_t *payload, uint16_t len)
+static void finishCalRx(sh2_OpReq_t *pReq, const uint8_t *payload, uint16_t len)
 {
     CommandResp_t *resp = (CommandResp_t *)payload;
     
     // skip this if it isn't the response we're waiting for.
     if (resp->reportId != SENSORHUB_COMMAND_RESP) return;
     if (resp->command != SH2_CMD_CAL) return;
-    if (resp->commandSeq != sh2.opData.finishCal.seq) return;
+    if (resp->commandSeq != pReq->opData.finishCal.seq) return;
 
-    sh2.opData.finishCal.status = (sh2_CalStatus_t)resp->r[1];
+    *(pReq->opData.finishCal.pStatus) = (sh2_CalStatus_t)resp->r[1];
 
     // Complete this operation
-    if (sh2.opData.finishCal.status == SH2_CAL_SUCCESS) {
-        opCompleted(SH2_OK);
+    if (*(pReq->opData.finishCal.pStatus) == SH2_CAL_SUCCESS) {
+        opCompleted(pReq, SH2_OK);
     }
     else {
-        opCompleted(SH2_ERR_HUB);
+        opCompleted(pReq, SH2_ERR_HUB);
     }
 
     return;
@@ -2061,23 +3700,285 @@ static void executableAdvertHdlr(void *cookie, uint8_t tag, uint8_t len, uint8_t
 static void executableDeviceHdlr(void *cookie, uint8_t *payload, uint16_t len, uint32_t timestamp)
 {
     sh2_AsyncEvent_t event;
+    sh2_t *caller = enterInstance(cookie);
 
     // Discard if length is bad
     if (len != 1) {
-        sh2.execBadPayload++;
+        sh2->execBadPayload++;
+        sh2 = caller;
         return;
     }
     
     switch (payload[0]) {
         case EXECUTABLE_DEVICE_RESP_RESET_COMPLETE:
+            // Configs and FRS contents may have changed across the reset.
+            cacheClear();
+
+            // The reference sensor's sequence numbers start over.
+            clockSyncRestart();
+
             // Notify client that reset is complete.
             event.eventId = SH2_RESET;
-            if (sh2.eventCallback) {
-                sh2.eventCallback(sh2.eventCallbackCookie, &event);
+            if (sh2->eventCallback) {
+                sh2->eventCallback(sh2->eventCallbackCookie, &event);
             }
             break;
         default:
-            sh2.execBadPayload++;
+            sh2->execBadPayload++;
             break;
     }
+
+    sh2 = caller;
+}
+
+// Make the instance an rx callback was registered for current on this
+// thread.  Returns the instance to restore when the callback is done.
+static sh2_t *enterInstance(void *cookie)
+{
+    sh2_t *caller = sh2;
+
+    sh2 = (sh2_t *)cookie;
+
+    return caller;
+}
+
+// --- Config and metadata cache -----------------------------------------
+
+static void cacheClear(void)
+{
+    for (int n = 0; n <= SH2_MAX_SENSOR_ID; n++) {
+        sh2->configCached[n] = false;
+    }
+    for (int n = 0; n < sh2->metadataCacheLen; n++) {
+        sh2->metadataCache[n].recordId = 0;
+    }
+    sh2->nextMetadataEntry = 0;
+}
+
+static void cacheDropConfig(sh2_SensorId_t sensorId)
+{
+    if (sensorId <= SH2_MAX_SENSOR_ID) {
+        sh2->configCached[sensorId] = false;
+    }
+}
+
+static sh2_MetadataCacheEntry_t *cacheFindMetadata(uint16_t recordId)
+{
+    if (recordId == 0) return 0;
+
+    for (int n = 0; n < sh2->metadataCacheLen; n++) {
+        if (sh2->metadataCache[n].recordId == recordId) {
+            return &sh2->metadataCache[n];
+        }
+    }
+
+    return 0;
+}
+
+static void cacheDropMetadata(uint16_t recordId)
+{
+    sh2_MetadataCacheEntry_t *pEntry = cacheFindMetadata(recordId);
+    if (pEntry != 0) {
+        pEntry->recordId = 0;
+    }
+}
+
+static void cacheStoreConfig(sh2_SensorId_t sensorId, const sh2_SensorConfig_t *pConfig)
+{
+    if (!sh2->cacheEnabled || (sensorId > SH2_MAX_SENSOR_ID)) return;
+
+    sh2->configCache[sensorId] = *pConfig;
+    sh2->configCached[sensorId] = true;
+}
+
+static void cacheStoreMetadata(uint16_t recordId, const sh2_SensorMetadata_t *pMetadata)
+{
+    if (!sh2->cacheEnabled || (sh2->metadataCacheLen == 0)) return;
+
+    sh2_MetadataCacheEntry_t *pEntry = cacheFindMetadata(recordId);
+    if (pEntry == 0) {
+        // Replace entries in the order they were filled
+        pEntry = &sh2->metadataCache[sh2->nextMetadataEntry];
+        sh2->nextMetadataEntry = (sh2->nextMetadataEntry + 1) % sh2->metadataCacheLen;
+    }
+
+    pEntry->metadata = *pMetadata;
+    pEntry->recordId = recordId;
+}
+
+static bool cacheGetConfig(sh2_SensorId_t sensorId, sh2_SensorConfig_t *pConfig)
+{
+    if (!sh2->cacheEnabled || (pConfig == 0) ||
+        (sensorId > SH2_MAX_SENSOR_ID) || !sh2->configCached[sensorId]) {
+        return false;
+    }
+
+    *pConfig = sh2->configCache[sensorId];
+    return true;
+}
+
+static bool cacheGetMetadata(uint16_t recordId, sh2_SensorMetadata_t *pMetadata)
+{
+    if (!sh2->cacheEnabled) return false;
+
+    sh2_MetadataCacheEntry_t *pEntry = cacheFindMetadata(recordId);
+    if (pEntry == 0) return false;
+
+    *pMetadata = pEntry->metadata;
+    return true;
+}
+
+// --- Clock sync -----------------------------------------------------------
+
+static void clockSyncRestart(void)
+{
+    sh2->clockNext = 0;
+    sh2->clockSamples = 0;
+    sh2->clockCorrection = 0;
+}
+
+static int64_t clockSyncPredict(uint32_t index)
+{
+    int64_t x = (int32_t)(index - sh2->clockX0);
+
+    return (int64_t)sh2->clockY0 + divRound(sh2->clockA + sh2->clockB*x, CLOCK_SYNC_ONE);
+}
+
+// Least squares fit of uncorrected timestamps against sample index
+static void clockSyncFit(void)
+{
+    uint16_t n = sh2->clockSamples;
+    uint16_t first = (sh2->clockNext + SH2_CLOCK_SYNC_WINDOW - n) % SH2_CLOCK_SYNC_WINDOW;
+    uint16_t last = (sh2->clockNext + SH2_CLOCK_SYNC_WINDOW - 1) % SH2_CLOCK_SYNC_WINDOW;
+    int64_t sx = 0, sr = 0, sxx = 0, sxr = 0;
+
+    // Fit relative to the oldest sample to keep precision
+    sh2->clockX0 = sh2->clockIndex[first];
+    sh2->clockY0 = sh2->clockTime[first];
+
+    // Start from the whole uS period between the oldest and newest samples
+    // and fit only what is left over.  The residuals are small, so the sums
+    // stay well inside 64 bits.
+    int64_t span = (int32_t)(sh2->clockIndex[last] - sh2->clockX0);
+    int64_t b0 = (span > 0) ? (int64_t)(sh2->clockTime[last] - sh2->clockY0) / span : 0;
+
+    for (uint16_t i = 0; i < n; i++) {
+        uint16_t k = (first + i) % SH2_CLOCK_SYNC_WINDOW;
+        int64_t x = (int32_t)(sh2->clockIndex[k] - sh2->clockX0);
+        int64_t r = (int64_t)(sh2->clockTime[k] - sh2->clockY0) - b0*x;
+        sx += x;
+        sr += r;
+        sxx += x*x;
+        sxr += x*r;
+    }
+
+    // Slope of the residuals, in fixed point
+    int64_t c = 0;
+    int64_t d = n*sxx - sx*sx;
+    if (d > 0) {
+        int64_t num = n*sxr - sx*sr;
+        c = (num / d) * CLOCK_SYNC_ONE + ((num % d) * CLOCK_SYNC_ONE) / d;
+    }
+    sh2->clockB = b0*CLOCK_SYNC_ONE + c;
+    sh2->clockA = (sr*CLOCK_SYNC_ONE - c*sx) / n;
+
+    // Sum squared errors with half the fraction bits, so they can't overflow
+    uint64_t sse = 0;
+    for (uint16_t i = 0; i < n; i++) {
+        uint16_t k = (first + i) % SH2_CLOCK_SYNC_WINDOW;
+        int64_t x = (int32_t)(sh2->clockIndex[k] - sh2->clockX0);
+        int64_t r = (int64_t)(sh2->clockTime[k] - sh2->clockY0) - b0*x;
+        int64_t e = (r*CLOCK_SYNC_ONE - (sh2->clockA + c*x)) / ((int64_t)1 << (CLOCK_SYNC_FRAC_BITS/2));
+        sse += (uint64_t)(e*e);
+    }
+    sh2->clockVariance = sse / n;
+}
+
+static void clockSyncSample(uint8_t seq, uint64_t timestamp)
+{
+    uint32_t index = 0;
+
+    if (sh2->clockSamples > 0) {
+        uint8_t step = seq - sh2->clockSeq;
+        if (step == 0) {
+            // Repeated report
+            return;
+        }
+        uint16_t last = (sh2->clockNext + SH2_CLOCK_SYNC_WINDOW - 1) % SH2_CLOCK_SYNC_WINDOW;
+        index = sh2->clockIndex[last] + step;
+    }
+    sh2->clockSeq = seq;
+
+    if (sh2->clockSamples >= CLOCK_SYNC_MIN_SAMPLES) {
+        // A long gap (more than 255 samples lost) or a step in the host
+        // clock makes the sample land far from the fit.
+        int64_t error = (int64_t)timestamp - clockSyncPredict(index);
+        int64_t limit = CLOCK_SYNC_MAX_ERROR * sh2->clockB / CLOCK_SYNC_ONE;
+        if ((error > limit) || (error < -limit)) {
+            sh2->clockResyncs++;
+            clockSyncRestart();
+            index = 0;
+        }
+    }
+
+    sh2->clockIndex[sh2->clockNext] = index;
+    sh2->clockTime[sh2->clockNext] = timestamp;
+    sh2->clockNext = (sh2->clockNext + 1) % SH2_CLOCK_SYNC_WINDOW;
+    if (sh2->clockSamples < SH2_CLOCK_SYNC_WINDOW) {
+        sh2->clockSamples++;
+    }
+
+    clockSyncFit();
+
+    if (sh2->clockSamples >= CLOCK_SYNC_MIN_SAMPLES) {
+        sh2->clockCorrection = clockSyncPredict(index) - (int64_t)timestamp;
+    }
+}
+
+// Find reference sensor reports in a cargo before its events are delivered,
+// so all of them get the correction for this cargo's interrupt latency.
+static void clockSyncCargo(uint8_t *payload, uint16_t len, uint32_t timestamp)
+{
+    uint16_t cursor = 0;
+    uint32_t referenceDelta = 0;
+
+    while (cursor < len) {
+        uint8_t reportId = payload[cursor];
+        uint8_t reportLen = getReportLen(reportId);
+        if (reportLen == 0) {
+            return;
+        }
+
+        if (reportId == SENSORHUB_BASE_TIMESTAMP_REF) {
+            const BaseTimestampRef_t *rpt = (const BaseTimestampRef_t *)(payload+cursor);
+            referenceDelta = -rpt->timebase;
+        }
+        else if (reportId == SENSORHUB_TIMESTAMP_REBASE) {
+            const TimestampRebase_t *rpt = (const TimestampRebase_t *)(payload+cursor);
+            referenceDelta += rpt->timebase;
+        }
+        else if (reportId == sh2->clockSensor) {
+            uint8_t *pReport = payload+cursor;
+            uint16_t delay = ((pReport[2] & 0xFC) << 6) + pReport[3];
+            clockSyncSample(pReport[1], touSTimestamp(timestamp, referenceDelta, delay));
+        }
+        cursor += reportLen;
+    }
+}
+
+// Apply clock sync correction to a sensor event timestamp
+static uint64_t clockSyncTime(uint8_t sensorId, uint64_t timestamp)
+{
+    if (sh2->clockSensor == 0) return timestamp;
+
+    timestamp += sh2->clockCorrection;
+
+    if (sensorId <= SH2_MAX_SENSOR_ID) {
+        if (timestamp <= sh2->clockLastTime[sensorId]) {
+            timestamp = sh2->clockLastTime[sensorId] + 1;
+        }
+        sh2->clockLastTime[sensorId] = timestamp;
+    }
+
+    return timestamp;
 }
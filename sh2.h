@@ -63,6 +63,9 @@ extern "C" {
     /**
      * @brief Sensor Event
      *
+     * report[] starts with the report id.  Gyro-integrated RV reports, which
+     * the hub sends without a header, have their id prepended and no
+     * sequence number or status.
      * See the SH-2 Reference Manual for more detail.
      */
     #define SH2_MAX_SENSOR_EVENT_LEN (16)
@@ -73,10 +76,72 @@ extern "C" {
             uint8_t reportId;
             uint8_t report[SH2_MAX_SENSOR_EVENT_LEN];
         };
+        /**
+         * Non-null only for events passed to a callback set with
+         * sh2_setSensorCallbackNoCopy().  Then it points at the report in the
+         * received payload, report[] holds only reportId and the event is
+         * valid for the duration of the callback.  Decode such events with
+         * sh2_decodeSensorReport(); the other decoders only read report[].
+         */
+        const uint8_t *pReport;
     } sh2_SensorEvent_t;
 
     typedef void (sh2_SensorCallback_t)(void * cookie, sh2_SensorEvent_t *pEvent);
 
+    /**
+     * @brief Batched sensor event callback
+     *
+     * Receives consecutive events from one SHTP cargo.  All events in a batch
+     * share the host timestamp of the cargo and the hub's referenceDelta
+     * (a cargo is split into several batches where the hub rebases its
+     * timestamps).  pEvents is only valid for the duration of the callback.
+     */
+    typedef void (sh2_SensorBatchCallback_t)(void * cookie,
+                                             sh2_SensorEvent_t *pEvents, uint16_t numEvents,
+                                             uint32_t timestamp, uint32_t referenceDelta);
+
+    /**
+     * @brief Sensor event ring statistics
+     *
+     * See sh2_setEventRing().
+     */
+    typedef struct sh2_EventRingStats {
+        uint32_t capacity;   /**< @brief Ring capacity in events, 0 if no ring */
+        uint32_t count;      /**< @brief Events currently waiting in the ring */
+        uint32_t highWater;  /**< @brief Most events ever waiting in the ring */
+        uint32_t overflows;  /**< @brief Events dropped because the ring was full */
+    } sh2_EventRingStats_t;
+
+    /**
+     * @brief Clock sync statistics
+     *
+     * See sh2_setClockSync().
+     */
+    typedef struct sh2_ClockSyncStats {
+        uint16_t samples;      /**< @brief Reference sensor samples in the fit */
+        uint32_t resyncs;      /**< @brief Times the fit restarted after a gap or jump */
+        uint32_t period_ns;    /**< @brief Fitted reference sample period, in host nS */
+        int32_t skew_ppm;      /**< @brief Hub clock rate relative to the host clock, positive if fast (0 if unknown) */
+        uint32_t jitter_ns;    /**< @brief RMS of reference sample times about the fit [nS] */
+        int32_t correction_us; /**< @brief Correction last applied to event timestamps [uS] */
+    } sh2_ClockSyncStats_t;
+
+    /**
+     * @brief Operation completion callback
+     *
+     * Called when an operation started with one of the ...Async() functions
+     * completes.  status is SH2_OK (0) on success or a negative value from
+     * sh2_err.h on error.  It may be called from the HAL's receive context, or
+     * before the ...Async() call returns.  Another operation may be started
+     * from within the callback.
+     */
+    typedef void (sh2_OpCallback_t)(void * cookie, int status);
+
+    /**
+     * @brief HAL for one of several hubs, see sh2_hal.h and sh2_open().
+     */
+    typedef struct sh2_Hal_s sh2_Hal_t;
+
     /**
      * @brief Product Id value
      *
@@ -181,6 +246,15 @@ extern "C" {
         uint32_t sensorSpecific;  /**< @brief See SH-2 Reference Manual for details. */
     } sh2_SensorConfig_t;
 
+    /**
+     * @brief One entry of a sh2_setSensorConfigs() request
+     */
+    typedef struct sh2_SensorConfigEntry {
+        sh2_SensorId_t sensorId;     /**< @brief Which sensor to configure */
+        sh2_SensorConfig_t config;   /**< @brief New configuration for that sensor */
+        int status;                  /**< @brief [out] SH2_OK or error from sh2_err.h */
+    } sh2_SensorConfigEntry_t;
+
     /**
      * @brief Sensor Metadata Record
      *
@@ -208,6 +282,39 @@ extern "C" {
         uint8_t sensorSpecific[48];  /**< @brief See SH-2 Reference Manual */
     } sh2_SensorMetadata_t;
 
+    /**
+     * @brief Metadata cache entry
+     *
+     * Storage for one cached metadata record, see sh2_setCache().
+     */
+    typedef struct sh2_MetadataCacheEntry {
+        uint16_t recordId;              /**< @brief FRS record id, 0 if the entry is unused */
+        sh2_SensorMetadata_t metadata;  /**< @brief Cached metadata */
+    } sh2_MetadataCacheEntry_t;
+
+    /**
+     * @brief Metadata prefetch statistics
+     *
+     * See sh2_prefetchAllMetadata().
+     */
+    typedef struct sh2_MetadataPrefetchStats {
+        uint16_t records;     /**< @brief Metadata records stored in the table */
+        uint32_t bytes;       /**< @brief FRS data bytes received */
+        uint32_t elapsed_us;  /**< @brief Time from first FRS read request to last response [uS] */
+    } sh2_MetadataPrefetchStats_t;
+
+    /**
+     * @brief FRS write statistics
+     *
+     * See sh2_getFrsWriteStats().
+     */
+    typedef struct sh2_FrsWriteStats {
+        uint16_t words;           /**< @brief Words written */
+        uint16_t busy;            /**< @brief Busy responses that caused a retry */
+        uint32_t elapsed_us;      /**< @brief Time from write ready to write completed [uS] */
+        uint32_t wordsPerSecond;  /**< @brief Write throughput */
+    } sh2_FrsWriteStats_t;
+
     /**
      * @brief SensorHub Error Record
      *
@@ -391,6 +498,41 @@ extern "C" {
      */
     int sh2_initialize(sh2_EventCallback_t *eventCallback, void *resetCookie);
 
+    /**
+     * @brief Initialize a session with one of several SensorHubs.
+     *
+     * Like sh2_initialize(), but for the hub controlled by pHal.  Up to
+     * SH2_MAX_INSTANCES hubs, numbered from 0, can be driven at once; each
+     * has its own SHTP channels, operation queue, callbacks and timestamp
+     * state.  sh2_initialize() uses the sh2_hal_ functions for the calling
+     * thread's current instance, or instance 0 if it has none.
+     *
+     * The other functions in this API act on the current instance of the
+     * calling thread, set by sh2_select() or by this call.  A thread that
+     * has not selected an instance gets SH2_ERR_BAD_PARAM from them.
+     * Callbacks run with their own instance current, so they may call this
+     * API without selecting it.
+     *
+     * Each instance may be used from its own thread.  Any one instance must
+     * not be used from several threads at once.
+     *
+     * @param  instance Which hub, 0 to SH2_MAX_INSTANCES-1.
+     * @param  pHal HAL controlling this hub.  Must remain valid while in use.
+     * @param  eventCallback Will be called when the sensorhub completes the reset process.
+     * @param  resetCookie Will be passed to eventCallback.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_open(uint8_t instance, sh2_Hal_t *pHal,
+                 sh2_EventCallback_t *eventCallback, void *resetCookie);
+
+    /**
+     * @brief Select the hub instance used by this thread's API calls.
+     *
+     * @param  instance Which hub, 0 to SH2_MAX_INSTANCES-1.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_select(uint8_t instance);
+
     /**
      * @brief Register a function to receive sensor events.
      *
@@ -400,6 +542,139 @@ extern "C" {
      */
     int sh2_setSensorCallback(sh2_SensorCallback_t *callback, void *cookie);
 
+    /**
+     * @brief Register a function to receive sensor events without copying report data.
+     *
+     * Like sh2_setSensorCallback() but each event's pReport points into the
+     * received payload instead of the report being copied into the event.
+     * The event must be decoded (see sh2_decodeSensorReport()) or copied
+     * before the callback returns.
+     *
+     * @param  callback A function that will be called each time a sensor event is received.
+     * @param  cookie  A value that will be passed to the sensor callback function.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setSensorCallbackNoCopy(sh2_SensorCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Register a function to receive sensor events in batches.
+     *
+     * While set, events that would go to the sensor callback are collected
+     * in pBuffer and passed to this callback once per cargo instead (or
+     * each time pBuffer fills, if a cargo holds more).  Batched events
+     * always hold a copy of their report.
+     *
+     * pBuffer must stay valid until the callback is removed.
+     *
+     * @param  callback A function that will be called with each batch of events, or NULL to remove it.
+     * @param  cookie  A value that will be passed to the callback function.
+     * @param  pBuffer Storage for a batch.  Ignored if callback is NULL.
+     * @param  capacity Number of events pBuffer holds, at least 1.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setSensorBatchCallback(sh2_SensorBatchCallback_t *callback, void *cookie,
+                                   sh2_SensorEvent_t *pBuffer, uint16_t capacity);
+
+    /**
+     * @brief Register a function to receive events of one sensor.
+     *
+     * Events of sensorId go to this callback instead of the sensor callback,
+     * batch callback or event ring.  Events of sensors with no callback of
+     * their own still go to those.  Whether the report is copied
+     * follows the last call to sh2_setSensorCallback() or
+     * sh2_setSensorCallbackNoCopy() (copied by default).
+     *
+     * @param  sensorId Which sensor, up to SH2_MAX_SENSOR_ID.
+     * @param  callback A function that will be called for each event of sensorId, or NULL to remove it.
+     * @param  cookie  A value that will be passed to the callback function.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setSensorCallbackFor(sh2_SensorId_t sensorId,
+                                 sh2_SensorCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Queue sensor events in a ring instead of calling the sensor callback.
+     *
+     * While a ring is set, each sensor event is copied into it from the HAL
+     * receive context and the application drains it with sh2_pollEvents().
+     * The ring is lock-free for one producer (the receive path) and one
+     * consumer (the thread calling sh2_pollEvents()) when the compiler
+     * supports C11 atomics.  Without them (or with SH2_NO_ATOMICS) both must
+     * run on one core and sh2_pollEvents() must not interrupt the receive
+     * path.  When the ring is full,
+     * new events are dropped and counted in the overflows statistic.
+     *
+     * Set the ring before enabling sensors; it must not be changed while
+     * events are being received.  Setting a new ring clears the statistics.
+     *
+     * @param  pBuffer Storage for the ring, or NULL to go back to the sensor callback.
+     * @param  capacity Number of events pBuffer holds.  Must be a power of two.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setEventRing(sh2_SensorEvent_t *pBuffer, uint32_t capacity);
+
+    /**
+     * @brief Remove sensor events from the ring set with sh2_setEventRing().
+     *
+     * @param  batch Array to receive the events, oldest first.
+     * @param  max Size of batch, in events.
+     * @return Number of events copied to batch (0 if the ring is empty).  Negative value from sh2_err.h on error.
+     */
+    int sh2_pollEvents(sh2_SensorEvent_t *batch, int max);
+
+    /**
+     * @brief Get statistics of the sensor event ring.
+     *
+     * @param  pStats Structure to receive the statistics.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getEventRingStats(sh2_EventRingStats_t *pStats);
+
+    /**
+     * @brief Correct sensor event timestamps for host interrupt jitter and clock drift.
+     *
+     * Event timestamps are normally taken from the HAL timestamp of the
+     * cargo (when INTN was asserted) less the age the hub reports for each
+     * event.  So they carry the host's interrupt latency, and cargos
+     * holding the same hub sample period drift against each other as the
+     * hub oscillator drifts against the host clock.
+     *
+     * With clock sync enabled, the reported times of a periodic reference
+     * sensor are fitted against its sample sequence numbers by linear
+     * regression over the last SH2_CLOCK_SYNC_WINDOW samples.  All events of
+     * a cargo are then moved by the difference between the fitted and the
+     * reported time of its reference sample, and each sensor's timestamps
+     * are kept strictly increasing.  The fit restarts if a sample is more
+     * than a few periods from where it predicts.
+     *
+     * The fit uses 64-bit integer arithmetic only (no floating point or libm).
+     *
+     * The reference sensor must be enabled separately, at a steady rate.
+     *
+     * @param  sensorId Reference sensor, or 0 to disable clock sync.
+     * @param  interval_us Nominal interval of the reference sensor [uS], used only to report skew (0 if unknown).
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setClockSync(sh2_SensorId_t sensorId, uint32_t interval_us);
+
+    /**
+     * @brief Get statistics of the clock sync fit.
+     *
+     * @param  pStats Structure to receive the statistics.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getClockSyncStats(sh2_ClockSyncStats_t *pStats);
+
+    struct shtp_Stats;
+
+    /**
+     * @brief Get SHTP transport statistics: discarded transfers and cargos.
+     *
+     * @param  pStats Structure to receive the statistics (shtp_Stats_t, see shtp.h).
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getShtpStats(struct shtp_Stats *pStats);
+
     /**
      * @brief Get Product ID information from Sensorhub.
      * 
@@ -426,6 +701,39 @@ extern "C" {
      */
     int sh2_setSensorConfig(sh2_SensorId_t sensorId, const sh2_SensorConfig_t *pConfig);
 
+    /**
+     * @brief Set the configuration of several sensors in one operation.
+     *
+     * The set feature commands are packed into as few SHTP cargos as possible.
+     * The status field of each entry is set to the result for that sensor.
+     * 
+     * @param  pEntries Array of sensor ids and configurations.
+     * @param  numEntries Number of entries in pEntries.
+     * @return SH2_OK (0), if all sensors were configured.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setSensorConfigs(sh2_SensorConfigEntry_t *pEntries, uint16_t numEntries);
+
+    /**
+     * @brief Cache sensor configurations and metadata on the host.
+     *
+     * While enabled, sh2_getSensorConfig() and sh2_getMetadata() (and their
+     * Async versions) answer from the cache when they can, without any bus
+     * traffic.  A cache hit completes the Async versions before they return.
+     *
+     * Cached entries are dropped when the hub resets, when an FRS record
+     * changes (SH2_FRS_CHANGE or sh2_setFrs()) and when a sensor is
+     * configured with sh2_setSensorConfig() or sh2_setSensorConfigs().
+     *
+     * Sensor configurations are cached for all sensors.  Metadata records
+     * are cached in pMetadata; when all entries are used, the oldest is replaced.
+     *
+     * @param  enable true to enable caching, false to disable it and drop the cache.
+     * @param  pMetadata Storage for cached metadata records.  May be NULL if numMetadata is 0.
+     * @param  numMetadata Number of entries in pMetadata.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setCache(bool enable, sh2_MetadataCacheEntry_t *pMetadata, uint16_t numMetadata);
+
     /**
      * @brief Get metadata related to a sensor.
      * 
@@ -435,6 +743,33 @@ extern "C" {
      */
     int sh2_getMetadata(sh2_SensorId_t sensorId, sh2_SensorMetadata_t *pData);
 
+    /**
+     * @brief Read the metadata of every sensor in one operation.
+     *
+     * Metadata records are read back-to-back, each FRS read request being
+     * issued as soon as the previous record completes.  Records the hub does
+     * not have are skipped, so pTable is filled from its start with one
+     * entry per record found.  Reading stops when pTable is full.
+     *
+     * Records read are also stored in the metadata cache, if enabled.
+     * (See sh2_setCache().)
+     *
+     * A record whose read is refused (busy) or loses data is re-requested
+     * from the last word received, up to SH2_FRS_READ_RETRIES times.
+     *
+     * Elapsed time is measured from the first read request to the HAL
+     * timestamp of the last FRS read response.  The request is timestamped
+     * with the HAL's getTimeUs(); if the HAL doesn't provide it, the first
+     * response's timestamp is used instead.
+     *
+     * @param  pTable Table to receive the metadata records.
+     * @param  numEntries Number of entries in pTable.
+     * @param  pStats Receives records read, bytes transferred and elapsed time.  May be NULL.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_prefetchAllMetadata(sh2_MetadataCacheEntry_t *pTable, uint16_t numEntries,
+                                sh2_MetadataPrefetchStats_t *pStats);
+
     /**
      * @brief Get an FRS record.
      * 
@@ -446,6 +781,24 @@ extern "C" {
      */
     int sh2_getFrs(uint16_t recordId, uint32_t *pData, uint16_t *words);
 
+    /**
+     * @brief Get part of an FRS record.
+     *
+     * Reads only the words from offset to offset + *words, for example a
+     * single field of a large record.
+     *
+     * If responses are lost (sh2_getFrs() too), the read resumes from the
+     * last word received rather than restarting the record.
+     * 
+     * @param  recordId Which FRS Record to retrieve.
+     * @param  offset First word to retrieve.
+     * @param  pData pointer to buffer to receive the results
+     * @param[in] words Number of 32-bit words to retrieve (and size of pData buffer.)
+     * @param[out] words Number of 32-bit words retrieved.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getFrsRange(uint16_t recordId, uint16_t offset, uint32_t *pData, uint16_t *words);
+
     /**
      * @brief Set an FRS record
      * 
@@ -456,6 +809,23 @@ extern "C" {
      */
     int sh2_setFrs(uint16_t recordId, uint32_t *pData, uint16_t words);
 
+    /**
+     * @brief Get statistics of the last successful FRS write.
+     *
+     * FRS writes keep up to SH2_FRS_WRITE_WINDOW write data requests
+     * outstanding, and send the last one only when all others were received.
+     * When the hub reports busy, the write resumes from the rejected offset
+     * with one request outstanding, and the window grows by one with each
+     * request received, back up to SH2_FRS_WRITE_WINDOW.
+     *
+     * Times are measured between the HAL timestamps of the write ready and
+     * write completed responses.
+     *
+     * @param  pStats Structure to receive the statistics.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getFrsWriteStats(sh2_FrsWriteStats_t *pStats);
+
     /**
      * @brief Get error counts.
      * 
@@ -598,6 +968,293 @@ extern "C" {
      */
     int sh2_finishCal(sh2_CalStatus_t *status);
 
+    /***************************************************************************************
+     * Asynchronous API
+     *
+     * Each function below queues the same operation as its blocking counterpart
+     * but returns without waiting for it to complete.  The result is reported
+     * through the completion callback.  Buffers passed in must remain valid
+     * until then.  If the operation cannot be queued, the error is returned
+     * and the callback is not called.
+     *
+     * Operations start in the order they were queued.  Queries whose responses
+     * carry a command sequence number (getCounts, getErrors, getOscType,
+     * getCalConfig) are sent without waiting for earlier ones to complete.
+     * SH2_ERR_OP_IN_PROGRESS is returned when the queue is full.
+     **************************************************************************************/
+
+    /**
+     * @brief Asynchronous version of sh2_getProdIds().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getProdIdsAsync(sh2_ProductIds_t *prodIds, sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_getSensorConfig().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getSensorConfigAsync(sh2_SensorId_t sensorId, sh2_SensorConfig_t *config,
+                                 sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_setSensorConfig().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setSensorConfigAsync(sh2_SensorId_t sensorId, const sh2_SensorConfig_t *pConfig,
+                                 sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_setSensorConfigs().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setSensorConfigsAsync(sh2_SensorConfigEntry_t *pEntries, uint16_t numEntries,
+                                  sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_getMetadata().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getMetadataAsync(sh2_SensorId_t sensorId, sh2_SensorMetadata_t *pData,
+                             sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_prefetchAllMetadata().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_prefetchAllMetadataAsync(sh2_MetadataCacheEntry_t *pTable, uint16_t numEntries,
+                                     sh2_MetadataPrefetchStats_t *pStats,
+                                     sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_getFrs().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getFrsAsync(uint16_t recordId, uint32_t *pData, uint16_t *words,
+                        sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_getFrsRange().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getFrsRangeAsync(uint16_t recordId, uint16_t offset, uint32_t *pData, uint16_t *words,
+                             sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_setFrs().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setFrsAsync(uint16_t recordId, uint32_t *pData, uint16_t words,
+                        sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_getErrors().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getErrorsAsync(uint8_t severity, sh2_ErrorRecord_t *pErrors, uint16_t *numErrors,
+                           sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_getCounts().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getCountsAsync(sh2_SensorId_t sensorId, sh2_Counts_t *pCounts,
+                           sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_clearCounts().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_clearCountsAsync(sh2_SensorId_t sensorId, sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_setTareNow().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setTareNowAsync(uint8_t axes, sh2_TareBasis_t basis,
+                            sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_clearTare().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_clearTareAsync(sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_persistTare().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_persistTareAsync(sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_setReorientation().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setReorientationAsync(sh2_Quaternion_t *orientation,
+                                  sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_reinitialize().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_reinitializeAsync(sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_saveDcdNow().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_saveDcdNowAsync(sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_getOscType().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getOscTypeAsync(sh2_OscType_t *pOscType, sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_setCalConfig().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setCalConfigAsync(uint8_t sensors, sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_getCalConfig().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_getCalConfigAsync(uint8_t *pSensors, sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_setDcdAutoSave().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_setDcdAutoSaveAsync(bool enabled, sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_flush().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_flushAsync(sh2_SensorId_t sensorId, sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_clearDcdAndReset().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_clearDcdAndResetAsync(sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_startCal().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_startCalAsync(uint32_t interval_us, sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Asynchronous version of sh2_finishCal().
+     * 
+     * @param  callback Called when the operation completes.
+     * @param  cookie  A value that will be passed to the callback.
+     * @return SH2_OK (0), if the operation was queued.  Negative value from sh2_err.h on error.
+     */
+    int sh2_finishCalAsync(sh2_CalStatus_t *status, sh2_OpCallback_t *callback, void *cookie);
+
+    /**
+     * @brief Fail operations that have been in progress too long.
+     *
+     * Call periodically, e.g. from a watchdog.  An operation times out on
+     * the first call at least SH2_OP_TIMEOUT_US (longer for FRS writes and
+     * DCD saves) after the call that first saw it in progress.  It completes
+     * with SH2_ERR_TIMEOUT and the next queued operation starts.
+     *
+     * Blocking calls also time out if sh2_hal_block() returns an error.
+     *
+     * @param  now_us Current time, in the same uS timebase as the HAL rx timestamps.
+     * @return Number of operations that timed out.
+     */
+    int sh2_checkTimeouts(uint32_t now_us);
+
+    /**
+     * @brief Cancel all queued and in progress operations.
+     *
+     * Each completes with SH2_ERR_CANCELLED, oldest first.  Use this to
+     * recover from a hub that stopped responding.
+     *
+     * @return Number of operations cancelled.
+     */
+    int sh2_cancelOperations(void);
+
 #ifdef __cplusplus
 }   // end of extern "C"
 #endif
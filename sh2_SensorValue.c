@@ -19,6 +19,9 @@
  * BNO080 Sensor Event decoding
  */
 
+#include <stddef.h>
+#include <string.h>
+
 #include "sh2_SensorValue.h"
 #include "sh2_err.h"
 #include "sh2_util.h"
@@ -28,514 +31,681 @@
 const float scaleRadToDeg = 180.0 / 3.14159265358;
 
 // ------------------------------------------------------------------------
-// Forward declarations
-
-static int decodeRawAccelerometer(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeAccelerometer(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeLinearAcceleration(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeGravity(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeRawGyroscope(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeGyroscopeCalibrated(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeGyroscopeUncal(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeRawMagnetometer(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeMagneticFieldCalibrated(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeMagneticFieldUncal(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeRotationVector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeGameRotationVector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeGeomagneticRotationVector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodePressure(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeAmbientLight(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeHumidity(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeProximity(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeTemperature(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeReserved(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeTapDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeStepDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeStepCounter(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeSignificantMotion(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeStabilityClassifier(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeShakeDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeFlipDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodePickupDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeStabilityDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodePersonalActivityClassifier(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeSleepDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeTiltDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodePocketDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeCircleDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeHeartRateMonitor(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeArvrStabilizedRV(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeArvrStabilizedGRV(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeGyroIntegratedRV(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
+// Decoder descriptors
+
+// How one report field is converted into sh2_SensorValue_t
+enum FieldKind {
+    FIELD_Q16,   // int16 scaled to float
+    FIELD_Q32,   // int32 scaled to float
+    FIELD_S16,   // int16, unscaled
+    FIELD_U8,
+    FIELD_U16,
+    FIELD_U32,
+};
+
+typedef struct FieldDesc {
+    uint8_t kind;          // enum FieldKind
+    uint8_t reportOffset;  // byte offset in the report
+    uint8_t valueOffset;   // byte offset in sh2_SensorValue_t
+    uint8_t q;             // q point of FIELD_Q16 and FIELD_Q32
+    uint8_t qSource;       // metadata q point that can replace q (enum QSource)
+    float scale;           // 1/2^q
+} FieldDesc_t;
+
+// Which metadata q point applies to a fixed point field
+enum QSource {
+    Q_FIXED,    // q is not described by metadata
+    Q_POINT1,   // sensor value, sh2_SensorMetadata_t.qPoint1
+    Q_POINT2,   // accuracy or bias, sh2_SensorMetadata_t.qPoint2
+};
+
+#define MAX_DECODER_FIELDS (SH2_MAX_SENSOR_COLUMNS)
+typedef struct SensorDecoder {
+    uint8_t numFields;
+    FieldDesc_t field[MAX_DECODER_FIELDS];
+} SensorDecoder_t;
+
+#define FIELD(kind, reportOffset, member, q, qSource) \
+    { (kind), (reportOffset), offsetof(sh2_SensorValue_t, un.member), (q), (qSource), SCALE_Q(q) }
+// Fixed point value field: kind, report offset, sh2_SensorValue_t member, q point
+#define QFIELD(kind, reportOffset, member, q) FIELD(kind, reportOffset, member, q, Q_POINT1)
+// Fixed point accuracy or bias field
+#define QFIELD2(kind, reportOffset, member, q) FIELD(kind, reportOffset, member, q, Q_POINT2)
+// Fixed point field whose q point is not in the metadata
+#define QFIXED(kind, reportOffset, member, q) FIELD(kind, reportOffset, member, q, Q_FIXED)
+// Integer field: kind, report offset, sh2_SensorValue_t member
+#define IFIELD(kind, reportOffset, member) FIELD(kind, reportOffset, member, 0, Q_FIXED)
+
+static int decodePersonalActivityClassifier(sh2_SensorValue_t *value, const uint8_t *report);
+
+static const SensorDecoder_t decoder[SH2_MAX_SENSOR_ID+1] = {
+    [SH2_RAW_ACCELEROMETER] = { 4, {
+        IFIELD(FIELD_S16, 4, rawAccelerometer.x),
+        IFIELD(FIELD_S16, 6, rawAccelerometer.y),
+        IFIELD(FIELD_S16, 8, rawAccelerometer.z),
+        IFIELD(FIELD_U32, 12, rawAccelerometer.timestamp) } },
+    [SH2_ACCELEROMETER] = { 3, {
+        QFIELD(FIELD_Q16, 4, accelerometer.x, 8),
+        QFIELD(FIELD_Q16, 6, accelerometer.y, 8),
+        QFIELD(FIELD_Q16, 8, accelerometer.z, 8) } },
+    [SH2_LINEAR_ACCELERATION] = { 3, {
+        QFIELD(FIELD_Q16, 4, linearAcceleration.x, 8),
+        QFIELD(FIELD_Q16, 6, linearAcceleration.y, 8),
+        QFIELD(FIELD_Q16, 8, linearAcceleration.z, 8) } },
+    [SH2_GRAVITY] = { 3, {
+        QFIELD(FIELD_Q16, 4, gravity.x, 8),
+        QFIELD(FIELD_Q16, 6, gravity.y, 8),
+        QFIELD(FIELD_Q16, 8, gravity.z, 8) } },
+    [SH2_RAW_GYROSCOPE] = { 5, {
+        IFIELD(FIELD_S16, 4, rawGyroscope.x),
+        IFIELD(FIELD_S16, 6, rawGyroscope.y),
+        IFIELD(FIELD_S16, 8, rawGyroscope.z),
+        IFIELD(FIELD_S16, 10, rawGyroscope.temperature),
+        IFIELD(FIELD_U32, 12, rawGyroscope.timestamp) } },
+    [SH2_GYROSCOPE_CALIBRATED] = { 3, {
+        QFIELD(FIELD_Q16, 4, gyroscope.x, 9),
+        QFIELD(FIELD_Q16, 6, gyroscope.y, 9),
+        QFIELD(FIELD_Q16, 8, gyroscope.z, 9) } },
+    [SH2_GYROSCOPE_UNCALIBRATED] = { 6, {
+        QFIELD(FIELD_Q16, 4, gyroscopeUncal.x, 9),
+        QFIELD(FIELD_Q16, 6, gyroscopeUncal.y, 9),
+        QFIELD(FIELD_Q16, 8, gyroscopeUncal.z, 9),
+        QFIELD2(FIELD_Q16, 10, gyroscopeUncal.biasX, 9),
+        QFIELD2(FIELD_Q16, 12, gyroscopeUncal.biasY, 9),
+        QFIELD2(FIELD_Q16, 14, gyroscopeUncal.biasZ, 9) } },
+    [SH2_RAW_MAGNETOMETER] = { 4, {
+        IFIELD(FIELD_S16, 4, rawMagnetometer.x),
+        IFIELD(FIELD_S16, 6, rawMagnetometer.y),
+        IFIELD(FIELD_S16, 8, rawMagnetometer.z),
+        IFIELD(FIELD_U32, 12, rawMagnetometer.timestamp) } },
+    [SH2_MAGNETIC_FIELD_CALIBRATED] = { 3, {
+        QFIELD(FIELD_Q16, 4, magneticField.x, 4),
+        QFIELD(FIELD_Q16, 6, magneticField.y, 4),
+        QFIELD(FIELD_Q16, 8, magneticField.z, 4) } },
+    [SH2_MAGNETIC_FIELD_UNCALIBRATED] = { 6, {
+        QFIELD(FIELD_Q16, 4, magneticFieldUncal.x, 4),
+        QFIELD(FIELD_Q16, 6, magneticFieldUncal.y, 4),
+        QFIELD(FIELD_Q16, 8, magneticFieldUncal.z, 4),
+        QFIELD2(FIELD_Q16, 10, magneticFieldUncal.biasX, 4),
+        QFIELD2(FIELD_Q16, 12, magneticFieldUncal.biasY, 4),
+        QFIELD2(FIELD_Q16, 14, magneticFieldUncal.biasZ, 4) } },
+    [SH2_ROTATION_VECTOR] = { 5, {
+        QFIELD(FIELD_Q16, 4, rotationVector.i, 14),
+        QFIELD(FIELD_Q16, 6, rotationVector.j, 14),
+        QFIELD(FIELD_Q16, 8, rotationVector.k, 14),
+        QFIELD(FIELD_Q16, 10, rotationVector.real, 14),
+        QFIELD2(FIELD_Q16, 12, rotationVector.accuracy, 12) } },
+    [SH2_GAME_ROTATION_VECTOR] = { 4, {
+        QFIELD(FIELD_Q16, 4, gameRotationVector.i, 14),
+        QFIELD(FIELD_Q16, 6, gameRotationVector.j, 14),
+        QFIELD(FIELD_Q16, 8, gameRotationVector.k, 14),
+        QFIELD(FIELD_Q16, 10, gameRotationVector.real, 14) } },
+    [SH2_GEOMAGNETIC_ROTATION_VECTOR] = { 5, {
+        QFIELD(FIELD_Q16, 4, geoMagRotationVector.i, 14),
+        QFIELD(FIELD_Q16, 6, geoMagRotationVector.j, 14),
+        QFIELD(FIELD_Q16, 8, geoMagRotationVector.k, 14),
+        QFIELD(FIELD_Q16, 10, geoMagRotationVector.real, 14),
+        QFIELD2(FIELD_Q16, 12, geoMagRotationVector.accuracy, 12) } },
+    [SH2_PRESSURE] = { 1, {
+        QFIELD(FIELD_Q32, 4, pressure.value, 20) } },
+    [SH2_AMBIENT_LIGHT] = { 1, {
+        QFIELD(FIELD_Q32, 4, ambientLight.value, 8) } },
+    [SH2_HUMIDITY] = { 1, {
+        QFIELD(FIELD_Q16, 4, humidity.value, 8) } },
+    [SH2_PROXIMITY] = { 1, {
+        QFIELD(FIELD_Q16, 4, proximity.value, 4) } },
+    [SH2_TEMPERATURE] = { 1, {
+        QFIELD(FIELD_Q16, 4, temperature.value, 7) } },
+    [SH2_RESERVED] = { 1, {
+        QFIELD(FIELD_Q16, 4, reserved.tbd, 7) } },
+    [SH2_TAP_DETECTOR] = { 1, {
+        IFIELD(FIELD_U8, 4, tapDetector.flags) } },
+    [SH2_STEP_DETECTOR] = { 1, {
+        IFIELD(FIELD_U32, 4, stepDetector.latency) } },
+    [SH2_STEP_COUNTER] = { 2, {
+        IFIELD(FIELD_U32, 4, stepCounter.latency),
+        IFIELD(FIELD_U16, 8, stepCounter.steps) } },
+    [SH2_SIGNIFICANT_MOTION] = { 1, {
+        IFIELD(FIELD_U16, 4, sigMotion.motion) } },
+    [SH2_STABILITY_CLASSIFIER] = { 1, {
+        IFIELD(FIELD_U8, 4, stabilityClassifier.classification) } },
+    [SH2_SHAKE_DETECTOR] = { 1, {
+        IFIELD(FIELD_U16, 4, shakeDetector.shake) } },
+    [SH2_FLIP_DETECTOR] = { 1, {
+        IFIELD(FIELD_U16, 4, flipDetector.flip) } },
+    [SH2_PICKUP_DETECTOR] = { 1, {
+        IFIELD(FIELD_U16, 4, pickupDetector.pickup) } },
+    [SH2_STABILITY_DETECTOR] = { 1, {
+        IFIELD(FIELD_U16, 4, stabilityDetector.stability) } },
+    // SH2_PERSONAL_ACTIVITY_CLASSIFIER is decoded by decodePersonalActivityClassifier()
+    [SH2_SLEEP_DETECTOR] = { 1, {
+        IFIELD(FIELD_U8, 4, sleepDetector.sleepState) } },
+    [SH2_TILT_DETECTOR] = { 1, {
+        IFIELD(FIELD_U16, 4, tiltDetector.tilt) } },
+    [SH2_POCKET_DETECTOR] = { 1, {
+        IFIELD(FIELD_U16, 4, pocketDetector.pocket) } },
+    [SH2_CIRCLE_DETECTOR] = { 1, {
+        IFIELD(FIELD_U16, 4, circleDetector.circle) } },
+    [SH2_HEART_RATE_MONITOR] = { 1, {
+        IFIELD(FIELD_U16, 4, heartRateMonitor.heartRate) } },
+    [SH2_ARVR_STABILIZED_RV] = { 5, {
+        QFIELD(FIELD_Q16, 4, arvrStabilizedRV.i, 14),
+        QFIELD(FIELD_Q16, 6, arvrStabilizedRV.j, 14),
+        QFIELD(FIELD_Q16, 8, arvrStabilizedRV.k, 14),
+        QFIELD(FIELD_Q16, 10, arvrStabilizedRV.real, 14),
+        QFIELD2(FIELD_Q16, 12, arvrStabilizedRV.accuracy, 12) } },
+    [SH2_ARVR_STABILIZED_GRV] = { 4, {
+        QFIELD(FIELD_Q16, 4, arvrStabilizedGRV.i, 14),
+        QFIELD(FIELD_Q16, 6, arvrStabilizedGRV.j, 14),
+        QFIELD(FIELD_Q16, 8, arvrStabilizedGRV.k, 14),
+        QFIELD(FIELD_Q16, 10, arvrStabilizedGRV.real, 14) } },
+    // Gyro integrated RV reports carry only the report id, no sequence/status
+    [SH2_GYRO_INTEGRATED_RV] = { 7, {
+        QFIELD(FIELD_Q16, 1, gyroIntegratedRV.i, 14),
+        QFIELD(FIELD_Q16, 3, gyroIntegratedRV.j, 14),
+        QFIELD(FIELD_Q16, 5, gyroIntegratedRV.k, 14),
+        QFIELD(FIELD_Q16, 7, gyroIntegratedRV.real, 14),
+        QFIXED(FIELD_Q16, 9, gyroIntegratedRV.angVelX, 10),
+        QFIXED(FIELD_Q16, 11, gyroIntegratedRV.angVelY, 10),
+        QFIXED(FIELD_Q16, 13, gyroIntegratedRV.angVelZ, 10) } },
+};
 
 // ------------------------------------------------------------------------
-// Public API
-
-int sh2_decodeSensorEvent(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	// Fill out fields of *value based on *event, converting data from message representation
-	// to natural representation.
+// SIMD conversion of int16 fixed point fields
+
+// SIMD paths assume a little endian host, like the reports themselves.
+#if !defined(SH2_NO_SIMD) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define USE_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define USE_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define USE_NEON
+#endif
+#endif
+
+// Little endian int16 at p, inlined for the conversion loops
+#define LE16(p) ((int16_t)((p)[0] | ((p)[1] << 8)))
+
+#if defined(USE_AVX2) || defined(USE_SSE2)
+// Gather n int16 fields into the low lanes of a vector.  Lanes are
+// inserted one by one so nothing past the last field is read.
+static inline __m128i loadQ16(const uint8_t *in, int n)
+{
+    __m128i v = _mm_setzero_si128();
+    if (n > 0) v = _mm_insert_epi16(v, LE16(in+0), 0);
+    if (n > 1) v = _mm_insert_epi16(v, LE16(in+2), 1);
+    if (n > 2) v = _mm_insert_epi16(v, LE16(in+4), 2);
+    if (n > 3) v = _mm_insert_epi16(v, LE16(in+6), 3);
+    if (n > 4) v = _mm_insert_epi16(v, LE16(in+8), 4);
+    if (n > 5) v = _mm_insert_epi16(v, LE16(in+10), 5);
+    if (n > 6) v = _mm_insert_epi16(v, LE16(in+12), 6);
+    return v;
+}
+#elif defined(USE_NEON)
+static inline int16x8_t loadQ16(const uint8_t *in, int n)
+{
+    int16x8_t v = vdupq_n_s16(0);
+    if (n > 0) v = vsetq_lane_s16(LE16(in+0), v, 0);
+    if (n > 1) v = vsetq_lane_s16(LE16(in+2), v, 1);
+    if (n > 2) v = vsetq_lane_s16(LE16(in+4), v, 2);
+    if (n > 3) v = vsetq_lane_s16(LE16(in+6), v, 3);
+    if (n > 4) v = vsetq_lane_s16(LE16(in+8), v, 4);
+    if (n > 5) v = vsetq_lane_s16(LE16(in+10), v, 5);
+    if (n > 6) v = vsetq_lane_s16(LE16(in+12), v, 6);
+    return v;
+}
+#endif
+
+// Convert n (up to MAX_DECODER_FIELDS) consecutive int16 fields at in
+// to float, multiplying field i by scale[i].  Called with constant n so
+// the lane loads and the final copy are unrolled.
+static inline void convertQ16(float *out, const uint8_t *in, const float *scale, int n)
+{
+#if defined(USE_AVX2) || defined(USE_SSE2) || defined(USE_NEON)
+    // Results are staged so nothing past the last field is written.
+    float f[8];
+#if defined(USE_AVX2)
+    __m256i v = _mm256_cvtepi16_epi32(loadQ16(in, n));
+    _mm256_storeu_ps(f, _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_loadu_ps(scale)));
+#elif defined(USE_SSE2)
+    __m128i v = loadQ16(in, n);
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    _mm_storeu_ps(f, _mm_mul_ps(_mm_cvtepi32_ps(lo), _mm_loadu_ps(scale)));
+    if (n > 4) {
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(f+4, _mm_mul_ps(_mm_cvtepi32_ps(hi), _mm_loadu_ps(scale+4)));
+    }
+#elif defined(USE_NEON)
+    int16x8_t v = loadQ16(in, n);
+    vst1q_f32(f, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), vld1q_f32(scale)));
+    if (n > 4) {
+        vst1q_f32(f+4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), vld1q_f32(scale+4)));
+    }
+#endif
+    memcpy(out, f, n*sizeof(float));
+#else
+    for (int i = 0; i < n; i++) {
+        out[i] = LE16(&in[i*2]) * scale[i];
+    }
+#endif
+}
 
-	int rc = SH2_OK;
+// ------------------------------------------------------------------------
+// Private decoding helpers
 
+// Fill in the fields common to all sensors.
+static inline void decodeHeader(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event,
+                                const uint8_t *report)
+{
 	value->sensorId = event->reportId;
 	value->timestamp = event->timestamp_uS;
 
     if (value->sensorId != SH2_GYRO_INTEGRATED_RV) {
-        value->sequence = event->report[1];
-        value->status = event->report[2] & 0x03;
+        value->sequence = report[1];
+        value->status = report[2] & 0x03;
     }
     else {
         value->sequence = 0;
         value->status = 0;
     }
-
-	// extract delay field (100uS units)
-	
-	
-	switch (value->sensorId) {
-	case SH2_RAW_ACCELEROMETER:
-		rc = decodeRawAccelerometer(value, event);
-		break;
-	case SH2_ACCELEROMETER:
-		rc = decodeAccelerometer(value, event);
-		break;
-	case SH2_LINEAR_ACCELERATION:
-		rc = decodeLinearAcceleration(value, event);
-		break;
-	case SH2_GRAVITY:
-		rc = decodeGravity(value, event);
-		break;
-	case SH2_RAW_GYROSCOPE:
-		rc = decodeRawGyroscope(value, event);
-		break;
-	case SH2_GYROSCOPE_CALIBRATED:
-		rc = decodeGyroscopeCalibrated(value, event);
-		break;
-	case SH2_GYROSCOPE_UNCALIBRATED:
-		rc = decodeGyroscopeUncal(value, event);
-		break;
-	case SH2_RAW_MAGNETOMETER:
-		rc = decodeRawMagnetometer(value, event);
-		break;
-	case SH2_MAGNETIC_FIELD_CALIBRATED:
-		rc = decodeMagneticFieldCalibrated(value, event);
-		break;
-	case SH2_MAGNETIC_FIELD_UNCALIBRATED:
-		rc = decodeMagneticFieldUncal(value, event);
-		break;
-	case SH2_ROTATION_VECTOR:
-		rc = decodeRotationVector(value, event);
-		break;
-	case SH2_GAME_ROTATION_VECTOR:
-		rc = decodeGameRotationVector(value, event);
-		break;
-	case SH2_GEOMAGNETIC_ROTATION_VECTOR:
-		rc = decodeGeomagneticRotationVector(value, event);
-		break;
-	case SH2_PRESSURE:
-		rc = decodePressure(value, event);
-		break;
-	case SH2_AMBIENT_LIGHT:
-		rc = decodeAmbientLight(value, event);
-		break;
-	case SH2_HUMIDITY:
-		rc = decodeHumidity(value, event);
-		break;
-	case SH2_PROXIMITY:
-		rc = decodeProximity(value, event);
-		break;
-	case SH2_TEMPERATURE:
-		rc = decodeTemperature(value, event);
-		break;
-	case SH2_RESERVED:
-		rc = decodeReserved(value, event);
-		break;
-	case SH2_TAP_DETECTOR:
-		rc = decodeTapDetector(value, event);
-		break;
-	case SH2_STEP_DETECTOR:
-		rc = decodeStepDetector(value, event);
-		break;
-	case SH2_STEP_COUNTER:
-		rc = decodeStepCounter(value, event);
-		break;
-	case SH2_SIGNIFICANT_MOTION:
-		rc = decodeSignificantMotion(value, event);
-		break;
-	case SH2_STABILITY_CLASSIFIER:
-		rc = decodeStabilityClassifier(value, event);
-		break;
-	case SH2_SHAKE_DETECTOR:
-		rc = decodeShakeDetector(value, event);
-		break;
-	case SH2_FLIP_DETECTOR:
-		rc = decodeFlipDetector(value, event);
-		break;
-	case SH2_PICKUP_DETECTOR:
-		rc = decodePickupDetector(value, event);
-		break;
-	case SH2_STABILITY_DETECTOR:
-		rc = decodeStabilityDetector(value, event);
-		break;
-	case SH2_PERSONAL_ACTIVITY_CLASSIFIER:
-		rc = decodePersonalActivityClassifier(value, event);
-		break;
-	case SH2_SLEEP_DETECTOR:
-		rc = decodeSleepDetector(value, event);
-		break;
-	case SH2_TILT_DETECTOR:
-		rc = decodeTiltDetector(value, event);
-		break;
-	case SH2_POCKET_DETECTOR:
-		rc = decodePocketDetector(value, event);
-		break;
-	case SH2_CIRCLE_DETECTOR:
-		rc = decodeCircleDetector(value, event);
-		break;
-    case SH2_HEART_RATE_MONITOR:
-		rc = decodeHeartRateMonitor(value, event);
-        break;
-    case SH2_ARVR_STABILIZED_RV:
-		rc = decodeArvrStabilizedRV(value, event);
-        break;
-    case SH2_ARVR_STABILIZED_GRV:
-		rc = decodeArvrStabilizedGRV(value, event);
-        break;
-    case SH2_GYRO_INTEGRATED_RV:
-		rc = decodeGyroIntegratedRV(value, event);
-        break;
-	default:
-		// Unknown report id
-		rc = SH2_ERR;
-		break;
-	}
-
-	return rc;
 }
 
-// ------------------------------------------------------------------------
-// Private utility functions
-
-static int decodeRawAccelerometer(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+// Value of a FIELD_Q16 or FIELD_Q32 field
+static inline float decodeQField(const uint8_t *report, const FieldDesc_t *f, float scale)
 {
-	value->un.rawAccelerometer.x = read16(&event->report[4]);
-	value->un.rawAccelerometer.y = read16(&event->report[6]);
-	value->un.rawAccelerometer.z = read16(&event->report[8]);
-	value->un.rawAccelerometer.timestamp = read32(&event->report[12]);
+    const uint8_t *in = &report[f->reportOffset];
 
-	return SH2_OK;
+    if (f->kind == FIELD_Q32) {
+        return read32(in) * scale;
+    }
+    return read16(in) * scale;
+}
+
+static inline void decodeField(sh2_SensorValue_t *value, const uint8_t *report,
+                               const FieldDesc_t *f, float scale)
+{
+    const uint8_t *in = &report[f->reportOffset];
+    void *pOut = (uint8_t *)value + f->valueOffset;
+
+    switch (f->kind) {
+        case FIELD_Q16:
+        case FIELD_Q32:
+            *(float *)pOut = decodeQField(report, f, scale);
+            break;
+        case FIELD_S16:
+            *(int16_t *)pOut = read16(in);
+            break;
+        case FIELD_U8:
+            *(uint8_t *)pOut = *in;
+            break;
+        case FIELD_U16:
+            *(uint16_t *)pOut = readu16(in);
+            break;
+        case FIELD_U32:
+            *(uint32_t *)pOut = readu32(in);
+            break;
+    }
 }
 
-static int decodeAccelerometer(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+// Look up the table decoder for a sensor, or NULL if it has none.
+static inline const SensorDecoder_t *getDecoder(uint8_t sensorId)
 {
-	value->un.accelerometer.x = read16(&event->report[4]) * SCALE_Q(8);
-	value->un.accelerometer.y = read16(&event->report[6]) * SCALE_Q(8);
-	value->un.accelerometer.z = read16(&event->report[8]) * SCALE_Q(8);
+    if ((sensorId > SH2_MAX_SENSOR_ID) || (decoder[sensorId].numFields == 0)) {
+        return 0;
+    }
 
-	return SH2_OK;
+    return &decoder[sensorId];
 }
 
-static int decodeLinearAcceleration(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+// Q point of a fixed point field, from metadata in pQPoints if known.
+static inline uint8_t fieldQ(const sh2_SensorQPoints_t *pQPoints, uint8_t sensorId,
+                             const FieldDesc_t *f)
 {
-	value->un.linearAcceleration.x = read16(&event->report[4]) * SCALE_Q(8);
-	value->un.linearAcceleration.y = read16(&event->report[6]) * SCALE_Q(8);
-	value->un.linearAcceleration.z = read16(&event->report[8]) * SCALE_Q(8);
+    if ((pQPoints != 0) && (f->qSource != Q_FIXED) && pQPoints->valid[sensorId]) {
+        return pQPoints->qPoint[sensorId][f->qSource - Q_POINT1];
+    }
 
-	return SH2_OK;
+    return f->q;
 }
 
-static int decodeGravity(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+// Store the scales of a sensor's fields in pQPoints
+static void updateFieldScales(sh2_SensorQPoints_t *pQPoints, uint8_t sensorId)
 {
-	value->un.gravity.x = read16(&event->report[4]) * SCALE_Q(8);
-	value->un.gravity.y = read16(&event->report[6]) * SCALE_Q(8);
-	value->un.gravity.z = read16(&event->report[8]) * SCALE_Q(8);
-
-	return SH2_OK;
-}
-
-static int decodeRawGyroscope(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.rawGyroscope.x = read16(&event->report[4]);
-	value->un.rawGyroscope.y = read16(&event->report[6]);
-	value->un.rawGyroscope.z = read16(&event->report[8]);
-	value->un.rawGyroscope.temperature = read16(&event->report[10]);
-	value->un.rawGyroscope.timestamp = read32(&event->report[12]);
-
-	return SH2_OK;
+    for (int n = 0; n < decoder[sensorId].numFields; n++) {
+        uint8_t q = fieldQ(pQPoints, sensorId, &decoder[sensorId].field[n]);
+        pQPoints->scale[sensorId][n] = SCALE_Q(q);
+    }
 }
 
-static int decodeGyroscopeCalibrated(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+// Scale of each field of a sensor, 1/2^q with q from fieldQ().  Taken from
+// pQPoints if given, else the built-in scales are copied to builtIn.
+static inline const float *getFieldScales(const sh2_SensorQPoints_t *pQPoints,
+                                          uint8_t sensorId, float *builtIn)
 {
-	value->un.gyroscope.x = read16(&event->report[4]) * SCALE_Q(9);
-	value->un.gyroscope.y = read16(&event->report[6]) * SCALE_Q(9);
-	value->un.gyroscope.z = read16(&event->report[8]) * SCALE_Q(9);
+    if (pQPoints != 0) {
+        return pQPoints->scale[sensorId];
+    }
 
-	return SH2_OK;
+    for (int n = 0; n < decoder[sensorId].numFields; n++) {
+        builtIn[n] = decoder[sensorId].field[n].scale;
+    }
+    return builtIn;
 }
 
-static int decodeGyroscopeUncal(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+// Decode events using convertQ16() for the runLen fields starting at pRun
+// and decodeField() for the others.
+static inline void decodeBatch(sh2_SensorValue_t *values,
+                               const sh2_SensorEvent_t *events, uint16_t numEvents,
+                               const FieldDesc_t *pRun, const float *scale, int runLen,
+                               const FieldDesc_t **other, const float *otherScale, int numOther)
 {
-	value->un.gyroscopeUncal.x = read16(&event->report[4]) * SCALE_Q(9);
-	value->un.gyroscopeUncal.y = read16(&event->report[6]) * SCALE_Q(9);
-	value->un.gyroscopeUncal.z = read16(&event->report[8]) * SCALE_Q(9);
+    for (int e = 0; e < numEvents; e++) {
+        sh2_SensorValue_t *value = &values[e];
+        const uint8_t *report = events[e].report;
 
-	value->un.gyroscopeUncal.biasX = read16(&event->report[10]) * SCALE_Q(9);
-	value->un.gyroscopeUncal.biasY = read16(&event->report[12]) * SCALE_Q(9);
-	value->un.gyroscopeUncal.biasZ = read16(&event->report[14]) * SCALE_Q(9);
+        decodeHeader(value, &events[e], report);
 
-	return SH2_OK;
+        if (runLen > 0) {
+            convertQ16((float *)((uint8_t *)value + pRun->valueOffset),
+                       &report[pRun->reportOffset], scale, runLen);
+        }
+        for (int n = 0; n < numOther; n++) {
+            decodeField(value, report, other[n], otherScale[n]);
+        }
+    }
 }
 
-static int decodeRawMagnetometer(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.rawMagnetometer.x = read16(&event->report[4]);
-	value->un.rawMagnetometer.y = read16(&event->report[6]);
-	value->un.rawMagnetometer.z = read16(&event->report[8]);
-	value->un.rawMagnetometer.timestamp = read32(&event->report[12]);
-
-	return SH2_OK;
-}
+// ------------------------------------------------------------------------
+// Public API
 
-static int decodeMagneticFieldCalibrated(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+int sh2_decodeSensorEvent(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
 {
-	value->un.magneticField.x = read16(&event->report[4]) * SCALE_Q(4);
-	value->un.magneticField.y = read16(&event->report[6]) * SCALE_Q(4);
-	value->un.magneticField.z = read16(&event->report[8]) * SCALE_Q(4);
-
-	return SH2_OK;
+    return sh2_decodeSensorReport(value, event, event->report, 0);
 }
 
-static int decodeMagneticFieldUncal(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+int sh2_decodeSensorReport(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event,
+                           const uint8_t *report, const sh2_SensorQPoints_t *pQPoints)
 {
-	value->un.magneticFieldUncal.x = read16(&event->report[4]) * SCALE_Q(4);
-	value->un.magneticFieldUncal.y = read16(&event->report[6]) * SCALE_Q(4);
-	value->un.magneticFieldUncal.z = read16(&event->report[8]) * SCALE_Q(4);
-
-	value->un.magneticFieldUncal.biasX = read16(&event->report[10]) * SCALE_Q(4);
-	value->un.magneticFieldUncal.biasY = read16(&event->report[12]) * SCALE_Q(4);
-	value->un.magneticFieldUncal.biasZ = read16(&event->report[14]) * SCALE_Q(4);
+	// Fill out fields of *value based on *event, converting data from message representation
+	// to natural representation.
 
-	return SH2_OK;
-}
+    decodeHeader(value, event, report);
 
-static int decodeRotationVector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.rotationVector.i = read16(&event->report[4]) * SCALE_Q(14);
-	value->un.rotationVector.j = read16(&event->report[6]) * SCALE_Q(14);
-	value->un.rotationVector.k = read16(&event->report[8]) * SCALE_Q(14);
-	value->un.rotationVector.real = read16(&event->report[10]) * SCALE_Q(14);
-	value->un.rotationVector.accuracy = read16(&event->report[12]) * SCALE_Q(12);
+    if (value->sensorId == SH2_PERSONAL_ACTIVITY_CLASSIFIER) {
+        return decodePersonalActivityClassifier(value, report);
+    }
 
-	return SH2_OK;
-}
+    const SensorDecoder_t *pDecoder = getDecoder(value->sensorId);
+    if (pDecoder == 0) {
+		// Unknown report id
+        return SH2_ERR;
+    }
 
-static int decodeGameRotationVector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.gameRotationVector.i = read16(&event->report[4]) * SCALE_Q(14);
-	value->un.gameRotationVector.j = read16(&event->report[6]) * SCALE_Q(14);
-	value->un.gameRotationVector.k = read16(&event->report[8]) * SCALE_Q(14);
-	value->un.gameRotationVector.real = read16(&event->report[10]) * SCALE_Q(14);
+    float builtIn[MAX_DECODER_FIELDS];
+    const float *scale = getFieldScales(pQPoints, value->sensorId, builtIn);
+    for (int n = 0; n < pDecoder->numFields; n++) {
+        decodeField(value, report, &pDecoder->field[n], scale[n]);
+    }
 
 	return SH2_OK;
 }
 
-static int decodeGeomagneticRotationVector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+int sh2_decodeSensorEventsBatch(sh2_SensorValue_t *values,
+                                const sh2_SensorEvent_t *events, uint16_t numEvents,
+                                const sh2_SensorQPoints_t *pQPoints)
 {
-	value->un.geoMagRotationVector.i = read16(&event->report[4]) * SCALE_Q(14);
-	value->un.geoMagRotationVector.j = read16(&event->report[6]) * SCALE_Q(14);
-	value->un.geoMagRotationVector.k = read16(&event->report[8]) * SCALE_Q(14);
-	value->un.geoMagRotationVector.real = read16(&event->report[10]) * SCALE_Q(14);
-	value->un.geoMagRotationVector.accuracy = read16(&event->report[12]) * SCALE_Q(12);
+    if (numEvents == 0) return SH2_OK;
+    if ((values == 0) || (events == 0)) return SH2_ERR_BAD_PARAM;
 
-	return SH2_OK;
-}
+    uint8_t sensorId = events[0].reportId;
+    for (int e = 1; e < numEvents; e++) {
+        if (events[e].reportId != sensorId) return SH2_ERR_BAD_PARAM;
+    }
 
-static int decodePressure(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.pressure.value = read32(&event->report[4]) * SCALE_Q(20);
+    const SensorDecoder_t *pDecoder = getDecoder(sensorId);
+    if (pDecoder == 0) {
+        // No table decoder (unknown id or special case), decode one by one.
+        for (int e = 0; e < numEvents; e++) {
+            int rc = sh2_decodeSensorReport(&values[e], &events[e], events[e].report, pQPoints);
+            if (rc != SH2_OK) return rc;
+        }
+        return SH2_OK;
+    }
 
-	return SH2_OK;
-}
+    // Find the run of int16 fixed point fields that are consecutive in
+    // both the report and sh2_SensorValue_t.  Those are converted together.
+    int runStart = 0;
+    int runLen = 0;
+    for (int n = 0; n < pDecoder->numFields; n++) {
+        int len = 0;
+        while ((n + len < pDecoder->numFields) &&
+               (pDecoder->field[n+len].kind == FIELD_Q16) &&
+               (pDecoder->field[n+len].reportOffset == pDecoder->field[n].reportOffset + 2*len) &&
+               (pDecoder->field[n+len].valueOffset == pDecoder->field[n].valueOffset + sizeof(float)*len)) {
+            len++;
+        }
+        if (len > runLen) {
+            runStart = n;
+            runLen = len;
+        }
+    }
+    if (runLen < 2) {
+        runLen = 0;
+    }
 
-static int decodeAmbientLight(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.ambientLight.value = read32(&event->report[4]) * SCALE_Q(8);
+    float builtIn[MAX_DECODER_FIELDS];
+    const float *fieldScales = getFieldScales(pQPoints, sensorId, builtIn);
+    float scale[8] = {0};
+    for (int n = 0; n < runLen; n++) {
+        scale[n] = fieldScales[runStart+n];
+    }
 
-	return SH2_OK;
-}
+    // Fields outside the run are decoded one at a time
+    const FieldDesc_t *other[MAX_DECODER_FIELDS];
+    float otherScale[MAX_DECODER_FIELDS];
+    int numOther = 0;
+    for (int n = 0; n < pDecoder->numFields; n++) {
+        if ((n < runStart) || (n >= runStart + runLen)) {
+            other[numOther] = &pDecoder->field[n];
+            otherScale[numOther] = fieldScales[n];
+            numOther++;
+        }
+    }
 
-static int decodeHumidity(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.humidity.value = read16(&event->report[4]) * SCALE_Q(8);
+    // Dispatch on the run length so each loop converts a constant number
+    // of fields.
+    const FieldDesc_t *pRun = &pDecoder->field[runStart];
+    switch (runLen) {
+        case 2: decodeBatch(values, events, numEvents, pRun, scale, 2, other, otherScale, numOther); break;
+        case 3: decodeBatch(values, events, numEvents, pRun, scale, 3, other, otherScale, numOther); break;
+        case 4: decodeBatch(values, events, numEvents, pRun, scale, 4, other, otherScale, numOther); break;
+        case 5: decodeBatch(values, events, numEvents, pRun, scale, 5, other, otherScale, numOther); break;
+        case 6: decodeBatch(values, events, numEvents, pRun, scale, 6, other, otherScale, numOther); break;
+        case 7: decodeBatch(values, events, numEvents, pRun, scale, 7, other, otherScale, numOther); break;
+        default: decodeBatch(values, events, numEvents, pRun, scale, 0, other, otherScale, numOther); break;
+    }
 
-	return SH2_OK;
+    return SH2_OK;
 }
 
-static int decodeProximity(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+int sh2_getSensorColumnCount(sh2_SensorId_t sensorId)
 {
-	value->un.proximity.value = read16(&event->report[4]) * SCALE_Q(4);
+    const SensorDecoder_t *pDecoder = getDecoder(sensorId);
+    if (pDecoder == 0) return SH2_ERR_BAD_PARAM;
 
-	return SH2_OK;
-}
+    // Only sensors whose fields are all fixed point have float columns
+    for (int n = 0; n < pDecoder->numFields; n++) {
+        if ((pDecoder->field[n].kind != FIELD_Q16) &&
+            (pDecoder->field[n].kind != FIELD_Q32)) {
+            return SH2_ERR_BAD_PARAM;
+        }
+    }
 
-static int decodeTemperature(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.temperature.value = read16(&event->report[4]) * SCALE_Q(7);
+    return pDecoder->numFields;
+}
+
+int sh2_decodeSensorEventsToColumns(sh2_SensorColumns_t *pColumns,
+                                    const sh2_SensorEvent_t *events, uint16_t numEvents)
+{
+    if ((pColumns == 0) || ((events == 0) && (numEvents > 0))) return SH2_ERR_BAD_PARAM;
+
+    int numColumns = sh2_getSensorColumnCount(pColumns->sensorId);
+    if (numColumns < 0) return numColumns;
+
+    const SensorDecoder_t *pDecoder = &decoder[pColumns->sensorId];
+    float builtIn[MAX_DECODER_FIELDS];
+    const float *scale = getFieldScales(pColumns->pQPoints, pColumns->sensorId, builtIn);
+    bool hasHeader = (pColumns->sensorId != SH2_GYRO_INTEGRATED_RV);
+    int added = 0;
+
+    for (int e = 0; e < numEvents; e++) {
+        if (events[e].reportId != pColumns->sensorId) continue;
+        if (pColumns->count >= pColumns->capacity) break;
+
+        const uint8_t *report = events[e].report;
+        uint32_t row = pColumns->count++;
+
+        if (pColumns->timestamp != 0) {
+            pColumns->timestamp[row] = events[e].timestamp_uS;
+        }
+        if (pColumns->sequence != 0) {
+            pColumns->sequence[row] = hasHeader ? report[1] : 0;
+        }
+        if (pColumns->status != 0) {
+            pColumns->status[row] = hasHeader ? (report[2] & 0x03) : 0;
+        }
+        for (int n = 0; n < numColumns; n++) {
+            if (pColumns->column[n] != 0) {
+                pColumns->column[n][row] = decodeQField(report, &pDecoder->field[n], scale[n]);
+            }
+        }
+        added++;
+    }
 
-	return SH2_OK;
+    return added;
 }
 
-static int decodeReserved(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+void sh2_initSensorQPoints(sh2_SensorQPoints_t *pQPoints)
 {
-	value->un.reserved.tbd = read16(&event->report[4]) * SCALE_Q(7);
-
-	return SH2_OK;
+    memset(pQPoints, 0, sizeof(*pQPoints));
+    for (int id = 0; id <= SH2_MAX_SENSOR_ID; id++) {
+        updateFieldScales(pQPoints, id);
+    }
 }
 
-static int decodeTapDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+int sh2_setSensorQPoints(sh2_SensorQPoints_t *pQPoints,
+                         sh2_SensorId_t sensorId, const sh2_SensorMetadata_t *pMetadata)
 {
-	value->un.tapDetector.flags = event->report[4];
+    if ((pQPoints == 0) || (sensorId > SH2_MAX_SENSOR_ID)) return SH2_ERR_BAD_PARAM;
 
-	return SH2_OK;
-}
+    if (pMetadata == 0) {
+        // Back to the built-in q points
+        pQPoints->valid[sensorId] = false;
+    }
+    else {
+        // Revision 0 means the record was never filled in.  No field that
+        // metadata describes is an integer, so a q point of 0 in use means
+        // a bad record too.
+        if ((pMetadata->revision == 0) ||
+            (pMetadata->qPoint1 > 30) || (pMetadata->qPoint2 > 30)) {
+            return SH2_ERR_BAD_PARAM;
+        }
+        for (int n = 0; n < decoder[sensorId].numFields; n++) {
+            uint8_t qSource = decoder[sensorId].field[n].qSource;
+            if (((qSource == Q_POINT1) && (pMetadata->qPoint1 == 0)) ||
+                ((qSource == Q_POINT2) && (pMetadata->qPoint2 == 0))) {
+                return SH2_ERR_BAD_PARAM;
+            }
+        }
+
+        pQPoints->qPoint[sensorId][0] = pMetadata->qPoint1;
+        pQPoints->qPoint[sensorId][1] = pMetadata->qPoint2;
+        pQPoints->valid[sensorId] = true;
+    }
 
-static int decodeStepDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.stepDetector.latency = readu32(&event->report[4]);
+    // Recompute the scales used by the float decoders
+    updateFieldScales(pQPoints, sensorId);
 
-	return SH2_OK;
+    return SH2_OK;
 }
 
-static int decodeStepCounter(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+int sh2_loadSensorQPoints(sh2_SensorQPoints_t *pQPoints, sh2_MetadataReader_t *readMetadata)
 {
-	value->un.stepCounter.latency = readu32(&event->report[4]);
-	value->un.stepCounter.steps = readu32(&event->report[8]);
+    sh2_SensorMetadata_t metadata;
+    int loaded = 0;
 
-	return SH2_OK;
-}
+    if ((pQPoints == 0) || (readMetadata == 0)) return SH2_ERR_BAD_PARAM;
 
-static int decodeSignificantMotion(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.sigMotion.motion = readu16(&event->report[4]);
+    for (int id = 0; id <= SH2_MAX_SENSOR_ID; id++) {
+        // Only sensors with metadata described fixed point fields
+        bool hasQ = false;
+        for (int n = 0; n < decoder[id].numFields; n++) {
+            if (decoder[id].field[n].qSource != Q_FIXED) {
+                hasQ = true;
+            }
+        }
+        if (!hasQ) continue;
 
-	return SH2_OK;
-}
-
-static int decodeStabilityClassifier(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.stabilityClassifier.classification = event->report[4];
+        // Sensors the hub doesn't support have no metadata; keep built-in q points.
+        if (readMetadata(id, &metadata) != SH2_OK) continue;
+        if (sh2_setSensorQPoints(pQPoints, id, &metadata) == SH2_OK) {
+            loaded++;
+        }
+    }
 
-	return SH2_OK;
+    return loaded;
 }
 
-static int decodeShakeDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+int sh2_decodeSensorEventQ(sh2_SensorValueQ_t *value, const sh2_SensorEvent_t *event,
+                           const sh2_SensorQPoints_t *pQPoints)
 {
-	value->un.shakeDetector.shake = readu16(&event->report[4]);
+    if ((value == 0) || (event == 0)) return SH2_ERR_BAD_PARAM;
 
-	return SH2_OK;
-}
-
-static int decodeFlipDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.flipDetector.flip = readu16(&event->report[4]);
+    int numFields = sh2_getSensorColumnCount(event->reportId);
+    if (numFields < 0) return numFields;
 
-	return SH2_OK;
-}
+    const SensorDecoder_t *pDecoder = &decoder[event->reportId];
+    const uint8_t *report = event->report;
 
-static int decodePickupDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.pickupDetector.pickup = readu16(&event->report[4]);
+    value->sensorId = event->reportId;
+    value->timestamp = event->timestamp_uS;
+    if (value->sensorId != SH2_GYRO_INTEGRATED_RV) {
+        value->sequence = report[1];
+        value->status = report[2] & 0x03;
+    }
+    else {
+        value->sequence = 0;
+        value->status = 0;
+    }
 
-	return SH2_OK;
-}
+    value->numFields = numFields;
+    for (int n = 0; n < numFields; n++) {
+        const FieldDesc_t *f = &pDecoder->field[n];
+        const uint8_t *in = &report[f->reportOffset];
 
-static int decodeStabilityDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.stabilityDetector.stability = readu16(&event->report[4]);
+        value->value[n] = (f->kind == FIELD_Q32) ? read32(in) : read16(in);
+        value->qPoint[n] = fieldQ(pQPoints, value->sensorId, f);
+    }
 
-	return SH2_OK;
+    return SH2_OK;
 }
 
-static int decodePersonalActivityClassifier(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static int decodePersonalActivityClassifier(sh2_SensorValue_t *value, const uint8_t *report)
 {
-	value->un.personalActivityClassifier.page = event->report[4] & 0x7F;
-	value->un.personalActivityClassifier.lastPage = ((event->report[4] & 0x80) != 0);
-	value->un.personalActivityClassifier.mostLikelyState = event->report[5];
+	value->un.personalActivityClassifier.page = report[4] & 0x7F;
+	value->un.personalActivityClassifier.lastPage = ((report[4] & 0x80) != 0);
+	value->un.personalActivityClassifier.mostLikelyState = report[5];
 	for (int n = 0; n < 10; n++) {
-		value->un.personalActivityClassifier.confidence[n] = event->report[6+n];
+		value->un.personalActivityClassifier.confidence[n] = report[6+n];
 	}
 	
 	return SH2_OK;
 }
 
-static int decodeSleepDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.sleepDetector.sleepState = event->report[4];
-
-	return SH2_OK;
-}
-
-static int decodeTiltDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.tiltDetector.tilt = readu16(&event->report[4]);
-
-	return SH2_OK;
-}
-
-static int decodePocketDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.pocketDetector.pocket = readu16(&event->report[4]);
-
-	return SH2_OK;
-}
-
-static int decodeCircleDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.circleDetector.circle = readu16(&event->report[4]);
-
-	return SH2_OK;
-}
-
-static int decodeHeartRateMonitor(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-    value->un.heartRateMonitor.heartRate = readu16(&event->report[4]);
-
-    return SH2_OK;
-}
-
-static int decodeArvrStabilizedRV(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.arvrStabilizedRV.i = read16(&event->report[4]) * SCALE_Q(14);
-	value->un.arvrStabilizedRV.j = read16(&event->report[6]) * SCALE_Q(14);
-	value->un.arvrStabilizedRV.k = read16(&event->report[8]) * SCALE_Q(14);
-	value->un.arvrStabilizedRV.real = read16(&event->report[10]) * SCALE_Q(14);
-	value->un.arvrStabilizedRV.accuracy = read16(&event->report[12]) * SCALE_Q(12);
-
-    return SH2_OK;
-}
-
-static int decodeArvrStabilizedGRV(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-	value->un.arvrStabilizedGRV.i = read16(&event->report[4]) * SCALE_Q(14);
-	value->un.arvrStabilizedGRV.j = read16(&event->report[6]) * SCALE_Q(14);
-	value->un.arvrStabilizedGRV.k = read16(&event->report[8]) * SCALE_Q(14);
-	value->un.arvrStabilizedGRV.real = read16(&event->report[10]) * SCALE_Q(14);
-
-    return SH2_OK;
-}
-
-static int decodeGyroIntegratedRV(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
-{
-    value->un.gyroIntegratedRV.i = read16(&event->report[0]) * SCALE_Q(14);
-    value->un.gyroIntegratedRV.j = read16(&event->report[2]) * SCALE_Q(14);
-    value->un.gyroIntegratedRV.k = read16(&event->report[4]) * SCALE_Q(14);
-    value->un.gyroIntegratedRV.real = read16(&event->report[6]) * SCALE_Q(14);
-    value->un.gyroIntegratedRV.angVelX = read16(&event->report[8]) * SCALE_Q(10);
-    value->un.gyroIntegratedRV.angVelY = read16(&event->report[10]) * SCALE_Q(10);
-    value->un.gyroIntegratedRV.angVelZ = read16(&event->report[12]) * SCALE_Q(10);
-
-    return SH2_OK;
-}
-
-
@@ -495,8 +495,173 @@ typedef struct sh2_SensorValue {
 	} un;
 } sh2_SensorValue_t;
 
+/**
+ * @brief Q points of each sensor, and the float scale factors they give.
+ *
+ * Allocated by the caller and set up with the built-in q points by
+ * sh2_initSensorQPoints(); sh2_setSensorQPoints() and sh2_loadSensorQPoints()
+ * replace them with those of the hub's metadata.  Decoders only read it,
+ * so once set up it can be shared by any number of threads.  Decoders
+ * passed NULL use the built-in q points.  The members are private to
+ * sh2_SensorValue.c.
+ */
+#define SH2_MAX_SENSOR_COLUMNS (7)
+typedef struct sh2_SensorQPoints {
+    bool valid[SH2_MAX_SENSOR_ID+1];
+    uint8_t qPoint[SH2_MAX_SENSOR_ID+1][2];  // qPoint1, qPoint2
+    float scale[SH2_MAX_SENSOR_ID+1][SH2_MAX_SENSOR_COLUMNS];
+} sh2_SensorQPoints_t;
+
 int sh2_decodeSensorEvent(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
 
+/**
+ * @brief Decode a sensor event whose report is held elsewhere, or with metadata q points.
+ *
+ * For events delivered by sh2_setSensorCallbackNoCopy(): pass the event's
+ * pReport.  The other decoders only use the event's report[].
+ *
+ * @param  value Structure to receive the results.
+ * @param  event Event to decode, for its reportId and timestamp.
+ * @param  report The report data.
+ * @param  pQPoints Q points to decode with, or NULL for the built-in ones.
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_decodeSensorReport(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event,
+                           const uint8_t *report, const sh2_SensorQPoints_t *pQPoints);
+
+/**
+ * @brief Decode several sensor events of the same sensor.
+ *
+ * Produces the same values as calling sh2_decodeSensorReport() on each event.
+ * Where the build target supports it (AVX2, SSE2 or NEON), fixed point fields
+ * are converted several at a time.  Define SH2_NO_SIMD to always use scalar code.
+ *
+ * @param  values Array of numEvents values to receive the results.
+ * @param  events Array of numEvents events, all with the same reportId.
+ * @param  numEvents Number of events to decode.
+ * @param  pQPoints Q points to decode with, or NULL for the built-in ones.
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_decodeSensorEventsBatch(sh2_SensorValue_t *values,
+                                const sh2_SensorEvent_t *events, uint16_t numEvents,
+                                const sh2_SensorQPoints_t *pQPoints);
+
+/**
+ * @brief Column (structure of arrays) storage for decoded events of one sensor.
+ *
+ * Row r of every array holds the r-th event appended.  column[n] holds the
+ * n-th field of the sensor, in the order of its sh2_SensorValue_t structure
+ * (e.g. x, y, z for accelerometers; i, j, k, real, accuracy for rotation
+ * vectors).  The caller provides the arrays, each with room for capacity
+ * rows.  Any array may be NULL to skip that column.
+ */
+typedef struct sh2_SensorColumns {
+    sh2_SensorId_t sensorId;  /**< @brief Sensor stored in these columns */
+    const sh2_SensorQPoints_t *pQPoints;  /**< @brief Q points to decode with, NULL for built-in */
+    uint32_t capacity;        /**< @brief Rows each array can hold */
+    uint32_t count;           /**< @brief Rows filled so far */
+    uint64_t *timestamp;      /**< @brief [uS] */
+    uint8_t *sequence;
+    uint8_t *status;
+    float *column[SH2_MAX_SENSOR_COLUMNS];
+} sh2_SensorColumns_t;
+
+/**
+ * @brief Number of float columns of a sensor.
+ *
+ * @param  sensorId Which sensor.
+ * @return Number of columns, or SH2_ERR_BAD_PARAM if the sensor can't be stored in columns.
+ */
+int sh2_getSensorColumnCount(sh2_SensorId_t sensorId);
+
+/**
+ * @brief Decode sensor events and append them to columns.
+ *
+ * Events of sensors other than pColumns->sensorId are skipped.  Stops when
+ * the columns are full.  Values are identical to those of sh2_decodeSensorReport().
+ *
+ * @param  pColumns Columns to append to.  count is advanced by the rows added.
+ * @param  events Array of events.
+ * @param  numEvents Number of events.
+ * @return Number of rows added.  Negative value from sh2_err.h on error.
+ */
+int sh2_decodeSensorEventsToColumns(sh2_SensorColumns_t *pColumns,
+                                    const sh2_SensorEvent_t *events, uint16_t numEvents);
+
+/**
+ * @brief Sensor value in fixed point.
+ *
+ * value[n] is the n-th field of the sensor, in the same order as the
+ * columns of sh2_SensorColumns_t, as the integer sent by the hub.  Its
+ * natural value is value[n] / 2^qPoint[n].
+ */
+typedef struct sh2_SensorValueQ {
+    uint8_t sensorId;    /**< @brief Which sensor produced this event. */
+    uint8_t sequence;    /**< @brief See sh2_SensorValue_t */
+    uint8_t status;      /**< @brief See sh2_SensorValue_t */
+    uint64_t timestamp;  /**< @brief [uS] */
+    uint8_t numFields;   /**< @brief Entries used in value and qPoint */
+    int32_t value[SH2_MAX_SENSOR_COLUMNS];
+    uint8_t qPoint[SH2_MAX_SENSOR_COLUMNS];
+} sh2_SensorValueQ_t;
+
+/**
+ * @brief Decode a sensor event without converting it to float.
+ *
+ * Supports the sensors that sh2_getSensorColumnCount() accepts.
+ *
+ * @param  value Structure to receive the results.
+ * @param  event Event to decode.
+ * @param  pQPoints Q points to report, or NULL for the built-in ones.
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_decodeSensorEventQ(sh2_SensorValueQ_t *value, const sh2_SensorEvent_t *event,
+                           const sh2_SensorQPoints_t *pQPoints);
+
+/**
+ * @brief Set up q points with the built-in values of every sensor.
+ *
+ * @param  pQPoints Q points to set up.
+ */
+void sh2_initSensorQPoints(sh2_SensorQPoints_t *pQPoints);
+
+/**
+ * @brief Use the q points of a sensor's metadata for decoding with pQPoints.
+ *
+ * qPoint1 applies to sensor values and qPoint2 to accuracy and bias fields.
+ * Applies to both fixed point and float decoding: the float scale factors
+ * are recomputed here, so decoding costs the same either way.
+ *
+ * Metadata with revision 0, or a q point of 0 for fields that use it, is
+ * rejected and the sensor keeps its previous q points.  Not to be called
+ * while pQPoints is being used by a decoder.
+ *
+ * @param  pQPoints Q points set up by sh2_initSensorQPoints().
+ * @param  sensorId Which sensor.
+ * @param  pMetadata Metadata from sh2_getMetadata(), or NULL to use the built-in q points.
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_setSensorQPoints(sh2_SensorQPoints_t *pQPoints,
+                         sh2_SensorId_t sensorId, const sh2_SensorMetadata_t *pMetadata);
+
+/**
+ * @brief Source of sensor metadata for sh2_loadSensorQPoints(), e.g. sh2_getMetadata.
+ */
+typedef int (sh2_MetadataReader_t)(sh2_SensorId_t sensorId, sh2_SensorMetadata_t *pData);
+
+/**
+ * @brief Read metadata of all fixed point sensors and use their q points for decoding.
+ *
+ * Calls readMetadata and sh2_setSensorQPoints() for each sensor.  With
+ * sh2_getMetadata it should be called once at startup, after the hub has
+ * reset.  Sensors without metadata keep the built-in q points.
+ *
+ * @param  pQPoints Q points set up by sh2_initSensorQPoints().
+ * @param  readMetadata Function that reads a sensor's metadata.
+ * @return Number of sensors whose q points were loaded.  Negative value from sh2_err.h on error.
+ */
+int sh2_loadSensorQPoints(sh2_SensorQPoints_t *pQPoints, sh2_MetadataReader_t *readMetadata);
+
 #ifdef __cplusplus
 }    // end of extern "C"
 #endif
@@ -37,6 +37,7 @@
 #define SH2_ERR_IO             (-4) /**< Error communicating with hub */
 #define SH2_ERR_HUB            (-5) /**< Error reported by hub */
 #define SH2_ERR_TIMEOUT        (-6) /**< Operation timed out */
+#define SH2_ERR_CANCELLED      (-7) /**< Operation cancelled */
 
 
 #endif
@@ -35,6 +35,12 @@
 #error SH2_HAL_MAX_TRANSFER must be defined by sh2_hal_impl.h
 #endif
 
+// Number of hubs that can be driven at once.
+// May be overridden in sh2_hal_impl.h.
+#ifndef SH2_MAX_INSTANCES
+#define SH2_MAX_INSTANCES (1)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -67,9 +73,35 @@ extern "C" {
 
     // Block the calling thread until unblock occurs.
     // (If tx, rx are implemented in a blocking fashion, these should be no-operations.)
+    // May return non-zero if unblock doesn't occur within some time limit;
+    // the operation being waited for then fails with SH2_ERR_TIMEOUT.
     int sh2_hal_block(void);
     int sh2_hal_unblock(void);
 
+    // HAL for one hub, used with sh2_open() when driving more than one.
+    // Each function behaves like its sh2_hal_ counterpart above for the hub
+    // this HAL controls.  Embed sh2_Hal_t as the first member of a struct
+    // holding the bus details, and cast self back to that struct.
+    typedef struct sh2_Hal_s sh2_Hal_t;
+    struct sh2_Hal_s {
+        int (*reset)(sh2_Hal_t *self, bool dfuMode, sh2_rxCallback_t *onRx, void *cookie);
+        int (*tx)(sh2_Hal_t *self, uint8_t *pData, uint32_t len);
+        int (*rx)(sh2_Hal_t *self, uint8_t *pData, uint32_t len);
+        int (*block)(sh2_Hal_t *self);
+        int (*unblock)(sh2_Hal_t *self);
+
+        // Optional, may be NULL.  Current time, in uS, on the same clock as
+        // the t_us passed to onRx.  Lets the driver time operations from the
+        // moment a request is sent rather than from the first response.
+        uint32_t (*getTimeUs)(sh2_Hal_t *self);
+    };
+
+#ifndef SH2_NO_GLOBAL_HAL
+    // HAL made of the sh2_hal_ functions above, used by sh2_initialize().
+    // Define SH2_NO_GLOBAL_HAL if they aren't implemented.
+    extern sh2_Hal_t sh2_globalHal;
+#endif
+
 #ifdef __cplusplus
 }    // end of extern "C"
 #endif
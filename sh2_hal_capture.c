@@ -0,0 +1,139 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * HAL wrapper logging SHTP transfers.
+ */
+
+#include <string.h>
+
+#include "sh2_hal_capture.h"
+#include "sh2_err.h"
+
+// --- Private Functions --------------------------------------------------
+
+static void writeRecord(sh2_CaptureHal_t *pCapture, sh2_CaptureType_t type,
+                        const uint8_t *pData, uint32_t len)
+{
+    uint8_t hdr[SH2_CAPTURE_RECORD_HDR_LEN];
+
+    hdr[0] = type;
+    hdr[1] = pCapture->last_us & 0xFF;
+    hdr[2] = (pCapture->last_us >> 8) & 0xFF;
+    hdr[3] = (pCapture->last_us >> 16) & 0xFF;
+    hdr[4] = (pCapture->last_us >> 24) & 0xFF;
+    hdr[5] = len & 0xFF;
+    hdr[6] = (len >> 8) & 0xFF;
+
+    pCapture->write(pCapture->writeCookie, hdr, sizeof(hdr));
+    if (len > 0) {
+        pCapture->write(pCapture->writeCookie, pData, len);
+    }
+    pCapture->records++;
+}
+
+// Logs each transfer from the hub before the driver sees it
+static void captureOnRx(void *cookie, uint8_t *pData, uint32_t len, uint32_t t_us)
+{
+    sh2_CaptureHal_t *pCapture = (sh2_CaptureHal_t *)cookie;
+
+    pCapture->last_us = t_us;
+    writeRecord(pCapture, SH2_CAPTURE_RX, pData, len);
+
+    pCapture->onRx(pCapture->cookie, pData, len, t_us);
+}
+
+static int captureReset(sh2_Hal_t *self, bool dfuMode, sh2_rxCallback_t *onRx, void *cookie)
+{
+    sh2_CaptureHal_t *pCapture = (sh2_CaptureHal_t *)self;
+    uint8_t dfu = dfuMode ? 1 : 0;
+
+    pCapture->onRx = onRx;
+    pCapture->cookie = cookie;
+    writeRecord(pCapture, SH2_CAPTURE_RESET, &dfu, sizeof(dfu));
+
+    return pCapture->pInner->reset(pCapture->pInner, dfuMode, captureOnRx, pCapture);
+}
+
+static int captureTx(sh2_Hal_t *self, uint8_t *pData, uint32_t len)
+{
+    sh2_CaptureHal_t *pCapture = (sh2_CaptureHal_t *)self;
+
+    writeRecord(pCapture, SH2_CAPTURE_TX, pData, len);
+
+    return pCapture->pInner->tx(pCapture->pInner, pData, len);
+}
+
+static int captureRx(sh2_Hal_t *self, uint8_t *pData, uint32_t len)
+{
+    sh2_CaptureHal_t *pCapture = (sh2_CaptureHal_t *)self;
+
+    // DFU reads are not logged
+    return pCapture->pInner->rx(pCapture->pInner, pData, len);
+}
+
+static int captureBlock(sh2_Hal_t *self)
+{
+    sh2_CaptureHal_t *pCapture = (sh2_CaptureHal_t *)self;
+
+    return pCapture->pInner->block(pCapture->pInner);
+}
+
+static int captureUnblock(sh2_Hal_t *self)
+{
+    sh2_CaptureHal_t *pCapture = (sh2_CaptureHal_t *)self;
+
+    return pCapture->pInner->unblock(pCapture->pInner);
+}
+
+static uint32_t captureGetTimeUs(sh2_Hal_t *self)
+{
+    sh2_CaptureHal_t *pCapture = (sh2_CaptureHal_t *)self;
+
+    return pCapture->pInner->getTimeUs(pCapture->pInner);
+}
+
+// --- Public API ---------------------------------------------------------
+
+void sh2_captureHal_init(sh2_CaptureHal_t *pCapture, sh2_Hal_t *pInner,
+                         sh2_CaptureWrite_t *write, void *writeCookie)
+{
+    uint8_t hdr[SH2_CAPTURE_HDR_LEN];
+
+    memset(pCapture, 0, sizeof(*pCapture));
+    pCapture->hal.reset = captureReset;
+    pCapture->hal.tx = captureTx;
+    pCapture->hal.rx = captureRx;
+    pCapture->hal.block = captureBlock;
+    pCapture->hal.unblock = captureUnblock;
+    if (pInner->getTimeUs != 0) {
+        pCapture->hal.getTimeUs = captureGetTimeUs;
+    }
+    pCapture->pInner = pInner;
+    pCapture->write = write;
+    pCapture->writeCookie = writeCookie;
+
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(hdr, SH2_CAPTURE_MAGIC, 4);
+    hdr[4] = SH2_CAPTURE_VERSION;
+    write(writeCookie, hdr, sizeof(hdr));
+}
+
+uint32_t sh2_captureHal_records(sh2_CaptureHal_t *pCapture)
+{
+    return pCapture->records;
+}
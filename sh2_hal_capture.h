@@ -0,0 +1,114 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file sh2_hal_capture.h
+ * @brief HAL wrapper that logs every SHTP transfer, for offline replay
+ *
+ * The capture HAL sits between the driver and another HAL and passes
+ * each transfer through unchanged, after appending it to a log through
+ * an application-supplied write function.  sh2_hal_replay.h plays such
+ * a log back.
+ *
+ * Log format, all values little endian:
+ *   Header: "SH2C", version (1 byte), 3 reserved bytes.
+ *   Records: type (1 byte, sh2_CaptureType_t), t_us (4 bytes),
+ *            len (2 bytes), then len bytes of data.
+ *
+ * Rx records carry the HAL timestamp of the transfer.  Tx and reset
+ * records carry the timestamp of the last rx transfer before them.
+ */
+
+#ifndef SH2_HAL_CAPTURE_H
+#define SH2_HAL_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sh2_hal.h"
+
+#define SH2_CAPTURE_MAGIC "SH2C"
+#define SH2_CAPTURE_VERSION (1)
+#define SH2_CAPTURE_HDR_LEN (8)
+#define SH2_CAPTURE_RECORD_HDR_LEN (7)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * @brief Kinds of log records
+     */
+    typedef enum sh2_CaptureType {
+        SH2_CAPTURE_RX = 0,     /**< @brief Transfer from the hub */
+        SH2_CAPTURE_TX = 1,     /**< @brief Transfer to the hub */
+        SH2_CAPTURE_RESET = 2,  /**< @brief Hub reset, data is the dfuMode flag */
+    } sh2_CaptureType_t;
+
+    /**
+     * @brief Append bytes to a log.
+     *
+     * Called from the receive path of the wrapped HAL and from sh2_ calls,
+     * so it should not block for long.  Calls are serialized if the
+     * application serializes those (as sh2_posixHal_lock() does).
+     */
+    typedef void (sh2_CaptureWrite_t)(void *cookie, const uint8_t *pData, uint32_t len);
+
+    /**
+     * @brief Capture HAL state.
+     *
+     * Allocated by the caller and set up by sh2_captureHal_init().  The
+     * members are private to sh2_hal_capture.c.
+     */
+    typedef struct sh2_CaptureHal {
+        sh2_Hal_t hal;  // Must be first
+
+        sh2_Hal_t *pInner;
+        sh2_CaptureWrite_t *write;
+        void *writeCookie;
+
+        sh2_rxCallback_t *onRx;
+        void *cookie;
+        uint32_t last_us;
+        uint32_t records;
+    } sh2_CaptureHal_t;
+
+    /**
+     * @brief Set up a capture HAL and write the log header.
+     *
+     * Pass &pCapture->hal to sh2_open() in place of pInner.  To capture
+     * the hub used by sh2_initialize(), wrap &sh2_globalHal.
+     *
+     * @param  pCapture Capture HAL state to set up.
+     * @param  pInner HAL of the hub.
+     * @param  write Function appending to the log.
+     * @param  writeCookie Passed to write.
+     */
+    void sh2_captureHal_init(sh2_CaptureHal_t *pCapture, sh2_Hal_t *pInner,
+                             sh2_CaptureWrite_t *write, void *writeCookie);
+
+    /**
+     * @brief Get the number of records logged so far.
+     */
+    uint32_t sh2_captureHal_records(sh2_CaptureHal_t *pCapture);
+
+#ifdef __cplusplus
+}    // end of extern "C"
+#endif
+
+// #ifdef SH2_HAL_CAPTURE_H
+#endif
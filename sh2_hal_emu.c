@@ -0,0 +1,1218 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Software SensorHub behind the HAL.
+ *
+ * Transfers from the host are decoded and answered immediately; the
+ * answers, and sensor cargos produced as virtual time advances, wait in a
+ * queue until sh2_emuHub_run() or sh2_hal_block() delivers them.  Each
+ * transfer is copied out of the queue before it is passed to the driver,
+ * so the driver may send more requests from its callbacks.
+ */
+
+#include <string.h>
+
+#include "sh2_hal_emu.h"
+#include "sh2_err.h"
+
+// --- Private Definitions ------------------------------------------------
+
+#define SHTP_HDR_LEN (4)
+#define MAX_CARGO (SH2_HAL_MAX_TRANSFER - SHTP_HDR_LEN)
+
+// Channels, as advertised
+#define CHAN_COMMAND      (0)
+#define CHAN_EXECUTABLE   (1)
+#define CHAN_CONTROL      (2)
+#define CHAN_INPUT_NORMAL (3)
+#define CHAN_INPUT_WAKE   (4)
+#define CHAN_INPUT_GYRO_RV (5)
+
+// Advertisement
+#define CMD_ADVERTISE (0)
+#define RESP_ADVERTISE (0)
+#define TAG_GUID (1)
+#define TAG_MAX_CARGO_PLUS_HEADER_WRITE (2)
+#define TAG_MAX_CARGO_PLUS_HEADER_READ (3)
+#define TAG_MAX_TRANSFER_WRITE (4)
+#define TAG_MAX_TRANSFER_READ (5)
+#define TAG_NORMAL_CHANNEL (6)
+#define TAG_WAKE_CHANNEL (7)
+#define TAG_APP_NAME (8)
+#define TAG_CHANNEL_NAME (9)
+#define TAG_SHTP_VERSION (0x80)
+#define TAG_SH2_VERSION (0x80)
+#define TAG_SH2_REPORT_LENGTHS (0x81)
+
+#define GUID_SHTP (0)
+#define GUID_EXECUTABLE (1)
+#define GUID_SENSORHUB (2)
+
+// Executable app
+#define EXECUTABLE_DEVICE_CMD_RESET (1)
+#define EXECUTABLE_DEVICE_RESP_RESET_COMPLETE (1)
+
+// SH-2 reports, requests first
+#define SENSORHUB_GET_FEATURE_REQ    (0xFE)
+#define SENSORHUB_SET_FEATURE_CMD    (0xFD)
+#define SENSORHUB_GET_FEATURE_RESP   (0xFC)
+#define SENSORHUB_BASE_TIMESTAMP_REF (0xFB)
+#define SENSORHUB_TIMESTAMP_REBASE   (0xFA)
+#define SENSORHUB_PROD_ID_REQ        (0xF9)
+#define SENSORHUB_PROD_ID_RESP       (0xF8)
+#define SENSORHUB_FRS_WRITE_REQ      (0xF7)
+#define SENSORHUB_FRS_WRITE_DATA_REQ (0xF6)
+#define SENSORHUB_FRS_WRITE_RESP     (0xF5)
+#define SENSORHUB_FRS_READ_REQ       (0xF4)
+#define SENSORHUB_FRS_READ_RESP      (0xF3)
+#define SENSORHUB_COMMAND_REQ        (0xF2)
+#define SENSORHUB_COMMAND_RESP       (0xF1)
+#define SENSORHUB_FORCE_SENSOR_FLUSH (0xF0)
+#define SENSORHUB_FLUSH_COMPLETED    (0xEF)
+
+#define GET_FEATURE_REQ_LEN (2)
+#define SET_FEATURE_CMD_LEN (17)
+#define GET_FEATURE_RESP_LEN (17)
+#define BASE_TIMESTAMP_REF_LEN (5)
+#define PROD_ID_REQ_LEN (2)
+#define PROD_ID_RESP_LEN (16)
+#define FRS_WRITE_REQ_LEN (6)
+#define FRS_WRITE_DATA_REQ_LEN (12)
+#define FRS_WRITE_RESP_LEN (4)
+#define FRS_READ_REQ_LEN (8)
+#define FRS_READ_RESP_LEN (16)
+#define COMMAND_REQ_LEN (12)
+#define COMMAND_RESP_LEN (16)
+#define FORCE_SENSOR_FLUSH_LEN (2)
+#define FLUSH_COMPLETED_LEN (2)
+
+#define FRS_WRITE_STATUS_RECEIVED (0)
+#define FRS_WRITE_STATUS_BUSY (2)
+#define FRS_WRITE_STATUS_WRITE_COMPLETED (3)
+#define FRS_WRITE_STATUS_READY (4)
+#define FRS_WRITE_STATUS_NOT_READY (6)
+#define FRS_WRITE_STATUS_INVALID_LENGTH (7)
+#define FRS_WRITE_STATUS_DEVICE_ERROR (10)
+#define FRS_WRITE_STATUS_READ_ONLY (11)
+
+#define FRS_READ_STATUS_NO_ERROR                        0
+#define FRS_READ_STATUS_BUSY                            2
+#define FRS_READ_STATUS_READ_RECORD_COMPLETED           3
+#define FRS_READ_STATUS_OFFSET_OUT_OF_RANGE             4
+#define FRS_READ_STATUS_RECORD_EMPTY                    5
+#define FRS_READ_STATUS_READ_BLOCK_COMPLETED            6
+#define FRS_READ_STATUS_READ_BLOCK_AND_RECORD_COMPLETED 7
+
+#define SH2_CMD_ERRORS                 1
+#define SH2_CMD_COUNTS                 2
+#define     SH2_COUNTS_GET_COUNTS          0
+#define SH2_CMD_TARE                   3
+#define SH2_CMD_INITIALIZE             4
+#define     SH2_INIT_SYSTEM                1
+#define SH2_INIT_UNSOLICITED           0x80
+#define SH2_CMD_FRS                    5
+#define SH2_CMD_DCD                    6
+#define SH2_CMD_ME_CAL                 7
+#define     SH2_ME_CAL_GET                 1
+#define SH2_CMD_DCD_SAVE               9
+#define SH2_CMD_GET_OSC_TYPE           10
+#define SH2_CMD_CLEAR_DCD_AND_RESET    11
+#define SH2_CMD_CAL                    12
+#define     SH2_CAL_START                   0
+#define     SH2_CAL_FINISH                  1
+
+// Status bits of sensor reports: accuracy high
+#define REPORT_STATUS (3)
+
+// Largest delay a sensor report can carry, in 100uS units
+#define MAX_DELAY (0x3FFF)
+
+#define VENDOR_ID "Emulated"
+
+// Report length and metadata of each emulated sensor
+typedef struct {
+    uint8_t reportLen;     // 0 if the sensor is not emulated
+    uint16_t metadataId;
+    uint16_t qPoint1;
+    uint16_t qPoint2;
+    uint32_t minPeriod_us;
+} EmuSensor_t;
+
+// --- Private Data -------------------------------------------------------
+
+static const EmuSensor_t emuSensor[SH2_MAX_SENSOR_ID+1] = {
+    [SH2_ACCELEROMETER]                = {10, FRS_ID_META_ACCELEROMETER,               8,  0, 2500},
+    [SH2_GYROSCOPE_CALIBRATED]         = {10, FRS_ID_META_GYROSCOPE_CALIBRATED,        9,  0, 2500},
+    [SH2_MAGNETIC_FIELD_CALIBRATED]    = {10, FRS_ID_META_MAGNETIC_FIELD_CALIBRATED,   4,  0, 10000},
+    [SH2_LINEAR_ACCELERATION]          = {10, FRS_ID_META_LINEAR_ACCELERATION,         8,  0, 2500},
+    [SH2_ROTATION_VECTOR]              = {14, FRS_ID_META_ROTATION_VECTOR,             14, 12, 2500},
+    [SH2_GRAVITY]                      = {10, FRS_ID_META_GRAVITY,                     8,  0, 2500},
+    [SH2_GYROSCOPE_UNCALIBRATED]       = {16, FRS_ID_META_GYROSCOPE_UNCALIBRATED,      9,  9, 2500},
+    [SH2_GAME_ROTATION_VECTOR]         = {12, FRS_ID_META_GAME_ROTATION_VECTOR,        14, 0, 2500},
+    [SH2_GEOMAGNETIC_ROTATION_VECTOR]  = {14, FRS_ID_META_GEOMAGNETIC_ROTATION_VECTOR, 14, 12, 10000},
+    [SH2_PRESSURE]                     = {8,  FRS_ID_META_PRESSURE,                    20, 0, 20000},
+    [SH2_AMBIENT_LIGHT]                = {8,  FRS_ID_META_AMBIENT_LIGHT,               8,  0, 20000},
+    [SH2_HUMIDITY]                     = {6,  FRS_ID_META_HUMIDITY,                    8,  0, 20000},
+    [SH2_PROXIMITY]                    = {6,  FRS_ID_META_PROXIMITY,                   4,  0, 20000},
+    [SH2_TEMPERATURE]                  = {6,  FRS_ID_META_TEMPERATURE,                 7,  0, 20000},
+    [SH2_MAGNETIC_FIELD_UNCALIBRATED]  = {16, FRS_ID_META_MAGNETIC_FIELD_UNCALIBRATED, 4,  4, 10000},
+    [SH2_TAP_DETECTOR]                 = {5,  FRS_ID_META_TAP_DETECTOR,                0,  0, 0},
+    [SH2_STEP_COUNTER]                 = {12, FRS_ID_META_STEP_COUNTER,                0,  0, 0},
+    [SH2_SIGNIFICANT_MOTION]           = {6,  FRS_ID_META_SIGNIFICANT_MOTION,          0,  0, 0},
+    [SH2_STABILITY_CLASSIFIER]         = {6,  FRS_ID_META_STABILITY_CLASSIFIER,        0,  0, 0},
+    [SH2_RAW_ACCELEROMETER]            = {16, FRS_ID_META_RAW_ACCELEROMETER,           0,  0, 2500},
+    [SH2_RAW_GYROSCOPE]                = {16, FRS_ID_META_RAW_GYROSCOPE,               0,  0, 2500},
+    [SH2_RAW_MAGNETOMETER]             = {14, FRS_ID_META_RAW_MAGNETOMETER,            0,  0, 10000},
+    [SH2_STEP_DETECTOR]                = {8,  FRS_ID_META_STEP_DETECTOR,               0,  0, 0},
+    [SH2_SHAKE_DETECTOR]               = {6,  FRS_ID_META_SHAKE_DETECTOR,              0,  0, 0},
+    [SH2_FLIP_DETECTOR]                = {6,  FRS_ID_META_FLIP_DETECTOR,               0,  0, 0},
+    [SH2_PICKUP_DETECTOR]              = {6,  FRS_ID_META_PICKUP_DETECTOR,             0,  0, 0},
+    [SH2_STABILITY_DETECTOR]           = {6,  FRS_ID_META_STABILITY_DETECTOR,          0,  0, 0},
+    [SH2_PERSONAL_ACTIVITY_CLASSIFIER] = {16, FRS_ID_META_PERSONAL_ACTIVITY_CLASSIFIER, 0, 0, 0},
+    [SH2_SLEEP_DETECTOR]               = {6,  FRS_ID_META_SLEEP_DETECTOR,              0,  0, 0},
+    [SH2_TILT_DETECTOR]                = {6,  FRS_ID_META_TILT_DETECTOR,               0,  0, 0},
+    [SH2_POCKET_DETECTOR]              = {6,  FRS_ID_META_POCKET_DETECTOR,             0,  0, 0},
+    [SH2_CIRCLE_DETECTOR]              = {6,  FRS_ID_META_CIRCLE_DETECTOR,             0,  0, 0},
+    [SH2_HEART_RATE_MONITOR]           = {6,  FRS_ID_META_HEART_RATE_MONITOR,          0,  0, 0},
+    [SH2_ARVR_STABILIZED_RV]           = {14, FRS_ID_META_ARVR_STABILIZED_RV,          14, 12, 2500},
+    [SH2_ARVR_STABILIZED_GRV]          = {12, FRS_ID_META_ARVR_STABILIZED_GRV,         14, 0, 2500},
+    [SH2_GYRO_INTEGRATED_RV]           = {14, FRS_ID_META_GYRO_INTEGRATED_RV,          14, 10, 1000},
+};
+
+// Lengths of the non-sensor reports the hub sends
+static const uint8_t controlReportLen[][2] = {
+    {SENSORHUB_GET_FEATURE_RESP, GET_FEATURE_RESP_LEN},
+    {SENSORHUB_BASE_TIMESTAMP_REF, BASE_TIMESTAMP_REF_LEN},
+    {SENSORHUB_TIMESTAMP_REBASE, BASE_TIMESTAMP_REF_LEN},
+    {SENSORHUB_PROD_ID_RESP, PROD_ID_RESP_LEN},
+    {SENSORHUB_FRS_WRITE_RESP, FRS_WRITE_RESP_LEN},
+    {SENSORHUB_FRS_READ_RESP, FRS_READ_RESP_LEN},
+    {SENSORHUB_COMMAND_RESP, COMMAND_RESP_LEN},
+    {SENSORHUB_FLUSH_COMPLETED, FLUSH_COMPLETED_LEN},
+};
+
+// Hub behind the sh2_hal_ functions
+static sh2_EmuHub_t *globalEmu = 0;
+
+// --- Private Functions --------------------------------------------------
+
+static uint16_t readu16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t readu32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void writeu16(uint8_t *p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+}
+
+static void writeu32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = (value >> 24) & 0xFF;
+}
+
+// Queue a cargo for the host, in as many transfers as it takes
+static void emuSend(sh2_EmuHub_t *pEmu, uint8_t chan, const uint8_t *pPayload, uint16_t len)
+{
+    uint16_t cursor = 0;
+    bool continuation = false;
+
+    do {
+        if (pEmu->queueCount >= SH2_EMU_QUEUE_LEN) {
+            pEmu->stats.overflows++;
+            return;
+        }
+
+        uint16_t chunk = len - cursor;
+        if (chunk > MAX_CARGO) {
+            chunk = MAX_CARGO;
+        }
+
+        // Continuations carry the length of the remaining cargo
+        uint16_t slot = (pEmu->queueHead + pEmu->queueCount) % SH2_EMU_QUEUE_LEN;
+        uint8_t *p = pEmu->queue[slot];
+        uint16_t remaining = len - cursor + SHTP_HDR_LEN;
+        p[0] = remaining & 0xFF;
+        p[1] = ((remaining >> 8) & 0x7F) | (continuation ? 0x80 : 0);
+        p[2] = chan;
+        p[3] = pEmu->chanSeq[chan]++;
+        memcpy(p + SHTP_HDR_LEN, pPayload + cursor, chunk);
+        pEmu->queueLen[slot] = chunk + SHTP_HDR_LEN;
+        pEmu->queueCount++;
+
+        cursor += chunk;
+        continuation = true;
+    } while (cursor < len);
+}
+
+// Pass the oldest queued transfer to the host
+static bool deliverNext(sh2_EmuHub_t *pEmu)
+{
+    uint8_t transfer[SH2_HAL_MAX_TRANSFER];
+    uint16_t len;
+
+    if (pEmu->queueCount == 0) {
+        return false;
+    }
+
+    len = pEmu->queueLen[pEmu->queueHead];
+    memcpy(transfer, pEmu->queue[pEmu->queueHead], len);
+    pEmu->queueHead = (pEmu->queueHead + 1) % SH2_EMU_QUEUE_LEN;
+    pEmu->queueCount--;
+
+    pEmu->stats.hubTransfers++;
+    pEmu->stats.hubBytes += len;
+    if (pEmu->onRx != 0) {
+        pEmu->onRx(pEmu->cookie, transfer, len, pEmu->now_us);
+    }
+
+    return true;
+}
+
+static uint32_t deliverAll(sh2_EmuHub_t *pEmu)
+{
+    uint32_t delivered = 0;
+
+    while (deliverNext(pEmu)) {
+        delivered++;
+    }
+
+    return delivered;
+}
+
+// Is this chance for an injected fault hit?
+static bool faulted(sh2_EmuHub_t *pEmu, sh2_EmuFault_t fault)
+{
+    if (pEmu->fault[fault].count == 0) {
+        return false;
+    }
+    if (pEmu->fault[fault].skip > 0) {
+        pEmu->fault[fault].skip--;
+        return false;
+    }
+
+    pEmu->fault[fault].count--;
+    pEmu->stats.faults++;
+    return true;
+}
+
+// Control responses go out together once a host transfer is processed
+static void respFlush(sh2_EmuHub_t *pEmu)
+{
+    if (pEmu->respLen > 0) {
+        emuSend(pEmu, CHAN_CONTROL, pEmu->resp, pEmu->respLen);
+        pEmu->respLen = 0;
+    }
+}
+
+static void respAdd(sh2_EmuHub_t *pEmu, const uint8_t *report, uint16_t len)
+{
+    if (faulted(pEmu, SH2_EMU_FAULT_DROP)) {
+        return;
+    }
+    if (pEmu->respLen + len > MAX_CARGO) {
+        respFlush(pEmu);
+    }
+    memcpy(pEmu->resp + pEmu->respLen, report, len);
+    pEmu->respLen += len;
+}
+
+static void cmdResp(sh2_EmuHub_t *pEmu, uint8_t command, uint8_t commandSeq,
+                    uint8_t respSeq, const uint8_t *r)
+{
+    uint8_t resp[COMMAND_RESP_LEN];
+
+    resp[0] = SENSORHUB_COMMAND_RESP;
+    resp[1] = pEmu->respSeq++;
+    resp[2] = command;
+    resp[3] = commandSeq;
+    resp[4] = respSeq;
+    memcpy(resp + 5, r, 11);
+    respAdd(pEmu, resp, sizeof(resp));
+}
+
+// ------------------------------------------------------------------------
+// Advertisement
+
+static uint16_t tlv(uint8_t *p, uint8_t tag, const void *pValue, uint8_t len)
+{
+    p[0] = tag;
+    p[1] = len;
+    memcpy(p + 2, pValue, len);
+    return len + 2;
+}
+
+static uint16_t tlvU8(uint8_t *p, uint8_t tag, uint8_t value)
+{
+    return tlv(p, tag, &value, 1);
+}
+
+static uint16_t tlvU16(uint8_t *p, uint8_t tag, uint16_t value)
+{
+    uint8_t v[2];
+
+    writeu16(v, value);
+    return tlv(p, tag, v, sizeof(v));
+}
+
+static uint16_t tlvU32(uint8_t *p, uint8_t tag, uint32_t value)
+{
+    uint8_t v[4];
+
+    writeu32(v, value);
+    return tlv(p, tag, v, sizeof(v));
+}
+
+static uint16_t tlvStr(uint8_t *p, uint8_t tag, const char *s)
+{
+    return tlv(p, tag, s, strlen(s) + 1);
+}
+
+static void sendAdvert(sh2_EmuHub_t *pEmu)
+{
+    uint8_t advert[512];
+    uint8_t lengths[2*(SH2_MAX_SENSOR_ID+1) + sizeof(controlReportLen)];
+    uint16_t n = 0;
+    uint16_t lengthsLen = 0;
+
+    for (unsigned id = 0; id <= SH2_MAX_SENSOR_ID; id++) {
+        if (emuSensor[id].reportLen != 0) {
+            lengths[lengthsLen++] = id;
+            lengths[lengthsLen++] = emuSensor[id].reportLen;
+        }
+    }
+    for (unsigned i = 0; i < sizeof(controlReportLen)/sizeof(controlReportLen[0]); i++) {
+        lengths[lengthsLen++] = controlReportLen[i][0];
+        lengths[lengthsLen++] = controlReportLen[i][1];
+    }
+
+    advert[n++] = RESP_ADVERTISE;
+
+    n += tlvU32(advert+n, TAG_GUID, GUID_SHTP);
+    n += tlvU16(advert+n, TAG_MAX_CARGO_PLUS_HEADER_WRITE, SH2_HAL_MAX_TRANSFER);
+    n += tlvU16(advert+n, TAG_MAX_CARGO_PLUS_HEADER_READ, SH2_HAL_MAX_TRANSFER);
+    n += tlvU16(advert+n, TAG_MAX_TRANSFER_WRITE, SH2_HAL_MAX_TRANSFER);
+    n += tlvU16(advert+n, TAG_MAX_TRANSFER_READ, SH2_HAL_MAX_TRANSFER);
+    n += tlvU8(advert+n, TAG_NORMAL_CHANNEL, CHAN_COMMAND);
+    n += tlvStr(advert+n, TAG_APP_NAME, "SHTP");
+    n += tlvStr(advert+n, TAG_CHANNEL_NAME, "command");
+    n += tlvStr(advert+n, TAG_SHTP_VERSION, "1.0.1");
+
+    n += tlvU32(advert+n, TAG_GUID, GUID_EXECUTABLE);
+    n += tlvU8(advert+n, TAG_NORMAL_CHANNEL, CHAN_EXECUTABLE);
+    n += tlvStr(advert+n, TAG_APP_NAME, "executable");
+    n += tlvStr(advert+n, TAG_CHANNEL_NAME, "device");
+
+    n += tlvU32(advert+n, TAG_GUID, GUID_SENSORHUB);
+    n += tlvStr(advert+n, TAG_APP_NAME, "sensorhub");
+    n += tlvU8(advert+n, TAG_NORMAL_CHANNEL, CHAN_CONTROL);
+    n += tlvStr(advert+n, TAG_CHANNEL_NAME, "control");
+    n += tlvU8(advert+n, TAG_NORMAL_CHANNEL, CHAN_INPUT_NORMAL);
+    n += tlvStr(advert+n, TAG_CHANNEL_NAME, "inputNormal");
+    n += tlvU8(advert+n, TAG_WAKE_CHANNEL, CHAN_INPUT_WAKE);
+    n += tlvStr(advert+n, TAG_CHANNEL_NAME, "inputWake");
+    n += tlvU8(advert+n, TAG_NORMAL_CHANNEL, CHAN_INPUT_GYRO_RV);
+    n += tlvStr(advert+n, TAG_CHANNEL_NAME, "inputGyroRv");
+    n += tlvStr(advert+n, TAG_SH2_VERSION, "1.0.0");
+    n += tlv(advert+n, TAG_SH2_REPORT_LENGTHS, lengths, lengthsLen);
+
+    emuSend(pEmu, CHAN_COMMAND, advert, n);
+}
+
+// ------------------------------------------------------------------------
+// Sensor reports
+
+static void flushCargo(sh2_EmuHub_t *pEmu)
+{
+    if (pEmu->cargoReports == 0) {
+        return;
+    }
+
+    // Reports are delayed from the base, which is this long before now
+    pEmu->cargo[0] = SENSORHUB_BASE_TIMESTAMP_REF;
+    writeu32(pEmu->cargo + 1, (pEmu->now_us - pEmu->cargoBase_us + 50) / 100);
+    emuSend(pEmu, CHAN_INPUT_NORMAL, pEmu->cargo, pEmu->cargoLen);
+
+    pEmu->cargoLen = 0;
+    pEmu->cargoReports = 0;
+}
+
+// Synthetic data: field i holds 1000*(i+1) + seq
+static void fillSample(uint8_t *p, uint8_t len, uint8_t seq)
+{
+    for (unsigned i = 0; i < len; i += 2) {
+        int16_t value = 1000*(i/2 + 1) + seq;
+        p[i] = value & 0xFF;
+        if (i+1 < len) {
+            p[i+1] = (value >> 8) & 0xFF;
+        }
+    }
+}
+
+// Gyro-integrated RV reports go out one per transfer on their own
+// channel, without the report header or a timebase.
+static void sendGyroRv(sh2_EmuHub_t *pEmu)
+{
+    uint8_t len = emuSensor[SH2_GYRO_INTEGRATED_RV].reportLen;
+    uint8_t report[sizeof(((sh2_SensorEvent_t *)0)->report)];
+
+    fillSample(report, len, pEmu->sensor[SH2_GYRO_INTEGRATED_RV].seq++);
+    emuSend(pEmu, CHAN_INPUT_GYRO_RV, report, len);
+
+    pEmu->sensor[SH2_GYRO_INTEGRATED_RV].reports++;
+    pEmu->stats.reports++;
+}
+
+static void addSample(sh2_EmuHub_t *pEmu, uint8_t sensorId, uint32_t t_us)
+{
+    uint8_t len = emuSensor[sensorId].reportLen;
+    uint32_t batch_us = pEmu->sensor[sensorId].batchInterval_us;
+
+    if ((pEmu->cargoReports > 0) &&
+        ((pEmu->cargoLen + len > MAX_CARGO) ||
+         ((pEmu->maxReports != 0) && (pEmu->cargoReports >= pEmu->maxReports)) ||
+         ((int32_t)(t_us - pEmu->cargoBase_us) > MAX_DELAY*100))) {
+        flushCargo(pEmu);
+    }
+
+    if (pEmu->cargoReports == 0) {
+        pEmu->cargoLen = BASE_TIMESTAMP_REF_LEN;
+        pEmu->cargoBase_us = t_us;
+        pEmu->cargoDeadline_us = t_us + batch_us;
+    }
+    else if ((int32_t)(t_us + batch_us - pEmu->cargoDeadline_us) < 0) {
+        pEmu->cargoDeadline_us = t_us + batch_us;
+    }
+
+    int32_t delay = ((int32_t)(t_us - pEmu->cargoBase_us) + 50) / 100;
+    if (delay < 0) delay = 0;
+
+    uint8_t *p = pEmu->cargo + pEmu->cargoLen;
+    uint8_t seq = pEmu->sensor[sensorId].seq++;
+    p[0] = sensorId;
+    p[1] = seq;
+    p[2] = REPORT_STATUS | ((delay >> 8) << 2);
+    p[3] = delay & 0xFF;
+    fillSample(p + 4, len - 4, seq);
+
+    pEmu->cargoLen += len;
+    pEmu->cargoReports++;
+    pEmu->sensor[sensorId].reports++;
+    pEmu->stats.reports++;
+}
+
+// Produce every sample due by now
+static void sample(sh2_EmuHub_t *pEmu)
+{
+    for (unsigned id = 0; id <= SH2_MAX_SENSOR_ID; id++) {
+        if ((pEmu->sensor[id].reportInterval_us == 0) || (emuSensor[id].reportLen == 0)) {
+            continue;
+        }
+        while ((int32_t)(pEmu->sensor[id].nextSample_us - pEmu->now_us) <= 0) {
+            if (id == SH2_GYRO_INTEGRATED_RV) {
+                sendGyroRv(pEmu);
+            }
+            else {
+                addSample(pEmu, id, pEmu->sensor[id].nextSample_us);
+            }
+            pEmu->sensor[id].nextSample_us += pEmu->sensor[id].reportInterval_us;
+        }
+    }
+
+    if ((pEmu->cargoReports > 0) &&
+        ((int32_t)(pEmu->cargoDeadline_us - pEmu->now_us) <= 0)) {
+        flushCargo(pEmu);
+    }
+}
+
+// ------------------------------------------------------------------------
+// Control requests
+
+static void sendFeature(sh2_EmuHub_t *pEmu, uint8_t sensorId)
+{
+    uint8_t resp[GET_FEATURE_RESP_LEN];
+
+    memset(resp, 0, sizeof(resp));
+    resp[0] = SENSORHUB_GET_FEATURE_RESP;
+    resp[1] = sensorId;
+    if (sensorId <= SH2_MAX_SENSOR_ID) {
+        resp[2] = pEmu->sensor[sensorId].flags;
+        writeu16(resp + 3, pEmu->sensor[sensorId].changeSensitivity);
+        writeu32(resp + 5, pEmu->sensor[sensorId].reportInterval_us);
+        writeu32(resp + 9, pEmu->sensor[sensorId].batchInterval_us);
+        writeu32(resp + 13, pEmu->sensor[sensorId].sensorSpecific);
+    }
+    respAdd(pEmu, resp, sizeof(resp));
+}
+
+static void setFeature(sh2_EmuHub_t *pEmu, const uint8_t *req)
+{
+    uint8_t sensorId = req[1];
+
+    if (sensorId <= SH2_MAX_SENSOR_ID) {
+        uint32_t interval_us = readu32(req + 5);
+        if ((interval_us != 0) && (interval_us < emuSensor[sensorId].minPeriod_us)) {
+            interval_us = emuSensor[sensorId].minPeriod_us;
+        }
+        if ((interval_us != 0) && (pEmu->sensor[sensorId].reportInterval_us == 0)) {
+            pEmu->sensor[sensorId].nextSample_us = pEmu->now_us + interval_us;
+        }
+
+        pEmu->sensor[sensorId].flags = req[2];
+        pEmu->sensor[sensorId].changeSensitivity = readu16(req + 3);
+        pEmu->sensor[sensorId].reportInterval_us = interval_us;
+        pEmu->sensor[sensorId].batchInterval_us = readu32(req + 9);
+        pEmu->sensor[sensorId].sensorSpecific = readu32(req + 13);
+    }
+
+    sendFeature(pEmu, sensorId);
+}
+
+static void sendProdIds(sh2_EmuHub_t *pEmu)
+{
+    // Bootloader, application, sensor hub and driver parts
+    static const uint32_t partNumber[] = {10003606, 10003608, 10003171, 10003251};
+    uint8_t resp[PROD_ID_RESP_LEN];
+
+    for (unsigned i = 0; i < sizeof(partNumber)/sizeof(partNumber[0]); i++) {
+        memset(resp, 0, sizeof(resp));
+        resp[0] = SENSORHUB_PROD_ID_RESP;
+        resp[1] = 1;  // reset cause: power on
+        resp[2] = 3;
+        resp[3] = 2;
+        writeu32(resp + 4, partNumber[i]);
+        writeu32(resp + 8, 300 + i);
+        writeu16(resp + 12, 7);
+        respAdd(pEmu, resp, sizeof(resp));
+    }
+}
+
+static bool isMetadata(uint16_t frsType)
+{
+    return (frsType >= FRS_ID_META_RAW_ACCELEROMETER) &&
+        (frsType <= FRS_ID_META_GYRO_INTEGRATED_RV);
+}
+
+// Revision 1 metadata of an emulated sensor, 0 words if not emulated
+static uint16_t metadata(uint16_t frsType, uint32_t *data)
+{
+    for (unsigned id = 0; id <= SH2_MAX_SENSOR_ID; id++) {
+        const EmuSensor_t *pSensor = &emuSensor[id];
+        if ((pSensor->reportLen == 0) || (pSensor->metadataId != frsType)) {
+            continue;
+        }
+
+        uint8_t vendorId[(sizeof(VENDOR_ID) + 3) & ~3];
+        memset(vendorId, 0, sizeof(vendorId));
+        memcpy(vendorId, VENDOR_ID, sizeof(VENDOR_ID));
+
+        data[0] = 1 | (1 << 8) | (1 << 16);    // ME, MH, SH versions
+        data[1] = 1 << pSensor->qPoint1;        // range: 1.0
+        data[2] = 1;                            // resolution: 1 LSB
+        data[3] = 0x0100 | (1 << 16);           // 0.25 mA, revision 1
+        data[4] = pSensor->minPeriod_us;
+        data[5] = 0;                            // FIFO
+        data[6] = (uint32_t)sizeof(VENDOR_ID) << 16;
+        data[7] = pSensor->qPoint1 | ((uint32_t)pSensor->qPoint2 << 16);
+        for (unsigned i = 0; i < sizeof(vendorId)/4; i++) {
+            data[8+i] = readu32(vendorId + 4*i);
+        }
+        return 8 + sizeof(vendorId)/4;
+    }
+
+    return 0;
+}
+
+static void frsReadResp(sh2_EmuHub_t *pEmu, uint16_t frsType, uint16_t offset,
+                        uint8_t words, uint8_t status, const uint32_t *data)
+{
+    uint8_t resp[FRS_READ_RESP_LEN];
+
+    memset(resp, 0, sizeof(resp));
+    resp[0] = SENSORHUB_FRS_READ_RESP;
+    resp[1] = (words << 4) | status;
+    writeu16(resp + 2, offset);
+    if (words >= 1) writeu32(resp + 4, data[0]);
+    if (words >= 2) writeu32(resp + 8, data[1]);
+    writeu16(resp + 12, frsType);
+    respAdd(pEmu, resp, sizeof(resp));
+}
+
+static void frsRead(sh2_EmuHub_t *pEmu, const uint8_t *req)
+{
+    uint16_t offset = readu16(req + 2);
+    uint16_t frsType = readu16(req + 4);
+    uint16_t blockSize = readu16(req + 6);
+    uint32_t metaData[SH2_EMU_FRS_WORDS];
+    const uint32_t *data = metaData;
+    uint16_t words = 0;
+
+    if (faulted(pEmu, SH2_EMU_FAULT_FRS_BUSY)) {
+        frsReadResp(pEmu, frsType, offset, 0, FRS_READ_STATUS_BUSY, 0);
+        return;
+    }
+
+    if (isMetadata(frsType)) {
+        words = metadata(frsType, metaData);
+    }
+    else {
+        for (unsigned i = 0; i < SH2_EMU_FRS_RECORDS; i++) {
+            if (pEmu->frs[i].frsType == frsType) {
+                data = pEmu->frs[i].data;
+                words = pEmu->frs[i].words;
+                break;
+            }
+        }
+    }
+
+    if (words == 0) {
+        frsReadResp(pEmu, frsType, offset, 0, FRS_READ_STATUS_RECORD_EMPTY, 0);
+        return;
+    }
+    if (offset >= words) {
+        frsReadResp(pEmu, frsType, offset, 0, FRS_READ_STATUS_OFFSET_OUT_OF_RANGE, 0);
+        return;
+    }
+
+    uint16_t end = words;
+    if ((blockSize != 0) && (offset + blockSize < words)) {
+        end = offset + blockSize;
+    }
+
+    for (uint16_t w = offset; w < end; w += 2) {
+        uint8_t n = (end - w >= 2) ? 2 : 1;
+        uint8_t status = FRS_READ_STATUS_NO_ERROR;
+        if (w + n >= end) {
+            if (end < words) {
+                status = FRS_READ_STATUS_READ_BLOCK_COMPLETED;
+            }
+            else if (blockSize != 0) {
+                status = FRS_READ_STATUS_READ_BLOCK_AND_RECORD_COMPLETED;
+            }
+            else {
+                status = FRS_READ_STATUS_READ_RECORD_COMPLETED;
+            }
+        }
+        frsReadResp(pEmu, frsType, w, n, status, data + w);
+    }
+}
+
+static void frsWriteResp(sh2_EmuHub_t *pEmu, uint8_t status, uint16_t offset)
+{
+    uint8_t resp[FRS_WRITE_RESP_LEN];
+
+    resp[0] = SENSORHUB_FRS_WRITE_RESP;
+    resp[1] = status;
+    writeu16(resp + 2, offset);
+    respAdd(pEmu, resp, sizeof(resp));
+}
+
+// Unsolicited notice that a record changed
+static void frsChanged(sh2_EmuHub_t *pEmu, uint16_t frsType)
+{
+    uint8_t r[11];
+
+    memset(r, 0, sizeof(r));
+    writeu16(r + 1, frsType);
+    cmdResp(pEmu, SH2_INIT_UNSOLICITED | SH2_CMD_FRS, 0, 0, r);
+}
+
+// Store a record, erasing it if words is 0
+static bool frsStore(sh2_EmuHub_t *pEmu, uint16_t frsType, const uint32_t *data, uint16_t words)
+{
+    int slot = -1;
+
+    for (int i = 0; i < SH2_EMU_FRS_RECORDS; i++) {
+        if (pEmu->frs[i].frsType == frsType) {
+            slot = i;
+            break;
+        }
+        if ((slot < 0) && (pEmu->frs[i].frsType == 0)) {
+            slot = i;
+        }
+    }
+
+    if (words == 0) {
+        if ((slot >= 0) && (pEmu->frs[slot].frsType == frsType)) {
+            pEmu->frs[slot].frsType = 0;
+            pEmu->frs[slot].words = 0;
+        }
+        return true;
+    }
+    if (slot < 0) {
+        return false;
+    }
+
+    pEmu->frs[slot].frsType = frsType;
+    pEmu->frs[slot].words = words;
+    memcpy(pEmu->frs[slot].data, data, words * sizeof(uint32_t));
+    return true;
+}
+
+static void frsWrite(sh2_EmuHub_t *pEmu, const uint8_t *req)
+{
+    uint16_t length = readu16(req + 2);
+    uint16_t frsType = readu16(req + 4);
+
+    if (isMetadata(frsType)) {
+        frsWriteResp(pEmu, FRS_WRITE_STATUS_READ_ONLY, 0);
+    }
+    else if (length > SH2_EMU_FRS_WORDS) {
+        frsWriteResp(pEmu, FRS_WRITE_STATUS_INVALID_LENGTH, 0);
+    }
+    else if (length == 0) {
+        frsStore(pEmu, frsType, 0, 0);
+        frsWriteResp(pEmu, FRS_WRITE_STATUS_WRITE_COMPLETED, 0);
+        frsChanged(pEmu, frsType);
+    }
+    else {
+        pEmu->writing = true;
+        pEmu->writeType = frsType;
+        pEmu->writeWords = length;
+        memset(pEmu->writeData, 0, sizeof(pEmu->writeData));
+        frsWriteResp(pEmu, FRS_WRITE_STATUS_READY, 0);
+    }
+}
+
+static void frsWriteData(sh2_EmuHub_t *pEmu, const uint8_t *req)
+{
+    uint16_t offset = readu16(req + 2);
+
+    if (!pEmu->writing) {
+        frsWriteResp(pEmu, FRS_WRITE_STATUS_NOT_READY, offset);
+        return;
+    }
+    if (faulted(pEmu, SH2_EMU_FAULT_FRS_BUSY)) {
+        frsWriteResp(pEmu, FRS_WRITE_STATUS_BUSY, offset);
+        return;
+    }
+
+    if (offset < pEmu->writeWords) pEmu->writeData[offset] = readu32(req + 4);
+    if (offset + 1 < pEmu->writeWords) pEmu->writeData[offset+1] = readu32(req + 8);
+
+    if (offset + 2 < pEmu->writeWords) {
+        frsWriteResp(pEmu, FRS_WRITE_STATUS_RECEIVED, offset);
+        return;
+    }
+
+    // Last data of the record
+    pEmu->writing = false;
+    if (!frsStore(pEmu, pEmu->writeType, pEmu->writeData, pEmu->writeWords)) {
+        frsWriteResp(pEmu, FRS_WRITE_STATUS_DEVICE_ERROR, offset);
+        return;
+    }
+    frsWriteResp(pEmu, FRS_WRITE_STATUS_WRITE_COMPLETED, offset);
+    frsChanged(pEmu, pEmu->writeType);
+}
+
+static void hubReset(sh2_EmuHub_t *pEmu);
+
+// Returns false if the request reset the hub
+static bool command(sh2_EmuHub_t *pEmu, const uint8_t *req)
+{
+    uint8_t seq = req[1];
+    uint8_t cmd = req[2];
+    const uint8_t *p = req + 3;
+    uint8_t r[11];
+
+    memset(r, 0, sizeof(r));
+    switch (cmd) {
+        case SH2_CMD_ERRORS:
+            r[2] = 255;  // no (more) errors
+            cmdResp(pEmu, cmd, seq, 0, r);
+            break;
+        case SH2_CMD_COUNTS:
+            if (p[0] == SH2_COUNTS_GET_COUNTS) {
+                uint32_t reports = (p[1] <= SH2_MAX_SENSOR_ID) ? pEmu->sensor[p[1]].reports : 0;
+                r[0] = p[0];
+                r[1] = p[1];
+                writeu32(r + 3, reports);   // offered
+                writeu32(r + 7, reports);   // accepted
+                cmdResp(pEmu, cmd, seq, 0, r);
+                writeu32(r + 3, reports);   // on
+                writeu32(r + 7, reports);   // attempted
+                cmdResp(pEmu, cmd, seq, 1, r);
+            }
+            else if (p[1] <= SH2_MAX_SENSOR_ID) {
+                pEmu->sensor[p[1]].reports = 0;
+            }
+            break;
+        case SH2_CMD_INITIALIZE:
+            r[1] = p[0];
+            cmdResp(pEmu, cmd, seq, 0, r);
+            break;
+        case SH2_CMD_DCD:
+        case SH2_CMD_GET_OSC_TYPE:
+            cmdResp(pEmu, cmd, seq, 0, r);
+            break;
+        case SH2_CMD_ME_CAL:
+            if (p[3] != SH2_ME_CAL_GET) {
+                pEmu->calConfig[0] = p[0];
+                pEmu->calConfig[1] = p[1];
+                pEmu->calConfig[2] = p[2];
+                pEmu->calConfig[3] = p[4];
+            }
+            memcpy(r + 1, pEmu->calConfig, sizeof(pEmu->calConfig));
+            cmdResp(pEmu, cmd, seq, 0, r);
+            break;
+        case SH2_CMD_CAL:
+            if (p[0] == SH2_CAL_FINISH) {
+                r[1] = SH2_CAL_SUCCESS;
+            }
+            cmdResp(pEmu, cmd, seq, 0, r);
+            break;
+        case SH2_CMD_CLEAR_DCD_AND_RESET:
+            hubReset(pEmu);
+            return false;
+        default:
+            // Tare, DCD save and unknown commands have no response
+            break;
+    }
+
+    return true;
+}
+
+static void flush(sh2_EmuHub_t *pEmu, uint8_t sensorId)
+{
+    uint8_t resp[FLUSH_COMPLETED_LEN];
+
+    flushCargo(pEmu);
+    resp[0] = SENSORHUB_FLUSH_COMPLETED;
+    resp[1] = sensorId;
+    emuSend(pEmu, CHAN_INPUT_NORMAL, resp, sizeof(resp));
+}
+
+static void controlRequests(sh2_EmuHub_t *pEmu, const uint8_t *payload, uint16_t len)
+{
+    uint16_t cursor = 0;
+
+    while (cursor < len) {
+        const uint8_t *req = payload + cursor;
+        uint16_t reqLen;
+
+        switch (req[0]) {
+            case SENSORHUB_GET_FEATURE_REQ:    reqLen = GET_FEATURE_REQ_LEN; break;
+            case SENSORHUB_SET_FEATURE_CMD:    reqLen = SET_FEATURE_CMD_LEN; break;
+            case SENSORHUB_PROD_ID_REQ:        reqLen = PROD_ID_REQ_LEN; break;
+            case SENSORHUB_FRS_READ_REQ:       reqLen = FRS_READ_REQ_LEN; break;
+            case SENSORHUB_FRS_WRITE_REQ:      reqLen = FRS_WRITE_REQ_LEN; break;
+            case SENSORHUB_FRS_WRITE_DATA_REQ: reqLen = FRS_WRITE_DATA_REQ_LEN; break;
+            case SENSORHUB_COMMAND_REQ:        reqLen = COMMAND_REQ_LEN; break;
+            case SENSORHUB_FORCE_SENSOR_FLUSH: reqLen = FORCE_SENSOR_FLUSH_LEN; break;
+            default:
+                // Can't find the next request without the length of this one
+                return;
+        }
+        if (cursor + reqLen > len) {
+            return;
+        }
+
+        switch (req[0]) {
+            case SENSORHUB_GET_FEATURE_REQ:
+                sendFeature(pEmu, req[1]);
+                break;
+            case SENSORHUB_SET_FEATURE_CMD:
+                setFeature(pEmu, req);
+                break;
+            case SENSORHUB_PROD_ID_REQ:
+                sendProdIds(pEmu);
+                break;
+            case SENSORHUB_FRS_READ_REQ:
+                frsRead(pEmu, req);
+                break;
+            case SENSORHUB_FRS_WRITE_REQ:
+                frsWrite(pEmu, req);
+                break;
+            case SENSORHUB_FRS_WRITE_DATA_REQ:
+                frsWriteData(pEmu, req);
+                break;
+            case SENSORHUB_COMMAND_REQ:
+                if (!command(pEmu, req)) {
+                    return;
+                }
+                break;
+            case SENSORHUB_FORCE_SENSOR_FLUSH:
+                flush(pEmu, req[1]);
+                break;
+        }
+
+        cursor += reqLen;
+    }
+}
+
+// ------------------------------------------------------------------------
+// Reset
+
+static void hubReset(sh2_EmuHub_t *pEmu)
+{
+    uint8_t r[11];
+    uint8_t resetComplete = EXECUTABLE_DEVICE_RESP_RESET_COMPLETE;
+
+    // Everything but FRS is lost
+    pEmu->queueHead = 0;
+    pEmu->queueCount = 0;
+    memset(pEmu->chanSeq, 0, sizeof(pEmu->chanSeq));
+    pEmu->respLen = 0;
+    pEmu->respSeq = 0;
+    memset(pEmu->sensor, 0, sizeof(pEmu->sensor));
+    pEmu->cargoLen = 0;
+    pEmu->cargoReports = 0;
+    pEmu->writing = false;
+    memset(pEmu->calConfig, 0, sizeof(pEmu->calConfig));
+
+    sendAdvert(pEmu);
+    emuSend(pEmu, CHAN_EXECUTABLE, &resetComplete, sizeof(resetComplete));
+
+    memset(r, 0, sizeof(r));
+    r[1] = SH2_INIT_SYSTEM;
+    cmdResp(pEmu, SH2_INIT_UNSOLICITED | SH2_CMD_INITIALIZE, 0, 0, r);
+    respFlush(pEmu);
+}
+
+// ------------------------------------------------------------------------
+// HAL
+
+static int emuReset(sh2_Hal_t *self, bool dfuMode, sh2_rxCallback_t *onRx, void *cookie)
+{
+    sh2_EmuHub_t *pEmu = (sh2_EmuHub_t *)self;
+
+    // The bootloader is not emulated
+    if (dfuMode) {
+        return SH2_ERR;
+    }
+
+    pEmu->onRx = onRx;
+    pEmu->cookie = cookie;
+    pEmu->unblocked = false;
+    hubReset(pEmu);
+
+    return SH2_OK;
+}
+
+static int emuTx(sh2_Hal_t *self, uint8_t *pData, uint32_t len)
+{
+    sh2_EmuHub_t *pEmu = (sh2_EmuHub_t *)self;
+
+    if ((len < SHTP_HDR_LEN) || (len > SH2_HAL_MAX_TRANSFER)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+    pEmu->stats.hostTransfers++;
+
+    uint16_t transferLen = readu16(pData) & 0x7FFF;
+    if (transferLen > len) {
+        transferLen = len;
+    }
+    const uint8_t *payload = pData + SHTP_HDR_LEN;
+    uint16_t payloadLen = transferLen - SHTP_HDR_LEN;
+    if (payloadLen == 0) {
+        return SH2_OK;
+    }
+
+    switch (pData[2]) {
+        case CHAN_COMMAND:
+            if (payload[0] == CMD_ADVERTISE) {
+                sendAdvert(pEmu);
+            }
+            break;
+        case CHAN_EXECUTABLE:
+            if (payload[0] == EXECUTABLE_DEVICE_CMD_RESET) {
+                hubReset(pEmu);
+            }
+            break;
+        case CHAN_CONTROL:
+            if (!faulted(pEmu, SH2_EMU_FAULT_SILENCE)) {
+                controlRequests(pEmu, payload, payloadLen);
+                respFlush(pEmu);
+            }
+            break;
+        default:
+            break;
+    }
+
+    return SH2_OK;
+}
+
+static int emuRx(sh2_Hal_t *self, uint8_t *pData, uint32_t len)
+{
+    (void)self;
+    (void)pData;
+    (void)len;
+
+    // Only DFU reads, and the bootloader is not emulated
+    return SH2_ERR;
+}
+
+static int emuBlock(sh2_Hal_t *self)
+{
+    sh2_EmuHub_t *pEmu = (sh2_EmuHub_t *)self;
+
+    // Responses are already queued: deliver until one completes the op
+    while (!pEmu->unblocked && deliverNext(pEmu)) {
+    }
+
+    if (!pEmu->unblocked) {
+        return SH2_ERR_TIMEOUT;
+    }
+    pEmu->unblocked = false;
+
+    return SH2_OK;
+}
+
+static int emuUnblock(sh2_Hal_t *self)
+{
+    sh2_EmuHub_t *pEmu = (sh2_EmuHub_t *)self;
+
+    pEmu->unblocked = true;
+
+    return SH2_OK;
+}
+
+static uint32_t emuGetTimeUs(sh2_Hal_t *self)
+{
+    sh2_EmuHub_t *pEmu = (sh2_EmuHub_t *)self;
+
+    return pEmu->now_us;
+}
+
+// --- Public API ---------------------------------------------------------
+
+void sh2_emuHub_init(sh2_EmuHub_t *pEmu)
+{
+    memset(pEmu, 0, sizeof(*pEmu));
+
+    pEmu->hal.reset = emuReset;
+    pEmu->hal.tx = emuTx;
+    pEmu->hal.rx = emuRx;
+    pEmu->hal.block = emuBlock;
+    pEmu->hal.unblock = emuUnblock;
+    pEmu->hal.getTimeUs = emuGetTimeUs;
+
+    if (globalEmu == 0) {
+        globalEmu = pEmu;
+    }
+}
+
+void sh2_emuHub_setMaxReports(sh2_EmuHub_t *pEmu, uint16_t maxReports)
+{
+    pEmu->maxReports = maxReports;
+}
+
+void sh2_emuHub_injectFault(sh2_EmuHub_t *pEmu, sh2_EmuFault_t fault,
+                            uint16_t skip, uint16_t count)
+{
+    if (fault >= SH2_EMU_FAULTS) {
+        return;
+    }
+
+    pEmu->fault[fault].skip = skip;
+    pEmu->fault[fault].count = count;
+}
+
+uint32_t sh2_emuHub_run(sh2_EmuHub_t *pEmu, uint32_t duration_us)
+{
+    uint32_t end_us = pEmu->now_us + duration_us;
+    uint32_t delivered = 0;
+
+    while (true) {
+        delivered += deliverAll(pEmu);
+
+        // Advance to the next sample or batch deadline, up to the end
+        uint32_t next_us = end_us;
+        for (unsigned id = 0; id <= SH2_MAX_SENSOR_ID; id++) {
+            if ((pEmu->sensor[id].reportInterval_us != 0) &&
+                (emuSensor[id].reportLen != 0) &&
+                ((int32_t)(pEmu->sensor[id].nextSample_us - next_us) < 0)) {
+                next_us = pEmu->sensor[id].nextSample_us;
+            }
+        }
+        if ((pEmu->cargoReports > 0) &&
+            ((int32_t)(pEmu->cargoDeadline_us - next_us) < 0)) {
+            next_us = pEmu->cargoDeadline_us;
+        }
+        if ((int32_t)(next_us - pEmu->now_us) > 0) {
+            pEmu->now_us = next_us;
+        }
+
+        sample(pEmu);
+
+        if (pEmu->now_us == end_us) {
+            break;
+        }
+    }
+    delivered += deliverAll(pEmu);
+
+    return delivered;
+}
+
+uint32_t sh2_emuHub_now(sh2_EmuHub_t *pEmu)
+{
+    return pEmu->now_us;
+}
+
+void sh2_emuHub_getStats(sh2_EmuHub_t *pEmu, sh2_EmuHubStats_t *pStats)
+{
+    *pStats = pEmu->stats;
+}
+
+#ifndef SH2_NO_GLOBAL_HAL
+// sh2_hal_ functions, for sh2_initialize()
+
+int sh2_hal_reset(bool dfuMode, sh2_rxCallback_t *onRx, void *cookie)
+{
+    if (globalEmu == 0) return SH2_ERR;
+
+    return emuReset(&globalEmu->hal, dfuMode, onRx, cookie);
+}
+
+int sh2_hal_tx(uint8_t *pData, uint32_t len)
+{
+    if (globalEmu == 0) return SH2_ERR;
+
+    return emuTx(&globalEmu->hal, pData, len);
+}
+
+int sh2_hal_rx(uint8_t *pData, uint32_t len)
+{
+    if (globalEmu == 0) return SH2_ERR;
+
+    return emuRx(&globalEmu->hal, pData, len);
+}
+
+int sh2_hal_block(void)
+{
+    if (globalEmu == 0) return SH2_ERR;
+
+    return emuBlock(&globalEmu->hal);
+}
+
+int sh2_hal_unblock(void)
+{
+    if (globalEmu == 0) return SH2_ERR;
+
+    return emuUnblock(&globalEmu->hal);
+}
+#endif
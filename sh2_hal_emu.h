@@ -0,0 +1,222 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file sh2_hal_emu.h
+ * @brief Software SensorHub behind the HAL, for testing without hardware
+ *
+ * The emulated hub advertises the usual SHTP apps and channels, answers
+ * SH-2 control requests (sensor configs, product ids, FRS reads and
+ * writes, commands, flush) and produces sensor reports at the configured
+ * rates.  Time is virtual: it only advances in sh2_emuHub_run(), and all
+ * transfers to the host are delivered from that call or from
+ * sh2_hal_block(), so runs are deterministic.
+ *
+ * Sensor reports carry synthetic data.  All go to the inputNormal channel
+ * except gyro-integrated RV, which goes header-less to inputGyroRv.
+ *
+ * Faults, such as a busy FRS or lost responses, can be injected to test
+ * the driver's recovery from them.  (See sh2_emuHub_injectFault().)
+ */
+
+#ifndef SH2_HAL_EMU_H
+#define SH2_HAL_EMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sh2.h"
+#include "sh2_hal.h"
+
+// Transfers to the host that can wait for delivery.
+// May be overridden in sh2_hal_impl.h.
+#ifndef SH2_EMU_QUEUE_LEN
+#define SH2_EMU_QUEUE_LEN (16)
+#endif
+
+// Writable FRS records, and the most words each may hold.
+// May be overridden in sh2_hal_impl.h.
+#ifndef SH2_EMU_FRS_RECORDS
+#define SH2_EMU_FRS_RECORDS (8)
+#endif
+#ifndef SH2_EMU_FRS_WORDS
+#define SH2_EMU_FRS_WORDS (64)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * @brief Emulated hub statistics
+     *
+     * See sh2_emuHub_getStats().
+     */
+    typedef struct sh2_EmuHubStats {
+        uint32_t hostTransfers;  /**< @brief Transfers received from the host */
+        uint32_t hubTransfers;   /**< @brief Transfers delivered to the host */
+        uint32_t hubBytes;       /**< @brief Bytes delivered to the host */
+        uint32_t reports;        /**< @brief Sensor reports produced */
+        uint32_t overflows;      /**< @brief Transfers dropped because the queue was full */
+        uint32_t faults;         /**< @brief Requests and responses hit by injected faults */
+    } sh2_EmuHubStats_t;
+
+    /**
+     * @brief Faults an emulated hub can inject
+     *
+     * See sh2_emuHub_injectFault().
+     */
+    typedef enum sh2_EmuFault {
+        SH2_EMU_FAULT_FRS_BUSY = 0,  /**< @brief FRS read and write data requests refused as busy */
+        SH2_EMU_FAULT_DROP,          /**< @brief Control channel responses lost */
+        SH2_EMU_FAULT_SILENCE,       /**< @brief Control channel transfers from the host ignored */
+        SH2_EMU_FAULTS
+    } sh2_EmuFault_t;
+
+    /**
+     * @brief Emulated hub state.
+     *
+     * Allocated by the caller and set up by sh2_emuHub_init().  The
+     * members are private to sh2_hal_emu.c.
+     */
+    typedef struct sh2_EmuHub {
+        sh2_Hal_t hal;  // Must be first
+
+        sh2_rxCallback_t *onRx;
+        void *cookie;
+        uint32_t now_us;
+        bool unblocked;
+        uint16_t maxReports;
+
+        // Transfers waiting for delivery to the host
+        uint8_t queue[SH2_EMU_QUEUE_LEN][SH2_HAL_MAX_TRANSFER];
+        uint16_t queueLen[SH2_EMU_QUEUE_LEN];
+        uint16_t queueHead;
+        uint16_t queueCount;
+        uint8_t chanSeq[8];
+
+        // Control responses to the transfer being processed
+        uint8_t resp[SH2_HAL_MAX_TRANSFER];
+        uint16_t respLen;
+        uint8_t respSeq;
+
+        // Sensor configs and report generation
+        struct {
+            uint8_t flags;
+            uint16_t changeSensitivity;
+            uint32_t reportInterval_us;
+            uint32_t batchInterval_us;
+            uint32_t sensorSpecific;
+            uint32_t nextSample_us;
+            uint32_t reports;
+            uint8_t seq;
+        } sensor[SH2_MAX_SENSOR_ID+1];
+
+        // Cargo of sensor reports being batched
+        uint8_t cargo[SH2_HAL_MAX_TRANSFER];
+        uint16_t cargoLen;
+        uint16_t cargoReports;
+        uint32_t cargoBase_us;
+        uint32_t cargoDeadline_us;
+
+        // Writable FRS records
+        struct {
+            uint16_t frsType;  // 0 if unused
+            uint16_t words;
+            uint32_t data[SH2_EMU_FRS_WORDS];
+        } frs[SH2_EMU_FRS_RECORDS];
+        bool writing;  // Between FRS write request and last data
+        uint16_t writeType;
+        uint16_t writeWords;
+        uint32_t writeData[SH2_EMU_FRS_WORDS];
+
+        uint8_t calConfig[4];
+
+        // Injected faults: pass skip chances by, then hit count
+        struct {
+            uint16_t skip;
+            uint16_t count;
+        } fault[SH2_EMU_FAULTS];
+
+        sh2_EmuHubStats_t stats;
+    } sh2_EmuHub_t;
+
+    /**
+     * @brief Set up an emulated hub.
+     *
+     * The first hub initialized also backs the sh2_hal_ functions, so
+     * sh2_initialize() can be used with it.  Pass &pEmu->hal to sh2_open()
+     * to emulate several hubs.  The hub starts when the driver resets it.
+     *
+     * @param  pEmu Hub state to set up.
+     */
+    void sh2_emuHub_init(sh2_EmuHub_t *pEmu);
+
+    /**
+     * @brief Limit the number of sensor reports in each cargo.
+     *
+     * By default a cargo holds every report due at the same time, or
+     * batched by the sensor's batch interval, up to SH2_HAL_MAX_TRANSFER.
+     *
+     * @param  pEmu The hub.
+     * @param  maxReports Most reports per cargo, 0 for no limit.
+     */
+    void sh2_emuHub_setMaxReports(sh2_EmuHub_t *pEmu, uint16_t maxReports);
+
+    /**
+     * @brief Inject a fault.
+     *
+     * Each FRS read or write data request (SH2_EMU_FAULT_FRS_BUSY),
+     * control channel response (SH2_EMU_FAULT_DROP) or control channel
+     * transfer from the host (SH2_EMU_FAULT_SILENCE) is a chance for the
+     * fault.  After skip chances go by, the next count are hit.  A busy FRS
+     * request is answered with the busy status and otherwise ignored.  The
+     * faults are independent of one another and survive hub resets.
+     *
+     * @param  pEmu The hub.
+     * @param  fault Which fault.
+     * @param  skip Chances to let by first.
+     * @param  count Chances to hit, 0 to clear the fault.
+     */
+    void sh2_emuHub_injectFault(sh2_EmuHub_t *pEmu, sh2_EmuFault_t fault,
+                                uint16_t skip, uint16_t count);
+
+    /**
+     * @brief Advance virtual time, delivering sensor reports and responses.
+     *
+     * @param  pEmu The hub.
+     * @param  duration_us Time to advance [uS].
+     * @return Number of transfers delivered to the host.
+     */
+    uint32_t sh2_emuHub_run(sh2_EmuHub_t *pEmu, uint32_t duration_us);
+
+    /**
+     * @brief Get the hub's virtual time, in the timebase of HAL timestamps.
+     */
+    uint32_t sh2_emuHub_now(sh2_EmuHub_t *pEmu);
+
+    /**
+     * @brief Get statistics of an emulated hub.
+     */
+    void sh2_emuHub_getStats(sh2_EmuHub_t *pEmu, sh2_EmuHubStats_t *pStats);
+
+#ifdef __cplusplus
+}    // end of extern "C"
+#endif
+
+// #ifdef SH2_HAL_EMU_H
+#endif
@@ -0,0 +1,701 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Reference HAL for Linux hosts.
+ *
+ * The hub is connected by i2c-dev or spidev, with INTN (and optionally
+ * RSTN, BOOTN and PS0/WAKE) on a GPIO character device.  A dedicated
+ * thread waits for INTN edges, reads each transfer into rxBuf and passes
+ * it to the driver with the driver lock held.
+ */
+
+// For clock_gettime(), nanosleep() and pthread_condattr_setclock()
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/i2c-dev.h>
+#include <linux/spi/spidev.h>
+
+#include "sh2_hal_posix.h"
+#include "sh2_err.h"
+
+// --- Private Definitions ------------------------------------------------
+
+#define SHTP_HDR_LEN (4)
+
+// RSTN pulse length and time for the hub to start after it [mS]
+#define RESET_PULSE_MS (10)
+
+// Longest the rx thread sleeps before checking whether it should stop [mS]
+#define INTN_POLL_MS (100)
+
+// Longest an SPI transmit waits for room in the transmit queue [mS]
+#define TX_WAIT_MS (500)
+
+// SPI clock if none is configured [Hz]
+#define DEFAULT_SPI_SPEED_HZ (1000000)
+
+// --- Private Data -------------------------------------------------------
+
+// HAL behind the sh2_hal_ functions
+static sh2_PosixHal_t *globalHal = 0;
+
+// --- Private Functions --------------------------------------------------
+
+static uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void deadlineAfter(struct timespec *pTs, uint32_t ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, pTs);
+    pTs->tv_sec += ms / 1000;
+    pTs->tv_nsec += (long)(ms % 1000) * 1000000;
+    if (pTs->tv_nsec >= 1000000000) {
+        pTs->tv_sec++;
+        pTs->tv_nsec -= 1000000000;
+    }
+}
+
+static void sleep_ms(uint32_t ms)
+{
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000 };
+
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+static int gpioOutput(int chipFd, int line, uint8_t value, const char *label)
+{
+    struct gpiohandle_request req;
+
+    if (line < 0) {
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.lineoffsets[0] = line;
+    req.lines = 1;
+    req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    req.default_values[0] = value;
+    strncpy(req.consumer_label, label, sizeof(req.consumer_label)-1);
+    if (ioctl(chipFd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0) {
+        return -1;
+    }
+
+    return req.fd;
+}
+
+static void gpioSet(int fd, uint8_t value)
+{
+    struct gpiohandle_data data;
+
+    if (fd < 0) return;
+
+    memset(&data, 0, sizeof(data));
+    data.values[0] = value;
+    ioctl(fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data);
+}
+
+static bool intnAsserted(sh2_PosixHal_t *pHal)
+{
+    struct gpiohandle_data data;
+
+    if (ioctl(pHal->intnFd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0) {
+        return false;
+    }
+
+    // INTN is active low
+    return data.values[0] == 0;
+}
+
+// Wait up to timeout_ms for INTN and note when it was asserted.
+// Returns 1 if asserted, 0 on timeout, negative on error.
+static int waitIntn(sh2_PosixHal_t *pHal, uint32_t timeout_ms)
+{
+    struct pollfd pfd = { .fd = pHal->intnFd, .events = POLLIN | POLLPRI };
+    struct gpioevent_data event;
+    bool gotEdge = false;
+    uint64_t edge_us = 0;
+
+    if (!intnAsserted(pHal)) {
+        int rc = poll(&pfd, 1, timeout_ms);
+        if (rc < 0) {
+            return (errno == EINTR) ? 0 : -1;
+        }
+        if (rc == 0) {
+            return 0;
+        }
+    }
+
+    // Use the kernel's timestamp of the latest edge, if it has one
+    while (read(pHal->intnFd, &event, sizeof(event)) == sizeof(event)) {
+        gotEdge = true;
+        edge_us = event.timestamp / 1000;
+    }
+
+    uint64_t now_us = monotonic_us();
+    if (gotEdge && (edge_us <= now_us) && (now_us - edge_us < 1000000)) {
+        pHal->lastIntn_us = (uint32_t)edge_us;
+    }
+    else {
+        // Still asserted for more data, or edges stamped with another clock
+        pHal->lastIntn_us = (uint32_t)now_us;
+    }
+
+    return intnAsserted(pHal) ? 1 : 0;
+}
+
+// Each thread marks the driver locks it holds in its own value of the
+// HAL's driverLockHeld key, so only the holder ever reads or writes it.
+static void driverLock(sh2_PosixHal_t *pHal)
+{
+    pthread_mutex_lock(&pHal->driverLock);
+    pthread_setspecific(pHal->driverLockHeld, pHal);
+}
+
+static void driverUnlock(sh2_PosixHal_t *pHal)
+{
+    pthread_setspecific(pHal->driverLockHeld, 0);
+    pthread_mutex_unlock(&pHal->driverLock);
+}
+
+static bool driverLockedByCaller(sh2_PosixHal_t *pHal)
+{
+    return pthread_getspecific(pHal->driverLockHeld) != 0;
+}
+
+static int spiTransfer(sh2_PosixHal_t *pHal, const uint8_t *pTx, uint8_t *pRx,
+                       uint32_t len, bool keepSelected)
+{
+    struct spi_ioc_transfer xfer;
+
+    memset(&xfer, 0, sizeof(xfer));
+    xfer.tx_buf = (uintptr_t)pTx;   // zeros are sent if null
+    xfer.rx_buf = (uintptr_t)pRx;
+    xfer.len = len;
+    xfer.cs_change = keepSelected;
+    if (ioctl(pHal->busFd, SPI_IOC_MESSAGE(1), &xfer) < 0) {
+        return SH2_ERR_IO;
+    }
+
+    return SH2_OK;
+}
+
+// Read one transfer over I2C.  Returns its length, 0 if none, negative on error.
+static int i2cRead(sh2_PosixHal_t *pHal)
+{
+    uint8_t hdr[SHTP_HDR_LEN];
+
+    if (read(pHal->busFd, hdr, SHTP_HDR_LEN) != SHTP_HDR_LEN) {
+        return SH2_ERR_IO;
+    }
+
+    uint32_t len = (hdr[0] + (hdr[1] << 8)) & ~0x8000;
+    if ((len < SHTP_HDR_LEN) || (len == 0x7FFF)) {
+        // Nothing to read
+        return 0;
+    }
+    if (len > SH2_HAL_MAX_TRANSFER) {
+        // The hub sends the rest in a continuation
+        len = SH2_HAL_MAX_TRANSFER;
+    }
+
+    // The hub sends the header again, followed by the payload
+    if (read(pHal->busFd, pHal->rxBuf, len) != (ssize_t)len) {
+        return SH2_ERR_IO;
+    }
+
+    return len;
+}
+
+// Exchange one transfer over SPI, sending the oldest queued transmit, if any.
+// Returns the length received, 0 if none, negative on error.
+static int spiExchange(sh2_PosixHal_t *pHal)
+{
+    uint32_t txLen = (pHal->txCount > 0) ? pHal->txLen[pHal->txHead] : 0;
+    const uint8_t *pTx = (txLen > 0) ? pHal->txQueue[pHal->txHead] : 0;
+
+    // Headers cross in both directions, chip select is held for the rest
+    int rc = spiTransfer(pHal, pTx, pHal->rxBuf, SHTP_HDR_LEN, true);
+    if (rc == SH2_OK) {
+        uint32_t rxLen = (pHal->rxBuf[0] + (pHal->rxBuf[1] << 8)) & ~0x8000;
+        if ((rxLen < SHTP_HDR_LEN) || (rxLen == 0x7FFF)) {
+            rxLen = 0;
+        }
+
+        uint32_t len = (rxLen > txLen) ? rxLen : txLen;
+        if (len > SH2_HAL_MAX_TRANSFER) {
+            len = SH2_HAL_MAX_TRANSFER;
+        }
+        if (len < SHTP_HDR_LEN) {
+            len = SHTP_HDR_LEN;
+        }
+
+        // Queued transmits are zero past their length
+        rc = spiTransfer(pHal, pTx ? pTx+SHTP_HDR_LEN : 0, pHal->rxBuf+SHTP_HDR_LEN,
+                         len-SHTP_HDR_LEN, false);
+        if (rc == SH2_OK) {
+            rc = (rxLen > len) ? len : rxLen;
+        }
+    }
+
+    if (txLen > 0) {
+        pHal->txHead = (pHal->txHead + 1) % SH2_POSIX_TX_QUEUE_LEN;
+        pHal->txCount--;
+        pthread_cond_broadcast(&pHal->txCond);
+
+        // Another falling edge on WAKE asks for the next exchange
+        gpioSet(pHal->wakeFd, 1);
+        if (pHal->txCount > 0) {
+            gpioSet(pHal->wakeFd, 0);
+        }
+    }
+
+    return rc;
+}
+
+static void *rxThread(void *arg)
+{
+    sh2_PosixHal_t *pHal = (sh2_PosixHal_t *)arg;
+
+    while (!pHal->stopping) {
+        int rc = waitIntn(pHal, INTN_POLL_MS);
+        if (rc < 0) {
+            // Don't spin if the GPIO line fails
+            sleep_ms(INTN_POLL_MS);
+            continue;
+        }
+        if (rc == 0) {
+            continue;
+        }
+
+        uint32_t t_us = pHal->lastIntn_us;
+
+        pthread_mutex_lock(&pHal->busLock);
+        int len = pHal->spi ? spiExchange(pHal) : i2cRead(pHal);
+        pthread_mutex_unlock(&pHal->busLock);
+
+        if ((len > 0) && (pHal->onRx != 0)) {
+            driverLock(pHal);
+            pHal->onRx(pHal->cookie, pHal->rxBuf, len, t_us);
+            driverUnlock(pHal);
+        }
+    }
+
+    return 0;
+}
+
+static void stopRxThread(sh2_PosixHal_t *pHal)
+{
+    if (!pHal->rxThreadRunning) return;
+
+    // The rx thread may be waiting for the driver lock to deliver data
+    bool locked = driverLockedByCaller(pHal);
+    if (locked) {
+        driverUnlock(pHal);
+    }
+
+    pHal->stopping = true;
+    pthread_join(pHal->rxThread, 0);
+
+    if (locked) {
+        driverLock(pHal);
+    }
+    pHal->rxThreadRunning = false;
+    pHal->stopping = false;
+}
+
+// Queue an SPI transmit for the rx thread.  Called with busLock held.
+static int spiQueueTx(sh2_PosixHal_t *pHal, const uint8_t *pData, uint32_t len)
+{
+    struct timespec deadline;
+    deadlineAfter(&deadline, TX_WAIT_MS);
+
+    while (pHal->txCount >= SH2_POSIX_TX_QUEUE_LEN) {
+        // Only the rx thread empties the queue, so it must not wait for it.
+        if (pthread_equal(pHal->rxThread, pthread_self())) {
+            return SH2_ERR_IO;
+        }
+
+        // Nor may the caller keep the driver lock while it waits: the rx
+        // thread may need it to deliver what it reads before sending more.
+        bool locked = driverLockedByCaller(pHal);
+        if (locked) {
+            driverUnlock(pHal);
+        }
+
+        int waitRc = pthread_cond_timedwait(&pHal->txCond, &pHal->busLock, &deadline);
+
+        if (locked) {
+            // Keep the lock order: driver lock, then bus lock
+            pthread_mutex_unlock(&pHal->busLock);
+            driverLock(pHal);
+            pthread_mutex_lock(&pHal->busLock);
+        }
+        if ((waitRc == ETIMEDOUT) && (pHal->txCount >= SH2_POSIX_TX_QUEUE_LEN)) {
+            return SH2_ERR_TIMEOUT;
+        }
+    }
+
+    uint16_t slot = (pHal->txHead + pHal->txCount) % SH2_POSIX_TX_QUEUE_LEN;
+    memcpy(pHal->txQueue[slot], pData, len);
+    memset(pHal->txQueue[slot]+len, 0, SH2_HAL_MAX_TRANSFER-len);
+    pHal->txLen[slot] = len;
+    pHal->txCount++;
+
+    if (pHal->txCount == 1) {
+        gpioSet(pHal->wakeFd, 0);
+    }
+
+    return SH2_OK;
+}
+
+// --- HAL functions ------------------------------------------------------
+
+static int posixReset(sh2_Hal_t *self, bool dfuMode, sh2_rxCallback_t *onRx, void *cookie)
+{
+    sh2_PosixHal_t *pHal = (sh2_PosixHal_t *)self;
+
+    if (dfuMode && ((pHal->bootnFd < 0) || (pHal->rstnFd < 0))) {
+        // DFU needs BOOTN held low through reset
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    stopRxThread(pHal);
+
+    pHal->onRx = onRx;
+    pHal->cookie = cookie;
+    pHal->txHead = 0;
+    pHal->txCount = 0;
+
+    if (pHal->rstnFd >= 0) {
+        gpioSet(pHal->bootnFd, dfuMode ? 0 : 1);
+        gpioSet(pHal->rstnFd, 0);
+        sleep_ms(RESET_PULSE_MS);
+        gpioSet(pHal->rstnFd, 1);
+        sleep_ms(RESET_PULSE_MS);
+    }
+
+    if (dfuMode) {
+        // The DFU protocol reads the hub with sh2_hal_rx()
+        return SH2_OK;
+    }
+
+    if (pthread_create(&pHal->rxThread, 0, rxThread, pHal) != 0) {
+        return SH2_ERR;
+    }
+    pHal->rxThreadRunning = true;
+
+    if (pHal->rstnFd < 0) {
+        // No reset line: ask the executable app to reset the hub instead.
+        static uint8_t resetCmd[] = { 5, 0, 1, 0, 1 };
+        return self->tx(self, resetCmd, sizeof(resetCmd));
+    }
+
+    return SH2_OK;
+}
+
+static int posixTx(sh2_Hal_t *self, uint8_t *pData, uint32_t len)
+{
+    sh2_PosixHal_t *pHal = (sh2_PosixHal_t *)self;
+    int rc = SH2_OK;
+
+    if (len > SH2_HAL_MAX_TRANSFER) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    pthread_mutex_lock(&pHal->busLock);
+
+    if (!pHal->spi) {
+        if (write(pHal->busFd, pData, len) != (ssize_t)len) {
+            rc = SH2_ERR_IO;
+        }
+    }
+    else if (!pHal->rxThreadRunning) {
+        // DFU: nothing else is using the bus
+        rc = spiTransfer(pHal, pData, 0, len, false);
+    }
+    else {
+        // Queue the transfer for the rx thread, which sends it once the hub
+        // answers WAKE by asserting INTN.
+        rc = spiQueueTx(pHal, pData, len);
+    }
+
+    pthread_mutex_unlock(&pHal->busLock);
+
+    return rc;
+}
+
+static int posixRx(sh2_Hal_t *self, uint8_t *pData, uint32_t len)
+{
+    sh2_PosixHal_t *pHal = (sh2_PosixHal_t *)self;
+    int rc = SH2_OK;
+
+    pthread_mutex_lock(&pHal->busLock);
+
+    if (pHal->spi) {
+        rc = spiTransfer(pHal, 0, pData, len, false);
+    }
+    else if (read(pHal->busFd, pData, len) != (ssize_t)len) {
+        rc = SH2_ERR_IO;
+    }
+
+    pthread_mutex_unlock(&pHal->busLock);
+
+    return rc;
+}
+
+static int posixBlock(sh2_Hal_t *self)
+{
+    sh2_PosixHal_t *pHal = (sh2_PosixHal_t *)self;
+    struct timespec deadline;
+    int rc = SH2_OK;
+
+    // Callers holding the driver lock give it up while they wait, so the
+    // rx thread can deliver the response.  (They hold it again on return.)
+    bool locked = driverLockedByCaller(pHal);
+    if (!locked) {
+        pthread_mutex_lock(&pHal->driverLock);
+    }
+
+    deadlineAfter(&deadline, pHal->blockTimeout_ms);
+    while (!pHal->unblocked && (rc == SH2_OK)) {
+        if (pHal->blockTimeout_ms == 0) {
+            pthread_cond_wait(&pHal->unblockCond, &pHal->driverLock);
+        }
+        else if (pthread_cond_timedwait(&pHal->unblockCond, &pHal->driverLock,
+                                        &deadline) == ETIMEDOUT) {
+            rc = SH2_ERR_TIMEOUT;
+        }
+    }
+    pHal->unblocked = false;
+
+    if (!locked) {
+        pthread_mutex_unlock(&pHal->driverLock);
+    }
+
+    return rc;
+}
+
+static int posixUnblock(sh2_Hal_t *self)
+{
+    sh2_PosixHal_t *pHal = (sh2_PosixHal_t *)self;
+
+    // Usually called from a callback on the rx thread, with the lock held
+    bool locked = driverLockedByCaller(pHal);
+    if (!locked) {
+        pthread_mutex_lock(&pHal->driverLock);
+    }
+
+    pHal->unblocked = true;
+    pthread_cond_signal(&pHal->unblockCond);
+
+    if (!locked) {
+        pthread_mutex_unlock(&pHal->driverLock);
+    }
+
+    return SH2_OK;
+}
+
+// Same clock as the INTN timestamps
+static uint32_t posixGetTimeUs(sh2_Hal_t *self)
+{
+    (void)self;
+
+    return (uint32_t)monotonic_us();
+}
+
+// --- Public API ---------------------------------------------------------
+
+// Close the bus and GPIO lines
+static void closeLines(sh2_PosixHal_t *pHal)
+{
+    if (pHal->wakeFd >= 0) close(pHal->wakeFd);
+    if (pHal->bootnFd >= 0) close(pHal->bootnFd);
+    if (pHal->rstnFd >= 0) close(pHal->rstnFd);
+    close(pHal->intnFd);
+    close(pHal->busFd);
+}
+
+int sh2_posixHal_init(sh2_PosixHal_t *pHal, const sh2_PosixHalConfig_t *pConfig)
+{
+    pthread_condattr_t condAttr;
+    int chipFd;
+
+    if ((pHal == 0) || (pConfig == 0) || (pConfig->device == 0) ||
+        (pConfig->gpioChip == 0) || (pConfig->intnLine < 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    memset(pHal, 0, sizeof(*pHal));
+    pHal->hal.reset = posixReset;
+    pHal->hal.tx = posixTx;
+    pHal->hal.rx = posixRx;
+    pHal->hal.block = posixBlock;
+    pHal->hal.unblock = posixUnblock;
+    pHal->hal.getTimeUs = posixGetTimeUs;
+    pHal->spi = pConfig->spi;
+    pHal->blockTimeout_ms = pConfig->blockTimeout_ms;
+    pHal->rstnFd = -1;
+    pHal->bootnFd = -1;
+    pHal->wakeFd = -1;
+    pHal->intnFd = -1;
+
+    // Bus
+    pHal->busFd = open(pConfig->device, O_RDWR);
+    if (pHal->busFd < 0) {
+        return SH2_ERR_IO;
+    }
+    if (pHal->spi) {
+        uint8_t mode = SPI_MODE_3;
+        uint8_t bits = 8;
+        uint32_t speed = pConfig->spiSpeed_hz ? pConfig->spiSpeed_hz : DEFAULT_SPI_SPEED_HZ;
+        if ((ioctl(pHal->busFd, SPI_IOC_WR_MODE, &mode) < 0) ||
+            (ioctl(pHal->busFd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0) ||
+            (ioctl(pHal->busFd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0)) {
+            close(pHal->busFd);
+            return SH2_ERR_IO;
+        }
+    }
+    else if (ioctl(pHal->busFd, I2C_SLAVE, pConfig->i2cAddr) < 0) {
+        close(pHal->busFd);
+        return SH2_ERR_IO;
+    }
+
+    // GPIO lines.  Outputs start deasserted (high).
+    chipFd = open(pConfig->gpioChip, O_RDWR);
+    if (chipFd < 0) {
+        close(pHal->busFd);
+        return SH2_ERR_IO;
+    }
+
+    struct gpioevent_request intnReq;
+    memset(&intnReq, 0, sizeof(intnReq));
+    intnReq.lineoffset = pConfig->intnLine;
+    intnReq.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    intnReq.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+    strncpy(intnReq.consumer_label, "sh2 intn", sizeof(intnReq.consumer_label)-1);
+    if (ioctl(chipFd, GPIO_GET_LINEEVENT_IOCTL, &intnReq) < 0) {
+        close(chipFd);
+        close(pHal->busFd);
+        return SH2_ERR_IO;
+    }
+    pHal->intnFd = intnReq.fd;
+    fcntl(pHal->intnFd, F_SETFL, fcntl(pHal->intnFd, F_GETFL) | O_NONBLOCK);
+
+    pHal->rstnFd = gpioOutput(chipFd, pConfig->rstnLine, 1, "sh2 rstn");
+    pHal->bootnFd = gpioOutput(chipFd, pConfig->bootnLine, 1, "sh2 bootn");
+    pHal->wakeFd = gpioOutput(chipFd, pConfig->wakeLine, 1, "sh2 wake");
+    close(chipFd);
+
+    // Locks.  Waits use the monotonic clock, like the HAL timestamps.
+    if (pthread_key_create(&pHal->driverLockHeld, 0) != 0) {
+        closeLines(pHal);
+        return SH2_ERR;
+    }
+    pthread_mutex_init(&pHal->driverLock, 0);
+    pthread_mutex_init(&pHal->busLock, 0);
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pHal->unblockCond, &condAttr);
+    pthread_cond_init(&pHal->txCond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+
+    if (globalHal == 0) {
+        globalHal = pHal;
+    }
+
+    return SH2_OK;
+}
+
+void sh2_posixHal_close(sh2_PosixHal_t *pHal)
+{
+    stopRxThread(pHal);
+    closeLines(pHal);
+
+    pthread_cond_destroy(&pHal->txCond);
+    pthread_cond_destroy(&pHal->unblockCond);
+    pthread_mutex_destroy(&pHal->busLock);
+    pthread_mutex_destroy(&pHal->driverLock);
+    pthread_key_delete(pHal->driverLockHeld);
+
+    if (globalHal == pHal) {
+        globalHal = 0;
+    }
+}
+
+void sh2_posixHal_lock(sh2_PosixHal_t *pHal)
+{
+    driverLock(pHal);
+}
+
+void sh2_posixHal_unlock(sh2_PosixHal_t *pHal)
+{
+    driverUnlock(pHal);
+}
+
+#ifndef SH2_NO_GLOBAL_HAL
+// sh2_hal_ functions, for sh2_initialize()
+
+int sh2_hal_reset(bool dfuMode, sh2_rxCallback_t *onRx, void *cookie)
+{
+    if (globalHal == 0) return SH2_ERR;
+
+    return posixReset(&globalHal->hal, dfuMode, onRx, cookie);
+}
+
+int sh2_hal_tx(uint8_t *pData, uint32_t len)
+{
+    if (globalHal == 0) return SH2_ERR;
+
+    return posixTx(&globalHal->hal, pData, len);
+}
+
+int sh2_hal_rx(uint8_t *pData, uint32_t len)
+{
+    if (globalHal == 0) return SH2_ERR;
+
+    return posixRx(&globalHal->hal, pData, len);
+}
+
+int sh2_hal_block(void)
+{
+    if (globalHal == 0) return SH2_ERR;
+
+    return posixBlock(&globalHal->hal);
+}
+
+int sh2_hal_unblock(void)
+{
+    if (globalHal == 0) return SH2_ERR;
+
+    return posixUnblock(&globalHal->hal);
+}
+#endif
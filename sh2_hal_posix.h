@@ -0,0 +1,151 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file sh2_hal_posix.h
+ * @brief Reference HAL for Linux hosts, using i2c-dev or spidev and GPIO lines
+ *
+ * The hub is read by a dedicated thread that sleeps until INTN is
+ * asserted, so an idle or streaming hub costs no polling.  Blocking
+ * sh2_ calls sleep on a condition variable until their operation
+ * completes.
+ *
+ * sh2_hal_impl.h need only define SH2_HAL_MAX_TRANSFER for this HAL.
+ */
+
+#ifndef SH2_HAL_POSIX_H
+#define SH2_HAL_POSIX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "sh2_hal.h"
+
+// SPI transfers to the hub that can wait to be sent.
+// May be overridden in sh2_hal_impl.h.
+#ifndef SH2_POSIX_TX_QUEUE_LEN
+#define SH2_POSIX_TX_QUEUE_LEN (8)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * @brief Bus and GPIO lines connecting one hub.
+     */
+    typedef struct sh2_PosixHalConfig {
+        const char *device;        /**< @brief "/dev/i2c-N" or "/dev/spidevB.C" */
+        bool spi;                  /**< @brief True if device is a spidev */
+        uint8_t i2cAddr;           /**< @brief I2C address, usually 0x4A or 0x4B */
+        uint32_t spiSpeed_hz;      /**< @brief SPI clock, up to 3000000 (0 for 1 MHz) */
+        const char *gpioChip;      /**< @brief "/dev/gpiochipN" with the lines below */
+        int intnLine;              /**< @brief INTN line offset */
+        int rstnLine;              /**< @brief RSTN line offset, -1 if not connected */
+        int bootnLine;             /**< @brief BOOTN line offset, -1 if not connected (no DFU) */
+        int wakeLine;              /**< @brief PS0/WAKE line offset for SPI, -1 if not connected */
+        uint32_t blockTimeout_ms;  /**< @brief Time sh2_hal_block() waits, 0 for no limit */
+    } sh2_PosixHalConfig_t;
+
+    /**
+     * @brief HAL state for one hub.
+     *
+     * Allocated by the caller and set up by sh2_posixHal_init().  The
+     * members are private to sh2_hal_posix.c.
+     */
+    typedef struct sh2_PosixHal {
+        sh2_Hal_t hal;  // Must be first
+
+        int busFd;
+        int intnFd;
+        int rstnFd;
+        int bootnFd;
+        int wakeFd;
+        bool spi;
+        uint32_t blockTimeout_ms;
+
+        sh2_rxCallback_t *onRx;
+        void *cookie;
+
+        pthread_t rxThread;
+        bool rxThreadRunning;
+        volatile bool stopping;
+
+        // Held while calling onRx, and by the application around sh2_ calls
+        pthread_mutex_t driverLock;
+        pthread_key_t driverLockHeld;  // Non-zero in the thread holding driverLock
+
+        // Serializes bus transfers
+        pthread_mutex_t busLock;
+
+        // sh2_hal_block()/unblock()
+        pthread_cond_t unblockCond;
+        bool unblocked;
+
+        // SPI transmits, sent in order by the rx thread once the hub
+        // asserts INTN
+        pthread_cond_t txCond;
+        uint8_t txQueue[SH2_POSIX_TX_QUEUE_LEN][SH2_HAL_MAX_TRANSFER];
+        uint32_t txLen[SH2_POSIX_TX_QUEUE_LEN];
+        uint16_t txHead;
+        uint16_t txCount;
+
+        uint32_t lastIntn_us;
+        uint8_t rxBuf[SH2_HAL_MAX_TRANSFER];
+    } sh2_PosixHal_t;
+
+    /**
+     * @brief Open the bus and GPIO lines of a hub.
+     *
+     * The first HAL initialized also backs the sh2_hal_ functions, so
+     * sh2_initialize() can be used with it.  Pass &pHal->hal to sh2_open()
+     * to drive several hubs.  The rx thread starts when the driver resets
+     * the hub.
+     *
+     * @param  pHal HAL state to set up.
+     * @param  pConfig Bus and GPIO lines of the hub.
+     * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+     */
+    int sh2_posixHal_init(sh2_PosixHal_t *pHal, const sh2_PosixHalConfig_t *pConfig);
+
+    /**
+     * @brief Stop the rx thread and close the bus and GPIO lines.
+     */
+    void sh2_posixHal_close(sh2_PosixHal_t *pHal);
+
+    /**
+     * @brief Exclude sensor and event callbacks of this hub.
+     *
+     * The rx thread delivers callbacks with this lock held.  Hold it
+     * around sh2_ calls made from other threads so they don't run at the
+     * same time as callbacks.  Blocking sh2_ calls release it while they
+     * wait.
+     */
+    void sh2_posixHal_lock(sh2_PosixHal_t *pHal);
+
+    /**
+     * @brief Release the lock taken by sh2_posixHal_lock().
+     */
+    void sh2_posixHal_unlock(sh2_PosixHal_t *pHal);
+
+#ifdef __cplusplus
+}    // end of extern "C"
+#endif
+
+// #ifdef SH2_HAL_POSIX_H
+#endif
@@ -0,0 +1,303 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * HAL playing back SHTP transfers logged by the capture HAL.
+ */
+
+#include <string.h>
+
+#include "sh2_hal_replay.h"
+#include "sh2_err.h"
+
+// --- Private Data -------------------------------------------------------
+
+// HAL behind the sh2_hal_ functions
+static sh2_ReplayHal_t *globalReplay = 0;
+
+// --- Private Functions --------------------------------------------------
+
+static uint16_t readu16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t readu32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Find the next rx record without consuming it.  Skips other records,
+// unless bounded: then it stops at a tx or reset record the driver hasn't
+// matched yet, since what follows answers a request not yet made.
+static bool nextRx(sh2_ReplayHal_t *pReplay, bool bounded, uint32_t *pT_us, uint16_t *pLen)
+{
+    while (pReplay->cursor + SH2_CAPTURE_RECORD_HDR_LEN <= pReplay->logLen) {
+        const uint8_t *p = pReplay->pLog + pReplay->cursor;
+        uint16_t len = readu16(p + 5);
+
+        if (pReplay->cursor + SH2_CAPTURE_RECORD_HDR_LEN + len > pReplay->logLen) {
+            // Truncated record, as left by a capture that was cut short
+            break;
+        }
+        if ((p[0] == SH2_CAPTURE_RX) && (len <= SH2_HAL_MAX_TRANSFER)) {
+            *pT_us = readu32(p + 1);
+            *pLen = len;
+            return true;
+        }
+        if (p[0] == SH2_CAPTURE_TX) {
+            if (bounded && (pReplay->txBalance <= 0)) {
+                return false;
+            }
+            pReplay->txBalance--;
+        }
+        else if (p[0] == SH2_CAPTURE_RESET) {
+            if (bounded && (pReplay->resetBalance <= 0)) {
+                return false;
+            }
+            pReplay->resetBalance--;
+        }
+        pReplay->cursor += SH2_CAPTURE_RECORD_HDR_LEN + len;
+    }
+
+    pReplay->cursor = pReplay->logLen;
+    return false;
+}
+
+// Deliver the next rx record, if paced, only once playback time reaches it
+static bool deliverNext(sh2_ReplayHal_t *pReplay, bool paced, bool bounded)
+{
+    uint32_t t_us;
+    uint16_t len;
+    uint64_t elapsed_us;
+
+    if (!nextRx(pReplay, bounded, &t_us, &len)) {
+        return false;
+    }
+
+    elapsed_us = pReplay->elapsed_us;
+    if (pReplay->started) {
+        elapsed_us += (uint32_t)(t_us - pReplay->last_us);
+    }
+    if (paced && (elapsed_us > pReplay->clock_us)) {
+        return false;
+    }
+
+    // The driver may modify the transfer, and the log is read-only
+    memcpy(pReplay->rxBuf, pReplay->pLog + pReplay->cursor + SH2_CAPTURE_RECORD_HDR_LEN, len);
+    pReplay->cursor += SH2_CAPTURE_RECORD_HDR_LEN + len;
+    pReplay->started = true;
+    pReplay->last_us = t_us;
+    pReplay->elapsed_us = elapsed_us;
+
+    if (pReplay->onRx != 0) {
+        pReplay->onRx(pReplay->cookie, pReplay->rxBuf, len, t_us);
+    }
+
+    return true;
+}
+
+// Keep pacing from falling behind records delivered unpaced
+static void catchUp(sh2_ReplayHal_t *pReplay)
+{
+    if (pReplay->clock_us < pReplay->elapsed_us) {
+        pReplay->clock_us = pReplay->elapsed_us;
+    }
+}
+
+static int replayReset(sh2_Hal_t *self, bool dfuMode, sh2_rxCallback_t *onRx, void *cookie)
+{
+    sh2_ReplayHal_t *pReplay = (sh2_ReplayHal_t *)self;
+
+    // DFU transfers are not logged
+    if (dfuMode) {
+        return SH2_ERR;
+    }
+
+    pReplay->onRx = onRx;
+    pReplay->cookie = cookie;
+    pReplay->unblocked = false;
+    pReplay->resetBalance++;
+
+    return SH2_OK;
+}
+
+static int replayTx(sh2_Hal_t *self, uint8_t *pData, uint32_t len)
+{
+    sh2_ReplayHal_t *pReplay = (sh2_ReplayHal_t *)self;
+    (void)pData;
+    (void)len;
+
+    // The log already holds the hub's responses, they may be delivered
+    // up to the next logged transfer to the hub.
+    pReplay->txBalance++;
+
+    return SH2_OK;
+}
+
+static int replayRx(sh2_Hal_t *self, uint8_t *pData, uint32_t len)
+{
+    (void)self;
+    (void)pData;
+    (void)len;
+
+    return SH2_ERR;
+}
+
+static int replayBlock(sh2_Hal_t *self)
+{
+    sh2_ReplayHal_t *pReplay = (sh2_ReplayHal_t *)self;
+
+    // Only responses to what the driver has sent are delivered
+    while (!pReplay->unblocked && deliverNext(pReplay, false, true)) {
+    }
+    catchUp(pReplay);
+
+    if (!pReplay->unblocked) {
+        return SH2_ERR_TIMEOUT;
+    }
+    pReplay->unblocked = false;
+
+    return SH2_OK;
+}
+
+static int replayUnblock(sh2_Hal_t *self)
+{
+    sh2_ReplayHal_t *pReplay = (sh2_ReplayHal_t *)self;
+
+    pReplay->unblocked = true;
+
+    return SH2_OK;
+}
+
+// Log time: the timestamp of the last rx record delivered
+static uint32_t replayGetTimeUs(sh2_Hal_t *self)
+{
+    sh2_ReplayHal_t *pReplay = (sh2_ReplayHal_t *)self;
+
+    return pReplay->last_us;
+}
+
+// --- Public API ---------------------------------------------------------
+
+int sh2_replayHal_init(sh2_ReplayHal_t *pReplay, const uint8_t *pLog, uint32_t logLen)
+{
+    if ((logLen < SH2_CAPTURE_HDR_LEN) ||
+        (memcmp(pLog, SH2_CAPTURE_MAGIC, 4) != 0) ||
+        (pLog[4] != SH2_CAPTURE_VERSION)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    memset(pReplay, 0, sizeof(*pReplay));
+    pReplay->hal.reset = replayReset;
+    pReplay->hal.tx = replayTx;
+    pReplay->hal.rx = replayRx;
+    pReplay->hal.block = replayBlock;
+    pReplay->hal.unblock = replayUnblock;
+    pReplay->hal.getTimeUs = replayGetTimeUs;
+    pReplay->pLog = pLog;
+    pReplay->logLen = logLen;
+    sh2_replayHal_rewind(pReplay);
+
+    if (globalReplay == 0) {
+        globalReplay = pReplay;
+    }
+
+    return SH2_OK;
+}
+
+uint32_t sh2_replayHal_run(sh2_ReplayHal_t *pReplay, uint32_t duration_us)
+{
+    uint32_t delivered = 0;
+
+    pReplay->clock_us += duration_us;
+    while (deliverNext(pReplay, true, false)) {
+        delivered++;
+    }
+
+    return delivered;
+}
+
+uint32_t sh2_replayHal_runAll(sh2_ReplayHal_t *pReplay)
+{
+    uint32_t delivered = 0;
+
+    while (deliverNext(pReplay, false, false)) {
+        delivered++;
+    }
+    catchUp(pReplay);
+
+    return delivered;
+}
+
+bool sh2_replayHal_done(sh2_ReplayHal_t *pReplay)
+{
+    uint32_t t_us;
+    uint16_t len;
+
+    return !nextRx(pReplay, false, &t_us, &len);
+}
+
+void sh2_replayHal_rewind(sh2_ReplayHal_t *pReplay)
+{
+    pReplay->cursor = SH2_CAPTURE_HDR_LEN;
+    pReplay->started = false;
+    pReplay->last_us = 0;
+    pReplay->elapsed_us = 0;
+    pReplay->clock_us = 0;
+    pReplay->txBalance = 0;
+    pReplay->resetBalance = 0;
+}
+
+#ifndef SH2_NO_GLOBAL_HAL
+// sh2_hal_ functions, for sh2_initialize()
+
+int sh2_hal_reset(bool dfuMode, sh2_rxCallback_t *onRx, void *cookie)
+{
+    if (globalReplay == 0) return SH2_ERR;
+
+    return replayReset(&globalReplay->hal, dfuMode, onRx, cookie);
+}
+
+int sh2_hal_tx(uint8_t *pData, uint32_t len)
+{
+    if (globalReplay == 0) return SH2_ERR;
+
+    return replayTx(&globalReplay->hal, pData, len);
+}
+
+int sh2_hal_rx(uint8_t *pData, uint32_t len)
+{
+    if (globalReplay == 0) return SH2_ERR;
+
+    return replayRx(&globalReplay->hal, pData, len);
+}
+
+int sh2_hal_block(void)
+{
+    if (globalReplay == 0) return SH2_ERR;
+
+    return replayBlock(&globalReplay->hal);
+}
+
+int sh2_hal_unblock(void)
+{
+    if (globalReplay == 0) return SH2_ERR;
+
+    return replayUnblock(&globalReplay->hal);
+}
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file sh2_hal_replay.h
+ * @brief HAL playing back a log written by the capture HAL
+ *
+ * Rx records of the log are passed to the driver with their original
+ * timestamps, so sensor events decode exactly as they did when captured.
+ * Transfers from the driver are discarded; blocking sh2_ calls complete
+ * with the responses that follow in the log, up to the next logged
+ * transfer to the hub (or reset) that the driver hasn't made yet.  Playback is paced by the
+ * application: sh2_replayHal_run() advances by the time it is given, so
+ * calling it with elapsed wall time replays at the original speed and
+ * calling sh2_replayHal_runAll() replays as fast as the driver decodes.
+ */
+
+#ifndef SH2_HAL_REPLAY_H
+#define SH2_HAL_REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sh2_hal.h"
+#include "sh2_hal_capture.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * @brief Replay HAL state.
+     *
+     * Allocated by the caller and set up by sh2_replayHal_init().  The
+     * members are private to sh2_hal_replay.c.
+     */
+    typedef struct sh2_ReplayHal {
+        sh2_Hal_t hal;  // Must be first
+
+        const uint8_t *pLog;
+        uint32_t logLen;
+        uint32_t cursor;       // Offset of the next record
+        bool started;          // Once the first rx record is delivered
+        uint32_t last_us;      // Timestamp of the last rx record delivered
+        uint64_t elapsed_us;   // Log time since the first rx record
+        uint64_t clock_us;     // Playback time since the first rx record
+
+        sh2_rxCallback_t *onRx;
+        void *cookie;
+        bool unblocked;
+        int32_t txBalance;     // Transfers sent by the driver less tx records passed
+        int32_t resetBalance;  // Likewise for resets
+
+        uint8_t rxBuf[SH2_HAL_MAX_TRANSFER];
+    } sh2_ReplayHal_t;
+
+    /**
+     * @brief Set up a replay HAL over a log in memory.
+     *
+     * The first HAL initialized also backs the sh2_hal_ functions, so
+     * sh2_initialize() can be used with it.  Pass &pReplay->hal to
+     * sh2_open() otherwise.  Nothing is delivered until the driver resets
+     * the hub and sh2_replayHal_run() or a blocking sh2_ call is made.
+     *
+     * @param  pReplay Replay HAL state to set up.
+     * @param  pLog Log, as written by the capture HAL.  Must remain valid while in use.
+     * @param  logLen Length of the log.
+     * @return SH2_OK (0), on success.  SH2_ERR_BAD_PARAM if the log header is not valid.
+     */
+    int sh2_replayHal_init(sh2_ReplayHal_t *pReplay, const uint8_t *pLog, uint32_t logLen);
+
+    /**
+     * @brief Deliver the rx records due in the next interval.
+     *
+     * @param  pReplay The HAL.
+     * @param  duration_us Playback time to advance [uS].
+     * @return Number of transfers delivered to the driver.
+     */
+    uint32_t sh2_replayHal_run(sh2_ReplayHal_t *pReplay, uint32_t duration_us);
+
+    /**
+     * @brief Deliver all remaining rx records without pacing.
+     *
+     * @param  pReplay The HAL.
+     * @return Number of transfers delivered to the driver.
+     */
+    uint32_t sh2_replayHal_runAll(sh2_ReplayHal_t *pReplay);
+
+    /**
+     * @brief Check whether the whole log has been played.
+     */
+    bool sh2_replayHal_done(sh2_ReplayHal_t *pReplay);
+
+    /**
+     * @brief Restart playback from the beginning of the log.
+     */
+    void sh2_replayHal_rewind(sh2_ReplayHal_t *pReplay);
+
+#ifdef __cplusplus
+}    // end of extern "C"
+#endif
+
+// #ifdef SH2_HAL_REPLAY_H
+#endif
@@ -53,6 +53,14 @@
 #define SHTP_MAX_TRANSFER_IN (SH2_HAL_MAX_TRANSFER - SHTP_HDR_LEN)
 #define SHTP_INITIAL_READ_LEN (0)
 
+// Number of cargos that can be reassembled concurrently (on different channels.)
+// May be overridden in sh2_hal_impl.h.
+#ifndef SHTP_RX_ASSEMBLIES
+#define SHTP_RX_ASSEMBLIES (2)
+#endif
+
+#define NO_CHAN (0xFF)
+
 #define TAG_SHTP_VERSION 0x80
 
 // ------------------------------------------------------------------------
@@ -79,6 +87,14 @@ typedef struct shtp_Channel_s {
     void *cookie;
 } shtp_Channel_t;
 
+typedef struct shtp_RxAssembly_s {
+    uint8_t  chan;       // NO_CHAN when this slot is free
+    uint16_t remaining;
+    uint16_t cursor;
+    uint32_t timestamp;
+    uint8_t  payload[SHTP_MAX_PAYLOAD_IN];
+} shtp_RxAssembly_t;
+
 typedef struct shtp_ChanListener_s {
     char appName[SHTP_APP_NAME_LEN];
     char chanName[SHTP_CHAN_NAME_LEN];
@@ -90,7 +106,9 @@ typedef struct shtp_ChanListener_s {
 #define ADVERT_REQUESTED (1)
 #define ADVERT_IDLE (2)
 
-typedef struct shtp_s {
+struct shtp_s {
+    sh2_Hal_t *pHal;
+
     char shtpVersion[8];
 
     uint8_t advertPhase;
@@ -101,6 +119,9 @@ typedef struct shtp_s {
     uint32_t shortFragments;
     uint32_t badRxChan;
     uint32_t badTxChan;
+    uint32_t interleaveDiscards;   // assemblies evicted by a cargo on another channel
+    uint32_t seqDiscards;          // assemblies broken by a missing or out-of-order fragment
+    uint32_t orphanFragments;      // continuations with no assembly in progress
     
     // transmit support
     uint16_t outMaxPayload;
@@ -109,11 +130,7 @@ typedef struct shtp_s {
 
     // receive support
     uint16_t inMaxTransfer;
-    uint16_t inRemaining;
-    uint8_t  inChan;
-    uint8_t  inPayload[SHTP_MAX_PAYLOAD_IN];
-    uint16_t inCursor;
-    uint32_t inTimestamp;
+    shtp_RxAssembly_t rxAssembly[SHTP_RX_ASSEMBLIES];
 
     // Applications and their listeners
     shtp_App_t app[SH2_MAX_APPS];
@@ -127,27 +144,28 @@ typedef struct shtp_s {
     shtp_ChanListener_t chanListener[SH2_MAX_CHANS];
     uint8_t             nextChanListener;
 
-} shtp_t;
+};
 
 // ------------------------------------------------------------------------
 // Forward definitions
 
 static void shtp_onRx(void* cookie, uint8_t* pdata, uint32_t len, uint32_t t_us);
-static void addApp(uint32_t guid, const char *appName);
-static void addChannel(uint8_t chanNo, uint32_t guid, const char * chanName, bool wake);
+static void addApp(shtp_t *pShtp, uint32_t guid, const char *appName);
+static void addChannel(shtp_t *pShtp, uint8_t chanNo, uint32_t guid, const char * chanName, bool wake);
 static void shtpAdvertHdlr(void *shtp, uint8_t tag, uint8_t len, uint8_t *val);
 static void shtpCmdListener(void *shtp, uint8_t *payload, uint16_t len, uint32_t timestamp);
-static void addAdvertListener(const char *appName,
+static void addAdvertListener(shtp_t *pShtp, const char *appName,
                               shtp_AdvertCallback_t *callback, void * cookie);
-static int addChanListener(const char * appName, const char * chanName,
+static int addChanListener(shtp_t *pShtp, const char * appName, const char * chanName,
                            shtp_Callback_t *callback, void *cookie);
-static int toChanNo(const char * appName, const char *chanName);
-static int txProcess(uint8_t chan, uint8_t* pData, uint32_t len);
+static int toChanNo(shtp_t *pShtp, const char * appName, const char *chanName);
+static int txProcess(shtp_t *pShtp, uint8_t chan, uint8_t* pData, uint32_t len);
 
 // ------------------------------------------------------------------------
 // Private, static data
 
-static shtp_t shtp;
+// One SHTP instance per hub
+static shtp_t instances[SH2_MAX_INSTANCES];
 
 static uint8_t advertise[] = {
     CMD_ADVERTISE,
@@ -157,97 +175,110 @@ static uint8_t advertise[] = {
 // ------------------------------------------------------------------------
 // Public API
 
-int shtp_init(void)
+shtp_t *shtp_init(uint8_t instance, sh2_Hal_t *pHal)
 {
+    if ((instance >= SH2_MAX_INSTANCES) || (pHal == 0)) {
+        return 0;
+    }
+    shtp_t *pShtp = &instances[instance];
+
+    pShtp->pHal = pHal;
+
     // Init stats
-    shtp.tooLargePayloads = 0;
-    shtp.txDiscards = 0;
-    shtp.shortFragments = 0;
-    shtp.badRxChan = 0;
-    shtp.badTxChan = 0;
+    pShtp->tooLargePayloads = 0;
+    pShtp->txDiscards = 0;
+    pShtp->shortFragments = 0;
+    pShtp->badRxChan = 0;
+    pShtp->badTxChan = 0;
+    pShtp->interleaveDiscards = 0;
+    pShtp->seqDiscards = 0;
+    pShtp->orphanFragments = 0;
 
     // Init transmit support
-    shtp.outMaxPayload = SHTP_MAX_PAYLOAD_OUT;
-    shtp.outMaxTransfer = INIT_MAX_TRANSFER_OUT;
+    pShtp->outMaxPayload = SHTP_MAX_PAYLOAD_OUT;
+    pShtp->outMaxTransfer = INIT_MAX_TRANSFER_OUT;
 
     // Init receive support
-    shtp.inMaxTransfer = SHTP_MAX_TRANSFER_IN;
-    shtp.inRemaining = 0;
-    shtp.inCursor = 0;
+    pShtp->inMaxTransfer = SHTP_MAX_TRANSFER_IN;
+    for (unsigned int n = 0; n < SHTP_RX_ASSEMBLIES; n++) {
+        pShtp->rxAssembly[n].chan = NO_CHAN;
+        pShtp->rxAssembly[n].remaining = 0;
+        pShtp->rxAssembly[n].cursor = 0;
+    }
 
     // Init SHTP Apps
     for (unsigned int n = 0; n < SH2_MAX_APPS; n++) {
-        shtp.app[n].guid = 0xFFFFFFFF;
-        strcpy(shtp.app[n].appName, "");
+        pShtp->app[n].guid = 0xFFFFFFFF;
+        strcpy(pShtp->app[n].appName, "");
     }
-    shtp.nextApp = 0;
-    shtp.advertPhase = ADVERT_NEEDED;
+    pShtp->nextApp = 0;
+    pShtp->advertPhase = ADVERT_NEEDED;
 
     // Init App Listeners
     for (unsigned int n = 0; n < SH2_MAX_APPS; n++) {
-        strcpy(shtp.appListener[n].appName, "");
-        shtp.appListener[n].callback = 0;
-        shtp.appListener[n].cookie = 0;
+        strcpy(pShtp->appListener[n].appName, "");
+        pShtp->appListener[n].callback = 0;
+        pShtp->appListener[n].cookie = 0;
     }
-    shtp.nextAppListener = 0;
+    pShtp->nextAppListener = 0;
 
     // Init the shtp channels
     for (unsigned int n = 0; n < SH2_MAX_CHANS; n++) {
-        shtp.chan[n].nextOutSeq = 0;
-        shtp.chan[n].nextInSeq = 0;
-        shtp.chan[n].guid = 0xFFFFFFFF;
-        strcpy(shtp.chan[n].chanName, "");
-        shtp.chan[n].cookie = 0;
-        shtp.chan[n].callback = 0;
-        shtp.chan[n].wake = false;
+        pShtp->chan[n].nextOutSeq = 0;
+        pShtp->chan[n].nextInSeq = 0;
+        pShtp->chan[n].guid = 0xFFFFFFFF;
+        strcpy(pShtp->chan[n].chanName, "");
+        pShtp->chan[n].cookie = 0;
+        pShtp->chan[n].callback = 0;
+        pShtp->chan[n].wake = false;
     }
 
     // Init registered channel listeners array
     for (unsigned int n = 0; n < SH2_MAX_CHANS; n++) {
-        strcpy(shtp.chanListener[n].appName, "");
-        strcpy(shtp.chanListener[n].chanName, "");
-        shtp.chanListener[n].cookie = 0;
-        shtp.chanListener[n].callback = 0;
+        strcpy(pShtp->chanListener[n].appName, "");
+        strcpy(pShtp->chanListener[n].chanName, "");
+        pShtp->chanListener[n].cookie = 0;
+        pShtp->chanListener[n].callback = 0;
     }
-    shtp.nextChanListener = 0;
+    pShtp->nextChanListener = 0;
 
     // Establish SHTP App and command channel a priori.
-    addApp(GUID_SHTP, "SHTP");
-    addChannel(0, GUID_SHTP, "command", false);
+    addApp(pShtp, GUID_SHTP, "SHTP");
+    addChannel(pShtp, 0, GUID_SHTP, "command", false);
 
     // Create the control channel for this SHTP instance
     // Register advert listener for SHTP App
-    shtp_listenAdvert("SHTP", shtpAdvertHdlr, NULL);
-    shtp_listenChan("SHTP", "command", shtpCmdListener, NULL);
+    shtp_listenAdvert(pShtp, "SHTP", shtpAdvertHdlr, pShtp);
+    shtp_listenChan(pShtp, "SHTP", "command", shtpCmdListener, pShtp);
 
-    return SH2_OK;
+    return pShtp;
 }
 
-void shtp_start(bool dfu)
+void shtp_start(shtp_t *pShtp, bool dfu)
 {
     // Reset device, registering rx callback
-    sh2_hal_reset(dfu, shtp_onRx, NULL);
+    pShtp->pHal->reset(pShtp->pHal, dfu, shtp_onRx, pShtp);
 }
 
 // Register a listener for advertisements related to one app
-int shtp_listenAdvert(const char * appName, 
+int shtp_listenAdvert(shtp_t *pShtp, const char * appName, 
                       shtp_AdvertCallback_t *callback, void *cookie)
 {
     int rc = SH2_OK;
     
     // Register the advert listener
-    addAdvertListener(appName, callback, cookie);
+    addAdvertListener(pShtp, appName, callback, cookie);
 
     // Arrange for a new set of advertisements, for this listener
-    if (shtp.advertPhase == ADVERT_IDLE) {
+    if (pShtp->advertPhase == ADVERT_IDLE) {
         // Request advertisement if one is not already on the way
-        rc = shtp_send(SHTP_CHAN_COMMAND, advertise, sizeof(advertise));
+        rc = shtp_send(pShtp, SHTP_CHAN_COMMAND, advertise, sizeof(advertise));
 
         if (rc == SH2_OK) {
-            shtp.advertPhase = ADVERT_REQUESTED;
+            pShtp->advertPhase = ADVERT_REQUESTED;
         }
         else {
-            shtp.advertPhase = ADVERT_NEEDED;
+            pShtp->advertPhase = ADVERT_NEEDED;
         }
     }
 
@@ -255,55 +286,115 @@ int shtp_listenAdvert(const char * appName,
 }
 
 
-int shtp_listenChan(const char *app, const char *chan,
+int shtp_listenChan(shtp_t *pShtp, const char *app, const char *chan,
                     shtp_Callback_t *callback, void *cookie)
 {
     // Balk if app or channel name isn't valid
     if ((app == 0) || (strlen(app) == 0)) return SH2_ERR_BAD_PARAM;
     if ((chan == 0) || (strlen(chan) == 0)) return SH2_ERR_BAD_PARAM;
 
-    return addChanListener(app, chan, callback, cookie);
+    return addChanListener(pShtp, app, chan, callback, cookie);
 }
 
-uint8_t shtp_chanNo(const char * appName, const char * chanName)
+uint8_t shtp_chanNo(shtp_t *pShtp, const char * appName, const char * chanName)
 {
     uint8_t chanNo = 0xFF;
     
-    chanNo = toChanNo(appName, chanName);
+    chanNo = toChanNo(pShtp, appName, chanName);
 
     return chanNo;
 }
 
-int shtp_send(uint8_t chan, uint8_t *payload, uint16_t len)
+uint16_t shtp_maxPayloadOut(shtp_t *pShtp)
+{
+    return pShtp->outMaxPayload;
+}
+
+int shtp_send(shtp_t *pShtp, uint8_t chan, uint8_t *payload, uint16_t len)
 {
     int ret = SH2_OK;
     
-    if (len > shtp.outMaxPayload) {
+    if (len > pShtp->outMaxPayload) {
         return SH2_ERR_BAD_PARAM;
     }
     if (chan >= SH2_MAX_CHANS) {
-        shtp.badTxChan++;
+        pShtp->badTxChan++;
         return SH2_ERR_BAD_PARAM;
     }
     
-    ret = txProcess(chan, payload, len);
+    ret = txProcess(pShtp, chan, payload, len);
 
     return ret;
 }
 
+void shtp_getStats(shtp_t *pShtp, shtp_Stats_t *pStats)
+{
+    pStats->tooLargePayloads = pShtp->tooLargePayloads;
+    pStats->txDiscards = pShtp->txDiscards;
+    pStats->shortFragments = pShtp->shortFragments;
+    pStats->badRxChan = pShtp->badRxChan;
+    pStats->badTxChan = pShtp->badTxChan;
+    pStats->interleaveDiscards = pShtp->interleaveDiscards;
+    pStats->seqDiscards = pShtp->seqDiscards;
+    pStats->orphanFragments = pShtp->orphanFragments;
+}
+
 // ------------------------------------------------------------------------
 // Private methods
 
-static void rxAssemble(uint8_t *in, uint16_t len, uint32_t t_us)
+// Find the assembly in progress for a channel, if any.
+static shtp_RxAssembly_t *findAssembly(shtp_t *pShtp, uint8_t chan)
+{
+    for (int n = 0; n < SHTP_RX_ASSEMBLIES; n++) {
+        if (pShtp->rxAssembly[n].chan == chan) {
+            return &pShtp->rxAssembly[n];
+        }
+    }
+
+    return 0;
+}
+
+// Claim an assembly slot for a new cargo.
+// If all slots are busy, the oldest assembly in progress is discarded.
+static shtp_RxAssembly_t *newAssembly(shtp_t *pShtp, uint8_t chan, uint32_t t_us)
+{
+    shtp_RxAssembly_t *pAsm = 0;
+
+    for (int n = 0; n < SHTP_RX_ASSEMBLIES; n++) {
+        if (pShtp->rxAssembly[n].chan == NO_CHAN) {
+            pAsm = &pShtp->rxAssembly[n];
+            break;
+        }
+        if ((pAsm == 0) ||
+            ((int32_t)(pShtp->rxAssembly[n].timestamp - pAsm->timestamp) < 0)) {
+            pAsm = &pShtp->rxAssembly[n];
+        }
+    }
+
+    if (pAsm->chan != NO_CHAN) {
+        // Evicting a cargo that was interleaved with this one.
+        pShtp->interleaveDiscards++;
+    }
+
+    pAsm->chan = chan;
+    pAsm->cursor = 0;
+    pAsm->remaining = 0;
+    pAsm->timestamp = t_us;
+
+    return pAsm;
+}
+
+static void rxAssemble(shtp_t *pShtp, uint8_t *in, uint16_t len, uint32_t t_us)
 {
     uint16_t payloadLen;
     bool continuation;
     uint8_t chan = 0;
     uint8_t seq = 0;
+    shtp_RxAssembly_t *pAsm = 0;
 
     // discard invalid short fragments
     if (len < SHTP_HDR_LEN) {
-        shtp.shortFragments++;
+        pShtp->shortFragments++;
         return;
     }
     
@@ -314,48 +405,57 @@ static void rxAssemble(uint8_t *in, uint16_t len, uint32_t t_us)
     seq = in[3];
     
     if (payloadLen < SHTP_HDR_LEN) {
-      shtp.shortFragments++;
+      pShtp->shortFragments++;
       return;
     }
 
     if ((chan >= SH2_MAX_CHANS) ||
-        (chan >= shtp.nextChanListener)) {
+        (chan >= pShtp->nextChanListener)) {
         // Invalid channel id.
-        shtp.badRxChan++;
+        pShtp->badRxChan++;
         return;
     }
         
-    // Discard earlier assembly in progress if the received data doesn't match it.
-    if (shtp.inRemaining) {
+    // Discard earlier assembly on this channel if the received data doesn't match it.
+    pAsm = findAssembly(pShtp, chan);
+    if (pAsm != 0) {
         // Check this against previously received data.
         if (!continuation ||
-            (chan != shtp.inChan) ||
-            (seq != shtp.chan[chan].nextInSeq)) {
+            (seq != pShtp->chan[chan].nextInSeq)) {
             // This fragment doesn't fit with previous one, discard earlier data
-            shtp.inRemaining = 0;
+            pShtp->seqDiscards++;
+            pAsm->chan = NO_CHAN;
+            pAsm = 0;
         }
     }
 
-    if (shtp.inRemaining == 0) {
+    if (pAsm == 0) {
         // Discard this fragment if it's a continuation of something we don't have.
         if (continuation) {
+            pShtp->orphanFragments++;
+            return;
+        }
+
+        if (len >= payloadLen) {
+            // Whole cargo is in this transfer: deliver it straight from the
+            // HAL's buffer rather than copying it into an assembly slot.
+            pShtp->chan[chan].nextInSeq = seq + 1;
+            if (pShtp->chan[chan].callback != 0) {
+                pShtp->chan[chan].callback(pShtp->chan[chan].cookie,
+                                         in+SHTP_HDR_LEN, payloadLen-SHTP_HDR_LEN,
+                                         t_us);
+            }
             return;
         }
 
         if (payloadLen-SHTP_HDR_LEN > SHTP_MAX_PAYLOAD_IN) {
             // Error: This payload won't fit! Discard it.
-            shtp.tooLargePayloads++;
+            pShtp->tooLargePayloads++;
             return;
         }
 
-        // This represents a new payload
-
-        // Store timestamp
-        shtp.inTimestamp = t_us;
-
-        // Start a new assembly.
-        shtp.inCursor = 0;
-        shtp.inChan = chan;
+        // This represents a new payload, start a new assembly.
+        pAsm = newAssembly(pShtp, chan, t_us);
     }
 
     // Append the new fragment to the payload under construction.
@@ -363,34 +463,36 @@ static void rxAssemble(uint8_t *in, uint16_t len, uint32_t t_us)
         // Only use the valid portion of the transfer
         len = payloadLen;
     }
-    memcpy(shtp.inPayload + shtp.inCursor, in+SHTP_HDR_LEN, len-SHTP_HDR_LEN);
-    shtp.inCursor += len-SHTP_HDR_LEN;
-    shtp.inRemaining = payloadLen - len;
+    memcpy(pAsm->payload + pAsm->cursor, in+SHTP_HDR_LEN, len-SHTP_HDR_LEN);
+    pAsm->cursor += len-SHTP_HDR_LEN;
+    pAsm->remaining = payloadLen - len;
+
+    // Remember next sequence number we expect for this channel.
+    pShtp->chan[chan].nextInSeq = seq + 1;
 
     // If whole payload received, deliver it to channel listener.
-    if (shtp.inRemaining == 0) {
+    if (pAsm->remaining == 0) {
+        // This slot is free for the next cargo.
+        pAsm->chan = NO_CHAN;
         
         // Call callback if there is one.
-        if (shtp.chan[chan].callback != 0) {
-            shtp.chan[chan].callback(shtp.chan[chan].cookie,
-                                       shtp.inPayload, shtp.inCursor,
-                                       shtp.inTimestamp);
+        if (pShtp->chan[chan].callback != 0) {
+            pShtp->chan[chan].callback(pShtp->chan[chan].cookie,
+                                     pAsm->payload, pAsm->cursor,
+                                     pAsm->timestamp);
         }
     }
-
-    // Remember next sequence number we expect for this channel.
-    shtp.chan[chan].nextInSeq = seq + 1;
 }
 
 static void shtp_onRx(void* cookie, uint8_t* pData, uint32_t len, uint32_t t_us)
 {
-    rxAssemble(pData, len, t_us);
+    rxAssemble((shtp_t *)cookie, pData, len, t_us);
 }
 
 // Try to match registered listeners with their channels.
 // This is performed every time the underlying Channel, App, Listener data structures are updated.
 // As a result, channel number to callback association is fast when receiving packets
-static void updateCallbacks(void)
+static void updateCallbacks(shtp_t *pShtp)
 {
     // Figure out which callback is associated with each channel.
     //   Channel -> (GUID, Chan name).
@@ -403,22 +505,22 @@ static void updateCallbacks(void)
     
     for (int chanNo = 0; chanNo < SH2_MAX_CHANS; chanNo++) {
         // Reset callback for this channel until we find the right one.
-        shtp.chan[chanNo].callback = 0;
+        pShtp->chan[chanNo].callback = 0;
             
-        if (shtp.chan[chanNo].guid == 0xFFFFFFFF) {
+        if (pShtp->chan[chanNo].guid == 0xFFFFFFFF) {
             // This channel entry not used.
             continue;
         }
 
         // Get GUID and Channel Name for this channel
-        guid = shtp.chan[chanNo].guid;
-        chanName = shtp.chan[chanNo].chanName;
+        guid = pShtp->chan[chanNo].guid;
+        chanName = pShtp->chan[chanNo].chanName;
 
         // Look up App name for this GUID
         appName = 0;
         for (int appNo = 0; appNo < SH2_MAX_APPS; appNo++) {
-            if (shtp.app[appNo].guid == guid) {
-                appName = shtp.app[appNo].appName;
+            if (pShtp->app[appNo].guid == guid) {
+                appName = pShtp->app[appNo].appName;
                 break;
             }
         }
@@ -428,13 +530,13 @@ static void updateCallbacks(void)
         else {
             // Look for a listener registered with this app name, channel name
             for (int listenerNo = 0; listenerNo < SH2_MAX_CHANS; listenerNo++) {
-                if ((shtp.chanListener[listenerNo].callback != 0) &&
-                    (strcmp(appName, shtp.chanListener[listenerNo].appName) == 0) &&
-                    (strcmp(chanName, shtp.chanListener[listenerNo].chanName) == 0)) {
+                if ((pShtp->chanListener[listenerNo].callback != 0) &&
+                    (strcmp(appName, pShtp->chanListener[listenerNo].appName) == 0) &&
+                    (strcmp(chanName, pShtp->chanListener[listenerNo].chanName) == 0)) {
                     
                     // This listener is the one for this channel
-                    shtp.chan[chanNo].callback = shtp.chanListener[listenerNo].callback;
-                    shtp.chan[chanNo].cookie = shtp.chanListener[listenerNo].cookie;
+                    pShtp->chan[chanNo].callback = pShtp->chanListener[listenerNo].callback;
+                    pShtp->chan[chanNo].cookie = pShtp->chanListener[listenerNo].cookie;
                     break;
                 }
             }
@@ -443,34 +545,34 @@ static void updateCallbacks(void)
 }
 
 // Add one to the set of known Apps
-static void addApp(uint32_t guid, const char *appName)
+static void addApp(shtp_t *pShtp, uint32_t guid, const char *appName)
 {
     shtp_App_t *pApp = 0;
 
     // Bail out if this GUID is already registered
-    for (int n = 0; n < shtp.nextApp; n++) {
-        if (shtp.app[n].guid == guid) return;
+    for (int n = 0; n < pShtp->nextApp; n++) {
+        if (pShtp->app[n].guid == guid) return;
     }
 
     // Bail out if no space for more apps
-    if (shtp.nextApp >= SH2_MAX_APPS) return;
+    if (pShtp->nextApp >= SH2_MAX_APPS) return;
 
     // Register this app
-    pApp = &shtp.app[shtp.nextApp];
-    shtp.nextApp++;
+    pApp = &pShtp->app[pShtp->nextApp];
+    pShtp->nextApp++;
     pApp->guid = guid;
     strcpy(pApp->appName, appName);
 
     // Re-evaluate channel callbacks
-    updateCallbacks();
+    updateCallbacks(pShtp);
 }
 
 // Add one to the set of known channels
-static void addChannel(uint8_t chanNo, uint32_t guid, const char * chanName, bool wake)
+static void addChannel(shtp_t *pShtp, uint8_t chanNo, uint32_t guid, const char * chanName, bool wake)
 {
     if (chanNo >= SH2_MAX_CHANS) return;
 
-    shtp_Channel_t * pChan = &shtp.chan[chanNo];
+    shtp_Channel_t * pChan = &pShtp->chan[chanNo];
 
     // Store channel definition
     pChan->guid = guid;
@@ -484,20 +586,21 @@ static void addChannel(uint8_t chanNo, uint32_t guid, const char * chanName, boo
     pChan->cookie = 0;
 
     // Re-evaluate channel callbacks
-    updateCallbacks();
+    updateCallbacks(pShtp);
 }
 
 
 // Callback for SHTP app-specific advertisement tags
 static void shtpAdvertHdlr(void *cookie, uint8_t tag, uint8_t len, uint8_t *val)
 {
+    shtp_t *pShtp = (shtp_t *)cookie;
     uint16_t x;
 
     switch (tag) {
         case TAG_MAX_CARGO_PLUS_HEADER_WRITE:
             x = readu16(val) - SHTP_HDR_LEN;
             if (x < SHTP_MAX_PAYLOAD_OUT) {
-                shtp.outMaxPayload = x;
+                pShtp->outMaxPayload = x;
             }
             break;
         case TAG_MAX_CARGO_PLUS_HEADER_READ:
@@ -507,20 +610,20 @@ static void shtpAdvertHdlr(void *cookie, uint8_t tag, uint8_t len, uint8_t *val)
         case TAG_MAX_TRANSFER_WRITE:
             x = readu16(val) - SHTP_HDR_LEN;
             if (x < SHTP_MAX_TRANSFER_OUT) {
-                shtp.outMaxTransfer = x;
+                pShtp->outMaxTransfer = x;
             } else {
-                shtp.outMaxTransfer = SHTP_MAX_TRANSFER_OUT;
+                pShtp->outMaxTransfer = SHTP_MAX_TRANSFER_OUT;
             }
             break;
         case TAG_MAX_TRANSFER_READ:
             x = readu16(val) - SHTP_HDR_LEN;
             if (x < SHTP_MAX_TRANSFER_IN) {
-                shtp.inMaxTransfer = x;
+                pShtp->inMaxTransfer = x;
             }
             break;
         case TAG_SHTP_VERSION:
-            if (strlen((const char *)val) < sizeof(shtp.shtpVersion)) {
-                strcpy(shtp.shtpVersion, (const char *)val);
+            if (strlen((const char *)val) < sizeof(pShtp->shtpVersion)) {
+                strcpy(pShtp->shtpVersion, (const char *)val);
             }
             break;
         default:
@@ -528,14 +631,14 @@ static void shtpAdvertHdlr(void *cookie, uint8_t tag, uint8_t len, uint8_t *val)
     }
 }
 
-static void callAdvertHandler(uint32_t guid,
+static void callAdvertHandler(shtp_t *pShtp, uint32_t guid,
                               uint8_t tag, uint8_t len, uint8_t *val)
 {
     // Find app name for this GUID
     const char * appName = 0;
     for (int n = 0; n < SH2_MAX_APPS; n++) {
-        if (shtp.app[n].guid == guid) {
-            appName = shtp.app[n].appName;
+        if (pShtp->app[n].guid == guid) {
+            appName = pShtp->app[n].appName;
             break;
         }
     }
@@ -547,17 +650,17 @@ static void callAdvertHandler(uint32_t guid,
     // Find listener for this app
     for (int n = 0; n < SH2_MAX_APPS; n++)
     {
-        if (strcmp(shtp.appListener[n].appName, appName) == 0) {
+        if (strcmp(pShtp->appListener[n].appName, appName) == 0) {
             // Found matching App entry
-            if (shtp.appListener[n].callback != 0) {
-                shtp.appListener[n].callback(shtp.appListener[n].cookie, tag, len, val);
+            if (pShtp->appListener[n].callback != 0) {
+                pShtp->appListener[n].callback(pShtp->appListener[n].cookie, tag, len, val);
                 return;
             }
         }
     }
 }
 
-static void processAdvertisement(uint8_t *payload, uint16_t payloadLen)
+static void processAdvertisement(shtp_t *pShtp, uint8_t *payload, uint16_t payloadLen)
 {
     uint8_t tag;
     uint8_t len;
@@ -572,7 +675,7 @@ static void processAdvertisement(uint8_t *payload, uint16_t payloadLen)
     strcpy(appName, "");
     strcpy(chanName, "");
 
-    shtp.advertPhase = ADVERT_IDLE;
+    pShtp->advertPhase = ADVERT_IDLE;
         
     while (cursor < payloadLen) {
         tag = payload[cursor++];
@@ -587,7 +690,7 @@ static void processAdvertisement(uint8_t *payload, uint16_t payloadLen)
                 break;
             case TAG_GUID:
                 // A new GUID is being established so terminate advertisement process with earlier app, if any.
-                callAdvertHandler(guid, TAG_NULL, 0, 0);
+                callAdvertHandler(pShtp, guid, TAG_NULL, 0, 0);
             
                 guid = readu32(val);
                 strcpy(appName, "");
@@ -603,22 +706,22 @@ static void processAdvertisement(uint8_t *payload, uint16_t payloadLen)
                 break;
             case TAG_APP_NAME:
                 strcpy(appName, (const char *)val);
-                addApp(guid, appName);
+                addApp(pShtp, guid, appName);
 
                 // Now that we potentially have a link between current guid and a
                 // registered app, start the advertisement process with the app.
-                callAdvertHandler(guid, TAG_GUID, 4, (uint8_t *)&guid);
+                callAdvertHandler(pShtp, guid, TAG_GUID, 4, (uint8_t *)&guid);
             
                 break;
             case TAG_CHANNEL_NAME:
                 strcpy(chanName, (const char *)val);
-                addChannel(chanNo, guid, (const char *)val, wake);
+                addChannel(pShtp, chanNo, guid, (const char *)val, wake);
 
                 // Store channel metadata
                 if (chanNo < SH2_MAX_CHANS) {
-                    shtp.chan[chanNo].guid = guid;
-                    strcpy(shtp.chan[chanNo].chanName, chanName);
-                    shtp.chan[chanNo].wake = wake;
+                    pShtp->chan[chanNo].guid = guid;
+                    strcpy(pShtp->chan[chanNo].chanName, chanName);
+                    pShtp->chan[chanNo].wake = wake;
                 }
                 break;
             case TAG_ADV_COUNT:
@@ -630,11 +733,11 @@ static void processAdvertisement(uint8_t *payload, uint16_t payloadLen)
         }
         
         // Deliver a TLV entry to the app's handler
-        callAdvertHandler(guid, tag, len, val);
+        callAdvertHandler(pShtp, guid, tag, len, val);
     }
 
     // terminate advertisement process with last app
-    callAdvertHandler(guid, TAG_NULL, 0, 0);
+    callAdvertHandler(pShtp, guid, TAG_NULL, 0, 0);
 }
 
 // Callback for SHTP command channel
@@ -646,7 +749,7 @@ static void shtpCmdListener(void *cookie, uint8_t *payload, uint16_t len, uint32
 
     switch (response) {
         case RESP_ADVERTISE:
-            processAdvertisement(payload, len);
+            processAdvertisement((shtp_t *)cookie, payload, len);
             break;
         default:
             // unknown response
@@ -655,62 +758,62 @@ static void shtpCmdListener(void *cookie, uint8_t *payload, uint16_t len, uint32
 }
 
 // Register a listener for an app (advertisement listener)
-static void addAdvertListener(const char *appName,
+static void addAdvertListener(shtp_t *pShtp, const char *appName,
                               shtp_AdvertCallback_t *callback, void * cookie)
 {
     shtp_AppListener_t *pAppListener = 0;
 
     // Bail out if no space for more apps
-    if (shtp.nextAppListener >= SH2_MAX_APPS) return;
+    if (pShtp->nextAppListener >= SH2_MAX_APPS) return;
 
     // Register this app
-    pAppListener = &shtp.appListener[shtp.nextAppListener];
-    shtp.nextAppListener++;
+    pAppListener = &pShtp->appListener[pShtp->nextAppListener];
+    pShtp->nextAppListener++;
     strcpy(pAppListener->appName, appName);
     pAppListener->callback = callback;
     pAppListener->cookie = cookie;
 }
 
 // Register a new channel listener
-static int addChanListener(const char * appName, const char * chanName,
+static int addChanListener(shtp_t *pShtp, const char * appName, const char * chanName,
                            shtp_Callback_t *callback, void *cookie)
 {
     shtp_ChanListener_t *pListener = 0;
 
     // Bail out if there are too many listeners registered
-    if (shtp.nextChanListener >= SH2_MAX_CHANS) return SH2_ERR;
+    if (pShtp->nextChanListener >= SH2_MAX_CHANS) return SH2_ERR;
 
     // Register channel listener
-    pListener = &shtp.chanListener[shtp.nextChanListener];
-    shtp.nextChanListener++;
+    pListener = &pShtp->chanListener[pShtp->nextChanListener];
+    pShtp->nextChanListener++;
     strcpy(pListener->appName, appName);
     strcpy(pListener->chanName, chanName);
     pListener->callback = callback;
     pListener->cookie = cookie;
 
     // re-evaluate channel callbacks
-    updateCallbacks();
+    updateCallbacks(pShtp);
 
     return SH2_OK;
 }
 
-static int toChanNo(const char * appName, const char *chanName)
+static int toChanNo(shtp_t *pShtp, const char * appName, const char *chanName)
 {
     int chan = 0;
     uint32_t guid = 0xFFFFFFFF;
 
     // Determine GUID for this appname
     for (int n = 0; n < SH2_MAX_APPS; n++) {
-        if (strcmp(shtp.app[n].appName, appName) == 0) {
-            guid = shtp.app[n].guid;
+        if (strcmp(pShtp->app[n].appName, appName) == 0) {
+            guid = pShtp->app[n].guid;
             break;
         }
     }
     if (guid == 0xFFFFFFFF) return -1;
 
     for (chan = 0; chan < SH2_MAX_CHANS; chan++) {
-        if ((strcmp(shtp.chan[chan].chanName, chanName) == 0) &&
-            shtp.chan[chan].guid == guid) {
+        if ((strcmp(pShtp->chan[chan].chanName, chanName) == 0) &&
+            pShtp->chan[chan].guid == guid) {
             // Found match
             return chan;
         }
@@ -731,7 +834,7 @@ static inline uint16_t min(uint16_t a, uint16_t b)
 }
 
 // Send a cargo as a sequence of transports
-static int txProcess(uint8_t chan, uint8_t* pData, uint32_t len)
+static int txProcess(shtp_t *pShtp, uint8_t chan, uint8_t* pData, uint32_t len)
 {
     int status = SH2_OK;
     
@@ -741,10 +844,10 @@ static int txProcess(uint8_t chan, uint8_t* pData, uint32_t len)
 
     while (remaining > 0) {
         // determine length of this transfer
-        len = min(remaining, shtp.outMaxTransfer);
+        len = min(remaining, pShtp->outMaxTransfer);
 
         // Stage one tranfer in the out buffer
-        memcpy(shtp.outTransfer+SHTP_HDR_LEN, pData+cursor, len);
+        memcpy(pShtp->outTransfer+SHTP_HDR_LEN, pData+cursor, len);
         remaining -= len;
         cursor += len;
 
@@ -752,19 +855,19 @@ static int txProcess(uint8_t chan, uint8_t* pData, uint32_t len)
         len += SHTP_HDR_LEN;
 
         // Put the header in the out buffer
-        shtp.outTransfer[0] = len & 0xFF;
-        shtp.outTransfer[1] = (len >> 8) & 0xFF;
+        pShtp->outTransfer[0] = len & 0xFF;
+        pShtp->outTransfer[1] = (len >> 8) & 0xFF;
         if (continuation) {
-            shtp.outTransfer[1] |= 0x80;
+            pShtp->outTransfer[1] |= 0x80;
         }
-        shtp.outTransfer[2] = chan;
-        shtp.outTransfer[3] = shtp.chan[chan].nextOutSeq++;
+        pShtp->outTransfer[2] = chan;
+        pShtp->outTransfer[3] = pShtp->chan[chan].nextOutSeq++;
 
         // Transmit
-        int status = sh2_hal_tx(shtp.outTransfer, len);
+        int status = pShtp->pHal->tx(pShtp->pHal, pShtp->outTransfer, len);
         if (status != SH2_OK) {
             // Error, throw away this cargo
-            shtp.txDiscards++;
+            pShtp->txDiscards++;
             break;
         }
 
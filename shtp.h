@@ -25,6 +25,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "sh2_hal.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -43,23 +45,47 @@ extern "C" {
 #define TAG_ADV_COUNT 10
 #define TAG_APP_SPECIFIC 0x80
 
+// Note: payload is only valid for the duration of the callback.  It may point
+// directly into the HAL's receive buffer.
 typedef void shtp_Callback_t(void * cookie, uint8_t *payload, uint16_t len, uint32_t timestamp);
 typedef void shtp_AdvertCallback_t(void * cookie, uint8_t tag, uint8_t len, uint8_t *value);
 typedef void shtp_SendCallback_t(void *cookie);
 
-int shtp_init(void);
+// SHTP instance, one per hub
+typedef struct shtp_s shtp_t;
+
+// Transport statistics, counted since shtp_init
+typedef struct shtp_Stats {
+    uint32_t tooLargePayloads;    // cargos too large to reassemble
+    uint32_t txDiscards;          // cargos not sent because the HAL failed
+    uint32_t shortFragments;      // transfers shorter than their header
+    uint32_t badRxChan;           // transfers on a channel out of range
+    uint32_t badTxChan;           // sends to a channel out of range
+    uint32_t interleaveDiscards;  // assemblies evicted by a cargo on another channel
+    uint32_t seqDiscards;         // assemblies broken by a missing or out-of-order fragment
+    uint32_t orphanFragments;     // continuations with no assembly in progress
+} shtp_Stats_t;
+
+// Initialize an SHTP instance (0 .. SH2_MAX_INSTANCES-1) to use pHal.
+// Returns 0 if instance is out of range.
+shtp_t *shtp_init(uint8_t instance, sh2_Hal_t *pHal);
 
-void shtp_start(bool dfu);
+void shtp_start(shtp_t *pShtp, bool dfu);
     
-int shtp_listenChan(const char * app, const char * chan,
+int shtp_listenChan(shtp_t *pShtp, const char * app, const char * chan,
                     shtp_Callback_t *callback, void * cookie);
 
-int shtp_listenAdvert(const char * appName,
+int shtp_listenAdvert(shtp_t *pShtp, const char * appName,
                       shtp_AdvertCallback_t *advertCallback, void * cookie);
 
-uint8_t shtp_chanNo(const char * appName, const char * chanName);
+uint8_t shtp_chanNo(shtp_t *pShtp, const char * appName, const char * chanName);
+
+// Largest cargo that can currently be passed to shtp_send.
+uint16_t shtp_maxPayloadOut(shtp_t *pShtp);
+
+int shtp_send(shtp_t *pShtp, uint8_t channel, uint8_t *payload, uint16_t len);
 
-int shtp_send(uint8_t channel, uint8_t *payload, uint16_t len);
+void shtp_getStats(shtp_t *pShtp, shtp_Stats_t *pStats);
 
 #ifdef __cplusplus
 }    // end of extern "C"
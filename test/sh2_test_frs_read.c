@@ -0,0 +1,125 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * FRS read resume and range test.
+ *
+ * A record is written to the emulated hub (sh2_hal_emu.c), then read back
+ * whole and in ranges with sh2_getFrs() and sh2_getFrsRange(), cleanly and
+ * with read responses lost.  A read that loses responses must resume from
+ * the last word received, with one more request, and return exactly the
+ * words written.
+ *
+ * Build from the repository root, with sh2_hal_impl.h on the include path:
+ *   cc -DSH2_NO_GLOBAL_HAL -I. -I<impl dir> test/sh2_test_frs_read.c \
+ *      sh2.c shtp.c sh2_util.c sh2_SensorValue.c sh2_hal_emu.c -lm
+ *
+ * Exits with 0 if all checks pass.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sh2_hal_emu.h"
+
+// A record the emulator stores, not a metadata one
+#define RECORD_ID (0x7979)
+#define RECORD_WORDS (40)
+
+static sh2_EmuHub_t emu;
+static uint32_t record[RECORD_WORDS];
+
+static int failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+    if (!ok) {
+        printf("FAIL line %d: %s\n", line, what);
+        failures++;
+    }
+}
+
+static void eventHdlr(void *cookie, sh2_AsyncEvent_t *pEvent)
+{
+}
+
+// Read words from offset (the whole record if offset and words are 0),
+// with read responses lost after skip.  Returns requests sent.
+static uint32_t readRange(const char *name, uint16_t offset, uint16_t words,
+                          uint16_t skip, uint16_t lost)
+{
+    uint32_t data[RECORD_WORDS + 1];
+    uint16_t got = (words != 0) ? words : RECORD_WORDS + 1;
+    sh2_EmuHubStats_t before, after;
+    int rc;
+
+    memset(data, 0, sizeof(data));
+    sh2_emuHub_getStats(&emu, &before);
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_DROP, skip, lost);
+
+    if ((offset == 0) && (words == 0)) {
+        rc = sh2_getFrs(RECORD_ID, data, &got);
+        words = RECORD_WORDS;
+    }
+    else {
+        rc = sh2_getFrsRange(RECORD_ID, offset, data, &got);
+    }
+
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_DROP, 0, 0);
+    sh2_emuHub_getStats(&emu, &after);
+
+    uint32_t requests = after.hostTransfers - before.hostTransfers;
+    printf("%s: rc %d, %u words, %u lost, %u requests\n", name, rc, got,
+           after.faults - before.faults, requests);
+    CHECK(rc == SH2_OK);
+    CHECK(after.faults - before.faults == lost);
+    CHECK(got == words);
+    CHECK(memcmp(data, record + offset, words * sizeof(uint32_t)) == 0);
+
+    return requests;
+}
+
+int main(void)
+{
+    sh2_emuHub_init(&emu);
+    CHECK(sh2_open(0, &emu.hal, eventHdlr, 0) == SH2_OK);
+    sh2_emuHub_run(&emu, 0);
+
+    for (int n = 0; n < RECORD_WORDS; n++) {
+        record[n] = 0x10000 * (n + 1) + n;
+    }
+    CHECK(sh2_setFrs(RECORD_ID, record, RECORD_WORDS) == SH2_OK);
+
+    // Whole record: two words per response
+    CHECK(readRange("clean", 0, 0, 0, 0) == 1);
+    CHECK(readRange("words 6 and 7 lost", 0, 0, 3, 1) == 2);
+    CHECK(readRange("words 2 to 5 lost", 0, 0, 1, 2) == 2);
+
+    // Part of it
+    CHECK(readRange("range", 10, 6, 0, 0) == 1);
+    CHECK(readRange("odd range", 11, 5, 0, 0) == 1);
+    CHECK(readRange("range to the end", 30, 10, 0, 0) == 1);
+    CHECK(readRange("range, words 12 and 13 lost", 10, 6, 1, 1) == 2);
+
+    printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Windowed FRS write test.
+ *
+ * Records are written to the emulated hub (sh2_hal_emu.c) with
+ * sh2_setFrs(), cleanly and with write data requests refused as busy at
+ * each point of the record and for longer spells.  The write must rewind
+ * to the refused offset, count the rewind in sh2_getFrsWriteStats() and
+ * leave exactly the words written in the hub, which sh2_getFrs() reads
+ * back.  It fails with SH2_ERR_HUB once the retries run out.
+ *
+ * Build from the repository root, with sh2_hal_impl.h on the include path:
+ *   cc -DSH2_NO_GLOBAL_HAL -I. -I<impl dir> test/sh2_test_frs_write.c \
+ *      sh2.c shtp.c sh2_util.c sh2_SensorValue.c sh2_hal_emu.c -lm
+ *
+ * Exits with 0 if all checks pass.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sh2_hal_emu.h"
+
+// A record the emulator stores, not a metadata one
+#define RECORD_ID (0x7979)
+#define RECORD_WORDS (40)
+
+static sh2_EmuHub_t emu;
+static uint32_t record[RECORD_WORDS];
+static uint32_t cleanTransfers;
+
+static int failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+    if (!ok) {
+        printf("FAIL line %d: %s\n", line, what);
+        failures++;
+    }
+}
+
+static void eventHdlr(void *cookie, sh2_AsyncEvent_t *pEvent)
+{
+}
+
+// Write words of a new pattern, refusing busy requests after skip.
+// Requests already sent when the write rewinds may be refused too, so
+// there are at most as many rewinds as refusals.  Returns transfers sent
+// to the hub.
+static uint32_t writeRecord(const char *name, uint16_t words, uint16_t skip, uint16_t busy)
+{
+    static uint32_t pattern = 0;
+    uint32_t data[RECORD_WORDS + 1];
+    uint16_t got = RECORD_WORDS + 1;
+    sh2_FrsWriteStats_t stats;
+    sh2_EmuHubStats_t before, after;
+
+    pattern += 0x01000000;
+    for (int n = 0; n < words; n++) {
+        record[n] = pattern + n;
+    }
+
+    sh2_emuHub_getStats(&emu, &before);
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_FRS_BUSY, skip, busy);
+
+    int rc = sh2_setFrs(RECORD_ID, record, words);
+
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_FRS_BUSY, 0, 0);
+    sh2_emuHub_getStats(&emu, &after);
+    sh2_getFrsWriteStats(&stats);
+
+    uint32_t transfers = after.hostTransfers - before.hostTransfers;
+    printf("%s: rc %d, %u words, %u busy, %u transfers\n", name, rc,
+           stats.words, stats.busy, transfers);
+    CHECK(rc == SH2_OK);
+    CHECK(after.faults - before.faults == busy);
+    CHECK(stats.words == words);
+    CHECK((busy == 0) ? (stats.busy == 0) : ((stats.busy >= 1) && (stats.busy <= busy)));
+
+    // What the hub stored
+    memset(data, 0, sizeof(data));
+    CHECK(sh2_getFrs(RECORD_ID, data, &got) == SH2_OK);
+    CHECK(got == words);
+    CHECK(memcmp(data, record, words * sizeof(uint32_t)) == 0);
+
+    return transfers;
+}
+
+int main(void)
+{
+    char name[32];
+
+    sh2_emuHub_init(&emu);
+    CHECK(sh2_open(0, &emu.hal, eventHdlr, 0) == SH2_OK);
+    sh2_emuHub_run(&emu, 0);
+
+    // Several data requests are outstanding at once
+    cleanTransfers = writeRecord("clean", RECORD_WORDS, 0, 0);
+    CHECK(cleanTransfers < 1 + RECORD_WORDS/2);
+    CHECK(writeRecord("odd length", 3, 0, 0) > 0);
+
+    // Refused at each offset: rewind there with one request outstanding,
+    // growing the window back as requests are received
+    for (uint16_t n = 0; n < RECORD_WORDS/2; n++) {
+        sh2_FrsWriteStats_t stats;
+        snprintf(name, sizeof(name), "busy at word %u", 2*n);
+        uint32_t transfers = writeRecord(name, RECORD_WORDS, n, 1);
+        sh2_getFrsWriteStats(&stats);
+        CHECK(stats.busy == 1);
+        CHECK(transfers <= cleanTransfers + 3);
+    }
+    writeRecord("busy for a while", RECORD_WORDS, 5, 6);
+
+    // Out of retries
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_FRS_BUSY, 5, 1000);
+    int rc = sh2_setFrs(RECORD_ID, record, RECORD_WORDS);
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_FRS_BUSY, 0, 0);
+    printf("busy past the last retry: rc %d\n", rc);
+    CHECK(rc == SH2_ERR_HUB);
+
+    // And back to normal
+    writeRecord("after", RECORD_WORDS, 0, 0);
+
+    printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+    return (failures == 0) ? 0 : 1;
+}
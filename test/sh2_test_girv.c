@@ -0,0 +1,158 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Gyro-integrated RV delivery test.
+ *
+ * The emulated hub (sh2_hal_emu.c) sends gyro-integrated RV reports the
+ * way a real one does: without a header, on the inputGyroRv channel,
+ * interleaved with batched accelerometer cargos on inputNormal.  Each
+ * event must reach the right callback with its report id in place and
+ * decode to the emulator's synthetic values, in copy, no-copy and event
+ * ring delivery.
+ *
+ * Build from the repository root, with sh2_hal_impl.h on the include path:
+ *   cc -DSH2_NO_GLOBAL_HAL -I. -I<impl dir> test/sh2_test_girv.c \
+ *      sh2.c shtp.c sh2_util.c sh2_SensorValue.c sh2_hal_emu.c -lm
+ *
+ * Exits with 0 if all checks pass.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sh2_SensorValue.h"
+#include "sh2_hal_emu.h"
+
+// Virtual time each delivery mode runs for [uS]
+#define RUN_US (100000)
+
+// Events expected in each run: 1mS GIRV, 10mS accelerometer
+#define GIRV_EVENTS (RUN_US / 1000)
+#define ACCEL_EVENTS (RUN_US / 10000)
+
+#define RING_LEN (256)
+
+static sh2_EmuHub_t emu;
+static sh2_SensorEvent_t ring[RING_LEN];
+
+static int failures;
+static unsigned girvEvents;
+static unsigned otherEvents;
+static uint8_t seq;  // Emulated sequence numbers wrap like report ones
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+    if (!ok) {
+        printf("FAIL line %d: %s\n", line, what);
+        failures++;
+    }
+}
+
+// The emulator fills field n of a report with 1000*(n+1) + sequence.
+static void checkGirv(const sh2_SensorEvent_t *pEvent, const uint8_t *report)
+{
+    sh2_SensorValue_t value;
+
+    CHECK(pEvent->len == 15);
+    CHECK(report[0] == SH2_GYRO_INTEGRATED_RV);
+    CHECK(sh2_decodeSensorReport(&value, pEvent, report, 0) == SH2_OK);
+    CHECK(value.sensorId == SH2_GYRO_INTEGRATED_RV);
+    CHECK(value.un.gyroIntegratedRV.i == (1000 + seq) / 16384.0f);
+    CHECK(value.un.gyroIntegratedRV.real == (4000 + seq) / 16384.0f);
+    CHECK(value.un.gyroIntegratedRV.angVelZ == (7000 + seq) / 1024.0f);
+
+    girvEvents++;
+    seq++;
+}
+
+static void eventHdlr(void *cookie, sh2_AsyncEvent_t *pEvent)
+{
+}
+
+static void girvHdlr(void *cookie, sh2_SensorEvent_t *pEvent)
+{
+    checkGirv(pEvent, (pEvent->pReport != 0) ? pEvent->pReport : pEvent->report);
+}
+
+static void otherHdlr(void *cookie, sh2_SensorEvent_t *pEvent)
+{
+    CHECK(pEvent->reportId == SH2_ACCELEROMETER);
+    otherEvents++;
+}
+
+static void run(const char *mode)
+{
+    girvEvents = 0;
+    otherEvents = 0;
+
+    sh2_emuHub_run(&emu, RUN_US);
+
+    // Drain the ring, if one is set
+    sh2_SensorEvent_t event;
+    while (sh2_pollEvents(&event, 1) == 1) {
+        if (event.reportId == SH2_GYRO_INTEGRATED_RV) {
+            checkGirv(&event, event.report);
+        }
+        else {
+            otherHdlr(0, &event);
+        }
+    }
+
+    printf("%s: %u gyro-integrated RV, %u other events\n", mode, girvEvents, otherEvents);
+    CHECK(girvEvents == GIRV_EVENTS);
+    CHECK(otherEvents == ACCEL_EVENTS);
+}
+
+int main(void)
+{
+    sh2_SensorConfig_t config;
+
+    sh2_emuHub_init(&emu);
+    CHECK(sh2_open(0, &emu.hal, eventHdlr, 0) == SH2_OK);
+    sh2_emuHub_run(&emu, 0);
+
+    memset(&config, 0, sizeof(config));
+    config.reportInterval_us = 1000;
+    CHECK(sh2_setSensorConfig(SH2_GYRO_INTEGRATED_RV, &config) == SH2_OK);
+    config.reportInterval_us = 10000;
+    CHECK(sh2_setSensorConfig(SH2_ACCELEROMETER, &config) == SH2_OK);
+    sh2_emuHub_run(&emu, 0);
+
+    // Events reported before the callbacks were set are not counted
+    seq = emu.sensor[SH2_GYRO_INTEGRATED_RV].seq;
+
+    sh2_setSensorCallback(otherHdlr, 0);
+    sh2_setSensorCallbackFor(SH2_GYRO_INTEGRATED_RV, girvHdlr, 0);
+    run("copy");
+
+    sh2_setSensorCallbackNoCopy(otherHdlr, 0);
+    run("no copy");
+
+    sh2_setSensorCallback(otherHdlr, 0);
+    sh2_setSensorCallbackFor(SH2_GYRO_INTEGRATED_RV, 0, 0);
+    CHECK(sh2_setEventRing(ring, RING_LEN) == SH2_OK);
+    run("ring");
+
+    printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+    return (failures == 0) ? 0 : 1;
+}
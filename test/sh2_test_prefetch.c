@@ -0,0 +1,148 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Metadata prefetch retry test.
+ *
+ * sh2_prefetchAllMetadata() reads every metadata record the emulated hub
+ * (sh2_hal_emu.c) has, first cleanly, then with FRS reads refused as busy
+ * and with responses lost part way through a record.  A refused or
+ * interrupted record must be re-requested and the table must come out as
+ * it did from the clean run, until the retries run out.
+ *
+ * Build from the repository root, with sh2_hal_impl.h on the include path:
+ *   cc -DSH2_NO_GLOBAL_HAL -I. -I<impl dir> test/sh2_test_prefetch.c \
+ *      sh2.c shtp.c sh2_util.c sh2_SensorValue.c sh2_hal_emu.c -lm
+ *
+ * Exits with 0 if all checks pass.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sh2_hal_emu.h"
+
+// Retries of a refused or interrupted FRS read.  Must match sh2.c.
+#ifndef SH2_FRS_READ_RETRIES
+#define SH2_FRS_READ_RETRIES (3)
+#endif
+
+#define TABLE_LEN (64)
+
+static sh2_EmuHub_t emu;
+static sh2_MetadataCacheEntry_t clean[TABLE_LEN];
+static sh2_MetadataPrefetchStats_t cleanStats;
+
+static int failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+    if (!ok) {
+        printf("FAIL line %d: %s\n", line, what);
+        failures++;
+    }
+}
+
+static void eventHdlr(void *cookie, sh2_AsyncEvent_t *pEvent)
+{
+}
+
+static bool sameEntry(const sh2_MetadataCacheEntry_t *a, const sh2_MetadataCacheEntry_t *b)
+{
+    return (a->recordId == b->recordId) &&
+        (a->metadata.qPoint1 == b->metadata.qPoint1) &&
+        (a->metadata.qPoint2 == b->metadata.qPoint2) &&
+        (a->metadata.range == b->metadata.range) &&
+        (a->metadata.minPeriod_uS == b->metadata.minPeriod_uS) &&
+        (a->metadata.vendorIdLen == b->metadata.vendorIdLen) &&
+        (strcmp(a->metadata.vendorId, b->metadata.vendorId) == 0);
+}
+
+// Prefetch with a fault injected, expecting the clean result
+static void prefetch(const char *name, sh2_EmuFault_t fault, uint16_t skip, uint16_t count)
+{
+    sh2_MetadataCacheEntry_t table[TABLE_LEN];
+    sh2_MetadataPrefetchStats_t stats;
+    sh2_EmuHubStats_t before, after;
+
+    memset(table, 0, sizeof(table));
+    sh2_emuHub_getStats(&emu, &before);
+    sh2_emuHub_injectFault(&emu, fault, skip, count);
+
+    int rc = sh2_prefetchAllMetadata(table, TABLE_LEN, &stats);
+
+    sh2_emuHub_injectFault(&emu, fault, 0, 0);
+    sh2_emuHub_getStats(&emu, &after);
+
+    printf("%s: rc %d, %u records, %u faults, %u requests\n", name, rc,
+           stats.records, after.faults - before.faults,
+           after.hostTransfers - before.hostTransfers);
+    CHECK(rc == SH2_OK);
+    CHECK(after.faults - before.faults == count);
+    CHECK(after.hostTransfers - before.hostTransfers == cleanStats.records + count);
+    CHECK(stats.records == cleanStats.records);
+    CHECK(stats.bytes == cleanStats.bytes);
+    for (unsigned n = 0; n < cleanStats.records; n++) {
+        CHECK(sameEntry(&table[n], &clean[n]));
+    }
+}
+
+int main(void)
+{
+    sh2_MetadataCacheEntry_t table[TABLE_LEN];
+    sh2_MetadataPrefetchStats_t stats;
+
+    sh2_emuHub_init(&emu);
+    CHECK(sh2_open(0, &emu.hal, eventHdlr, 0) == SH2_OK);
+    sh2_emuHub_run(&emu, 0);
+
+    // Clean run, one request per record
+    memset(clean, 0, sizeof(clean));
+    CHECK(sh2_prefetchAllMetadata(clean, TABLE_LEN, &cleanStats) == SH2_OK);
+    printf("clean: %u records, %u bytes\n", cleanStats.records, cleanStats.bytes);
+    CHECK(cleanStats.records > 2);
+    CHECK(strcmp(clean[0].metadata.vendorId, "Emulated") == 0);
+
+    // Refused, then asked again
+    prefetch("first read busy", SH2_EMU_FAULT_FRS_BUSY, 0, 1);
+    prefetch("third record busy", SH2_EMU_FAULT_FRS_BUSY, 2, 1);
+    prefetch("busy until the last retry", SH2_EMU_FAULT_FRS_BUSY, 1, SH2_FRS_READ_RETRIES);
+
+    // Responses lost within a record: resumed from the last word received
+    prefetch("second response lost", SH2_EMU_FAULT_DROP, 1, 1);
+    prefetch("fifth response lost", SH2_EMU_FAULT_DROP, 4, 1);
+
+    // Out of retries
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_FRS_BUSY, 1, SH2_FRS_READ_RETRIES + 1);
+    int rc = sh2_prefetchAllMetadata(table, TABLE_LEN, &stats);
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_FRS_BUSY, 0, 0);
+    printf("busy past the last retry: rc %d, %u records\n", rc, stats.records);
+    CHECK(rc == SH2_ERR_HUB);
+    CHECK(stats.records == 1);
+
+    // And back to normal
+    CHECK(sh2_prefetchAllMetadata(table, TABLE_LEN, &stats) == SH2_OK);
+    CHECK(stats.records == cleanStats.records);
+
+    printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Operation timeout and cancel test.
+ *
+ * The emulated hub (sh2_hal_emu.c) ignores requests or loses responses,
+ * so operations never complete by themselves.  sh2_checkTimeouts() must
+ * fail them with SH2_ERR_TIMEOUT exactly SH2_OP_TIMEOUT_US after first
+ * seeing them, blocking calls must fail when the HAL gives up waiting, and
+ * sh2_cancelOperations() must fail everything queued with
+ * SH2_ERR_CANCELLED, oldest first.  Each time, the operations after them
+ * must then run normally.
+ *
+ * Build from the repository root, with sh2_hal_impl.h on the include path:
+ *   cc -DSH2_NO_GLOBAL_HAL -I. -I<impl dir> test/sh2_test_timeout.c \
+ *      sh2.c shtp.c sh2_util.c sh2_SensorValue.c sh2_hal_emu.c -lm
+ *
+ * Exits with 0 if all checks pass.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sh2_hal_emu.h"
+
+// Time an operation may be in progress, uS.  Must match sh2.c.
+#ifndef SH2_OP_TIMEOUT_US
+#define SH2_OP_TIMEOUT_US (1000000)
+#endif
+
+// Operations in flight at once in the cancel test
+#define OPS (3)
+
+// Status of an op that hasn't completed
+#define PENDING (1)
+
+static sh2_EmuHub_t emu;
+
+static int failures;
+static int status[OPS];
+static int completions[OPS];
+static int completionOrder[OPS];
+static int completed;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+    if (!ok) {
+        printf("FAIL line %d: %s\n", line, what);
+        failures++;
+    }
+}
+
+static void eventHdlr(void *cookie, sh2_AsyncEvent_t *pEvent)
+{
+}
+
+static void opDone(void *cookie, int opStatus)
+{
+    int op = (int)(intptr_t)cookie;
+
+    status[op] = opStatus;
+    completions[op]++;
+    if (completed < OPS) {
+        completionOrder[completed] = op;
+    }
+    completed++;
+}
+
+static void resetOps(void)
+{
+    for (int op = 0; op < OPS; op++) {
+        status[op] = PENDING;
+        completions[op] = 0;
+        completionOrder[op] = -1;
+    }
+    completed = 0;
+}
+
+int main(void)
+{
+    sh2_OscType_t oscType;
+    sh2_ProductIds_t prodIds;
+    uint32_t frs[16];
+    uint16_t words;
+
+    sh2_emuHub_init(&emu);
+    CHECK(sh2_open(0, &emu.hal, eventHdlr, 0) == SH2_OK);
+    sh2_emuHub_run(&emu, 0);
+    CHECK(sh2_getOscType(&oscType) == SH2_OK);
+
+    // An ignored request times out one period after the first check
+    resetOps();
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_SILENCE, 0, 1);
+    CHECK(sh2_getOscTypeAsync(&oscType, opDone, (void *)0) == SH2_OK);
+    sh2_emuHub_run(&emu, 1000);
+    uint32_t t0 = sh2_emuHub_now(&emu);
+    CHECK(sh2_checkTimeouts(t0) == 0);
+    CHECK(sh2_checkTimeouts(t0 + SH2_OP_TIMEOUT_US - 1) == 0);
+    CHECK(status[0] == PENDING);
+    CHECK(sh2_checkTimeouts(t0 + SH2_OP_TIMEOUT_US) == 1);
+    printf("silent hub, async: status %d\n", status[0]);
+    CHECK(status[0] == SH2_ERR_TIMEOUT);
+    CHECK(completions[0] == 1);
+    CHECK(sh2_checkTimeouts(t0 + 2*SH2_OP_TIMEOUT_US) == 0);
+
+    // The op queued behind one that times out starts then
+    resetOps();
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_DROP, 0, 1);
+    CHECK(sh2_getOscTypeAsync(&oscType, opDone, (void *)0) == SH2_OK);
+    CHECK(sh2_getProdIdsAsync(&prodIds, opDone, (void *)1) == SH2_OK);
+    sh2_emuHub_run(&emu, 1000);
+    t0 = sh2_emuHub_now(&emu);
+    CHECK(sh2_checkTimeouts(t0) == 0);
+    CHECK(sh2_checkTimeouts(t0 + SH2_OP_TIMEOUT_US) == 1);
+    sh2_emuHub_run(&emu, 1000);
+    printf("lost response, async: status %d, next %d\n", status[0], status[1]);
+    CHECK(status[0] == SH2_ERR_TIMEOUT);
+    CHECK(status[1] == SH2_OK);
+    CHECK(completionOrder[0] == 0);
+    CHECK(completionOrder[1] == 1);
+
+    // Blocking calls fail when the HAL has nothing more to deliver
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_SILENCE, 0, 1);
+    int rc = sh2_getOscType(&oscType);
+    printf("silent hub, blocking: rc %d\n", rc);
+    CHECK(rc == SH2_ERR_TIMEOUT);
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_DROP, 0, 1000);
+    words = 16;
+    rc = sh2_getFrs(FRS_ID_META_ACCELEROMETER, frs, &words);
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_DROP, 0, 0);
+    printf("lost responses, blocking: rc %d\n", rc);
+    CHECK(rc == SH2_ERR_TIMEOUT);
+    CHECK(sh2_getOscType(&oscType) == SH2_OK);
+    words = 16;
+    CHECK(sh2_getFrs(FRS_ID_META_ACCELEROMETER, frs, &words) == SH2_OK);
+    CHECK(words > 0);
+
+    // Cancel the op the hub ignored and those queued behind it
+    resetOps();
+    sh2_emuHub_injectFault(&emu, SH2_EMU_FAULT_SILENCE, 0, 1);
+    words = 16;
+    CHECK(sh2_getOscTypeAsync(&oscType, opDone, (void *)0) == SH2_OK);
+    CHECK(sh2_getFrsAsync(FRS_ID_META_ACCELEROMETER, frs, &words, opDone, (void *)1) == SH2_OK);
+    CHECK(sh2_getProdIdsAsync(&prodIds, opDone, (void *)2) == SH2_OK);
+    sh2_emuHub_run(&emu, 1000);
+    CHECK(completed == 0);
+    CHECK(sh2_cancelOperations() == OPS);
+    sh2_emuHub_run(&emu, 1000);
+    printf("cancelled: status %d %d %d\n", status[0], status[1], status[2]);
+    for (int op = 0; op < OPS; op++) {
+        CHECK(status[op] == SH2_ERR_CANCELLED);
+        CHECK(completions[op] == 1);
+        CHECK(completionOrder[op] == op);
+    }
+    CHECK(sh2_cancelOperations() == 0);
+    CHECK(sh2_checkTimeouts(sh2_emuHub_now(&emu) + 2*SH2_OP_TIMEOUT_US) == 0);
+
+    // And back to normal
+    CHECK(sh2_getOscType(&oscType) == SH2_OK);
+    CHECK(sh2_getProdIds(&prodIds) == SH2_OK);
+
+    printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+    return (failures == 0) ? 0 : 1;
+}